@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Compile GLSL shaders to SPIR-V and pack them into a single shader pack.
+
+Layout (see ShaderPack.h, keep both in sync):
+    header  : magic 'SPAK', version, entry count, reserved      (4 x uint32)
+    index   : entry count x { char name[56]; uint32 offset; uint32 size }, sorted by name
+    blobs   : SPIR-V, each starting on a 16 byte boundary
+
+Usage: pack_shaders.py --output shaders.pack [--compiler glslc] <shader files or directories>...
+Directories contribute every shader source or .spv file directly inside them.
+Inputs ending in .spv are packed as they are, anything else is compiled first.
+"""
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+MAGIC = 0x4B415053
+VERSION = 1
+ALIGNMENT = 16
+NAME_LENGTH = 56
+SPIRV_MAGIC = 0x07230203
+SHADER_EXTENSIONS = (".vert", ".frag", ".comp", ".geom", ".tesc", ".tese", ".spv")
+
+
+def find_compiler(requested):
+    if requested:
+        return requested
+    for candidate in ("glslc", "glslangValidator"):
+        path = shutil.which(candidate)
+        if path:
+            return path
+    vulkan_sdk = os.environ.get("VULKAN_SDK")
+    if vulkan_sdk:
+        # Bin on Windows, bin in the Linux and macOS SDKs
+        for directory in ("bin", "Bin"):
+            for candidate in ("glslc", "glslangValidator"):
+                for suffix in ("", ".exe"):
+                    path = os.path.join(vulkan_sdk, directory, candidate + suffix)
+                    if os.path.exists(path):
+                        return path
+    sys.exit("pack_shaders: no GLSL compiler found (install glslc or glslangValidator, or pass --compiler)")
+
+
+def compile_shader(compiler, source, output):
+    if os.path.basename(compiler).lower().startswith("glslangvalidator"):
+        command = [compiler, "-V", "-o", output, source]
+    else:
+        command = [compiler, "-o", output, source]
+    subprocess.check_call(command)
+
+
+def load_spirv(path):
+    with open(path, "rb") as spirv_file:
+        data = spirv_file.read()
+    if len(data) < 4 or len(data) % 4 != 0 or struct.unpack_from("<I", data)[0] != SPIRV_MAGIC:
+        sys.exit("pack_shaders: %s is not valid SPIR-V" % path)
+    return data
+
+
+def expand_inputs(inputs):
+    sources = []
+    for path in inputs:
+        if os.path.isdir(path):
+            sources += [os.path.join(path, name) for name in sorted(os.listdir(path)) if name.endswith(SHADER_EXTENSIONS)]
+        else:
+            sources.append(path)
+    return sources
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--output", required=True)
+    parser.add_argument("--compiler")
+    parser.add_argument("inputs", nargs="+")
+    args = parser.parse_args()
+
+    shaders = {}
+    with tempfile.TemporaryDirectory() as work_dir:
+        compiler = None
+        for source in expand_inputs(args.inputs):
+            name = os.path.basename(source)
+            if name.endswith(".spv"):
+                name = name[:-len(".spv")]
+                shaders[name] = load_spirv(source)
+            else:
+                compiler = compiler or find_compiler(args.compiler)
+                output = os.path.join(work_dir, name + ".spv")
+                compile_shader(compiler, source, output)
+                shaders[name] = load_spirv(output)
+            if len(name.encode()) >= NAME_LENGTH:
+                sys.exit("pack_shaders: shader name %s is too long" % name)
+
+    names = sorted(shaders)
+    offset = 16 + len(names) * (NAME_LENGTH + 8)
+    index = b""
+    blobs = b""
+    for name in names:
+        padding = (-offset) % ALIGNMENT
+        blobs += b"\0" * padding
+        offset += padding
+        index += struct.pack("<%dsII" % NAME_LENGTH, name.encode(), offset, len(shaders[name]))
+        blobs += shaders[name]
+        offset += len(shaders[name])
+
+    # Write to a temporary file first so a failed build never leaves a half written pack behind
+    temp_output = args.output + ".tmp"
+    with open(temp_output, "wb") as pack_file:
+        pack_file.write(struct.pack("<IIII", MAGIC, VERSION, len(names), 0))
+        pack_file.write(index)
+        pack_file.write(blobs)
+    os.replace(temp_output, args.output)
+
+
+if __name__ == "__main__":
+    main()
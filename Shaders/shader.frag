@@ -0,0 +1,13 @@
+#version 450
+
+layout(location = 0) in vec3 fragColour;	// Interpolated colour from vertex (location must match)
+
+layout(set = 0, binding = 1) uniform MaterialUniforms {
+	vec4 tint;								// Per material, from the uniform ring
+} material;
+
+layout(location = 0) out vec4 outColour; 	// Final output colour (must also have location)
+
+void main() {
+	outColour = vec4(fragColour, 1.0) * material.tint;
+}
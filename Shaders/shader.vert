@@ -0,0 +1,21 @@
+#version 450		// Use GLSL 4.5
+
+layout(location = 0) in vec3 pos;			// Position stream (binding 0 in either vertex layout)
+layout(location = 1) in vec3 col;
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+	mat4 viewProjection;					// Once per frame, from the uniform ring
+} frame;
+
+layout(push_constant) uniform DrawConstants {
+	mat4 model;								// Per object transform, pushed for every draw
+} draw;
+
+layout(location = 0) out vec3 fragColour;	// Output colour for vertex (location is required)
+layout(location = 1) out vec2 fragUV;		// Model space xy, one texture repeat per mesh width (0.8)
+
+void main() {
+	gl_Position = frame.viewProjection * draw.model * vec4(pos, 1.0);
+	fragColour = col;
+	fragUV = pos.xy * 1.25;
+}
@@ -0,0 +1,32 @@
+#version 450		// Use GLSL 4.5
+
+// shader.vert for GPU driven rendering: the transform comes from the instance buffer instead of a push constant
+
+layout(location = 0) in vec3 pos;			// Position stream (binding 0 in either vertex layout)
+layout(location = 1) in vec3 col;
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+	mat4 viewProjection;					// Once per frame, from the uniform ring
+} frame;
+
+struct InstanceData {
+	mat4 model;
+	vec4 boundingSphere;
+	uint indexCount;
+	uint batchIndex;
+	uint firstCommand;
+	uint padding;
+};
+
+layout(set = 2, binding = 0) readonly buffer Instances {
+	InstanceData instances[];				// Indexed by the firstInstance the cull pass wrote
+};
+
+layout(location = 0) out vec3 fragColour;	// Output colour for vertex (location is required)
+layout(location = 1) out vec2 fragUV;		// Model space xy, one texture repeat per mesh width (0.8)
+
+void main() {
+	gl_Position = frame.viewProjection * instances[gl_InstanceIndex].model * vec4(pos, 1.0);
+	fragColour = col;
+	fragUV = pos.xy * 1.25;
+}
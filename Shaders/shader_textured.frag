@@ -0,0 +1,20 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// shader.frag sampling the material's streamed texture from the bindless table
+
+layout(location = 0) in vec3 fragColour;	// Interpolated colour from vertex (location must match)
+layout(location = 1) in vec2 fragUV;
+
+layout(set = 0, binding = 1) uniform MaterialUniforms {
+	vec4 tint;								// Per material, from the uniform ring
+	uint textureIndex;						// Bindless slot, changes whenever the texture's resident levels do
+} material;
+
+layout(set = 1, binding = 0) uniform sampler2D bindlessImages[];
+
+layout(location = 0) out vec4 outColour; 	// Final output colour (must also have location)
+
+void main() {
+	outColour = texture(bindlessImages[nonuniformEXT(material.textureIndex)], fragUV) * vec4(fragColour, 1.0) * material.tint;
+}
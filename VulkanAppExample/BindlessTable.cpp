@@ -0,0 +1,209 @@
+#include "BindlessTable.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "CpuProfiler.h"
+
+BindlessTable::BindlessTable()
+{
+}
+
+void BindlessTable::create(VkDevice logicalDevice, const DeviceCapabilities& capabilities, DescriptorLayoutCache& layoutCache,
+	uint32_t maxImages, uint32_t maxBuffers)
+{
+	PROFILE_FUNCTION();
+
+	device = logicalDevice;
+
+	// -- CAPACITY --
+	// Update-after-bind descriptors have their own, usually much larger, limits
+	const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& limits = capabilities.descriptorIndexingProperties;
+	// Combined image samplers count against both the sampled image and the sampler limits
+	imageSlots.capacity = std::min({ maxImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+		limits.maxPerStageDescriptorUpdateAfterBindSamplers, limits.maxDescriptorSetUpdateAfterBindSamplers });
+	bufferSlots.capacity = std::min({ maxBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers });
+
+	// The fragment stage sees both bindings, and both count against its resource limit. Buffers give way first, as
+	// images are what most of the table is for.
+	uint32_t resourceLimit = limits.maxPerStageUpdateAfterBindResources;
+	if (static_cast<uint64_t>(imageSlots.capacity) + bufferSlots.capacity > resourceLimit)
+	{
+		bufferSlots.capacity = std::min(bufferSlots.capacity, resourceLimit / 2);
+		imageSlots.capacity = std::min(imageSlots.capacity, resourceLimit - bufferSlots.capacity);
+	}
+	if (imageSlots.capacity == 0 || bufferSlots.capacity == 0)
+	{
+		throw std::runtime_error("ERROR: Device reports no update-after-bind descriptors for a bindless table!");
+	}
+
+	// -- LAYOUT --
+	VkDescriptorSetLayoutBinding imageBinding = {};
+	imageBinding.binding = IMAGE_BINDING;
+	imageBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	imageBinding.descriptorCount = imageSlots.capacity;
+	imageBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;					// Only fragment shaders sample textures
+	imageBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding bufferBinding = {};
+	bufferBinding.binding = BUFFER_BINDING;
+	bufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bufferBinding.descriptorCount = bufferSlots.capacity;
+	bufferBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	bufferBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT		// Empty slots are fine as long as they aren't read
+		| VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT										// Writable after the set is bound
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;							// ...even while frames using it are in flight
+
+	layout = layoutCache.getLayout({ imageBinding, bufferBinding }, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+		{ bindingFlags, bindingFlags });
+
+	// -- POOL & SET --
+	// The set lives as long as the table, so it gets a pool of its own
+	VkDescriptorPoolSize poolSizes[2] = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = imageSlots.capacity;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = bufferSlots.capacity;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;		// Required for update-after-bind layouts
+	poolCreateInfo.maxSets = 1;
+	poolCreateInfo.poolSizeCount = 2;
+	poolCreateInfo.pPoolSizes = poolSizes;
+
+	VkResult result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create the bindless Descriptor Pool!");
+	}
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = pool;
+	setAllocInfo.descriptorSetCount = 1;
+	setAllocInfo.pSetLayouts = &layout;
+
+	result = vkAllocateDescriptorSets(device, &setAllocInfo, &descriptorSet);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to allocate the bindless Descriptor Set!");
+	}
+}
+
+void BindlessTable::destroy()
+{
+	// Destroying the pool frees the set; the layout belongs to the layout cache
+	vkDestroyDescriptorPool(device, pool, nullptr);
+	pool = VK_NULL_HANDLE;
+	descriptorSet = VK_NULL_HANDLE;
+	imageSlots = SlotList();
+	bufferSlots = SlotList();
+}
+
+uint32_t BindlessTable::addImage(VkImageView imageView, VkSampler sampler, VkImageLayout imageLayout)
+{
+	std::lock_guard<std::mutex> lock(tableMutex);
+
+	uint32_t index = imageSlots.acquire();
+	if (index == INVALID_INDEX)
+	{
+		return INVALID_INDEX;
+	}
+
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = imageLayout;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = descriptorSet;
+	write.dstBinding = IMAGE_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	return index;
+}
+
+uint32_t BindlessTable::addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	std::lock_guard<std::mutex> lock(tableMutex);
+
+	uint32_t index = bufferSlots.acquire();
+	if (index == INVALID_INDEX)
+	{
+		return INVALID_INDEX;
+	}
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = offset;
+	bufferInfo.range = range;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = descriptorSet;
+	write.dstBinding = BUFFER_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &bufferInfo;
+
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+	return index;
+}
+
+void BindlessTable::removeImage(uint32_t index)
+{
+	// The stale descriptor stays in the slot until it is overwritten; partially bound arrays allow that as long as it isn't read
+	std::lock_guard<std::mutex> lock(tableMutex);
+	imageSlots.release(index);
+}
+
+void BindlessTable::removeBuffer(uint32_t index)
+{
+	std::lock_guard<std::mutex> lock(tableMutex);
+	bufferSlots.release(index);
+}
+
+uint32_t BindlessTable::getImageCount()
+{
+	std::lock_guard<std::mutex> lock(tableMutex);
+	return imageSlots.count();
+}
+
+uint32_t BindlessTable::getBufferCount()
+{
+	std::lock_guard<std::mutex> lock(tableMutex);
+	return bufferSlots.count();
+}
+
+BindlessTable::~BindlessTable()
+{
+}
+
+uint32_t BindlessTable::SlotList::acquire()
+{
+	if (!freeSlots.empty())
+	{
+		uint32_t index = freeSlots.back();
+		freeSlots.pop_back();
+		return index;
+	}
+	return next < capacity ? next++ : INVALID_INDEX;
+}
+
+void BindlessTable::SlotList::release(uint32_t index)
+{
+	if (index >= next || std::find(freeSlots.begin(), freeSlots.end(), index) != freeSlots.end())
+	{
+		throw std::runtime_error("ERROR: Removing a bindless slot that isn't in use!");
+	}
+	freeSlots.push_back(index);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <mutex>
+
+#include "DeviceCapabilities.h"
+#include "DescriptorAllocator.h"
+
+// One descriptor set holding every persistent image and buffer, bound once per command buffer. Shaders index
+// into its arrays (a texture or material index from a push constant or instance data) instead of the renderer
+// binding a set per draw. Needs VK_EXT_descriptor_indexing (see DeviceCapabilities::supportsBindless):
+// - Arrays are partially bound, so unused slots may hold no descriptor at all
+// - Update-after-bind: new resources can be added while the set is bound in command buffers still in flight,
+//   as long as those command buffers don't use the slot being written
+//
+// In shaders (GL_EXT_nonuniform_qualifier):
+//   layout(set = N, binding = 0) uniform sampler2D bindlessImages[];
+//   layout(set = N, binding = 1) buffer BindlessBuffer { ... } bindlessBuffers[];
+class BindlessTable
+{
+public:
+	static const uint32_t IMAGE_BINDING = 0;
+	static const uint32_t BUFFER_BINDING = 1;
+	static const uint32_t INVALID_INDEX = UINT32_MAX;
+
+	BindlessTable();
+
+	// Capacities are clamped to the device's update-after-bind limits
+	void create(VkDevice logicalDevice, const DeviceCapabilities &capabilities, DescriptorLayoutCache &layoutCache,
+		uint32_t maxImages, uint32_t maxBuffers);
+	void destroy();
+
+	// Return the array index shaders use. INVALID_INDEX when the table is full.
+	uint32_t addImage(VkImageView imageView, VkSampler sampler, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	uint32_t addBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+	// The slot is handed out again by the next add, so no frame in flight may still use it
+	void removeImage(uint32_t index);
+	void removeBuffer(uint32_t index);
+
+	VkDescriptorSetLayout getLayout() const { return layout; }
+	VkDescriptorSet getSet() const { return descriptorSet; }
+	uint32_t getImageCapacity() const { return imageSlots.capacity; }
+	uint32_t getBufferCapacity() const { return bufferSlots.capacity; }
+	uint32_t getImageCount();
+	uint32_t getBufferCount();
+
+	~BindlessTable();
+
+private:
+	// Indices into one binding's array: never used ones from next, freed ones from the free list first
+	struct SlotList {
+		uint32_t capacity = 0;
+		uint32_t next = 0;
+		std::vector<uint32_t> freeSlots;
+
+		uint32_t acquire();
+		void release(uint32_t index);
+		uint32_t count() const { return next - static_cast<uint32_t>(freeSlots.size()); }
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;		// Owned by the layout cache
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+	// vkUpdateDescriptorSets needs the set externally synchronised
+	std::mutex tableMutex;
+	SlotList imageSlots;
+	SlotList bufferSlots;
+};
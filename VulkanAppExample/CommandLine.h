@@ -0,0 +1,59 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+
+// Values of command line flags. A value that doesn't parse in full, or is out of range, is reported and ends the
+// program: a typo shouldn't quietly run with some other setting.
+
+inline void exitWithBadValue(const std::string &flag, const char *text, const char *expected = nullptr)
+{
+	std::cout << "ERROR: bad value for " << flag << ": \"" << text << "\"";
+	if (expected != nullptr)
+	{
+		std::cout << ", expected " << expected;
+	}
+	std::cout << std::endl;
+	std::exit(EXIT_FAILURE);
+}
+
+// An argument no flag matches, or a flag given without its value
+inline void exitWithUnknownArgument(const std::string &arg)
+{
+	std::cout << "ERROR: unknown argument or missing value: " << arg << std::endl;
+	std::exit(EXIT_FAILURE);
+}
+
+inline uint64_t parseUnsignedFlag(const std::string &flag, const char *text, uint64_t maxValue = UINT64_MAX)
+{
+	// strtoull takes a minus sign and wraps around, so only digits get that far
+	errno = 0;
+	char *end = nullptr;
+	unsigned long long value = text[0] >= '0' && text[0] <= '9' ? std::strtoull(text, &end, 10) : 0;
+	if (end == nullptr || *end != '\0' || errno != 0 || value > maxValue)
+	{
+		exitWithBadValue(flag, text);
+	}
+	return static_cast<uint64_t>(value);
+}
+
+inline uint32_t parseUint32Flag(const std::string &flag, const char *text)
+{
+	return static_cast<uint32_t>(parseUnsignedFlag(flag, text, UINT32_MAX));
+}
+
+inline double parseNumberFlag(const std::string &flag, const char *text)
+{
+	errno = 0;
+	char *end = nullptr;
+	double value = std::strtod(text, &end);
+	if (end == text || *end != '\0' || errno != 0 || !std::isfinite(value) || value < 0.0)
+	{
+		exitWithBadValue(flag, text);
+	}
+	return value;
+}
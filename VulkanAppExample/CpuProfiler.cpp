@@ -0,0 +1,183 @@
+#include "CpuProfiler.h"
+#include "Utilities.h"
+
+#include <iomanip>
+
+// How often the background thread empties the rings. A ring holds RING_CAPACITY zones, far more than one
+// thread records in this time.
+static const std::chrono::milliseconds DRAIN_INTERVAL(10);
+
+std::atomic<bool> CpuProfiler::running{ false };
+const std::chrono::steady_clock::time_point CpuProfiler::epoch = std::chrono::steady_clock::now();
+
+std::mutex CpuProfiler::ringsMutex;
+std::vector<std::unique_ptr<CpuProfiler::ThreadRing>> CpuProfiler::rings;
+std::ofstream CpuProfiler::traceFile;
+bool CpuProfiler::firstEvent = true;
+
+std::thread CpuProfiler::drainThread;
+std::mutex CpuProfiler::drainMutex;
+std::condition_variable CpuProfiler::drainWake;
+bool CpuProfiler::drainStopping = false;
+
+thread_local CpuProfiler::ThreadRing* CpuProfiler::threadRing = nullptr;
+thread_local std::string CpuProfiler::pendingThreadName;
+
+bool CpuProfiler::start(const std::string& tracePath)
+{
+	stop();
+
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+
+		traceFile.open(tracePath, std::ios::trunc);
+		if (!traceFile.is_open())
+		{
+			return false;
+		}
+		traceFile << std::fixed << std::setprecision(3);		// Microseconds with ns resolution, never exponent form
+		traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		firstEvent = true;
+
+		// Zones left over from a previous run belong to the old file
+		for (auto& ring : rings)
+		{
+			ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+			ring->nameWritten = false;
+		}
+	}
+
+	drainStopping = false;
+	drainThread = std::thread(&CpuProfiler::drainLoop);
+	running.store(true, std::memory_order_release);
+	return true;
+}
+
+void CpuProfiler::stop()
+{
+	if (!drainThread.joinable())
+	{
+		return;
+	}
+
+	running.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(drainMutex);
+		drainStopping = true;
+	}
+	drainWake.notify_all();
+	drainThread.join();
+
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	drainRings();
+	traceFile << "\n]}\n";
+	traceFile.close();
+}
+
+uint64_t CpuProfiler::getDroppedZoneCount()
+{
+	std::lock_guard<std::mutex> lock(ringsMutex);
+
+	uint64_t dropped = 0;
+	for (const auto& ring : rings)
+	{
+		dropped += ring->dropped.load(std::memory_order_relaxed);
+	}
+	return dropped;
+}
+
+void CpuProfiler::setThreadName(const std::string& name)
+{
+	// Threads that never record a zone (the profiler isn't running) never get a ring, the name waits for one
+	if (threadRing == nullptr)
+	{
+		pendingThreadName = name;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	threadRing->threadName = name;
+	threadRing->nameWritten = false;
+}
+
+uint64_t CpuProfiler::now()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+void CpuProfiler::record(const char* name, uint64_t startNs, uint64_t endNs)
+{
+	ThreadRing& ring = getThreadRing();
+
+	// Only this thread writes head, and only the drain writes tail: acquire the tail so the slot is known to be read
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	if (head - ring.tail.load(std::memory_order_acquire) >= RING_CAPACITY)
+	{
+		ring.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	CpuZoneEvent& event = ring.events[head & (RING_CAPACITY - 1)];
+	event.name = name;
+	event.startNs = startNs;
+	event.endNs = endNs;
+
+	// Release publishes the event before the drain can see the new head
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+CpuProfiler::ThreadRing& CpuProfiler::getThreadRing()
+{
+	// The lock is only taken the first time a thread records, after that the ring is cached
+	if (threadRing == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+
+		rings.push_back(std::make_unique<ThreadRing>());
+		threadRing = rings.back().get();
+		threadRing->threadId = static_cast<uint32_t>(rings.size());
+		threadRing->threadName = pendingThreadName.empty() ? "Thread " + std::to_string(threadRing->threadId) : pendingThreadName;
+	}
+	return *threadRing;
+}
+
+void CpuProfiler::drainLoop()
+{
+	PROFILE_THREAD_NAME("Profiler drain");
+
+	std::unique_lock<std::mutex> wakeLock(drainMutex);
+	while (!drainStopping)
+	{
+		drainWake.wait_for(wakeLock, DRAIN_INTERVAL, []() { return drainStopping; });
+
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		drainRings();
+	}
+}
+
+void CpuProfiler::drainRings()
+{
+	for (auto& ring : rings)
+	{
+		if (!ring->nameWritten)
+		{
+			traceFile << (firstEvent ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->threadId
+				<< ",\"args\":{\"name\":" << jsonString(ring->threadName) << "}}";
+			firstEvent = false;
+			ring->nameWritten = true;
+		}
+
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		for (; tail != head; tail++)
+		{
+			const CpuZoneEvent& event = ring->events[tail & (RING_CAPACITY - 1)];
+			traceFile << (firstEvent ? "\n" : ",\n") << "{\"name\":" << jsonString(event.name) << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadId
+				<< ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+			firstEvent = false;
+		}
+
+		// Hands the slots back to the owning thread
+		ring->tail.store(tail, std::memory_order_release);
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <chrono>
+
+// CPU zones are compiled in for Debug builds, or any build that defines ENABLE_CPU_PROFILING. Everywhere else the
+// macros below expand to nothing, so instrumented code costs nothing in release.
+#ifndef CPU_PROFILING_ENABLED
+#if defined(_DEBUG) || defined(ENABLE_CPU_PROFILING)
+#define CPU_PROFILING_ENABLED 1
+#else
+#define CPU_PROFILING_ENABLED 0
+#endif
+#endif
+
+#define CPU_PROFILER_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILER_CONCAT(a, b) CPU_PROFILER_CONCAT_INNER(a, b)
+
+#if CPU_PROFILING_ENABLED
+// Times the rest of the enclosing block. name must outlive the profiler (a string literal), it is stored as a pointer.
+#define PROFILE_ZONE(name) CpuZone CPU_PROFILER_CONCAT(cpuZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+// Names the calling thread's track in the trace
+#define PROFILE_THREAD_NAME(name) CpuProfiler::setThreadName(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_THREAD_NAME(name)
+#endif
+
+// One finished zone
+struct CpuZoneEvent {
+	const char *name;
+	uint64_t startNs;						// Since the profiler's epoch
+	uint64_t endNs;
+};
+
+// Collects zones from every thread and streams them to a Chrome trace (chrome://tracing, Perfetto).
+// Each thread writes into its own single producer / single consumer ring, so recording a zone takes no lock;
+// a background thread drains the rings to the file. Zones recorded while the profiler is stopped are ignored,
+// and zones that find their ring full are dropped (and counted) rather than waiting for the drain.
+class CpuProfiler
+{
+public:
+
+	// Starts draining into a new trace file. Returns false if the file can't be created.
+	static bool start(const std::string &tracePath);
+	static void stop();					// Drains what is left and closes the file
+
+	static bool isRunning() { return running.load(std::memory_order_relaxed); }
+	static uint64_t getDroppedZoneCount();
+
+	static void setThreadName(const std::string &name);
+
+	// Called by CpuZone
+	static uint64_t now();
+	static void record(const char *name, uint64_t startNs, uint64_t endNs);
+
+private:
+	// Power of two, so positions wrap with a mask
+	static const uint32_t RING_CAPACITY = 1 << 14;
+
+	struct ThreadRing {
+		alignas(64) std::atomic<uint64_t> head{ 0 };	// Next slot the owning thread writes
+		alignas(64) std::atomic<uint64_t> tail{ 0 };	// Next slot the drain reads
+		alignas(64) std::atomic<uint64_t> dropped{ 0 };	// Zones that found the ring full
+		uint32_t threadId = 0;							// Track in the trace
+		std::string threadName;
+		bool nameWritten = false;
+		CpuZoneEvent events[RING_CAPACITY];
+	};
+
+	static std::atomic<bool> running;
+	static const std::chrono::steady_clock::time_point epoch;
+
+	static std::mutex ringsMutex;						// Guards the list of rings and the trace file
+	static std::vector<std::unique_ptr<ThreadRing>> rings;
+	static std::ofstream traceFile;
+	static bool firstEvent;
+
+	static std::thread drainThread;
+	static std::mutex drainMutex;
+	static std::condition_variable drainWake;
+	static bool drainStopping;
+
+	// Per thread: its ring, created the first time it records a zone, and the name it was given before that
+	static thread_local ThreadRing *threadRing;
+	static thread_local std::string pendingThreadName;
+
+	static ThreadRing &getThreadRing();
+	static void drainLoop();
+	static void drainRings();						// Caller holds ringsMutex
+};
+
+// Records the time from construction to destruction as one zone
+class CpuZone
+{
+public:
+	explicit CpuZone(const char *zoneName) : name(zoneName), active(CpuProfiler::isRunning())
+	{
+		startNs = active ? CpuProfiler::now() : 0;
+	}
+	~CpuZone()
+	{
+		if (active)
+		{
+			CpuProfiler::record(name, startNs, CpuProfiler::now());
+		}
+	}
+
+	CpuZone(const CpuZone &) = delete;
+	CpuZone &operator=(const CpuZone &) = delete;
+
+private:
+	const char *name;
+	bool active;
+	uint64_t startNs;
+};
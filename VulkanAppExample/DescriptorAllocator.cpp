@@ -0,0 +1,263 @@
+#include "DescriptorAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "CpuProfiler.h"
+
+// Sets per pool, and how many descriptors of each type a pool holds per set. A set that needs more than
+// the pool has left just moves on to the next pool.
+static const uint32_t SETS_PER_POOL = 256;
+
+struct PoolRatio {
+	VkDescriptorType type;
+	float descriptorsPerSet;
+};
+
+static const PoolRatio POOL_RATIOS[] = {
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,			1.0f },
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,	1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,			1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,	0.5f },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,	2.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,				1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,				0.5f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER,					0.5f },
+};
+
+// -- LAYOUT CACHE --
+DescriptorLayoutCache::DescriptorLayoutCache()
+{
+}
+
+void DescriptorLayoutCache::create(VkDevice logicalDevice)
+{
+	device = logicalDevice;
+}
+
+void DescriptorLayoutCache::destroy()
+{
+	std::lock_guard<std::mutex> lock(layoutsMutex);
+	for (auto& layout : layouts)
+	{
+		vkDestroyDescriptorSetLayout(device, layout.second, nullptr);
+	}
+	layouts.clear();
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, VkDescriptorSetLayoutCreateFlags flags,
+	const std::vector<VkDescriptorBindingFlagsEXT>& bindingFlags)
+{
+	if (!bindingFlags.empty() && bindingFlags.size() != bindings.size())
+	{
+		throw std::runtime_error("ERROR: Descriptor binding flags don't match the bindings!");
+	}
+
+	// -- SIGNATURE --
+	// Sorted by binding number, so the order bindings are listed in doesn't create a second layout
+	std::vector<uint32_t> order(bindings.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&bindings](uint32_t a, uint32_t b) { return bindings[a].binding < bindings[b].binding; });
+
+	std::vector<uint32_t> signature;
+	signature.reserve(1 + order.size() * 5);
+	signature.push_back(flags);
+	for (uint32_t i : order)
+	{
+		if (bindings[i].pImmutableSamplers != nullptr)
+		{
+			throw std::runtime_error("ERROR: Immutable samplers can't be cached by signature!");
+		}
+		signature.push_back(bindings[i].binding);
+		signature.push_back(static_cast<uint32_t>(bindings[i].descriptorType));
+		signature.push_back(bindings[i].descriptorCount);
+		signature.push_back(bindings[i].stageFlags);
+		signature.push_back(bindingFlags.empty() ? 0 : bindingFlags[i]);
+	}
+
+	std::lock_guard<std::mutex> lock(layoutsMutex);
+
+	auto existing = layouts.find(signature);
+	if (existing != layouts.end())
+	{
+		return existing->second;
+	}
+
+	// -- CREATE LAYOUT --
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = {};
+	bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlagsCreateInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+	bindingFlagsCreateInfo.pBindingFlags = bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.pNext = bindingFlags.empty() ? nullptr : &bindingFlagsCreateInfo;	// Only valid with VK_EXT_descriptor_indexing
+	layoutCreateInfo.flags = flags;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutCreateInfo.pBindings = bindings.data();
+
+	VkDescriptorSetLayout layout;
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &layout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a Descriptor Set Layout!");
+	}
+
+	layouts.emplace(std::move(signature), layout);
+	return layout;
+}
+
+uint32_t DescriptorLayoutCache::getLayoutCount()
+{
+	std::lock_guard<std::mutex> lock(layoutsMutex);
+	return static_cast<uint32_t>(layouts.size());
+}
+
+DescriptorLayoutCache::~DescriptorLayoutCache()
+{
+}
+
+size_t DescriptorLayoutCache::SignatureHash::operator()(const std::vector<uint32_t>& signature) const
+{
+	return static_cast<size_t>(hashBytes(signature.data(), signature.size() * sizeof(uint32_t)));
+}
+
+// -- PER FRAME ALLOCATOR --
+DescriptorAllocator::DescriptorAllocator()
+{
+}
+
+void DescriptorAllocator::create(VkDevice logicalDevice, uint32_t framesInFlight)
+{
+	device = logicalDevice;
+	frames.resize(framesInFlight);
+	currentFrame = 0;
+	frameStarted = false;
+	stats = DescriptorAllocatorStats();
+}
+
+void DescriptorAllocator::destroy()
+{
+	for (auto& frame : frames)
+	{
+		// Destroying a pool frees every set allocated from it
+		for (VkDescriptorPool pool : frame.pools)
+		{
+			vkDestroyDescriptorPool(device, pool, nullptr);
+		}
+	}
+	frames.clear();
+}
+
+void DescriptorAllocator::beginFrame(uint32_t frameIndex)
+{
+	std::lock_guard<std::mutex> lock(allocateMutex);
+
+	// The frame recorded before this one is complete, so its counts are final
+	if (frameStarted)
+	{
+		const FramePools& recorded = frames[currentFrame];
+		stats.setsLastFrame = recorded.setCount;
+		stats.poolsLastFrame = recorded.setCount > 0 ? recorded.activePool + 1 : 0;
+		stats.peakSetsPerFrame = std::max(stats.peakSetsPerFrame, recorded.setCount);
+	}
+
+	currentFrame = frameIndex;
+	frameStarted = true;
+
+	// One reset per pool returns every set at once, far cheaper than freeing them one by one
+	FramePools& frame = frames[frameIndex];
+	for (uint32_t i = 0; i < frame.pools.size() && i <= frame.activePool; i++)
+	{
+		vkResetDescriptorPool(device, frame.pools[i], 0);
+	}
+	frame.activePool = 0;
+	frame.activePoolSets = 0;
+	frame.setCount = 0;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout)
+{
+	std::lock_guard<std::mutex> lock(allocateMutex);
+	FramePools& frame = frames[currentFrame];
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorSetCount = 1;
+	setAllocInfo.pSetLayouts = &layout;
+
+	// Try the active pool, and when that one is full the next (creating it the first time a frame needs it)
+	while (true)
+	{
+		if (frame.activePool == frame.pools.size())
+		{
+			frame.pools.push_back(createPool());
+			stats.poolCount++;
+		}
+		setAllocInfo.descriptorPool = frame.pools[frame.activePool];
+
+		VkDescriptorSet descriptorSet;
+		VkResult result = vkAllocateDescriptorSets(device, &setAllocInfo, &descriptorSet);
+		if (result == VK_SUCCESS)
+		{
+			frame.activePoolSets++;
+			frame.setCount++;
+			return descriptorSet;
+		}
+		if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+		{
+			throw std::runtime_error("ERROR: Failed to allocate a Descriptor Set!");
+		}
+
+		// A set that doesn't even fit an empty pool never will
+		if (frame.activePoolSets == 0)
+		{
+			throw std::runtime_error("ERROR: Descriptor Set needs more descriptors than a pool holds!");
+		}
+		frame.activePool++;
+		frame.activePoolSets = 0;
+	}
+}
+
+DescriptorAllocatorStats DescriptorAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(allocateMutex);
+	return stats;
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+}
+
+VkDescriptorPool DescriptorAllocator::createPool()
+{
+	PROFILE_FUNCTION();
+
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (const PoolRatio& ratio : POOL_RATIOS)
+	{
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = ratio.type;
+		poolSize.descriptorCount = static_cast<uint32_t>(ratio.descriptorsPerSet * SETS_PER_POOL);
+		poolSizes.push_back(poolSize);
+	}
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = 0;							// No FREE_DESCRIPTOR_SET_BIT: sets only go back with a reset
+	poolCreateInfo.maxSets = SETS_PER_POOL;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkDescriptorPool pool;
+	VkResult result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a Descriptor Pool!");
+	}
+	return pool;
+}
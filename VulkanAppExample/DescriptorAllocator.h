@@ -0,0 +1,87 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+// Creates each distinct descriptor set layout once. Layouts are looked up by their binding signature (binding
+// numbers, types, counts, stages and binding flags), so every pipeline asking for the same bindings shares a layout
+// and stays compatible with sets allocated for any of the others. Layouts live until destroy().
+class DescriptorLayoutCache
+{
+public:
+
+	DescriptorLayoutCache();
+
+	void create(VkDevice logicalDevice);
+	void destroy();
+
+	// bindingFlags is empty, or has one entry per binding (VK_EXT_descriptor_indexing). Immutable samplers aren't supported.
+	VkDescriptorSetLayout getLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings, VkDescriptorSetLayoutCreateFlags flags = 0,
+		const std::vector<VkDescriptorBindingFlagsEXT> &bindingFlags = {});
+
+	uint32_t getLayoutCount();
+
+	~DescriptorLayoutCache();
+
+private:
+	struct SignatureHash {
+		size_t operator()(const std::vector<uint32_t> &signature) const;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::mutex layoutsMutex;
+	std::unordered_map<std::vector<uint32_t>, VkDescriptorSetLayout, SignatureHash> layouts;
+};
+
+// Descriptor sets allocated through a DescriptorAllocator, for the last frame that finished recording
+struct DescriptorAllocatorStats {
+	uint32_t setsLastFrame = 0;			// Sets allocated while the last frame was recorded
+	uint32_t poolsLastFrame = 0;		// Pools those sets came from
+	uint32_t peakSetsPerFrame = 0;
+	uint32_t poolCount = 0;				// Pools created over all frames in flight
+};
+
+// Hands out descriptor sets that only live for one frame. Every frame in flight has its own list of pools,
+// and sets are taken from them linearly; nothing is freed individually. Once the frame's fence has signalled
+// beginFrame resets all of its pools in one call each, and they are reused from the start.
+class DescriptorAllocator
+{
+public:
+
+	DescriptorAllocator();
+
+	void create(VkDevice logicalDevice, uint32_t framesInFlight);
+	void destroy();
+
+	// Call once the GPU has finished the frame that last used this slot. Every set allocated for it becomes invalid.
+	void beginFrame(uint32_t frameIndex);
+
+	// Valid until the frame slot comes round again. May be called from several recording threads.
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+	DescriptorAllocatorStats getStats();
+
+	~DescriptorAllocator();
+
+private:
+	struct FramePools {
+		std::vector<VkDescriptorPool> pools;		// Kept across frames, reset instead of destroyed
+		uint32_t activePool = 0;					// Pools before this one are full
+		uint32_t activePoolSets = 0;				// Sets allocated from the active pool
+		uint32_t setCount = 0;						// Sets allocated since the last reset
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::vector<FramePools> frames;
+	uint32_t currentFrame = 0;
+	bool frameStarted = false;
+
+	std::mutex allocateMutex;
+	DescriptorAllocatorStats stats;
+
+	// - Support Functions
+	VkDescriptorPool createPool();
+};
@@ -0,0 +1,358 @@
+#include "DeviceCapabilities.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
+
+#include "CpuProfiler.h"
+
+// -- DEVICE SCORING --
+// Device type dominates: any discrete GPU beats any integrated one, whatever else they offer
+static const uint32_t SCORE_DISCRETE_GPU = 10000;
+static const uint32_t SCORE_INTEGRATED_GPU = 5000;
+static const uint32_t SCORE_VIRTUAL_GPU = 2500;
+static const uint32_t SCORE_CPU = 500;
+
+static const uint32_t SCORE_PER_GIB_DEVICE_LOCAL = 100;		// Largest device local heap, capped below
+static const uint32_t MAX_SCORED_GIB_DEVICE_LOCAL = 24;
+static const uint32_t SCORE_ASYNC_COMPUTE_FAMILY = 200;
+static const uint32_t SCORE_TRANSFER_FAMILY = 200;
+static const uint32_t SCORE_OPTIONAL_FEATURE = 50;
+
+bool DeviceCapabilities::hasExtensions(const std::vector<const char*>& extensionNames) const
+{
+	for (const auto& extensionName : extensionNames)
+	{
+		if (!hasExtension(extensionName))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool DeviceCapabilities::supportsBindless() const
+{
+	const VkPhysicalDeviceDescriptorIndexingFeaturesEXT& indexing = descriptorIndexingFeatures;
+	return hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) && hasExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME)
+		&& indexing.runtimeDescriptorArray && indexing.descriptorBindingPartiallyBound && indexing.descriptorBindingUpdateUnusedWhilePending
+		&& indexing.descriptorBindingSampledImageUpdateAfterBind && indexing.descriptorBindingStorageBufferUpdateAfterBind
+		&& indexing.shaderSampledImageArrayNonUniformIndexing;
+}
+
+static QueueFamilyIndices chooseQueueFamilies(const DeviceCapabilities& capabilities, bool needsPresentation)
+{
+	QueueFamilyIndices indices;
+	const std::vector<VkQueueFamilyProperties>& queueFamilyList = capabilities.queueFamilies;
+
+	// A family that does both graphics and presentation saves sharing the swap chain images between two
+	for (uint32_t i = 0; i < queueFamilyList.size(); i++)
+	{
+		if (queueFamilyList[i].queueCount > 0 && (queueFamilyList[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			&& (!needsPresentation || capabilities.presentationSupport[i]))
+		{
+			indices.graphicsFamily = static_cast<int>(i);
+			indices.presentationFamily = needsPresentation ? static_cast<int>(i) : -1;
+			break;
+		}
+	}
+
+	// Otherwise the first of each
+	for (uint32_t i = 0; i < queueFamilyList.size() && !indices.isValid(needsPresentation); i++)
+	{
+		// First check if queue family has at least 1 queue in that Family ...
+		if (indices.graphicsFamily < 0 && queueFamilyList[i].queueCount > 0 && queueFamilyList[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
+			indices.graphicsFamily = static_cast<int>(i);
+		}
+
+		// Check if queue is presentation type can be both grapphics and presentation
+		if (indices.presentationFamily < 0 && queueFamilyList[i].queueCount > 0 && capabilities.presentationSupport[i])
+		{
+			indices.presentationFamily = static_cast<int>(i);
+		}
+	}
+
+	// Prefer a family that can only transfer (usually a DMA engine), then one without graphics, so uploads
+	// don't compete with rendering. Every graphics family supports transfers, so fall back to that.
+	int bestTransferScore = -1;
+	for (uint32_t family = 0; family < queueFamilyList.size(); family++)
+	{
+		VkQueueFlags flags = queueFamilyList[family].queueFlags;
+		if (queueFamilyList[family].queueCount == 0 || !(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			continue;
+		}
+
+		int score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+		if (score > bestTransferScore)
+		{
+			bestTransferScore = score;
+			indices.transferFamily = static_cast<int>(family);
+		}
+	}
+	if (indices.transferFamily < 0)
+	{
+		indices.transferFamily = indices.graphicsFamily;
+	}
+
+	// Async compute: a family with compute but no graphics, runs alongside the graphics queue. Preferably not the
+	// transfer family, otherwise both share it (a queue each if the family has two).
+	for (uint32_t family = 0; family < queueFamilyList.size(); family++)
+	{
+		VkQueueFlags flags = queueFamilyList[family].queueFlags;
+		if (queueFamilyList[family].queueCount == 0 || !(flags & VK_QUEUE_COMPUTE_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			continue;
+		}
+		if (indices.computeFamily < 0 || indices.computeFamily == indices.transferFamily)
+		{
+			indices.computeFamily = static_cast<int>(family);
+		}
+	}
+	if (indices.computeFamily < 0)
+	{
+		indices.computeFamily = indices.graphicsFamily;
+	}
+
+	return indices;
+}
+
+DeviceCapabilities queryDeviceCapabilities(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+	const Properties2Functions& properties2)
+{
+	PROFILE_FUNCTION();
+
+	DeviceCapabilities capabilities;
+	capabilities.physicalDevice = physicalDevice;
+
+	// -- PROPERTIES, FEATURES AND MEMORY --
+	vkGetPhysicalDeviceProperties(physicalDevice, &capabilities.properties);
+	vkGetPhysicalDeviceFeatures(physicalDevice, &capabilities.features);
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &capabilities.memoryProperties);
+
+	// -- EXTENSIONS --
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensionList(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensionList.data());
+
+	capabilities.extensions.reserve(extensionCount);
+	for (const auto& extension : extensionList)
+	{
+		capabilities.extensions.insert(extension.extensionName);
+	}
+
+	// -- EXTENDED PROPERTIES AND FEATURES --
+	// Structures of device extensions may only be chained in when the device has the extension
+	bool descriptorIndexing = capabilities.hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	if (properties2.getProperties2 != nullptr)
+	{
+		// VkPhysicalDeviceIDPropertiesKHR belongs to the external memory capabilities instance extension
+		VkPhysicalDeviceIDPropertiesKHR idProperties = {};
+		idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+
+		capabilities.descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+		void* extendedProperties = descriptorIndexing ? &capabilities.descriptorIndexingProperties : nullptr;
+		if (properties2.deviceIDProperties)
+		{
+			idProperties.pNext = extendedProperties;
+			extendedProperties = &idProperties;
+		}
+
+		VkPhysicalDeviceProperties2KHR deviceProperties2 = {};
+		deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+		deviceProperties2.pNext = extendedProperties;
+		properties2.getProperties2(physicalDevice, &deviceProperties2);
+
+		// Without it, device selection by UUID falls back to pipelineCacheUUID
+		if (properties2.deviceIDProperties)
+		{
+			std::copy(std::begin(idProperties.deviceUUID), std::end(idProperties.deviceUUID), capabilities.deviceUUID);
+			capabilities.hasDeviceUUID = true;
+		}
+		capabilities.descriptorIndexingProperties.pNext = nullptr;
+	}
+
+	if (properties2.getFeatures2 != nullptr && descriptorIndexing)
+	{
+		capabilities.descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+		VkPhysicalDeviceFeatures2KHR deviceFeatures2 = {};
+		deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+		deviceFeatures2.pNext = &capabilities.descriptorIndexingFeatures;
+		properties2.getFeatures2(physicalDevice, &deviceFeatures2);
+
+		// Copied around with the snapshot, so it must not point at this stack frame
+		capabilities.descriptorIndexingFeatures.pNext = nullptr;
+	}
+
+	// -- QUEUE FAMILIES --
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	capabilities.queueFamilies.resize(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, capabilities.queueFamilies.data());
+
+	capabilities.presentationSupport.assign(queueFamilyCount, VK_FALSE);
+	if (surface != VK_NULL_HANDLE)
+	{
+		for (uint32_t i = 0; i < queueFamilyCount; i++)
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &capabilities.presentationSupport[i]);
+		}
+	}
+
+	capabilities.queueFamilyIndices = chooseQueueFamilies(capabilities, surface != VK_NULL_HANDLE);
+
+	// -- SURFACE FORMATS AND PRESENTATION MODES --
+	// Querying these needs the swap chain extension
+	if (surface != VK_NULL_HANDLE && capabilities.hasExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+	{
+		uint32_t formatCount = 0;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+		capabilities.surfaceFormats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, capabilities.surfaceFormats.data());
+
+		uint32_t presentationCount = 0;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentationCount, nullptr);
+		capabilities.presentationModes.resize(presentationCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentationCount, capabilities.presentationModes.data());
+	}
+
+	return capabilities;
+}
+
+DeviceScore scoreDevice(const DeviceCapabilities& capabilities)
+{
+	DeviceScore score;
+
+	switch (capabilities.properties.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		score.type = SCORE_DISCRETE_GPU;	break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	score.type = SCORE_INTEGRATED_GPU;	break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		score.type = SCORE_VIRTUAL_GPU;		break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:				score.type = SCORE_CPU;				break;
+	default:																			break;
+	}
+
+	// Integrated GPUs report system memory as device local, so this mostly separates discrete cards from each other
+	VkDeviceSize largestHeap = 0;
+	for (uint32_t i = 0; i < capabilities.memoryProperties.memoryHeapCount; i++)
+	{
+		const VkMemoryHeap& heap = capabilities.memoryProperties.memoryHeaps[i];
+		if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			largestHeap = std::max(largestHeap, heap.size);
+		}
+	}
+	uint32_t heapGiB = static_cast<uint32_t>(std::min<VkDeviceSize>(largestHeap >> 30, MAX_SCORED_GIB_DEVICE_LOCAL));
+	score.memory = heapGiB * SCORE_PER_GIB_DEVICE_LOCAL;
+
+	// Work on a family without graphics can overlap rendering instead of queueing behind it
+	for (const auto& queueFamily : capabilities.queueFamilies)
+	{
+		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			score.queues += SCORE_ASYNC_COMPUTE_FAMILY;
+			break;
+		}
+	}
+	if (capabilities.queueFamilyIndices.transferFamily != capabilities.queueFamilyIndices.graphicsFamily)
+	{
+		score.queues += SCORE_TRANSFER_FAMILY;
+	}
+
+	// Features that are used when present
+	const QueueFamilyIndices& indices = capabilities.queueFamilyIndices;
+	bool graphicsTimestamps = indices.graphicsFamily >= 0 && capabilities.queueFamilies[indices.graphicsFamily].timestampValidBits > 0;
+	bool optionalFeatures[] = {
+		graphicsTimestamps,
+		capabilities.features.multiDrawIndirect == VK_TRUE,
+		capabilities.features.drawIndirectFirstInstance == VK_TRUE,
+		capabilities.features.samplerAnisotropy == VK_TRUE,
+		capabilities.hasExtension(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME),
+		capabilities.supportsBindless(),
+	};
+	for (bool supported : optionalFeatures)
+	{
+		score.features += supported ? SCORE_OPTIONAL_FEATURE : 0;
+	}
+
+	return score;
+}
+
+const char* deviceTypeName(VkPhysicalDeviceType type)
+{
+	switch (type)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		return "discrete";
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	return "integrated";
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		return "virtual";
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:				return "CPU";
+	default:										return "other";
+	}
+}
+
+const char* presentModeName(VkPresentModeKHR presentMode)
+{
+	switch (presentMode)
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:		return "immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR:		return "mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR:			return "FIFO";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:	return "FIFO relaxed";
+	default:								return "other";
+	}
+}
+
+bool matchesDeviceSelector(const DeviceCapabilities& capabilities, uint32_t deviceIndex, const std::string& selector)
+{
+	if (selector.empty())
+	{
+		return false;
+	}
+
+	// -- UUID --
+	// Dashes are ignored so both the plain and the 8-4-4-4-12 form work
+	std::string hexDigits;
+	for (char c : selector)
+	{
+		if (c != '-')
+		{
+			hexDigits += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		}
+	}
+	if (hexDigits.size() == 2 * VK_UUID_SIZE && std::all_of(hexDigits.begin(), hexDigits.end(), [](char c) { return std::isxdigit(static_cast<unsigned char>(c)) != 0; }))
+	{
+		auto toHex = [](const uint8_t* uuid) {
+			static const char hex[] = "0123456789abcdef";
+			std::string text;
+			for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+			{
+				text += hex[uuid[i] >> 4];
+				text += hex[uuid[i] & 0xF];
+			}
+			return text;
+		};
+		return (capabilities.hasDeviceUUID && toHex(capabilities.deviceUUID) == hexDigits) || toHex(capabilities.properties.pipelineCacheUUID) == hexDigits;
+	}
+
+	// -- INDEX --
+	// Checked after the UUID, which may be all decimal digits too. Anything too long for an index matches nothing.
+	if (std::all_of(selector.begin(), selector.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; }))
+	{
+		errno = 0;
+		char* end = nullptr;
+		unsigned long index = std::strtoul(selector.c_str(), &end, 10);
+		return errno == 0 && end == selector.c_str() + selector.size() && index == deviceIndex;
+	}
+
+	// -- NAME --
+	auto toLower = [](std::string text) {
+		std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return text;
+	};
+	return toLower(capabilities.properties.deviceName).find(toLower(selector)) != std::string::npos;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "Utilities.h"
+
+// Everything the renderer needs to know about a physical device, queried once when the device is first looked at.
+// Decisions made later (device suitability, queue families, optional extensions, swap chain formats) read from
+// here instead of going back to the loader, which can be slow with several GPUs and ICDs installed.
+struct DeviceCapabilities {
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties = {};
+	VkPhysicalDeviceFeatures features = {};
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	uint8_t deviceUUID[VK_UUID_SIZE] = {};					// Stable across driver updates, unlike pipelineCacheUUID
+	bool hasDeviceUUID = false;								// Needs VK_KHR_external_memory_capabilities on the instance
+
+	// All zero unless the device has VK_EXT_descriptor_indexing and the instance VK_KHR_get_physical_device_properties2
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties = {};
+
+	std::vector<VkQueueFamilyProperties> queueFamilies;
+	std::vector<VkBool32> presentationSupport;				// Per queue family, all false without a surface
+	QueueFamilyIndices queueFamilyIndices;					// Families chosen from the lists above
+
+	std::unordered_set<std::string> extensions;				// Names of every device extension
+
+	// Surface formats and present modes only change with the surface, which lives as long as the renderer.
+	// Surface capabilities (current extent) change on resize, so those are still queried when needed.
+	std::vector<VkSurfaceFormatKHR> surfaceFormats;
+	std::vector<VkPresentModeKHR> presentationModes;
+
+	bool hasExtension(const char *extensionName) const { return extensions.count(extensionName) > 0; }
+	bool hasExtensions(const std::vector<const char *> &extensionNames) const;
+
+	// Whether a BindlessTable can be created: update-after-bind, partially bound arrays of images and buffers
+	bool supportsBindless() const;
+};
+
+// Instance functions from VK_KHR_get_physical_device_properties2, all null when the instance doesn't have it
+struct Properties2Functions {
+	PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = nullptr;
+	PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = nullptr;
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+	bool deviceIDProperties = false;		// VK_KHR_external_memory_capabilities is enabled too, so device UUIDs can be queried
+};
+
+// surface may be VK_NULL_HANDLE (headless), in which case nothing about presentation is queried.
+// Without properties2 functions only the Vulkan 1.0 properties and features are filled in.
+DeviceCapabilities queryDeviceCapabilities(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+	const Properties2Functions &properties2 = Properties2Functions());
+
+// How well a device suits the renderer, higher is better. Only compares devices that passed the suitability check.
+struct DeviceScore {
+	uint32_t type = 0;				// Discrete > integrated > virtual > CPU
+	uint32_t memory = 0;			// Size of the largest device local heap
+	uint32_t queues = 0;			// Separate async compute and transfer families
+	uint32_t features = 0;			// Optional features and extensions the renderer can make use of
+	uint32_t total() const { return type + memory + queues + features; }
+};
+
+DeviceScore scoreDevice(const DeviceCapabilities &capabilities);
+
+// Human readable name of a VkPhysicalDeviceType
+const char *deviceTypeName(VkPhysicalDeviceType type);
+
+// Human readable name of a VkPresentModeKHR
+const char *presentModeName(VkPresentModeKHR presentMode);
+
+// Whether the device matches a user's pin: a device index, the device UUID or pipelineCacheUUID (32 hex digits,
+// dashes allowed, as vulkaninfo prints them) or part of the device name (case insensitive)
+bool matchesDeviceSelector(const DeviceCapabilities &capabilities, uint32_t deviceIndex, const std::string &selector);
@@ -0,0 +1,374 @@
+#include "FrameCapture.h"
+
+#include <stdexcept>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include "PngEncoder.h"
+#include "CpuProfiler.h"
+
+static const uint32_t BYTES_PER_PIXEL = 4;
+
+FrameCapture::FrameCapture()
+{
+}
+
+void FrameCapture::create(VkDevice logicalDevice, MemoryAllocator* memoryAllocator, CaptureFormat captureFormat, const std::string& capturePath,
+	uint32_t slotCount, uint32_t captureInterval, uint32_t encodeThreads)
+{
+	PROFILE_FUNCTION();
+
+	device = logicalDevice;
+	allocator = memoryAllocator;
+	format = captureFormat;
+	path = capturePath;
+	interval = std::max(captureInterval, 1u);			// main rejects 0, this only guards other callers
+
+	if (format == CaptureFormat::Raw)
+	{
+		rawFile.open(path, std::ios::binary | std::ios::trunc);
+		if (!rawFile.is_open())
+		{
+			throw std::runtime_error("ERROR: Failed to open capture file " + path + "!");
+		}
+	}
+
+	// Fences start unsignalled, each is only waited on after its slot's copy was submitted
+	slots.resize(std::max(slotCount, 1u));
+	for (Slot& slot : slots)
+	{
+		VkFenceCreateInfo fenceCreateInfo = {};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &slot.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to create a capture Fence!");
+		}
+	}
+
+	// Raw frames are written in order by the collector itself, only PNG needs encoders
+	if (format == CaptureFormat::Png)
+	{
+		encodePool.start(encodeThreads);
+		maxPendingEncodes = encodePool.getThreadCount() * 2;
+	}
+
+	startTime = std::chrono::steady_clock::now();
+	stopped = false;
+	collectorThread = std::thread(&FrameCapture::collectorLoop, this);
+}
+
+void FrameCapture::destroy()
+{
+	if (collectorThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(captureMutex);
+			stopping = true;
+		}
+		slotSubmitted.notify_all();
+		collectorThread.join();
+	}
+	encodePool.stop();		// Finishes the frames still queued for encoding first
+	{
+		std::lock_guard<std::mutex> lock(captureMutex);
+		stopTime = std::chrono::steady_clock::now();
+		stopped = true;
+	}
+
+	for (Slot& slot : slots)
+	{
+		if (slot.buffer != VK_NULL_HANDLE)
+		{
+			allocator->destroyBuffer(slot.buffer, slot.allocation);
+		}
+		vkDestroyFence(device, slot.fence, nullptr);
+	}
+	slots.clear();
+
+	if (rawFile.is_open())
+	{
+		rawFile.close();
+	}
+}
+
+bool FrameCapture::recordCapture(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, VkExtent2D extent, VkImageLayout finalLayout)
+{
+	PROFILE_FUNCTION();
+
+	// -- COPY --
+	bool due = frameCounter % interval == 0 && isFormatSupported(imageFormat);
+	uint64_t frameNumber = frameCounter++;
+	bool recorded = false;
+	if (due)
+	{
+		Slot& slot = slots[nextSlot];
+		bool busy;
+		{
+			std::lock_guard<std::mutex> lock(captureMutex);
+			busy = slot.busy;
+			framesDropped += busy ? 1 : 0;
+		}
+
+		if (!busy)
+		{
+			ensureSlotCapacity(slot, static_cast<VkDeviceSize>(extent.width) * extent.height * BYTES_PER_PIXEL);
+			slot.frameNumber = frameNumber;
+			slot.extent = extent;
+			slot.swapRedBlue = imageFormat == VK_FORMAT_B8G8R8A8_UNORM || imageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+
+			// Tightly packed rows, bufferRowLength 0 takes them from the extent
+			VkBufferImageCopy region = {};
+			region.bufferOffset = 0;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { extent.width, extent.height, 1 };
+			vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+			// The fence makes the copy available on the device, the host still has to be able to see it
+			VkBufferMemoryBarrier hostBarrier = {};
+			hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			hostBarrier.buffer = slot.buffer;
+			hostBarrier.offset = 0;
+			hostBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+			{
+				std::lock_guard<std::mutex> lock(captureMutex);
+				slot.busy = true;
+				framesCaptured++;
+			}
+			recordedSlot = static_cast<int32_t>(nextSlot);
+			nextSlot = (nextSlot + 1) % static_cast<uint32_t>(slots.size());
+			recorded = true;
+		}
+	}
+
+	// -- HAND BACK --
+	// Only reads happened in TRANSFER_SRC, so the transition has nothing to make available
+	if (finalLayout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+	{
+		VkImageMemoryBarrier imageBarrier = {};
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = 0;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imageBarrier.newLayout = finalLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = image;
+		imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageBarrier.subresourceRange.baseMipLevel = 0;
+		imageBarrier.subresourceRange.levelCount = 1;
+		imageBarrier.subresourceRange.baseArrayLayer = 0;
+		imageBarrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+			1, &imageBarrier);
+	}
+
+	return recorded;
+}
+
+void FrameCapture::submit(VkQueue queue)
+{
+	if (recordedSlot < 0)
+	{
+		return;
+	}
+
+	// An empty submission's fence signals once everything submitted to the queue before it has completed.
+	// The frame's own fence is reset and reused by the render loop, so it can't be handed to another thread.
+	VkResult result = vkQueueSubmit(queue, 0, nullptr, slots[recordedSlot].fence);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to submit a capture Fence!");
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(captureMutex);
+		submittedSlots.push_back(static_cast<uint32_t>(recordedSlot));
+	}
+	slotSubmitted.notify_one();
+	recordedSlot = -1;
+}
+
+FrameCaptureStats FrameCapture::getStats()
+{
+	std::lock_guard<std::mutex> lock(captureMutex);
+
+	FrameCaptureStats stats;
+	stats.framesCaptured = framesCaptured;
+	stats.framesDropped = framesDropped;
+	stats.framesWritten = framesWritten;
+	stats.failedWrites = failedWrites;
+	stats.bytesRead = bytesRead;
+	stats.bytesWritten = bytesWritten;
+	stats.pendingFrames = pendingEncodes;
+	for (const Slot& slot : slots)
+	{
+		stats.pendingFrames += slot.busy ? 1 : 0;
+	}
+
+	double seconds = std::chrono::duration<double>((stopped ? stopTime : std::chrono::steady_clock::now()) - startTime).count();
+	if (seconds > 0.0)
+	{
+		stats.readMegabytesPerSecond = bytesRead / (1024.0 * 1024.0) / seconds;
+		stats.framesPerSecond = framesWritten / seconds;
+	}
+	uint64_t encodedFrames = framesWritten + failedWrites;
+	stats.avgEncodeMs = encodedFrames > 0 ? encodeMs / encodedFrames : 0.0;
+	return stats;
+}
+
+bool FrameCapture::isFormatSupported(VkFormat format)
+{
+	return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM ||
+		format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+FrameCapture::~FrameCapture()
+{
+}
+
+void FrameCapture::collectorLoop()
+{
+	PROFILE_THREAD_NAME("Capture collector");
+
+	while (true)
+	{
+		uint32_t slotIndex;
+		{
+			std::unique_lock<std::mutex> lock(captureMutex);
+			slotSubmitted.wait(lock, [this]() { return stopping || !submittedSlots.empty(); });
+			if (submittedSlots.empty())
+			{
+				break;		// Stopping, and everything submitted has been collected
+			}
+			slotIndex = submittedSlots.front();
+			submittedSlots.pop_front();
+		}
+
+		// -- COLLECT --
+		// Copied out straight away, so the slot is free again as soon as possible however long the write takes
+		Slot& slot = slots[slotIndex];
+		vkWaitForFences(device, 1, &slot.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+		vkResetFences(device, 1, &slot.fence);
+
+		size_t size = static_cast<size_t>(slot.extent.width) * slot.extent.height * BYTES_PER_PIXEL;
+		auto pixels = std::make_shared<std::vector<uint8_t>>(size);
+		{
+			PROFILE_ZONE("Copy out");
+			const uint8_t* mapped = static_cast<const uint8_t*>(slot.allocation.mapped);
+			std::memcpy(pixels->data(), mapped, size);
+			if (slot.swapRedBlue)
+			{
+				for (size_t i = 0; i < size; i += BYTES_PER_PIXEL)
+				{
+					std::swap((*pixels)[i], (*pixels)[i + 2]);
+				}
+			}
+		}
+		uint64_t frameNumber = slot.frameNumber;
+		VkExtent2D extent = slot.extent;
+		{
+			std::lock_guard<std::mutex> lock(captureMutex);
+			slot.busy = false;
+			bytesRead += size;
+		}
+
+		// -- WRITE --
+		if (format == CaptureFormat::Raw)
+		{
+			writeFrame(frameNumber, extent, *pixels);
+			continue;
+		}
+
+		// Bounded, so a slow disk or encoder holds the collector up (and the ring fills and frames drop) rather than
+		// memory growing without limit
+		{
+			std::unique_lock<std::mutex> lock(captureMutex);
+			encodeFinished.wait(lock, [this]() { return pendingEncodes < maxPendingEncodes; });
+			pendingEncodes++;
+		}
+		encodePool.enqueue([this, frameNumber, extent, pixels](uint32_t) {
+			writeFrame(frameNumber, extent, *pixels);
+			{
+				std::lock_guard<std::mutex> lock(captureMutex);
+				pendingEncodes--;
+			}
+			encodeFinished.notify_all();
+		});
+	}
+
+	// Whatever is still encoding finishes before destroy goes on
+	std::unique_lock<std::mutex> lock(captureMutex);
+	encodeFinished.wait(lock, [this]() { return pendingEncodes == 0; });
+}
+
+void FrameCapture::writeFrame(uint64_t frameNumber, VkExtent2D extent, const std::vector<uint8_t>& pixels)
+{
+	PROFILE_FUNCTION();
+
+	auto encodeStart = std::chrono::steady_clock::now();
+	bool written = false;
+	size_t size = pixels.size();
+
+	if (format == CaptureFormat::Raw)
+	{
+		rawFile.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+		written = rawFile.good();
+	}
+	else
+	{
+		std::vector<uint8_t> png = PngEncoder::encode(extent.width, extent.height, pixels.data());
+
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_%06llu.png", static_cast<unsigned long long>(frameNumber));
+		std::ofstream file(path + suffix, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(png.data()), png.size());
+		written = file.good();
+		size = png.size();
+	}
+
+	double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+	std::lock_guard<std::mutex> lock(captureMutex);
+	encodeMs += elapsedMs;
+	if (written)
+	{
+		framesWritten++;
+		bytesWritten += size;
+	}
+	else
+	{
+		failedWrites++;
+	}
+}
+
+void FrameCapture::ensureSlotCapacity(Slot& slot, VkDeviceSize size)
+{
+	if (slot.buffer != VK_NULL_HANDLE && slot.allocation.size >= size)
+	{
+		return;
+	}
+
+	// Grows with the render target, the slot is free so nothing uses the old buffer any more.
+	// Cached memory makes the copy out fast; coherent means no invalidate before reading.
+	if (slot.buffer != VK_NULL_HANDLE)
+	{
+		allocator->destroyBuffer(slot.buffer, slot.allocation);
+	}
+	slot.buffer = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		VK_MEMORY_PROPERTY_HOST_CACHED_BIT, AllocationLifetime::Persistent, &slot.allocation);
+}
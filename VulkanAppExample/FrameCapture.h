@@ -0,0 +1,111 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+
+#include "Utilities.h"
+#include "MemoryAllocator.h"
+#include "ThreadPool.h"
+
+struct FrameCaptureStats {
+	uint64_t framesCaptured = 0;		// Copies recorded
+	uint64_t framesDropped = 0;			// Due for capture while every slot was still busy
+	uint64_t framesWritten = 0;
+	uint64_t failedWrites = 0;
+	uint64_t bytesRead = 0;				// Pixels read back from the device
+	uint64_t bytesWritten = 0;			// After encoding
+	uint32_t pendingFrames = 0;			// Copied, not written yet
+	double readMegabytesPerSecond = 0.0;	// Since create (until destroy)
+	double framesPerSecond = 0.0;		// Written, since create (until destroy)
+	double avgEncodeMs = 0.0;			// Per frame, on one encoding thread
+};
+
+// Reads rendered frames back without ever making the render thread wait for them. Each captured frame is copied into
+// the next slot of a ring of persistently mapped, host visible buffers by the frame's own command buffer; a collector
+// thread waits for the slot's fence, takes the pixels out and frees the slot. If the ring is full when a frame is due
+// the frame is dropped rather than waited for.
+//
+// Raw captures go to a single file, frame after frame of tightly packed RGBA8 (e.g. ffmpeg -f rawvideo -pix_fmt rgba
+// -s WxH -i FILE). PNG captures are compressed on a pool of encoding threads, one frame each, into PATH_NNNNNN.png.
+class FrameCapture
+{
+public:
+	FrameCapture();
+
+	// slotCount buffers, a frame is captured every interval frames
+	void create(VkDevice logicalDevice, MemoryAllocator *memoryAllocator, CaptureFormat format, const std::string &path, uint32_t slotCount,
+		uint32_t interval, uint32_t encodeThreads);
+	void destroy();		// Waits for the copies and writes in flight; getStats still reports on them afterwards
+
+	// After the frame's rendering, with image in TRANSFER_SRC_OPTIMAL (visible to transfer reads): copies it out if the
+	// frame is due and a slot is free, and leaves it in finalLayout either way. Returns whether a copy was recorded.
+	bool recordCapture(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkExtent2D extent, VkImageLayout finalLayout);
+
+	// Right after the frame's submission, on the same queue: lets the collector know when the copy has finished
+	void submit(VkQueue queue);
+
+	FrameCaptureStats getStats();
+
+	// Whether frames in format can be captured: 8 bit RGBA or BGRA
+	static bool isFormatSupported(VkFormat format);
+
+	~FrameCapture();
+
+private:
+	struct Slot {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation allocation;
+		VkFence fence = VK_NULL_HANDLE;
+		bool busy = false;						// Between recordCapture and the collector being done with it
+		uint64_t frameNumber = 0;
+		VkExtent2D extent = {};
+		bool swapRedBlue = false;				// BGRA source
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator *allocator = nullptr;
+	CaptureFormat format = CaptureFormat::Png;
+	std::string path;
+	uint32_t interval = 1;
+	std::vector<Slot> slots;
+	uint32_t nextSlot = 0;
+	uint64_t frameCounter = 0;
+	int32_t recordedSlot = -1;					// Waiting for submit
+	std::ofstream rawFile;
+
+	// Collector thread: takes submitted slots in order
+	std::thread collectorThread;
+	std::mutex captureMutex;					// Guards the slots' busy flags, the queue, the counters and stopping
+	std::condition_variable slotSubmitted;
+	std::condition_variable encodeFinished;
+	std::deque<uint32_t> submittedSlots;
+	bool stopping = false;
+	ThreadPool encodePool;
+	uint32_t pendingEncodes = 0;
+	uint32_t maxPendingEncodes = 2;
+
+	// - Statistics
+	std::chrono::steady_clock::time_point startTime;
+	std::chrono::steady_clock::time_point stopTime;
+	bool stopped = false;						// Rates are measured up to stopTime
+	uint64_t framesCaptured = 0;
+	uint64_t framesDropped = 0;
+	uint64_t framesWritten = 0;
+	uint64_t failedWrites = 0;
+	uint64_t bytesRead = 0;
+	uint64_t bytesWritten = 0;
+	double encodeMs = 0.0;
+
+	// - Support Functions
+	void collectorLoop();
+	void writeFrame(uint64_t frameNumber, VkExtent2D extent, const std::vector<uint8_t> &pixels);
+	void ensureSlotCapacity(Slot &slot, VkDeviceSize size);
+};
@@ -0,0 +1,87 @@
+#include "FrameLimiter.h"
+
+#include <thread>
+#include <algorithm>
+
+#include "CpuProfiler.h"
+
+// Bounds of the time kept for spinning: the low end still covers a fine grained timer, the high end a 4 ms tick
+static const std::chrono::microseconds MIN_SPIN_MARGIN(100);
+static const std::chrono::microseconds MAX_SPIN_MARGIN(4000);
+static const std::chrono::microseconds INITIAL_SPIN_MARGIN(1000);
+
+FrameLimiter::FrameLimiter() : spinMargin(INITIAL_SPIN_MARGIN)
+{
+}
+
+void FrameLimiter::setFrameRate(double framesPerSecond)
+{
+	frameRate = std::max(framesPerSecond, 0.0);
+	interval = frameRate > 0.0
+		? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / frameRate))
+		: std::chrono::steady_clock::duration::zero();
+	started = false;
+}
+
+double FrameLimiter::wait(const std::function<void(std::chrono::steady_clock::time_point)>& sleep)
+{
+	if (!isEnabled())
+	{
+		return 0.0;
+	}
+
+	PROFILE_FUNCTION();
+
+	auto waitStart = std::chrono::steady_clock::now();
+	if (!started)
+	{
+		nextFrame = waitStart;
+		started = true;
+	}
+
+	// More than a whole frame late: this frame goes now and the grid starts again from it
+	if (waitStart - nextFrame > interval)
+	{
+		nextFrame = waitStart;
+	}
+
+	// -- SLEEP --
+	// Wake up spinMargin early; a wake-up later than that grows the margin, and it shrinks again slowly while
+	// sleeps are punctual, so one bad wake-up doesn't cost a spinning core for the rest of the run
+	auto sleepUntil = nextFrame - spinMargin;
+	if (sleepUntil > waitStart)
+	{
+		if (sleep)
+		{
+			sleep(sleepUntil);
+		}
+		else
+		{
+			std::this_thread::sleep_until(sleepUntil);
+		}
+		auto overshoot = std::chrono::steady_clock::now() - sleepUntil;
+		if (overshoot + MIN_SPIN_MARGIN > spinMargin)
+		{
+			spinMargin = std::min<std::chrono::steady_clock::duration>(overshoot + MIN_SPIN_MARGIN, MAX_SPIN_MARGIN);
+		}
+		else
+		{
+			spinMargin = std::max<std::chrono::steady_clock::duration>(spinMargin - spinMargin / 64, MIN_SPIN_MARGIN);
+		}
+	}
+
+	// -- SPIN --
+	auto now = std::chrono::steady_clock::now();
+	while (now < nextFrame)
+	{
+		std::this_thread::yield();
+		now = std::chrono::steady_clock::now();
+	}
+
+	nextFrame += interval;
+	return std::chrono::duration<double, std::milli>(now - waitStart).count();
+}
+
+FrameLimiter::~FrameLimiter()
+{
+}
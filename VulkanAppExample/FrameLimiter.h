@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+// Paces the render loop to a target frame rate. Frames are due on a fixed grid from the first one, so a single slow
+// frame doesn't push back every frame after it; falling more than a frame behind restarts the grid instead of
+// rushing to catch up.
+//
+// The OS sleep can overshoot by a scheduler tick or more, so the limiter sleeps until shortly before the frame is due
+// and spins the rest. How much it keeps for spinning follows how late recent sleeps woke up.
+class FrameLimiter
+{
+public:
+	FrameLimiter();
+
+	void setFrameRate(double framesPerSecond);		// 0 turns the limiter off
+	double getFrameRate() const { return frameRate; }
+	bool isEnabled() const { return frameRate > 0.0; }
+
+	// Blocks until the next frame is due and returns how long that took, in milliseconds. Call once per frame,
+	// before anything the frame's latency should include (input, simulation, recording).
+	// sleep, if given, is called instead of the OS sleep and must block until the time point it is passed; the caller
+	// can use it to wait on something of its own in the meantime.
+	double wait(const std::function<void(std::chrono::steady_clock::time_point)> &sleep = nullptr);
+
+	double getSpinMarginMs() const { return std::chrono::duration<double, std::milli>(spinMargin).count(); }
+
+	~FrameLimiter();
+
+private:
+	double frameRate = 0.0;
+	std::chrono::steady_clock::duration interval = std::chrono::steady_clock::duration::zero();
+	std::chrono::steady_clock::time_point nextFrame;
+	bool started = false;							// nextFrame is set, from the first wait after setFrameRate
+	std::chrono::steady_clock::duration spinMargin;
+};
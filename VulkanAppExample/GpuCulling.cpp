@@ -0,0 +1,328 @@
+#include "GpuCulling.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "CpuProfiler.h"
+
+static const VkDeviceSize COMMAND_STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+
+GpuCulling::GpuCulling()
+{
+}
+
+void GpuCulling::create(VkDevice logicalDevice, MemoryAllocator* memoryAllocator, DescriptorLayoutCache& layoutCache,
+	const IndirectDrawSupport& indirectSupport, uint32_t framesInFlight, const std::vector<uint32_t>& queueFamilies)
+{
+	PROFILE_FUNCTION();
+
+	device = logicalDevice;
+	allocator = memoryAllocator;
+	support = indirectSupport;
+	frames.resize(framesInFlight);
+
+	sharingFamilies.clear();
+	for (uint32_t family : queueFamilies)
+	{
+		if (std::find(sharingFamilies.begin(), sharingFamilies.end(), family) == sharingFamilies.end())
+		{
+			sharingFamilies.push_back(family);
+		}
+	}
+
+	// -- INSTANCE SET LAYOUT --
+	// Shared by the cull pass and the graphics pipelines, which only read the instances
+	VkDescriptorSetLayoutBinding instanceBinding = {};
+	instanceBinding.binding = INSTANCE_BINDING;
+	instanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	instanceBinding.descriptorCount = 1;
+	instanceBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+	instanceBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding commandBinding = instanceBinding;
+	commandBinding.binding = COMMAND_BINDING;
+	commandBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutBinding drawCountBinding = commandBinding;
+	drawCountBinding.binding = DRAW_COUNT_BINDING;
+
+	setLayout = layoutCache.getLayout({ instanceBinding, commandBinding, drawCountBinding });
+
+	// -- CULL PIPELINE LAYOUT --
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &setLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create the cull Pipeline Layout!");
+	}
+}
+
+void GpuCulling::destroy()
+{
+	destroyBuffers();
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	pipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	frames.clear();
+}
+
+void GpuCulling::createPipeline(PipelineCache* pipelineCache, const ShaderPack* shaderPack)
+{
+	PROFILE_FUNCTION();
+
+	ShaderCode code = shaderPack->get("cull.comp");
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = code.size;
+	shaderModuleCreateInfo.pCode = code.code;		// Already 4 byte aligned inside the pack
+
+	VkShaderModule shaderModule;
+	VkResult result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = pipelineCache->createComputePipeline("cull.comp", pipelineCreateInfo, &pipeline);
+
+	// Not needed once the pipeline exists
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create the cull Pipeline!");
+	}
+}
+
+void GpuCulling::setScene(const std::vector<RenderObject>& objects, const std::vector<Mesh>& meshes, UploadManager* uploadManager)
+{
+	PROFILE_FUNCTION();
+
+	destroyBuffers();
+	batches.clear();
+	instanceCount = static_cast<uint32_t>(objects.size());
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	// -- BATCHES --
+	// Instances are sorted by material, then mesh, so each batch's commands are contiguous and the draw loop
+	// changes pipeline as rarely as possible. Blended objects lose their draw list order across batches.
+	std::vector<uint32_t> order(instanceCount);
+	for (uint32_t i = 0; i < instanceCount; i++)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&objects](uint32_t a, uint32_t b) {
+		if (objects[a].materialIndex != objects[b].materialIndex)
+		{
+			return objects[a].materialIndex < objects[b].materialIndex;
+		}
+		return objects[a].meshIndex < objects[b].meshIndex;
+	});
+
+	std::vector<InstanceData> instances(instanceCount);
+	for (uint32_t slot = 0; slot < instanceCount; slot++)
+	{
+		const RenderObject& object = objects[order[slot]];
+		if (batches.empty() || batches.back().meshIndex != object.meshIndex || batches.back().materialIndex != object.materialIndex)
+		{
+			batches.push_back({ object.meshIndex, object.materialIndex, slot, 0 });
+		}
+		IndirectBatch& batch = batches.back();
+		batch.commandCount++;
+
+		// Instances are stored in batch order, so the instance index doubles as the command slot
+		InstanceData& instance = instances[slot];
+		instance.model = object.model;
+		instance.boundingSphere = meshes[object.meshIndex].getBoundingSphere();
+		instance.indexCount = meshes[object.meshIndex].getIndexCount();
+		instance.batchIndex = static_cast<uint32_t>(batches.size() - 1);
+		instance.firstCommand = batch.firstCommand;
+	}
+
+	// -- MODE --
+	// Counts need the multi draw limit to cover a whole batch, otherwise each batch would need several count slots
+	uint32_t largestBatch = 0;
+	for (const IndirectBatch& batch : batches)
+	{
+		largestBatch = std::max(largestBatch, batch.commandCount);
+	}
+	if (support.drawIndexedIndirectCount != nullptr && support.multiDrawIndirect && largestBatch <= support.maxDrawIndirectCount)
+	{
+		mode = IndirectDrawMode::DrawCount;
+	}
+	else
+	{
+		mode = support.multiDrawIndirect ? IndirectDrawMode::MultiDraw : IndirectDrawMode::SingleDraw;
+	}
+
+	// -- BUFFERS --
+	// Shared concurrently when several families use them: commands are written on one queue and drawn on another
+	// every frame, ownership transfers back and forth would cost more than the sharing does
+	VkDeviceSize instanceSize = sizeof(InstanceData) * instanceCount;
+	instanceBuffer = allocator->createBuffer(instanceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, &instanceAllocation, sharingFamilies);
+	uploadTicket = uploadManager->uploadBuffer(instanceBuffer, 0, instances.data(), instanceSize, sharingFamilies.size() > 1);
+
+	for (auto& frame : frames)
+	{
+		frame.commandBuffer = allocator->createBuffer(COMMAND_STRIDE * instanceCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, &frame.commandAllocation, sharingFamilies);
+		frame.drawCountBuffer = allocator->createBuffer(sizeof(uint32_t) * batches.size(),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, &frame.drawCountAllocation, sharingFamilies);
+	}
+}
+
+void GpuCulling::recordCull(VkCommandBuffer commandBuffer, uint32_t frameIndex, DescriptorAllocator& descriptorAllocator, const glm::mat4& viewProjection,
+	bool drawQueue)
+{
+	PROFILE_FUNCTION();
+
+	currentFrame = frameIndex;
+	instanceSet = VK_NULL_HANDLE;
+	if (instanceCount == 0)
+	{
+		return;
+	}
+	const FrameBuffers& frame = frames[frameIndex];
+
+	// -- INSTANCE SET --
+	instanceSet = descriptorAllocator.allocate(setLayout);
+
+	VkDescriptorBufferInfo bufferInfos[3] = {};
+	bufferInfos[INSTANCE_BINDING] = { instanceBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[COMMAND_BINDING] = { frame.commandBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[DRAW_COUNT_BINDING] = { frame.drawCountBuffer, 0, VK_WHOLE_SIZE };
+
+	VkWriteDescriptorSet writes[3] = {};
+	for (uint32_t binding = 0; binding < 3; binding++)
+	{
+		writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[binding].dstSet = instanceSet;
+		writes[binding].dstBinding = binding;
+		writes[binding].descriptorCount = 1;
+		writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[binding].pBufferInfo = &bufferInfos[binding];
+	}
+	vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+
+	// -- RESET COUNTS --
+	// Only compacted draws append; the other modes write every command slot
+	if (mode == IndirectDrawMode::DrawCount)
+	{
+		vkCmdFillBuffer(commandBuffer, frame.drawCountBuffer, 0, VK_WHOLE_SIZE, 0);
+
+		VkMemoryBarrier clearBarrier = {};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &clearBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	// -- CULL --
+	// Frustum planes straight from the view projection rows (Gribb & Hartmann), depth in [0, 1]
+	CullConstants cullConstants = {};
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; row++)
+	{
+		rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+	}
+	cullConstants.frustumPlanes[0] = rows[3] + rows[0];		// Left
+	cullConstants.frustumPlanes[1] = rows[3] - rows[0];		// Right
+	cullConstants.frustumPlanes[2] = rows[3] + rows[1];		// Top (Vulkan's y points down)
+	cullConstants.frustumPlanes[3] = rows[3] - rows[1];		// Bottom
+	cullConstants.frustumPlanes[4] = rows[2];				// Near
+	cullConstants.frustumPlanes[5] = rows[3] - rows[2];		// Far
+	for (glm::vec4& plane : cullConstants.frustumPlanes)
+	{
+		plane /= glm::length(glm::vec3(plane));				// So distances to the plane compare with radii
+	}
+	cullConstants.instanceCount = instanceCount;
+	cullConstants.compact = mode == IndirectDrawMode::DrawCount ? 1 : 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &instanceSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &cullConstants);
+	vkCmdDispatch(commandBuffer, (instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// Commands and counts are read by the draws of the render pass that follows. A compute only queue has no
+	// indirect stage to barrier against, the semaphore wait covers it there.
+	if (!drawQueue)
+	{
+		return;
+	}
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+		1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuCulling::recordDraws(VkCommandBuffer commandBuffer, uint32_t batchIndex) const
+{
+	const IndirectBatch& batch = batches[batchIndex];
+	const FrameBuffers& frame = frames[currentFrame];
+	VkDeviceSize commandOffset = COMMAND_STRIDE * batch.firstCommand;
+
+	if (mode == IndirectDrawMode::DrawCount)
+	{
+		support.drawIndexedIndirectCount(commandBuffer, frame.commandBuffer, commandOffset, frame.drawCountBuffer, sizeof(uint32_t) * batchIndex,
+			batch.commandCount, static_cast<uint32_t>(COMMAND_STRIDE));
+		return;
+	}
+
+	// Culled instances still have their command, with instanceCount 0. Calls are split at the device's limit.
+	uint32_t drawsPerCall = mode == IndirectDrawMode::MultiDraw ? std::max(support.maxDrawIndirectCount, 1u) : 1;
+	for (uint32_t first = 0; first < batch.commandCount; first += drawsPerCall)
+	{
+		uint32_t drawCount = std::min(drawsPerCall, batch.commandCount - first);
+		vkCmdDrawIndexedIndirect(commandBuffer, frame.commandBuffer, commandOffset + COMMAND_STRIDE * first, drawCount, static_cast<uint32_t>(COMMAND_STRIDE));
+	}
+}
+
+GpuCulling::~GpuCulling()
+{
+}
+
+void GpuCulling::destroyBuffers()
+{
+	if (instanceBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	allocator->destroyBuffer(instanceBuffer, instanceAllocation);
+	instanceBuffer = VK_NULL_HANDLE;
+	for (auto& frame : frames)
+	{
+		allocator->destroyBuffer(frame.commandBuffer, frame.commandAllocation);
+		allocator->destroyBuffer(frame.drawCountBuffer, frame.drawCountAllocation);
+		frame = FrameBuffers();
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "Mesh.h"
+#include "MemoryAllocator.h"
+#include "UploadManager.h"
+#include "DescriptorAllocator.h"
+#include "PipelineCache.h"
+#include "ShaderPack.h"
+
+// What the device offers for indirect draws, filled in when the logical device is created
+struct IndirectDrawSupport {
+	bool multiDrawIndirect = false;									// More than one draw per vkCmdDrawIndexedIndirect
+	uint32_t maxDrawIndirectCount = 1;
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;	// VK_KHR_draw_indirect_count, null without it
+};
+
+// How the indirect commands are laid out and consumed, from best to worst
+enum class IndirectDrawMode {
+	DrawCount,			// Visible instances are compacted, the GPU also writes how many draws each batch has
+	MultiDraw,			// One command per instance, culled ones with instanceCount 0, a whole batch per call
+	SingleDraw			// As MultiDraw, but one call per command (no multiDrawIndirect)
+};
+
+// Instances sharing a mesh and material, drawn by one indirect call (or one per command, see IndirectDrawMode)
+struct IndirectBatch {
+	uint32_t meshIndex;
+	uint32_t materialIndex;
+	uint32_t firstCommand;			// Index of the batch's first command in the command buffer
+	uint32_t commandCount;			// Instances in the batch, the most draws it can produce
+};
+
+// GPU driven culling and draw submission. The scene's instances live in a storage buffer; every frame a compute
+// pass tests their bounding spheres against the frustum and writes a VkDrawIndexedIndirectCommand for each one
+// that is visible, so the CPU records a handful of indirect draws however large the scene is.
+//
+// The instance set (instances, commands, draw counts) is bound at set 0 of the cull pipeline and at
+// INSTANCE_DESCRIPTOR_SET of the graphics pipelines, whose vertex shader reads instances[gl_InstanceIndex].
+// Needs drawIndirectFirstInstance, since firstInstance is how a draw finds its instance.
+//
+// The cull can be recorded for an async compute queue: with the graphics and compute families passed to create
+// the buffers are shared concurrently, and the graphics submission only has to wait for the compute one.
+class GpuCulling
+{
+public:
+	static const uint32_t INSTANCE_BINDING = 0;
+	static const uint32_t COMMAND_BINDING = 1;
+	static const uint32_t DRAW_COUNT_BINDING = 2;
+	static const uint32_t CULL_GROUP_SIZE = 64;		// local_size_x of cull.comp
+
+	GpuCulling();
+
+	// queueFamilies: every family that touches the buffers (transfer, compute, graphics), duplicates allowed
+	void create(VkDevice logicalDevice, MemoryAllocator *memoryAllocator, DescriptorLayoutCache &layoutCache,
+		const IndirectDrawSupport &indirectSupport, uint32_t framesInFlight, const std::vector<uint32_t> &queueFamilies);
+	void destroy();
+
+	// Builds the cull pipeline from cull.comp in the shader pack
+	void createPipeline(PipelineCache *pipelineCache, const ShaderPack *shaderPack);
+
+	// Groups the objects into batches and uploads their instance data. The scene is static afterwards, and
+	// can be culled on another queue than graphics once the upload is complete (see getUploadTicket).
+	void setScene(const std::vector<RenderObject> &objects, const std::vector<Mesh> &meshes, UploadManager *uploadManager);
+
+	// Outside a render pass: resets the draw counts, culls and makes the commands visible to indirect draws.
+	// The instance set it allocates from descriptorAllocator stays valid for the rest of the frame.
+	// With drawQueue false the caller does the hand-off instead: a render graph barrier, or on another queue than
+	// the draws the submission's semaphore, which the graphics side must wait on at VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT.
+	void recordCull(VkCommandBuffer commandBuffer, uint32_t frameIndex, DescriptorAllocator &descriptorAllocator, const glm::mat4 &viewProjection,
+		bool drawQueue = true);
+
+	// Inside the render pass, with the batch's pipeline, mesh and the instance set bound
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t batchIndex) const;
+
+	VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+	VkDescriptorSet getInstanceSet() const { return instanceSet; }		// Of the frame last culled
+	const std::vector<IndirectBatch>& getBatches() const { return batches; }
+	IndirectDrawMode getMode() const { return mode; }
+	uint32_t getInstanceCount() const { return instanceCount; }
+	uint64_t getUploadTicket() const { return uploadTicket; }
+
+	~GpuCulling();
+
+private:
+	struct FrameBuffers {
+		VkBuffer commandBuffer = VK_NULL_HANDLE;		// VkDrawIndexedIndirectCommand per instance
+		Allocation commandAllocation;
+		VkBuffer drawCountBuffer = VK_NULL_HANDLE;		// uint32_t per batch, DrawCount mode only
+		Allocation drawCountAllocation;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator *allocator = nullptr;
+	IndirectDrawSupport support;
+	IndirectDrawMode mode = IndirectDrawMode::SingleDraw;
+	std::vector<uint32_t> sharingFamilies;				// Distinct, the buffers are exclusive with fewer than two
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;	// Owned by the layout cache
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	// Written by the CPU once, frames in flight each cull into their own commands
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	Allocation instanceAllocation;
+	std::vector<FrameBuffers> frames;
+	uint32_t instanceCount = 0;
+	std::vector<IndirectBatch> batches;
+	uint64_t uploadTicket = 0;
+
+	uint32_t currentFrame = 0;
+	VkDescriptorSet instanceSet = VK_NULL_HANDLE;
+
+	void destroyBuffers();
+};
@@ -0,0 +1,444 @@
+#include "GpuProfiler.h"
+#include "Utilities.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+// Samples kept per scope for the statistics, a few seconds' worth at interactive frame rates
+static const size_t SCOPE_HISTORY_LENGTH = 256;
+
+// Events kept for the trace, oldest dropped first
+static const size_t MAX_TRACE_EVENTS = 200000;
+
+// Frames of graphics scopes kept to measure compute overlap against. Async compute usually runs under the
+// previous frame's graphics work, so the current frame alone would miss most of it.
+static const size_t OVERLAP_GRAPHICS_FRAMES = 4;
+
+GpuProfiler::GpuProfiler()
+{
+}
+
+void GpuProfiler::create(VkDevice logicalDevice, float timestampPeriod, const std::vector<uint32_t>& timestampValidBits, uint32_t framesInFlight,
+	uint32_t maxScopesPerFrame)
+{
+	device = logicalDevice;
+	epoch = std::chrono::steady_clock::now();
+
+	// Timestamps are only usable if the queue family gives them some valid bits, and the tick length says how to read them
+	uint32_t graphicsBits = timestampValidBits.empty() ? 0 : timestampValidBits[0];
+	enabled = graphicsBits > 0 && timestampPeriod > 0.0f;
+	if (!enabled)
+	{
+		return;
+	}
+
+	timestampPeriodNs = timestampPeriod;
+	for (uint32_t track = 0; track < GPU_TRACK_COUNT; track++)
+	{
+		uint32_t bits = track < timestampValidBits.size() ? timestampValidBits[track] : 0;
+		timestampMasks[track] = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+	}
+	maxQueries = maxScopesPerFrame * 2;
+
+	// Query pool creation information
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = maxQueries;			// Start and end of every scope
+
+	frames.resize(std::max(framesInFlight, 1u));
+	for (auto& frame : frames)
+	{
+		for (uint32_t track = 0; track < GPU_TRACK_COUNT; track++)
+		{
+			if (timestampMasks[track] == 0)
+			{
+				continue;
+			}
+
+			VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &frame.tracks[track].queryPool);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("ERROR: Failed to create a timestamp Query Pool!");
+			}
+		}
+	}
+}
+
+void GpuProfiler::destroy()
+{
+	for (auto& frame : frames)
+	{
+		for (auto& track : frame.tracks)
+		{
+			vkDestroyQueryPool(device, track.queryPool, nullptr);
+		}
+	}
+	frames.clear();
+	enabled = false;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(profilerMutex);
+
+	currentFrame = frameIndex % static_cast<uint32_t>(frames.size());
+	FrameQueries& frame = frames[currentFrame];
+
+	// The slot's fence has signalled, so its timestamps are all written and can be read without waiting
+	collectResults(frame);
+
+	for (auto& track : frame.tracks)
+	{
+		track.queryCount = 0;
+		track.openScopes = 0;
+		track.begun = false;
+	}
+	frame.scopes.clear();
+	frame.cpuStart = std::chrono::steady_clock::now();
+	frame.frameNumber = frameCounter++;
+	frame.recorded = true;
+
+	TrackQueries& graphics = frame.tracks[static_cast<uint32_t>(GpuTrack::Graphics)];
+	vkCmdResetQueryPool(commandBuffer, graphics.queryPool, 0, maxQueries);
+	graphics.begun = true;
+}
+
+void GpuProfiler::beginTrack(VkCommandBuffer commandBuffer, GpuTrack track)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(profilerMutex);
+
+	TrackQueries& queries = frames[currentFrame].tracks[static_cast<uint32_t>(track)];
+	if (queries.queryPool == VK_NULL_HANDLE || queries.begun)
+	{
+		return;
+	}
+
+	vkCmdResetQueryPool(commandBuffer, queries.queryPool, 0, maxQueries);
+	queries.begun = true;
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const std::string& name, GpuTrack track)
+{
+	if (!enabled)
+	{
+		return 0;
+	}
+
+	uint32_t scopeIndex;
+	uint32_t query;
+	VkQueryPool queryPool;
+	{
+		std::lock_guard<std::mutex> lock(profilerMutex);
+
+		FrameQueries& frame = frames[currentFrame];
+		TrackQueries& queries = frame.tracks[static_cast<uint32_t>(track)];
+		if (!queries.begun || queries.queryCount + 2 > maxQueries)
+		{
+			return UINT32_MAX;		// Out of queries this frame, drop the scope rather than fail the frame
+		}
+
+		// Both queries are reserved now, so a scope's start and end stay next to each other whatever other threads do
+		query = queries.queryCount;
+		queries.queryCount += 2;
+		queryPool = queries.queryPool;
+
+		scopeIndex = static_cast<uint32_t>(frame.scopes.size());
+		frame.scopes.push_back({ name, track, query, query + 1, queries.openScopes++ });
+	}
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+	return scopeIndex;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+	if (!enabled || scope == UINT32_MAX)
+	{
+		return;
+	}
+
+	uint32_t query;
+	VkQueryPool queryPool;
+	{
+		std::lock_guard<std::mutex> lock(profilerMutex);
+
+		FrameQueries& frame = frames[currentFrame];
+		TrackQueries& queries = frame.tracks[static_cast<uint32_t>(frame.scopes[scope].track)];
+		query = frame.scopes[scope].endQuery;
+		queryPool = queries.queryPool;
+		queries.openScopes--;
+	}
+
+	// Bottom of pipe: the timestamp is written once everything before it has completely finished
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query);
+}
+
+void GpuProfiler::addCpuEvent(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	std::lock_guard<std::mutex> lock(profilerMutex);
+
+	traceEvents.push_back({ name, 1, toMicroseconds(start), std::chrono::duration<double, std::micro>(end - start).count(), frameCounter });
+	while (traceEvents.size() > MAX_TRACE_EVENTS)
+	{
+		traceEvents.pop_front();
+	}
+}
+
+std::vector<GpuScopeStats> GpuProfiler::getScopeStats()
+{
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(profilerMutex);
+		for (const auto& entry : history)
+		{
+			names.push_back(entry.first);
+		}
+	}
+
+	std::vector<GpuScopeStats> scopeStats;
+	for (const auto& name : names)
+	{
+		scopeStats.push_back(getScopeStats(name));
+	}
+	return scopeStats;
+}
+
+GpuScopeStats GpuProfiler::getScopeStats(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(profilerMutex);
+
+	GpuScopeStats scopeStats;
+	scopeStats.name = name;
+
+	auto entry = history.find(name);
+	if (entry == history.end() || entry->second.empty())
+	{
+		return scopeStats;
+	}
+
+	std::vector<double> samples(entry->second.begin(), entry->second.end());
+	scopeStats.sampleCount = static_cast<uint32_t>(samples.size());
+	scopeStats.lastMs = samples.back();
+
+	double total = 0.0;
+	for (double sample : samples)
+	{
+		total += sample;
+	}
+	scopeStats.avgMs = total / samples.size();
+
+	std::sort(samples.begin(), samples.end());
+	scopeStats.minMs = samples.front();
+	scopeStats.p99Ms = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+
+	return scopeStats;
+}
+
+GpuOverlapStats GpuProfiler::getOverlapStats()
+{
+	std::lock_guard<std::mutex> lock(profilerMutex);
+
+	GpuOverlapStats overlapStats;
+	if (overlapHistory.empty())
+	{
+		return overlapStats;
+	}
+
+	for (const auto& sample : overlapHistory)
+	{
+		overlapStats.computeMs += sample.first;
+		overlapStats.overlappedMs += sample.second;
+	}
+	overlapStats.sampleCount = static_cast<uint32_t>(overlapHistory.size());
+	overlapStats.computeMs /= overlapStats.sampleCount;
+	overlapStats.overlappedMs /= overlapStats.sampleCount;
+
+	return overlapStats;
+}
+
+bool GpuProfiler::writeChromeTrace(const std::string& filePath)
+{
+	std::lock_guard<std::mutex> lock(profilerMutex);
+
+	std::ofstream file(filePath);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// Complete ("X") events on named tracks of one process. Fixed notation, the default would print large
+	// microsecond timestamps in exponent form and lose precision.
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU graphics\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"GPU compute\"}}";
+	for (const auto& event : traceEvents)
+	{
+		file << ",\n{\"name\":" << jsonString(event.name) << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadId
+			<< ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs
+			<< ",\"args\":{\"frame\":" << event.frameNumber << "}}";
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	return file.good();
+}
+
+GpuProfiler::~GpuProfiler()
+{
+}
+
+void GpuProfiler::collectResults(FrameQueries& frame)
+{
+	if (!frame.recorded || frame.scopes.empty())
+	{
+		return;
+	}
+	frame.recorded = false;
+
+	std::vector<uint64_t> timestamps[GPU_TRACK_COUNT];
+	for (uint32_t track = 0; track < GPU_TRACK_COUNT; track++)
+	{
+		if (!readTimestamps(frame.tracks[track], timestamps[track]))
+		{
+			return;		// Not all written (frame was never submitted), skip it
+		}
+	}
+
+	// There is no shared clock between CPU and GPU without extensions, so the GPU tracks are lined up with the
+	// CPU time the frame was recorded at; offsets between CPU and GPU are approximate, durations are exact.
+	// The origin is the earliest graphics timestamp, compute work that started before it gets a negative offset.
+	const std::vector<uint64_t>& graphicsTimestamps = timestamps[static_cast<uint32_t>(GpuTrack::Graphics)];
+	uint64_t gpuOrigin = 0;
+	bool hasOrigin = false;
+	for (const auto& scope : frame.scopes)
+	{
+		if (scope.track == GpuTrack::Graphics && (!hasOrigin || ticksBetween(gpuOrigin, graphicsTimestamps[scope.startQuery], GpuTrack::Graphics) < 0.0))
+		{
+			gpuOrigin = graphicsTimestamps[scope.startQuery];
+			hasOrigin = true;
+		}
+	}
+	if (!hasOrigin)
+	{
+		return;
+	}
+	double originUs = toMicroseconds(frame.cpuStart);
+
+	// Frames are collected in the order they were submitted, so the front holds the oldest frame
+	recentGraphicsIntervals.emplace_back();
+	if (recentGraphicsIntervals.size() > OVERLAP_GRAPHICS_FRAMES)
+	{
+		recentGraphicsIntervals.pop_front();
+	}
+
+	std::vector<std::pair<uint64_t, uint64_t>> computeIntervals;
+	for (const auto& scope : frame.scopes)
+	{
+		uint32_t track = static_cast<uint32_t>(scope.track);
+		uint64_t start = timestamps[track][scope.startQuery];
+		uint64_t end = timestamps[track][scope.endQuery];
+		double durationMs = ticksBetween(start, end, scope.track) * timestampPeriodNs / 1000000.0;
+
+		std::deque<double>& samples = history[scope.name];
+		samples.push_back(durationMs);
+		if (samples.size() > SCOPE_HISTORY_LENGTH)
+		{
+			samples.pop_front();
+		}
+
+		double offsetUs = ticksBetween(gpuOrigin, start, scope.track) * timestampPeriodNs / 1000.0;
+		traceEvents.push_back({ scope.name, 2 + track, originUs + offsetUs, durationMs * 1000.0, frame.frameNumber });
+
+		// Nested scopes are inside their parents already, only the top level counts towards the overlap
+		if (scope.depth == 0)
+		{
+			if (scope.track == GpuTrack::Graphics)
+			{
+				recentGraphicsIntervals.back().push_back({ start, end });
+			}
+			else
+			{
+				computeIntervals.push_back({ start, end });
+			}
+		}
+	}
+
+	while (traceEvents.size() > MAX_TRACE_EVENTS)
+	{
+		traceEvents.pop_front();
+	}
+
+	// -- OVERLAP --
+	// Top level graphics scopes are recorded one after the other on one queue, so they don't overlap each other
+	// and the intersections can simply be added up
+	if (!computeIntervals.empty())
+	{
+		double computeTicks = 0.0;
+		double overlappedTicks = 0.0;
+		for (const auto& compute : computeIntervals)
+		{
+			computeTicks += ticksBetween(compute.first, compute.second, GpuTrack::Compute);
+			for (const auto& graphicsFrame : recentGraphicsIntervals)
+			{
+				for (const auto& graphics : graphicsFrame)
+				{
+					// Relative to the compute scope's start
+					double start = std::max(0.0, ticksBetween(compute.first, graphics.first, GpuTrack::Compute));
+					double end = std::min(ticksBetween(compute.first, compute.second, GpuTrack::Compute), ticksBetween(compute.first, graphics.second, GpuTrack::Compute));
+					overlappedTicks += std::max(0.0, end - start);
+				}
+			}
+		}
+
+		overlapHistory.push_back({ computeTicks * timestampPeriodNs / 1000000.0, overlappedTicks * timestampPeriodNs / 1000000.0 });
+		if (overlapHistory.size() > SCOPE_HISTORY_LENGTH)
+		{
+			overlapHistory.pop_front();
+		}
+	}
+}
+
+bool GpuProfiler::readTimestamps(const TrackQueries& track, std::vector<uint64_t>& timestamps)
+{
+	timestamps.resize(track.queryCount);
+	if (track.queryCount == 0)
+	{
+		return true;
+	}
+
+	VkResult result = vkGetQueryPoolResults(device, track.queryPool, 0, track.queryCount, timestamps.size() * sizeof(uint64_t),
+		timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	return result == VK_SUCCESS;
+}
+
+double GpuProfiler::ticksBetween(uint64_t from, uint64_t to, GpuTrack track) const
+{
+	// Signed and wrap aware: a difference past half the valid range is read as going backwards
+	uint64_t mask = timestampMasks[static_cast<uint32_t>(track)];
+	uint64_t difference = (to - from) & mask;
+	uint64_t signBit = (mask >> 1) + 1;
+	if (difference & signBit)
+	{
+		return -static_cast<double>(((from - to) & mask));
+	}
+	return static_cast<double>(difference);
+}
+
+double GpuProfiler::toMicroseconds(std::chrono::steady_clock::time_point time) const
+{
+	return std::chrono::duration<double, std::micro>(time - epoch).count();
+}
@@ -0,0 +1,135 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+// Queues whose work is timed, each with its own queries and its own track in the trace
+enum class GpuTrack {
+	Graphics = 0,
+	Compute = 1			// The async compute queue, when there is one
+};
+static const uint32_t GPU_TRACK_COUNT = 2;
+
+// Timing of one named GPU scope over the recent frames
+struct GpuScopeStats {
+	std::string name;
+	double minMs = 0.0;
+	double avgMs = 0.0;
+	double p99Ms = 0.0;
+	double lastMs = 0.0;
+	uint32_t sampleCount = 0;
+};
+
+// How much of the compute track's work ran while the graphics queue was busy, averaged over the recent frames
+struct GpuOverlapStats {
+	double computeMs = 0.0;					// Top level compute scopes, per frame
+	double overlappedMs = 0.0;				// Part of computeMs that overlapped top level graphics scopes
+	uint32_t sampleCount = 0;				// Frames with compute scopes
+};
+
+// Brackets GPU work with vkCmdWriteTimestamp. Every frame in flight has its own query pool, which is read back
+// the next time the slot comes round (after its fence has signalled), so reading results never stalls.
+//
+// Work on another queue goes on its own track. Comparing timestamps across queues assumes they share the
+// device's timebase, which holds for the queues of one device on the drivers this has been run on.
+class GpuProfiler
+{
+public:
+
+	GpuProfiler();
+
+	// timestampPeriod comes from the device limits, timestampValidBits from the queue family of each track
+	// (indexed by GpuTrack, missing ones are disabled). Disabled (every call is a no-op) if the graphics family
+	// can't write timestamps; scopes on another track that can't are dropped.
+	void create(VkDevice logicalDevice, float timestampPeriod, const std::vector<uint32_t> &timestampValidBits, uint32_t framesInFlight,
+		uint32_t maxScopesPerFrame = 256);
+	void destroy();
+
+	bool isEnabled() const { return enabled; }
+
+	// Collects the results of the last frame recorded in this slot and resets its queries. Record into the
+	// frame's first command buffer, outside any render pass, once the slot's fence has been waited on.
+	// The graphics track's queries are reset here.
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+	// Resets another track's queries. Record at the start of the frame's first command buffer for that queue,
+	// after beginFrame; scopes on a track that wasn't begun this frame are dropped.
+	void beginTrack(VkCommandBuffer commandBuffer, GpuTrack track);
+
+	// Scopes can be nested, and recorded from any thread into any command buffer of the track's queue this frame
+	uint32_t beginScope(VkCommandBuffer commandBuffer, const std::string &name, GpuTrack track = GpuTrack::Graphics);
+	void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+	// CPU side events, so the trace shows GPU work next to the frame that produced it
+	void addCpuEvent(const std::string &name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+	std::vector<GpuScopeStats> getScopeStats();
+	GpuScopeStats getScopeStats(const std::string &name);
+	GpuOverlapStats getOverlapStats();
+
+	// Chrome trace (chrome://tracing, Perfetto) of the last frames collected
+	bool writeChromeTrace(const std::string &filePath);
+
+	~GpuProfiler();
+
+private:
+	struct Scope {
+		std::string name;
+		GpuTrack track;
+		uint32_t startQuery;
+		uint32_t endQuery;
+		uint32_t depth;
+	};
+
+	struct TrackQueries {
+		VkQueryPool queryPool = VK_NULL_HANDLE;	// Null when the track's family can't write timestamps
+		uint32_t queryCount = 0;				// Queries written this frame
+		uint32_t openScopes = 0;				// Nesting depth while recording
+		bool begun = false;						// Reset this frame, so its queries can be written
+	};
+
+	struct FrameQueries {
+		TrackQueries tracks[GPU_TRACK_COUNT];
+		std::vector<Scope> scopes;
+		std::chrono::steady_clock::time_point cpuStart;
+		uint64_t frameNumber = 0;
+		bool recorded = false;
+	};
+
+	struct TraceEvent {
+		std::string name;
+		uint32_t threadId;						// 1 CPU, 2 + GpuTrack for the GPU tracks
+		double startUs;							// Since the profiler was created
+		double durationUs;
+		uint64_t frameNumber;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	bool enabled = false;
+	double timestampPeriodNs = 1.0;				// Nanoseconds per timestamp tick
+	uint64_t timestampMasks[GPU_TRACK_COUNT] = {};	// Only timestampValidBits of a timestamp are meaningful
+	uint32_t maxQueries = 0;
+
+	std::vector<FrameQueries> frames;
+	uint32_t currentFrame = 0;
+	uint64_t frameCounter = 0;
+	std::chrono::steady_clock::time_point epoch;
+
+	std::map<std::string, std::deque<double>> history;	// Recent durations per scope name, in ms
+	std::deque<TraceEvent> traceEvents;
+	std::deque<std::vector<std::pair<uint64_t, uint64_t>>> recentGraphicsIntervals;	// Top level graphics scopes per recent frame, in ticks
+	std::deque<std::pair<double, double>> overlapHistory;					// Compute and overlapped ms per frame
+	std::mutex profilerMutex;
+
+	// - Support Functions
+	void collectResults(FrameQueries &frame);
+	bool readTimestamps(const TrackQueries &track, std::vector<uint64_t> &timestamps);
+	double ticksBetween(uint64_t from, uint64_t to, GpuTrack track) const;
+	double toMicroseconds(std::chrono::steady_clock::time_point time) const;
+};
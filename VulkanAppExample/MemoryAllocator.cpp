@@ -0,0 +1,594 @@
+#include "MemoryAllocator.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "CpuProfiler.h"
+
+// Smallest node handed out by the buddy pools
+static const VkDeviceSize MIN_NODE_SIZE = 256;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+MemoryAllocator::MemoryAllocator()
+{
+}
+
+void MemoryAllocator::create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t framesInFlight, VkDeviceSize blockSize, VkDeviceSize ringSize)
+{
+	PROFILE_FUNCTION();
+
+	this->physicalDevice = physicalDevice;
+	this->device = logicalDevice;
+	this->framesInFlight = std::max(framesInFlight, 1u);
+	this->ringSize = ringSize;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+
+	// Buddy blocks must be a power of two multiple of the smallest node
+	this->blockSize = MIN_NODE_SIZE;
+	maxOrder = 0;
+	while (this->blockSize < blockSize)
+	{
+		this->blockSize *= 2;
+		maxOrder++;
+	}
+
+	pools.clear();
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+	for (uint32_t i = 0; i < pools.size(); i++)
+	{
+		pools[i].memoryTypeIndex = i / 2;
+	}
+	deferredFrees.assign(this->framesInFlight, {});
+	currentFrame = 0;
+}
+
+void MemoryAllocator::destroy()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.blocks)
+		{
+			vkFreeMemory(device, block->memory, nullptr);
+		}
+		pool.blocks.clear();
+
+		if (pool.ring.memory != VK_NULL_HANDLE)
+		{
+			vkFreeMemory(device, pool.ring.memory, nullptr);
+			pool.ring = RingBlock();
+		}
+	}
+
+	for (auto& dedicated : dedicatedAllocations)
+	{
+		vkFreeMemory(device, dedicated.first, nullptr);
+	}
+	dedicatedAllocations.clear();
+	deferredFrees.clear();
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+	// Score every compatible type by how many preferred flags it has, lowest index wins a tie (drivers order types by preference)
+	int bestIndex = -1;
+	int bestScore = -1;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+		if (!(allowedTypes & (1u << i)) || (flags & required) != required)
+		{
+			continue;
+		}
+
+		int score = 0;
+		for (VkMemoryPropertyFlags bit = 1; bit != 0 && bit <= preferred; bit <<= 1)
+		{
+			if ((preferred & bit) && (flags & bit))
+			{
+				score++;
+			}
+		}
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestIndex = static_cast<int>(i);
+		}
+	}
+
+	if (bestIndex < 0)
+	{
+		throw std::runtime_error("ERROR: Failed to find a suitable memory type!");
+	}
+
+	return static_cast<uint32_t>(bestIndex);
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	AllocationLifetime lifetime, bool linearResource)
+{
+	uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, required, preferred);
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	// Linear and optimal resources only need separate pools when the device has a granularity to respect
+	bool separatePools = bufferImageGranularity > 1;
+	uint32_t poolIndex = memoryTypeIndex * 2 + (separatePools && !linearResource ? 1 : 0);
+	Pool& pool = pools[poolIndex];
+
+	if (lifetime == AllocationLifetime::Transient && requirements.size <= ringSize / 4)
+	{
+		RingBlock& ring = pool.ring;
+		if (ring.memory == VK_NULL_HANDLE)
+		{
+			ring.memory = allocateMemory(ringSize, memoryTypeIndex, &ring.mapped);
+			ring.size = ringSize;
+			ring.frameBytes.assign(framesInFlight, 0);
+			ring.frameEnds.assign(framesInFlight, 0);
+			ring.frameAllocationCounts.assign(framesInFlight, 0);
+		}
+
+		VkDeviceSize offset;
+		if (allocateFromRing(ring, requirements.size, requirements.alignment, &offset))
+		{
+			Allocation allocation;
+			allocation.memory = ring.memory;
+			allocation.offset = offset;
+			allocation.size = requirements.size;
+			allocation.mapped = ring.mapped ? static_cast<char*>(ring.mapped) + offset : nullptr;
+			allocation.memoryTypeIndex = memoryTypeIndex;
+			allocation.poolIndex = poolIndex;
+			return allocation;
+		}
+	}
+
+	Allocation allocation = allocatePersistent(pool, poolIndex, requirements.size, requirements.alignment);
+
+	// Transient data that didn't fit in the ring is released with the frame, just like ring memory
+	if (lifetime == AllocationLifetime::Transient)
+	{
+		deferredFrees[currentFrame].push_back(allocation);
+	}
+
+	return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	// Ring allocations are released in bulk by beginFrame
+	if (!allocation.dedicated && allocation.memory == pools[allocation.poolIndex].ring.memory)
+	{
+		allocation = Allocation();
+		return;
+	}
+
+	freePersistent(allocation);
+	allocation = Allocation();
+}
+
+VkBuffer MemoryAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	AllocationLifetime lifetime, Allocation* allocation, const std::vector<uint32_t>& queueFamilies)
+{
+	// Information to create a buffer (doesn't include assigning memory)
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;									// Size of buffer (size of 1 vertex * number of vertices)
+	bufferInfo.usage = usage;								// Multiple types of buffer possible
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;		// Similar to Swap Chain images, can share vertex buffers
+	if (queueFamilies.size() > 1)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+		bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
+
+	VkBuffer buffer;
+	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a Buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	*allocation = allocate(memRequirements, required, preferred, lifetime, true);
+	vkBindBufferMemory(device, buffer, allocation->memory, allocation->offset);
+
+	return buffer;
+}
+
+void MemoryAllocator::destroyBuffer(VkBuffer buffer, Allocation& allocation)
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	free(allocation);
+}
+
+VkImage MemoryAllocator::createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	Allocation* allocation)
+{
+	VkImage image;
+	VkResult result = vkCreateImage(device, &imageCreateInfo, nullptr, &image);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create an Image!");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+
+	*allocation = allocate(memoryRequirements, required, preferred, AllocationLifetime::Persistent, imageCreateInfo.tiling == VK_IMAGE_TILING_LINEAR);
+	vkBindImageMemory(device, image, allocation->memory, allocation->offset);
+
+	return image;
+}
+
+void MemoryAllocator::destroyImage(VkImage image, Allocation& allocation)
+{
+	vkDestroyImage(device, image, nullptr);
+	free(allocation);
+}
+
+void MemoryAllocator::beginFrame(uint32_t frameIndex)
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	currentFrame = frameIndex % framesInFlight;
+
+	// Frames retire in order, so the slot being reused holds the oldest data in every ring
+	for (auto& pool : pools)
+	{
+		RingBlock& ring = pool.ring;
+		if (ring.memory == VK_NULL_HANDLE || ring.frameBytes[currentFrame] == 0)
+		{
+			continue;
+		}
+
+		ring.used -= ring.frameBytes[currentFrame];
+		ring.tail = ring.frameEnds[currentFrame];
+		ring.frameBytes[currentFrame] = 0;
+		ring.frameAllocationCounts[currentFrame] = 0;
+
+		// Start again from the beginning when empty, to offer the largest contiguous range
+		if (ring.used == 0)
+		{
+			ring.head = 0;
+			ring.tail = 0;
+		}
+	}
+
+	for (auto& allocation : deferredFrees[currentFrame])
+	{
+		freePersistent(allocation);
+	}
+	deferredFrees[currentFrame].clear();
+}
+
+void MemoryAllocator::enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2)
+{
+	this->getMemoryProperties2 = getMemoryProperties2;
+}
+
+std::vector<HeapStats> MemoryAllocator::getHeapStats()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	std::vector<HeapStats> heapStats(memoryProperties.memoryHeapCount);
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		heapStats[i].heapSize = memoryProperties.memoryHeaps[i].size;
+	}
+
+	// The driver's figures include other processes' pressure and memory we didn't allocate through here
+	if (getMemoryProperties2 != nullptr)
+	{
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {};
+		memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		memoryProperties2.pNext = &budgetProperties;
+		getMemoryProperties2(physicalDevice, &memoryProperties2);
+
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		{
+			heapStats[i].budget = budgetProperties.heapBudget[i];
+			heapStats[i].usage = budgetProperties.heapUsage[i];
+		}
+	}
+
+	for (const auto& pool : pools)
+	{
+		HeapStats& stats = heapStats[memoryProperties.memoryTypes[pool.memoryTypeIndex].heapIndex];
+
+		for (const auto& block : pool.blocks)
+		{
+			stats.reserved += blockSize;
+			stats.used += block->used;
+			stats.memoryObjectCount++;
+			stats.allocationCount += block->allocationCount;
+
+			// Largest free node is the highest order with anything on its free list
+			for (uint32_t order = maxOrder + 1; order-- > 0;)
+			{
+				if (!block->freeLists[order].empty())
+				{
+					stats.largestFreeRange = std::max(stats.largestFreeRange, nodeSize(order));
+					break;
+				}
+			}
+		}
+
+		const RingBlock& ring = pool.ring;
+		if (ring.memory != VK_NULL_HANDLE)
+		{
+			stats.reserved += ring.size;
+			stats.used += ring.used;
+			stats.memoryObjectCount++;
+			for (uint32_t count : ring.frameAllocationCounts)
+			{
+				stats.allocationCount += count;
+			}
+
+			VkDeviceSize largestRingRange = 0;
+			if (ring.used == 0)
+			{
+				largestRingRange = ring.size;
+			}
+			else if (ring.head > ring.tail)
+			{
+				largestRingRange = std::max(ring.size - ring.head, ring.tail);
+			}
+			else if (ring.head < ring.tail)
+			{
+				largestRingRange = ring.tail - ring.head;
+			}
+			stats.largestFreeRange = std::max(stats.largestFreeRange, largestRingRange);
+		}
+	}
+
+	for (const auto& dedicated : dedicatedAllocations)
+	{
+		HeapStats& stats = heapStats[memoryProperties.memoryTypes[dedicated.second.memoryTypeIndex].heapIndex];
+		stats.reserved += dedicated.second.size;
+		stats.used += dedicated.second.size;
+		stats.memoryObjectCount++;
+		stats.allocationCount++;
+	}
+
+	for (auto& stats : heapStats)
+	{
+		stats.free = stats.reserved - stats.used;
+		stats.fragmentation = stats.free > 0 ? 1.0f - static_cast<float>(stats.largestFreeRange) / static_cast<float>(stats.free) : 0.0f;
+		stats.fragmentation = std::max(stats.fragmentation, 0.0f);
+	}
+
+	return heapStats;
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+}
+
+Allocation MemoryAllocator::allocatePersistent(Pool& pool, uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment)
+{
+	Allocation allocation;
+	allocation.size = size;
+	allocation.memoryTypeIndex = pool.memoryTypeIndex;
+	allocation.poolIndex = poolIndex;
+
+	// Anything over half a block would waste most of a block in the buddy system, give it its own memory
+	if (size > blockSize / 2)
+	{
+		allocation.memory = allocateMemory(size, pool.memoryTypeIndex, &allocation.mapped);
+		allocation.dedicated = true;
+		dedicatedAllocations[allocation.memory] = allocation;
+		return allocation;
+	}
+
+	// Buddy nodes are aligned to their own size, so a node at least as big as the alignment is always aligned
+	allocation.order = orderForSize(std::max(size, alignment));
+
+	VkDeviceSize offset = 0;
+	bool found = false;
+	for (uint32_t i = 0; i < pool.blocks.size() && !found; i++)
+	{
+		if (allocateFromBlock(*pool.blocks[i], allocation.order, &offset))
+		{
+			allocation.blockIndex = i;
+			found = true;
+		}
+	}
+
+	// Every block is full (or there are none yet), grab another one from the driver
+	if (!found)
+	{
+		auto block = std::make_unique<BuddyBlock>();
+		block->memory = allocateMemory(blockSize, pool.memoryTypeIndex, &block->mapped);
+		block->freeLists.resize(maxOrder + 1);
+		block->freeLists[maxOrder].insert(0);
+		pool.blocks.push_back(std::move(block));
+
+		allocation.blockIndex = static_cast<uint32_t>(pool.blocks.size() - 1);
+		allocateFromBlock(*pool.blocks.back(), allocation.order, &offset);
+	}
+
+	BuddyBlock& block = *pool.blocks[allocation.blockIndex];
+	block.used += nodeSize(allocation.order);
+	block.allocationCount++;
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+
+	return allocation;
+}
+
+void MemoryAllocator::freePersistent(Allocation& allocation)
+{
+	if (allocation.dedicated)
+	{
+		vkFreeMemory(device, allocation.memory, nullptr);
+		dedicatedAllocations.erase(allocation.memory);
+		return;
+	}
+
+	BuddyBlock& block = *pools[allocation.poolIndex].blocks[allocation.blockIndex];
+	freeToBlock(block, allocation.offset, allocation.order);
+	block.used -= nodeSize(allocation.order);
+	block.allocationCount--;
+}
+
+VkDeviceMemory MemoryAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped)
+{
+	VkMemoryAllocateInfo memoryAllocInfo = {};
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = size;
+	memoryAllocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory;
+	VkResult result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, &memory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to allocate device memory!");
+	}
+
+	// Host visible memory stays mapped for its whole life, mapping is not free on every driver
+	*mapped = nullptr;
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		vkMapMemory(device, memory, 0, size, 0, mapped);
+	}
+
+	return memory;
+}
+
+bool MemoryAllocator::allocateFromBlock(BuddyBlock& block, uint32_t order, VkDeviceSize* offset)
+{
+	// Find the smallest free node that is big enough
+	uint32_t foundOrder = order;
+	while (foundOrder <= maxOrder && block.freeLists[foundOrder].empty())
+	{
+		foundOrder++;
+	}
+	if (foundOrder > maxOrder)
+	{
+		return false;
+	}
+
+	VkDeviceSize nodeOffset = *block.freeLists[foundOrder].begin();
+	block.freeLists[foundOrder].erase(block.freeLists[foundOrder].begin());
+
+	// Split it in halves until it is the requested size, the upper halves go back on the free lists
+	while (foundOrder > order)
+	{
+		foundOrder--;
+		block.freeLists[foundOrder].insert(nodeOffset + nodeSize(foundOrder));
+	}
+
+	*offset = nodeOffset;
+	return true;
+}
+
+void MemoryAllocator::freeToBlock(BuddyBlock& block, VkDeviceSize offset, uint32_t order)
+{
+	// Merge with the buddy for as long as the buddy is free as well
+	while (order < maxOrder)
+	{
+		VkDeviceSize buddyOffset = offset ^ nodeSize(order);
+		auto buddy = block.freeLists[order].find(buddyOffset);
+		if (buddy == block.freeLists[order].end())
+		{
+			break;
+		}
+
+		block.freeLists[order].erase(buddy);
+		offset = std::min(offset, buddyOffset);
+		order++;
+	}
+
+	block.freeLists[order].insert(offset);
+}
+
+bool MemoryAllocator::allocateFromRing(RingBlock& ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+	// head == tail is either completely empty or completely full
+	if (ring.used >= ring.size)
+	{
+		return false;
+	}
+
+	VkDeviceSize alignedHead = alignUp(ring.head, alignment);
+	VkDeviceSize consumed = 0;
+
+	if (ring.head >= ring.tail)
+	{
+		// Free space is [head, size) followed by [0, tail)
+		if (alignedHead + size <= ring.size)
+		{
+			*offset = alignedHead;
+			consumed = alignedHead + size - ring.head;
+		}
+		else if (size <= ring.tail)
+		{
+			// Wrap around; the unused end of the ring is charged to this frame so it comes back with it
+			*offset = 0;
+			consumed = (ring.size - ring.head) + size;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// Free space is [head, tail)
+		if (alignedHead + size > ring.tail)
+		{
+			return false;
+		}
+		*offset = alignedHead;
+		consumed = alignedHead + size - ring.head;
+	}
+
+	ring.head = *offset + size;
+	ring.used += consumed;
+	ring.frameBytes[currentFrame] += consumed;
+	ring.frameEnds[currentFrame] = ring.head;
+	ring.frameAllocationCounts[currentFrame]++;
+
+	return true;
+}
+
+uint32_t MemoryAllocator::orderForSize(VkDeviceSize size) const
+{
+	uint32_t order = 0;
+	while (nodeSize(order) < size)
+	{
+		order++;
+	}
+	return order;
+}
+
+VkDeviceSize MemoryAllocator::nodeSize(uint32_t order) const
+{
+	return MIN_NODE_SIZE << order;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <memory>
+
+// How long an allocation is expected to live, which decides the pool it comes from
+enum class AllocationLifetime {
+	Persistent,		// Buffers/images that live across many frames: buddy pool, freed individually
+	Transient		// Per-frame data: linear ring, released in bulk when the frame's fence signals
+};
+
+// A piece of device memory handed out by the MemoryAllocator
+struct Allocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;		// Memory object the allocation lives in (shared with other allocations)
+	VkDeviceSize offset = 0;					// Offset to bind the resource at
+	VkDeviceSize size = 0;						// Size requested by the resource
+	void *mapped = nullptr;						// Host pointer to offset, if the memory is host visible (persistently mapped)
+	uint32_t memoryTypeIndex = 0;
+
+	// - Bookkeeping for free()
+	uint32_t poolIndex = 0;
+	uint32_t blockIndex = 0;
+	uint32_t order = 0;							// Buddy order of the node backing this allocation
+	bool dedicated = false;						// Has its own VkDeviceMemory
+};
+
+// Usage of one memory heap
+struct HeapStats {
+	VkDeviceSize heapSize = 0;					// Size the driver reports for the heap
+	VkDeviceSize reserved = 0;					// Bytes obtained from vkAllocateMemory
+	VkDeviceSize used = 0;						// Bytes currently handed out to resources
+	VkDeviceSize free = 0;						// reserved - used
+	VkDeviceSize largestFreeRange = 0;			// Largest allocation that would fit without a new block
+	float fragmentation = 0.0f;					// 1 - largestFreeRange / free, 0 when all free space is contiguous
+	uint32_t memoryObjectCount = 0;				// vkAllocateMemory calls currently alive
+	uint32_t allocationCount = 0;				// Sub-allocations currently alive
+	VkDeviceSize budget = 0;					// What the process may use of the heap, from VK_EXT_memory_budget (0 without it)
+	VkDeviceSize usage = 0;						// What the process uses of the heap, everything included (0 without it)
+};
+
+// Sub-allocates buffers and images out of a small number of large VkDeviceMemory blocks, so resource count
+// is not bounded by maxMemoryAllocationCount and the driver allocation cost is only paid once per block.
+// Linear (buffers, linear images) and optimal-tiling resources get separate pools per memory type, so
+// neighbours never violate bufferImageGranularity.
+class MemoryAllocator
+{
+public:
+
+	MemoryAllocator();
+
+	void create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t framesInFlight,
+		VkDeviceSize blockSize = 64 * 1024 * 1024, VkDeviceSize ringSize = 16 * 1024 * 1024);
+	void destroy();
+
+	// With VK_EXT_memory_budget enabled on the device, getHeapStats also reports the driver's budget and usage
+	void enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2);
+	bool hasMemoryBudget() const { return getMemoryProperties2 != nullptr; }
+
+	// Picks a memory type that has all of required and as many of preferred as possible
+	uint32_t findMemoryType(uint32_t allowedTypes, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const;
+
+	Allocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		AllocationLifetime lifetime, bool linearResource);
+	void free(Allocation &allocation);		// Transient allocations don't need freeing, see beginFrame
+
+	// Create a resource and bind it to freshly allocated memory in one go. A buffer used by more than one of
+	// queueFamilies is shared concurrently, so those queues need no ownership transfers for it.
+	VkBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		AllocationLifetime lifetime, Allocation *allocation, const std::vector<uint32_t> &queueFamilies = {});
+	void destroyBuffer(VkBuffer buffer, Allocation &allocation);
+	VkImage createImage(const VkImageCreateInfo &imageCreateInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		Allocation *allocation);
+	void destroyImage(VkImage image, Allocation &allocation);
+
+	// Call once the fence of frameIndex has signalled: releases every transient allocation made the last time that frame slot was used
+	void beginFrame(uint32_t frameIndex);
+
+	std::vector<HeapStats> getHeapStats();
+	const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const { return memoryProperties; }
+
+	~MemoryAllocator();
+
+private:
+	// Power of two sized block carved up with a buddy system
+	struct BuddyBlock {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void *mapped = nullptr;
+		std::vector<std::set<VkDeviceSize>> freeLists;	// Free node offsets, indexed by order
+		VkDeviceSize used = 0;
+		uint32_t allocationCount = 0;
+	};
+
+	// Single block used as a ring buffer, with one segment per frame in flight
+	struct RingBlock {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void *mapped = nullptr;
+		VkDeviceSize size = 0;
+		VkDeviceSize head = 0;							// Next free byte
+		VkDeviceSize tail = 0;							// Oldest byte still in use
+		VkDeviceSize used = 0;							// Bytes between tail and head, including wrap padding
+		std::vector<VkDeviceSize> frameBytes;			// Bytes (with padding) each frame slot consumed last time it was used
+		std::vector<VkDeviceSize> frameEnds;			// Head position at the end of each frame slot's last use
+		std::vector<uint32_t> frameAllocationCounts;
+	};
+
+	struct Pool {
+		uint32_t memoryTypeIndex = 0;
+		std::vector<std::unique_ptr<BuddyBlock>> blocks;
+		RingBlock ring;
+	};
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	VkDeviceSize bufferImageGranularity = 1;
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+
+	VkDeviceSize blockSize = 0;
+	VkDeviceSize ringSize = 0;
+	uint32_t maxOrder = 0;
+	uint32_t framesInFlight = 1;
+	uint32_t currentFrame = 0;
+
+	std::vector<Pool> pools;						// Two per memory type: [type * 2] linear, [type * 2 + 1] optimal (unused if granularity is 1)
+	std::map<VkDeviceMemory, Allocation> dedicatedAllocations;
+	std::vector<std::vector<Allocation>> deferredFrees;	// Transient allocations that didn't fit in the ring, per frame slot
+	std::mutex allocatorMutex;
+
+	// - Support Functions
+	Allocation allocatePersistent(Pool &pool, uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment);
+	void freePersistent(Allocation &allocation);
+	VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void **mapped);
+	bool allocateFromBlock(BuddyBlock &block, uint32_t order, VkDeviceSize *offset);
+	void freeToBlock(BuddyBlock &block, VkDeviceSize offset, uint32_t order);
+	bool allocateFromRing(RingBlock &ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset);
+	uint32_t orderForSize(VkDeviceSize size) const;
+	VkDeviceSize nodeSize(uint32_t order) const;
+};
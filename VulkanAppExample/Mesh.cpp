@@ -0,0 +1,403 @@
+#include "Mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+
+#include "CpuProfiler.h"
+
+// -- VERTEX CACHE OPTIMISATION --
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": greedily emit the triangle whose vertices score best,
+// where a vertex scores for being recently used (likely still in the cache) and for having few triangles left
+// (so it is finished off instead of being left behind as a lone triangle later).
+static const int FORSYTH_CACHE_SIZE = 32;
+static const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+static const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+static const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+static const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+static float forsythVertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+	if (remainingTriangles == 0)
+	{
+		return -1.0f;		// Nothing left to emit with this vertex
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			// Used by the last triangle: deliberately not the best, or strips of one triangle wide are produced
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+
+	score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles using each vertex, as one flat array
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t index : indices)
+	{
+		remaining[index]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (size_t k = 0; k < 3; k++)
+		{
+			adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	// LRU cache, with room for the three vertices pushed in front before the overflow is dropped
+	std::vector<uint32_t> cache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	int bestTriangle = -1;
+	size_t scanCursor = 0;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		// Nothing in the cache had a candidate, fall back to the best not yet emitted triangle
+		if (bestTriangle < 0)
+		{
+			float bestScore = -1.0f;
+			while (scanCursor < triangleCount && emitted[scanCursor])
+			{
+				scanCursor++;
+			}
+			for (size_t t = scanCursor; t < triangleCount; t++)
+			{
+				if (!emitted[t] && triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					bestTriangle = static_cast<int>(t);
+				}
+			}
+		}
+
+		const uint32_t* triangle = &indices[bestTriangle * 3];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[bestTriangle] = true;
+
+		// Take the triangle out of its vertices' adjacency lists
+		for (size_t k = 0; k < 3; k++)
+		{
+			uint32_t v = triangle[k];
+			uint32_t* begin = &adjacency[adjacencyOffsets[v]];
+			uint32_t* end = begin + remaining[v];
+			std::iter_swap(std::find(begin, end, static_cast<uint32_t>(bestTriangle)), end - 1);
+			remaining[v]--;
+		}
+
+		// Move the triangle's vertices to the front of the cache
+		std::vector<uint32_t> newCache(triangle, triangle + 3);
+		for (uint32_t v : cache)
+		{
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				newCache.push_back(v);
+			}
+		}
+		for (size_t i = FORSYTH_CACHE_SIZE; i < newCache.size(); i++)
+		{
+			cachePosition[newCache[i]] = -1;
+		}
+
+		// Rescore everything that was or is in the cache, and the triangles around it; pick the best for next time
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t v = newCache[i];
+			if (i < static_cast<size_t>(FORSYTH_CACHE_SIZE))
+			{
+				cachePosition[v] = static_cast<int>(i);
+			}
+
+			float newScore = forsythVertexScore(cachePosition[v], remaining[v]);
+			float delta = newScore - vertexScore[v];
+			vertexScore[v] = newScore;
+
+			for (uint32_t a = 0; a < remaining[v]; a++)
+			{
+				uint32_t t = adjacency[adjacencyOffsets[v] + a];
+				triangleScore[t] += delta;
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					bestTriangle = static_cast<int>(t);
+				}
+			}
+		}
+
+		if (newCache.size() > static_cast<size_t>(FORSYTH_CACHE_SIZE))
+		{
+			newCache.resize(FORSYTH_CACHE_SIZE);
+		}
+		cache.swap(newCache);
+	}
+
+	indices.swap(output);
+}
+
+// Renumber vertices in the order the index buffer first references them, dropping unused ones
+static void optimizeVertexFetch(MeshData& meshData)
+{
+	const uint32_t UNUSED = 0xFFFFFFFF;
+	std::vector<uint32_t> remap(meshData.vertices.size(), UNUSED);
+	std::vector<Vertex> vertices;
+	vertices.reserve(meshData.vertices.size());
+
+	for (uint32_t& index : meshData.indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(meshData.vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	meshData.vertices.swap(vertices);
+}
+
+void optimizeMesh(MeshData& meshData)
+{
+	PROFILE_FUNCTION();
+
+	optimizeVertexCache(meshData.indices, meshData.vertices.size());
+	optimizeVertexFetch(meshData);
+}
+
+float calculateACMR(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	if (indices.size() < 3)
+	{
+		return 0.0f;
+	}
+
+	// FIFO cache, the model most hardware is closest to: a hit doesn't refresh the entry
+	std::vector<uint64_t> insertedAt(vertexCount, 0);
+	uint64_t misses = 0;
+	for (uint32_t index : indices)
+	{
+		if (insertedAt[index] == 0 || misses + 1 - insertedAt[index] > cacheSize)
+		{
+			misses++;
+			insertedAt[index] = misses;
+		}
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
+
+Mesh::Mesh()
+{
+}
+
+Mesh::Mesh(MemoryAllocator* memoryAllocator, UploadManager* uploadManager, const MeshData& meshData, VertexLayout layout)
+{
+	PROFILE_FUNCTION();
+
+	allocator = memoryAllocator;
+	this->layout = layout;
+	vertexCount = static_cast<uint32_t>(meshData.vertices.size());
+	indexCount = static_cast<uint32_t>(meshData.indices.size());
+
+	// -- BOUNDS --
+	// Sphere around the centre of the bounding box: not the tightest, but cheap and good enough to cull with
+	if (vertexCount > 0)
+	{
+		glm::vec3 minimum = meshData.vertices[0].pos;
+		glm::vec3 maximum = meshData.vertices[0].pos;
+		for (const Vertex& vertex : meshData.vertices)
+		{
+			minimum = glm::min(minimum, vertex.pos);
+			maximum = glm::max(maximum, vertex.pos);
+		}
+		glm::vec3 centre = (minimum + maximum) * 0.5f;
+		float radius = 0.0f;
+		for (const Vertex& vertex : meshData.vertices)
+		{
+			radius = std::max(radius, glm::length(vertex.pos - centre));
+		}
+		boundingSphere = glm::vec4(centre, radius);
+	}
+
+	// -- VERTEX STREAMS --
+	// Build the streams on the CPU in the layout the binding descriptions describe
+	std::vector<char> vertexData;
+	if (layout == VertexLayout::Interleaved)
+	{
+		streamOffsets = { 0 };
+		vertexData.resize(sizeof(Vertex) * vertexCount);
+		memcpy(vertexData.data(), meshData.vertices.data(), vertexData.size());
+	}
+	else
+	{
+		VkDeviceSize positionSize = sizeof(glm::vec3) * vertexCount;
+		streamOffsets = { 0, positionSize };
+		vertexData.resize(static_cast<size_t>(positionSize * 2));
+
+		glm::vec3* positions = reinterpret_cast<glm::vec3*>(vertexData.data());
+		glm::vec3* colours = reinterpret_cast<glm::vec3*>(vertexData.data() + positionSize);
+		for (uint32_t i = 0; i < vertexCount; i++)
+		{
+			positions[i] = meshData.vertices[i].pos;
+			colours[i] = meshData.vertices[i].col;
+		}
+	}
+
+	vertexBuffer = allocator->createBuffer(vertexData.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, &vertexAllocation);
+	uploadManager->uploadBuffer(vertexBuffer, 0, vertexData.data(), vertexData.size());
+
+	// -- INDICES --
+	// Half the bandwidth and memory when every vertex can be addressed with 16 bits
+	std::vector<uint16_t> shortIndices;
+	const void* indexData = meshData.indices.data();
+	VkDeviceSize indexSize = sizeof(uint32_t) * indexCount;
+	indexType = VK_INDEX_TYPE_UINT32;
+	if (vertexCount <= 0xFFFF)
+	{
+		shortIndices.assign(meshData.indices.begin(), meshData.indices.end());
+		indexData = shortIndices.data();
+		indexSize = sizeof(uint16_t) * indexCount;
+		indexType = VK_INDEX_TYPE_UINT16;
+	}
+
+	indexBuffer = allocator->createBuffer(indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, &indexAllocation);
+	uploadManager->uploadBuffer(indexBuffer, 0, indexData, indexSize);
+}
+
+void Mesh::bind(VkCommandBuffer commandBuffer, bool positionOnly) const
+{
+	std::vector<VkBuffer> buffers(streamOffsets.size(), vertexBuffer);
+	uint32_t bindingCount = positionOnly ? 1 : static_cast<uint32_t>(streamOffsets.size());
+
+	// An interleaved stream still carries the colour when only positions are wanted, it's just not read
+	vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, buffers.data(), streamOffsets.data());
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+}
+
+void Mesh::draw(VkCommandBuffer commandBuffer, bool positionOnly) const
+{
+	bind(commandBuffer, positionOnly);
+	vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+}
+
+void Mesh::destroyBuffers()
+{
+	if (allocator == nullptr)
+	{
+		return;
+	}
+
+	allocator->destroyBuffer(vertexBuffer, vertexAllocation);
+	allocator->destroyBuffer(indexBuffer, indexAllocation);
+	vertexBuffer = VK_NULL_HANDLE;
+	indexBuffer = VK_NULL_HANDLE;
+	allocator = nullptr;
+}
+
+std::vector<VkVertexInputBindingDescription> Mesh::getBindingDescriptions(VertexLayout layout, bool positionOnly)
+{
+	std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+
+	// How the data for a single vertex (including info such as position, colour, texture coords, normals, etc) is as a whole
+	VkVertexInputBindingDescription bindingDescription = {};
+	bindingDescription.binding = 0;									// Can bind multiple streams of data, this defines which one
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;		// How to move between data after each vertex.
+																	// VK_VERTEX_INPUT_RATE_VERTEX	: Move on to the next vertex
+																	// VK_VERTEX_INPUT_RATE_INSTANCE	: Move to a vertex for the next instance
+
+	if (layout == VertexLayout::Interleaved)
+	{
+		bindingDescription.stride = sizeof(Vertex);					// Size of a single vertex object
+		bindingDescriptions.push_back(bindingDescription);
+	}
+	else
+	{
+		bindingDescription.stride = sizeof(glm::vec3);				// Position stream
+		bindingDescriptions.push_back(bindingDescription);
+
+		if (!positionOnly)
+		{
+			bindingDescription.binding = 1;							// Everything else
+			bindingDescription.stride = sizeof(glm::vec3);
+			bindingDescriptions.push_back(bindingDescription);
+		}
+	}
+
+	return bindingDescriptions;
+}
+
+std::vector<VkVertexInputAttributeDescription> Mesh::getAttributeDescriptions(VertexLayout layout, bool positionOnly)
+{
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(positionOnly ? 1 : 2);
+
+	// Position Attribute
+	attributeDescriptions[0].binding = 0;							// Which binding the data is at (should be same as above)
+	attributeDescriptions[0].location = 0;							// Location in shader where data will be read from
+	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;	// Format the data will take (also helps define size of data)
+	attributeDescriptions[0].offset = layout == VertexLayout::Interleaved ? offsetof(Vertex, pos) : 0;	// Where this attribute is defined in the data for a single vertex
+
+	// Colour Attribute
+	if (!positionOnly)
+	{
+		attributeDescriptions[1].binding = layout == VertexLayout::Interleaved ? 0 : 1;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[1].offset = layout == VertexLayout::Interleaved ? offsetof(Vertex, col) : 0;
+	}
+
+	return attributeDescriptions;
+}
+
+Mesh::~Mesh()
+{
+}
@@ -0,0 +1,73 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "MemoryAllocator.h"
+#include "UploadManager.h"
+
+// Geometry as it comes out of an importer, before it is sent to the GPU
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;		// Triangle list
+};
+
+// Reorders triangles for the post-transform vertex cache, then vertices in the order they are first used so
+// vertex fetch walks memory linearly. Run once at import time; the result renders identically.
+void optimizeMesh(MeshData &meshData);
+
+// Average cache miss ratio (transformed vertices per triangle) with a FIFO cache of cacheSize entries:
+// 3.0 is the worst possible, 0.5 the best for a regular grid
+float calculateACMR(const std::vector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize = 16);
+
+// An instance of a mesh in the scene
+struct RenderObject {
+	uint32_t meshIndex;		// Index into the renderer's mesh list
+	glm::mat4 model;		// Model to world transform, sent as a push constant (or in the instance buffer)
+	uint32_t materialIndex = 0;	// Index into the renderer's materials (pipeline variants)
+};
+
+// Device local vertex and index buffers for one mesh, filled through the upload manager
+class Mesh
+{
+public:
+	Mesh();
+	Mesh(MemoryAllocator *memoryAllocator, UploadManager *uploadManager, const MeshData &meshData, VertexLayout layout);
+
+	uint32_t getVertexCount() const { return vertexCount; }
+	uint32_t getIndexCount() const { return indexCount; }
+	VkIndexType getIndexType() const { return indexType; }
+	VkBuffer getVertexBuffer() const { return vertexBuffer; }
+	VkBuffer getIndexBuffer() const { return indexBuffer; }
+	glm::vec4 getBoundingSphere() const { return boundingSphere; }		// Centre (xyz) and radius (w), in model space
+
+	// Binds the vertex streams and index buffer. positionOnly binds just the position stream, for depth-only
+	// pipelines built with getAttributeDescriptions(layout, true).
+	void bind(VkCommandBuffer commandBuffer, bool positionOnly = false) const;
+	void draw(VkCommandBuffer commandBuffer, bool positionOnly = false) const;
+
+	void destroyBuffers();
+
+	// Vertex input description matching the buffers a mesh of the given layout binds
+	static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(VertexLayout layout, bool positionOnly = false);
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(VertexLayout layout, bool positionOnly = false);
+
+	~Mesh();
+
+private:
+	MemoryAllocator *allocator = nullptr;
+	VertexLayout layout = VertexLayout::Interleaved;
+	glm::vec4 boundingSphere = glm::vec4(0.0f);
+
+	uint32_t vertexCount = 0;
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;		// All streams, one after the other
+	Allocation vertexAllocation;
+	std::vector<VkDeviceSize> streamOffsets;		// Offset of each stream in vertexBuffer
+
+	uint32_t indexCount = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	Allocation indexAllocation;
+};
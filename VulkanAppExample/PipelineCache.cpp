@@ -0,0 +1,329 @@
+#include "PipelineCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+#include "Utilities.h"
+#include "CpuProfiler.h"
+
+// 'VKPC' in little endian, bump PIPELINE_CACHE_FILE_VERSION whenever FileHeader changes
+static const uint32_t PIPELINE_CACHE_FILE_MAGIC = 0x43504B56;
+static const uint32_t PIPELINE_CACHE_FILE_VERSION = 1;
+
+PipelineCache::PipelineCache()
+{
+}
+
+void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& filePath, bool creationFeedbackEnabled)
+{
+	PROFILE_FUNCTION();
+
+	device = logicalDevice;
+	path = filePath;
+	feedbackEnabled = creationFeedbackEnabled;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	std::vector<char> initialData = loadValidatedData();
+
+	// Create the cache, seeded with the data from disk if it was usable
+	VkPipelineCacheCreateInfo cacheCreateInfo = {};
+	cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCreateInfo.initialDataSize = initialData.size();
+	cacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+	VkResult result = vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache);
+	if (result != VK_SUCCESS && !initialData.empty())
+	{
+		// Some drivers reject data they cannot use rather than ignoring it, so retry with an empty cache
+		std::cout << "Pipeline cache: driver rejected cached data, starting empty" << std::endl;
+		cacheCreateInfo.initialDataSize = 0;
+		cacheCreateInfo.pInitialData = nullptr;
+		stats.loadedFromDisk = false;
+		coldCreateTimes.clear();
+		result = vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache);
+	}
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a Pipeline Cache!");
+	}
+}
+
+void PipelineCache::save()
+{
+	PROFILE_FUNCTION();
+
+	if (cache == VK_NULL_HANDLE || path.empty())
+	{
+		return;
+	}
+
+	size_t dataSize = 0;
+	vkGetPipelineCacheData(device, cache, &dataSize, nullptr);
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS)
+	{
+		std::cout << "Pipeline cache: failed to read cache data, not saving" << std::endl;
+		return;
+	}
+	data.resize(dataSize);
+
+	FileHeader header = {};
+	header.magic = PIPELINE_CACHE_FILE_MAGIC;
+	header.fileVersion = PIPELINE_CACHE_FILE_VERSION;
+	header.vendorID = deviceProperties.vendorID;
+	header.deviceID = deviceProperties.deviceID;
+	header.driverVersion = deviceProperties.driverVersion;
+	memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.timingCount = static_cast<uint32_t>(coldCreateTimes.size());
+	header.dataSize = data.size();
+	header.dataHash = hashBytes(data.data(), data.size());
+
+	std::vector<PipelineTimingEntry> timings;
+	for (const auto& coldCreateTime : coldCreateTimes)
+	{
+		timings.push_back({ coldCreateTime.first, coldCreateTime.second });
+	}
+
+	// Write next to the real file and rename over it, so a crash mid-write never leaves a torn cache behind
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "Pipeline cache: failed to open " << tempPath << " for writing" << std::endl;
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(timings.data()), timings.size() * sizeof(PipelineTimingEntry));
+		file.write(data.data(), data.size());
+
+		if (!file.good())
+		{
+			std::cout << "Pipeline cache: failed to write " << tempPath << std::endl;
+			file.close();
+			std::remove(tempPath.c_str());
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::cout << "Pipeline cache: failed to replace " << path << ": " << error.message() << std::endl;
+		std::remove(tempPath.c_str());
+	}
+}
+
+void PipelineCache::destroy()
+{
+	if (cache == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	save();
+
+	vkDestroyPipelineCache(device, cache, nullptr);
+	cache = VK_NULL_HANDLE;
+}
+
+VkResult PipelineCache::createGraphicsPipeline(const std::string& name, const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline* pipeline)
+{
+	PROFILE_FUNCTION();
+
+	// Chain creation feedback in front of whatever the caller already has in pNext
+	VkPipelineCreationFeedbackEXT pipelineFeedback = {};
+	std::vector<VkPipelineCreationFeedbackEXT> stageFeedbacks(createInfo.stageCount);
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackCreateInfo = {};
+	feedbackCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+	feedbackCreateInfo.pNext = createInfo.pNext;
+	feedbackCreateInfo.pPipelineCreationFeedback = &pipelineFeedback;
+	feedbackCreateInfo.pipelineStageCreationFeedbackCount = createInfo.stageCount;
+	feedbackCreateInfo.pPipelineStageCreationFeedbacks = stageFeedbacks.data();
+
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = createInfo;
+	if (feedbackEnabled)
+	{
+		pipelineCreateInfo.pNext = &feedbackCreateInfo;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &pipelineCreateInfo, nullptr, pipeline);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	if (result == VK_SUCCESS)
+	{
+		recordCreation(name, elapsed, pipelineFeedback);
+	}
+
+	return result;
+}
+
+VkResult PipelineCache::createComputePipeline(const std::string& name, const VkComputePipelineCreateInfo& createInfo, VkPipeline* pipeline)
+{
+	PROFILE_FUNCTION();
+
+	VkPipelineCreationFeedbackEXT pipelineFeedback = {};
+	VkPipelineCreationFeedbackEXT stageFeedback = {};
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackCreateInfo = {};
+	feedbackCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+	feedbackCreateInfo.pNext = createInfo.pNext;
+	feedbackCreateInfo.pPipelineCreationFeedback = &pipelineFeedback;
+	feedbackCreateInfo.pipelineStageCreationFeedbackCount = 1;
+	feedbackCreateInfo.pPipelineStageCreationFeedbacks = &stageFeedback;
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = createInfo;
+	if (feedbackEnabled)
+	{
+		pipelineCreateInfo.pNext = &feedbackCreateInfo;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	VkResult result = vkCreateComputePipelines(device, cache, 1, &pipelineCreateInfo, nullptr, pipeline);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	if (result == VK_SUCCESS)
+	{
+		recordCreation(name, elapsed, pipelineFeedback);
+	}
+
+	return result;
+}
+
+PipelineCache::~PipelineCache()
+{
+}
+
+std::vector<char> PipelineCache::loadValidatedData()
+{
+	if (path.empty())
+	{
+		return {};
+	}
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		std::cout << "Pipeline cache: no cache file at " << path << ", starting cold" << std::endl;
+		return {};
+	}
+
+	size_t fileSize = static_cast<size_t>(file.tellg());
+	file.seekg(0);
+
+	FileHeader header = {};
+	if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+	{
+		std::cout << "Pipeline cache: " << path << " is truncated, ignoring it" << std::endl;
+		return {};
+	}
+
+	// The blob is only meaningful to the exact device and driver that produced it
+	if (header.magic != PIPELINE_CACHE_FILE_MAGIC || header.fileVersion != PIPELINE_CACHE_FILE_VERSION ||
+		header.vendorID != deviceProperties.vendorID || header.deviceID != deviceProperties.deviceID ||
+		header.driverVersion != deviceProperties.driverVersion ||
+		memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		std::cout << "Pipeline cache: " << path << " was written by a different device or driver, ignoring it" << std::endl;
+		return {};
+	}
+
+	size_t expectedSize = sizeof(header) + header.timingCount * sizeof(PipelineTimingEntry) + header.dataSize;
+	if (fileSize != expectedSize)
+	{
+		std::cout << "Pipeline cache: " << path << " has an unexpected size, ignoring it" << std::endl;
+		return {};
+	}
+
+	std::vector<PipelineTimingEntry> timings(header.timingCount);
+	std::vector<char> data(static_cast<size_t>(header.dataSize));
+	file.read(reinterpret_cast<char*>(timings.data()), timings.size() * sizeof(PipelineTimingEntry));
+	file.read(data.data(), data.size());
+
+	if (!file || hashBytes(data.data(), data.size()) != header.dataHash || !checkCacheHeader(data))
+	{
+		std::cout << "Pipeline cache: " << path << " is corrupt, ignoring it" << std::endl;
+		return {};
+	}
+
+	for (const auto& timing : timings)
+	{
+		coldCreateTimes[timing.nameHash] = timing.coldCreateTimeNs;
+	}
+
+	stats.loadedFromDisk = true;
+	std::cout << "Pipeline cache: loaded " << data.size() << " bytes from " << path << std::endl;
+
+	return data;
+}
+
+bool PipelineCache::checkCacheHeader(const std::vector<char>& data)
+{
+	// The data must start with a VkPipelineCacheHeaderVersionOne that matches this device
+	VkPipelineCacheHeaderVersionOne cacheHeader;
+	if (data.size() < sizeof(cacheHeader))
+	{
+		return false;
+	}
+	memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+
+	return cacheHeader.headerSize >= sizeof(cacheHeader) &&
+		cacheHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		cacheHeader.vendorID == deviceProperties.vendorID &&
+		cacheHeader.deviceID == deviceProperties.deviceID &&
+		memcmp(cacheHeader.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::recordCreation(const std::string& name, std::chrono::steady_clock::duration elapsed, const VkPipelineCreationFeedbackEXT& feedback)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	uint64_t nameHash = hashBytes(name.data(), name.size());
+	uint64_t elapsedNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	auto coldCreateTime = coldCreateTimes.find(nameHash);
+
+	// Prefer what the driver tells us; without VK_EXT_pipeline_creation_feedback assume a hit when a
+	// valid cache from a previous run already contained this pipeline
+	PipelineCacheRecord record;
+	record.name = name;
+	record.createTimeMs = elapsedNs / 1.0e6;
+	if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)
+	{
+		record.cacheHit = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
+	}
+	else
+	{
+		record.cacheHit = stats.loadedFromDisk && coldCreateTime != coldCreateTimes.end();
+	}
+
+	if (record.cacheHit)
+	{
+		stats.hits++;
+		if (coldCreateTime != coldCreateTimes.end() && coldCreateTime->second > elapsedNs)
+		{
+			record.timeSavedMs = (coldCreateTime->second - elapsedNs) / 1.0e6;
+		}
+	}
+	else
+	{
+		// Remember how long a cold build takes so the next run can report what the cache saved
+		stats.misses++;
+		coldCreateTimes[nameHash] = elapsedNs;
+	}
+
+	stats.totalCreateTimeMs += record.createTimeMs;
+	stats.totalTimeSavedMs += record.timeSavedMs;
+	records.push_back(record);
+
+	std::cout << "Pipeline '" << name << "': " << record.createTimeMs << " ms, cache " << (record.cacheHit ? "hit" : "miss");
+	if (record.cacheHit)
+	{
+		std::cout << " (saved " << record.timeSavedMs << " ms)";
+	}
+	std::cout << std::endl;
+}
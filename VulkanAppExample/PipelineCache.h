@@ -0,0 +1,85 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+
+// Result of creating one pipeline through the cache
+struct PipelineCacheRecord {
+	std::string name;				// Name the pipeline was created with
+	double createTimeMs = 0.0;		// Wall time spent in vkCreate*Pipelines
+	bool cacheHit = false;			// Whether the driver could reuse cached compilation results
+	double timeSavedMs = 0.0;		// Cold creation time recorded previously minus createTimeMs (hits only)
+};
+
+// Totals over every pipeline created through the cache
+struct PipelineCacheStats {
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	double totalCreateTimeMs = 0.0;
+	double totalTimeSavedMs = 0.0;
+	bool loadedFromDisk = false;	// A valid cache file for this device/driver was found at startup
+};
+
+// VkPipelineCache that is loaded from disk at startup and written back atomically on destroy.
+// The file is keyed on vendor ID, device ID, driver version and pipelineCacheUUID; a blob written
+// by any other device or driver is dropped instead of being handed to the driver.
+class PipelineCache
+{
+public:
+
+	PipelineCache();
+
+	// filePath may be empty, in which case the cache lives in memory only
+	void create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string &filePath, bool creationFeedbackEnabled);
+	void save();
+	void destroy();
+
+	VkResult createGraphicsPipeline(const std::string &name, const VkGraphicsPipelineCreateInfo &createInfo, VkPipeline *pipeline);
+	VkResult createComputePipeline(const std::string &name, const VkComputePipelineCreateInfo &createInfo, VkPipeline *pipeline);
+
+	VkPipelineCache getCache() const { return cache; }
+	const PipelineCacheStats& getStats() const { return stats; }
+	const std::vector<PipelineCacheRecord>& getRecords() const { return records; }
+
+	~PipelineCache();
+
+private:
+	// On-disk layout: header, timingCount PipelineTimingEntry records, then dataSize bytes of Vulkan cache data
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t fileVersion;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint32_t timingCount;
+		uint64_t dataSize;
+		uint64_t dataHash;				// Hash of the Vulkan cache data, catches truncated or corrupt files
+	};
+
+	struct PipelineTimingEntry {
+		uint64_t nameHash;
+		uint64_t coldCreateTimeNs;		// Time the pipeline took to create on a cache miss
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties deviceProperties = {};
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	bool feedbackEnabled = false;
+
+	PipelineCacheStats stats;
+	std::vector<PipelineCacheRecord> records;
+	std::unordered_map<uint64_t, uint64_t> coldCreateTimes;	// name hash -> cold creation time in ns
+	std::mutex statsMutex;		// VkPipelineCache is internally synchronised, so pipelines may be created from several threads
+
+	// - Support Functions
+	std::vector<char> loadValidatedData();
+	bool checkCacheHeader(const std::vector<char> &data);
+	void recordCreation(const std::string &name, std::chrono::steady_clock::duration elapsed, const VkPipelineCreationFeedbackEXT &feedback);
+};
@@ -0,0 +1,474 @@
+#include "PipelineManager.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+
+#include "Mesh.h"
+#include "CpuProfiler.h"
+
+// -- PIPELINE KEY --
+// Everything except the strings is hashed field by field, so padding never ends up in the hash
+uint64_t PipelineKey::hash() const
+{
+	uint64_t result = hashBytes(vertexShader.data(), vertexShader.size());
+	result = hashBytes(fragmentShader.data(), fragmentShader.size(), result);
+	result = hashBytes(&vertexLayout, sizeof(vertexLayout), result);
+	result = hashBytes(&positionOnly, sizeof(positionOnly), result);
+	result = hashBytes(&topology, sizeof(topology), result);
+	result = hashBytes(&polygonMode, sizeof(polygonMode), result);
+	result = hashBytes(&cullMode, sizeof(cullMode), result);
+	result = hashBytes(&frontFace, sizeof(frontFace), result);
+	result = hashBytes(&samples, sizeof(samples), result);
+	result = hashBytes(&blendMode, sizeof(blendMode), result);
+	result = hashBytes(&depthTest, sizeof(depthTest), result);
+	result = hashBytes(&depthWrite, sizeof(depthWrite), result);
+	result = hashBytes(&depthCompare, sizeof(depthCompare), result);
+	result = hashBytes(&layout, sizeof(layout), result);
+	result = hashBytes(&renderPass, sizeof(renderPass), result);
+	result = hashBytes(&subpass, sizeof(subpass), result);
+	return result;
+}
+
+bool PipelineKey::operator==(const PipelineKey& other) const
+{
+	return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader
+		&& vertexLayout == other.vertexLayout && positionOnly == other.positionOnly && topology == other.topology
+		&& polygonMode == other.polygonMode && cullMode == other.cullMode && frontFace == other.frontFace && samples == other.samples
+		&& blendMode == other.blendMode && depthTest == other.depthTest && depthWrite == other.depthWrite && depthCompare == other.depthCompare
+		&& layout == other.layout && renderPass == other.renderPass && subpass == other.subpass;
+}
+
+// -- PIPELINE MANAGER --
+PipelineManager::PipelineManager()
+{
+}
+
+void PipelineManager::create(VkDevice logicalDevice, PipelineCache* pipelineCache, const ShaderPack* shaderPack, uint32_t compileThreads)
+{
+	device = logicalDevice;
+	cache = pipelineCache;
+	shaders = shaderPack;
+
+	if (compileThreads > 0)
+	{
+		compilePool.start(compileThreads);
+	}
+}
+
+void PipelineManager::destroy()
+{
+	// Queued compiles still write into the entries
+	compilePool.stop();
+
+	std::unique_lock<std::shared_mutex> lock(entriesMutex);
+	for (auto& entry : entries)
+	{
+		vkDestroyPipeline(device, entry.second->pipeline.load(), nullptr);
+	}
+	entries.clear();
+
+	std::lock_guard<std::mutex> baseLock(basePipelinesMutex);
+	basePipelines.clear();
+}
+
+VkPipeline PipelineManager::getPipeline(const PipelineKey& key)
+{
+	requestCount++;
+
+	Entry* entry = findEntry(key);
+	if (entry == nullptr)
+	{
+		entry = findOrAddEntry(key);
+	}
+	return waitForPipeline(key, *entry);
+}
+
+VkPipeline PipelineManager::requestPipeline(const PipelineKey& key, const PipelineKey& fallback)
+{
+	requestCount++;
+
+	// Fast path: only a shared lock, taken by every recording thread at once
+	Entry* entry = findEntry(key);
+	if (entry != nullptr && entry->state.load(std::memory_order_acquire) == PipelineState::Ready)
+	{
+		return entry->pipeline.load(std::memory_order_acquire);
+	}
+
+	if (entry == nullptr)
+	{
+		entry = findOrAddEntry(key);
+	}
+
+	if (!entry->claimed.exchange(true))
+	{
+		if (compilePool.getThreadCount() == 0)
+		{
+			compile(key, *entry);
+			syncCompileCount++;
+			if (entry->state.load(std::memory_order_acquire) == PipelineState::Ready)
+			{
+				return entry->pipeline.load(std::memory_order_acquire);
+			}
+		}
+		else
+		{
+			// The key is copied, the caller's may be gone by the time the job runs
+			compilePool.enqueue([this, key, entry](uint32_t) {
+				compile(key, *entry);
+				asyncCompileCount++;
+			});
+		}
+	}
+
+	fallbackCount++;
+	return getPipeline(fallback);
+}
+
+void PipelineManager::waitIdle()
+{
+	compilePool.waitIdle();
+}
+
+void PipelineManager::destroyPipelines(VkRenderPass renderPass)
+{
+	// A compile against this render pass may still be running
+	compilePool.waitIdle();
+
+	std::unique_lock<std::shared_mutex> lock(entriesMutex);
+	std::lock_guard<std::mutex> baseLock(basePipelinesMutex);
+
+	for (auto entry = entries.begin(); entry != entries.end();)
+	{
+		if (entry->first.renderPass != renderPass)
+		{
+			++entry;
+			continue;
+		}
+
+		VkPipeline pipeline = entry->second->pipeline.load();
+		for (auto base = basePipelines.begin(); base != basePipelines.end();)
+		{
+			base = (base->second == pipeline) ? basePipelines.erase(base) : std::next(base);
+		}
+		vkDestroyPipeline(device, pipeline, nullptr);
+		entry = entries.erase(entry);
+	}
+}
+
+PipelineManagerStats PipelineManager::getStats() const
+{
+	PipelineManagerStats stats;
+	stats.requests = requestCount.load();
+	stats.fallbacksUsed = fallbackCount.load();
+	stats.syncCompiles = syncCompileCount.load();
+	stats.asyncCompiles = asyncCompileCount.load();
+	stats.derivatives = derivativeCount.load();
+	stats.failedCompiles = failedCompileCount.load();
+	stats.shaderModules = shaderModuleCount.load();
+	stats.shaderModuleMs = shaderModuleNanoseconds.load() / 1e6;
+
+	std::shared_lock<std::shared_mutex> lock(entriesMutex);
+	for (const auto& entry : entries)
+	{
+		if (entry.second->state.load() == PipelineState::Ready)
+		{
+			stats.pipelineCount++;
+		}
+	}
+	return stats;
+}
+
+PipelineManager::~PipelineManager()
+{
+}
+
+PipelineManager::Entry* PipelineManager::findEntry(const PipelineKey& key) const
+{
+	std::shared_lock<std::shared_mutex> lock(entriesMutex);
+
+	auto entry = entries.find(key);
+	return entry != entries.end() ? entry->second.get() : nullptr;
+}
+
+PipelineManager::Entry* PipelineManager::findOrAddEntry(const PipelineKey& key)
+{
+	std::unique_lock<std::shared_mutex> lock(entriesMutex);
+
+	// Another thread may have added it between the shared and the exclusive lock
+	std::unique_ptr<Entry>& entry = entries[key];
+	if (!entry)
+	{
+		entry = std::make_unique<Entry>();
+	}
+	return entry.get();
+}
+
+VkPipeline PipelineManager::waitForPipeline(const PipelineKey& key, Entry& entry)
+{
+	if (entry.state.load(std::memory_order_acquire) == PipelineState::Pending)
+	{
+		if (!entry.claimed.exchange(true))
+		{
+			compile(key, entry);
+			syncCompileCount++;
+		}
+		else
+		{
+			// Already being compiled, by a background thread or another caller
+			std::unique_lock<std::mutex> lock(compiledMutex);
+			entryCompiled.wait(lock, [&entry]() { return entry.state.load() != PipelineState::Pending; });
+		}
+	}
+
+	if (entry.state.load(std::memory_order_acquire) == PipelineState::Failed)
+	{
+		throw std::runtime_error("ERROR: Failed to create the " + key.vertexShader + " / " + key.fragmentShader + " graphics pipeline!");
+	}
+	return entry.pipeline.load(std::memory_order_acquire);
+}
+
+void PipelineManager::compile(const PipelineKey& key, Entry& entry)
+{
+	PROFILE_FUNCTION();
+
+	uint64_t family = familyHash(key);
+	VkPipeline basePipeline = VK_NULL_HANDLE;
+	{
+		std::lock_guard<std::mutex> lock(basePipelinesMutex);
+		auto base = basePipelines.find(family);
+		if (base != basePipelines.end())
+		{
+			basePipeline = base->second;
+		}
+	}
+
+	PipelineState state = PipelineState::Ready;
+	try
+	{
+		VkPipeline pipeline = buildPipeline(key, basePipeline);
+		entry.pipeline.store(pipeline, std::memory_order_release);
+
+		if (basePipeline == VK_NULL_HANDLE)
+		{
+			// Two compiles of the same family can race here, the first one to finish becomes the base
+			std::lock_guard<std::mutex> lock(basePipelinesMutex);
+			basePipelines.emplace(family, pipeline);
+		}
+		else
+		{
+			derivativeCount++;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		// Runs on the compile threads, so report it here; getPipeline rethrows for its caller
+		std::cerr << e.what() << std::endl;
+		failedCompileCount++;
+		state = PipelineState::Failed;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(compiledMutex);
+		entry.state.store(state, std::memory_order_release);
+	}
+	entryCompiled.notify_all();
+}
+
+VkPipeline PipelineManager::buildPipeline(const PipelineKey& key, VkPipeline basePipeline)
+{
+	// Build shader modules to link to graphics pipeline. The SPIR-V is read straight out of the mapped pack.
+	VkShaderModule vertexShaderModule = createShaderModule(key.vertexShader);
+	VkShaderModule fragmentShaderModule = VK_NULL_HANDLE;
+	try
+	{
+		fragmentShaderModule = createShaderModule(key.fragmentShader);
+	}
+	catch (...)
+	{
+		// The vertex module is only destroyed further down, which a throw here would skip
+		vkDestroyShaderModule(device, vertexShaderModule, nullptr);
+		throw;
+	}
+
+	// -- SHADER STAGE CREATION INFORMATION --
+	// Vertex stage creation information
+	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
+	vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertexShaderCreateInfo.module = vertexShaderModule;
+	vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertexShaderCreateInfo.pName = "main"; // entry point of the shader.
+
+	// Fragment stage creation information
+	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo = {};
+	fragmentShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fragmentShaderCreateInfo.module = fragmentShaderModule;
+	fragmentShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fragmentShaderCreateInfo.pName = "main"; // entry point of the shader.
+
+	VkPipelineShaderStageCreateInfo shaderStages[] =
+	{
+		vertexShaderCreateInfo,
+		fragmentShaderCreateInfo
+	};
+
+	// -- VERTEX INPUT --
+	// Must match the streams the meshes bind, which depends on the vertex layout
+	std::vector<VkVertexInputBindingDescription> bindingDescriptions = Mesh::getBindingDescriptions(key.vertexLayout, key.positionOnly);
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = Mesh::getAttributeDescriptions(key.vertexLayout, key.positionOnly);
+
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+	vertexInputCreateInfo.pVertexBindingDescriptions = bindingDescriptions.data();			// List of Vertex Binding Descriptions (data spacing/stride information)
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();		// List of Vertex Attribute Descriptions (data format and where to bind to/from)
+
+	// -- INPUT ASSEMBLY --
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = key.topology;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	// -- VIEWPORT & SCISSOR --
+	// Both are dynamic, so only the count is given here and pipelines never depend on the swap chain
+	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
+	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateCreateInfo.viewportCount = 1;
+	viewportStateCreateInfo.pViewports = nullptr;		// Set with vkCmdSetViewport when recording
+	viewportStateCreateInfo.scissorCount = 1;
+	viewportStateCreateInfo.pScissors = nullptr;		// Set with vkCmdSetScissor when recording
+
+	// -- DYNAMIC STATES --
+	VkDynamicState dynamicStateEnables[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateCreateInfo.dynamicStateCount = 2;
+	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables;
+
+	// -- RASTERIZER --
+	// Convert triangles into fragments
+	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
+	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerCreateInfo.depthClampEnable = VK_FALSE;
+	rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+	rasterizerCreateInfo.polygonMode = key.polygonMode;
+	rasterizerCreateInfo.lineWidth = 1.0f;
+	rasterizerCreateInfo.cullMode = key.cullMode;
+	rasterizerCreateInfo.frontFace = key.frontFace;
+	rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
+
+	// -- MULTISAMPLING --
+	VkPipelineMultisampleStateCreateInfo multiSamplingCreateInfo = {};
+	multiSamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multiSamplingCreateInfo.sampleShadingEnable = VK_FALSE;
+	multiSamplingCreateInfo.rasterizationSamples = key.samples;
+
+	// -- BLENDING --
+	// Blending uses the following equation (srcColourBlendFactor * newColour) colourBlendOp (dstColourBlendFactor * oldColour)
+	VkPipelineColorBlendAttachmentState colourState = {};
+	colourState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colourState.blendEnable = key.blendMode != BlendMode::Opaque ? VK_TRUE : VK_FALSE;
+	colourState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	colourState.dstColorBlendFactor = key.blendMode == BlendMode::Additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colourState.colorBlendOp = VK_BLEND_OP_ADD;
+	colourState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colourState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colourState.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo colourBlendingCreateInfo = {};
+	colourBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colourBlendingCreateInfo.logicOpEnable = VK_FALSE;
+	colourBlendingCreateInfo.attachmentCount = 1;
+	colourBlendingCreateInfo.pAttachments = &colourState;
+
+	// -- DEPTH STENCIL TESTING --
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = {};
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = key.depthTest ? VK_TRUE : VK_FALSE;
+	depthStencilCreateInfo.depthWriteEnable = key.depthWrite ? VK_TRUE : VK_FALSE;
+	depthStencilCreateInfo.depthCompareOp = key.depthCompare;
+	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+
+	// -- Graphics pipeline creation --
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stageCount = 2;
+	pipelineCreateInfo.pStages = shaderStages;
+	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+	pipelineCreateInfo.pMultisampleState = &multiSamplingCreateInfo;
+	pipelineCreateInfo.pColorBlendState = &colourBlendingCreateInfo;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+	pipelineCreateInfo.layout = key.layout;
+	pipelineCreateInfo.renderPass = key.renderPass;
+	pipelineCreateInfo.subpass = key.subpass;
+
+	// Pipeline derivatives: every pipeline may become a base, variants of it name it as their parent
+	pipelineCreateInfo.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+	if (basePipeline != VK_NULL_HANDLE)
+	{
+		pipelineCreateInfo.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+	}
+	pipelineCreateInfo.basePipelineHandle = basePipeline;
+	pipelineCreateInfo.basePipelineIndex = -1;
+
+	// Handles differ between runs, so they're left out of the name the cache keeps creation times under
+	PipelineKey nameKey = key;
+	nameKey.layout = VK_NULL_HANDLE;
+	nameKey.renderPass = VK_NULL_HANDLE;
+	std::string name = key.vertexShader + "+" + key.fragmentShader + "#" + std::to_string(nameKey.hash());
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult result = cache->createGraphicsPipeline(name, pipelineCreateInfo, &pipeline);
+
+	// Destroy shader module no longer needed after pipeline created
+	vkDestroyShaderModule(device, vertexShaderModule, nullptr);
+	vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create the " + key.vertexShader + " / " + key.fragmentShader + " graphics pipeline!");
+	}
+	return pipeline;
+}
+
+VkShaderModule PipelineManager::createShaderModule(const std::string& name)
+{
+	auto start = std::chrono::steady_clock::now();
+	ShaderCode code = shaders->get(name);
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = code.size;
+	shaderModuleCreateInfo.pCode = code.code;		// Already 4 byte aligned inside the pack
+
+	VkShaderModule shaderModule;
+	VkResult res = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (res != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a shader module!");
+	}
+
+	shaderModuleCount++;
+	shaderModuleNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	return shaderModule;
+}
+
+uint64_t PipelineManager::familyHash(const PipelineKey& key)
+{
+	// Derivatives only pay off between pipelines sharing shaders, so state that would change those splits families
+	uint64_t result = hashBytes(key.vertexShader.data(), key.vertexShader.size());
+	result = hashBytes(key.fragmentShader.data(), key.fragmentShader.size(), result);
+	result = hashBytes(&key.vertexLayout, sizeof(key.vertexLayout), result);
+	result = hashBytes(&key.positionOnly, sizeof(key.positionOnly), result);
+	result = hashBytes(&key.layout, sizeof(key.layout), result);
+	result = hashBytes(&key.renderPass, sizeof(key.renderPass), result);
+	result = hashBytes(&key.subpass, sizeof(key.subpass), result);
+	return result;
+}
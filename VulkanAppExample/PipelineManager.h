@@ -0,0 +1,152 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "Utilities.h"
+#include "ThreadPool.h"
+#include "PipelineCache.h"
+#include "ShaderPack.h"
+
+enum class BlendMode {
+	Opaque,				// Overwrite
+	AlphaBlend,			// src * a + dst * (1 - a)
+	Additive			// src * a + dst
+};
+
+// Everything a graphics pipeline is built from. Two equal keys always give the same pipeline, so a key is
+// all that is needed to find one. State not in here (dynamic viewport/scissor, colour write mask) is the
+// same for every pipeline.
+struct PipelineKey {
+	// -- SHADERS & INPUT --
+	std::string vertexShader = "shader.vert";		// Names inside the shader pack
+	std::string fragmentShader = "shader.frag";
+	VertexLayout vertexLayout = VertexLayout::Interleaved;
+	bool positionOnly = false;						// Only bind the position stream (depth-only passes)
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	// -- RASTERIZER --
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// -- BLENDING & DEPTH --
+	BlendMode blendMode = BlendMode::AlphaBlend;
+	bool depthTest = false;							// Ignored by render passes without a depth attachment
+	bool depthWrite = false;
+	VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
+
+	// -- COMPATIBILITY --
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+
+	uint64_t hash() const;
+	bool operator==(const PipelineKey &other) const;
+};
+
+struct PipelineKeyHash {
+	size_t operator()(const PipelineKey &key) const { return static_cast<size_t>(key.hash()); }
+};
+
+struct PipelineManagerStats {
+	uint64_t requests = 0;				// getPipeline and requestPipeline calls
+	uint64_t fallbacksUsed = 0;			// requestPipeline calls answered with the fallback
+	uint32_t syncCompiles = 0;			// Pipelines built on the calling thread
+	uint32_t asyncCompiles = 0;			// Pipelines built in the background
+	uint32_t derivatives = 0;			// Pipelines created as derivatives of an earlier one
+	uint32_t failedCompiles = 0;
+	uint32_t pipelineCount = 0;			// Pipelines currently alive
+	uint32_t shaderModules = 0;			// Shader modules created for the builds above
+	double shaderModuleMs = 0.0;		// vkCreateShaderModule time for them, summed over all threads
+};
+
+// Owns every graphics pipeline, one per PipelineKey. Lookups of built pipelines only take a shared lock, so
+// recording threads can resolve keys at the same time. A key that isn't built yet is compiled on the manager's
+// own threads (never the recording pool, so a slow compile can't stall a frame) while the caller draws with a
+// fallback. Pipelines that only differ in fixed function state from an earlier one are created as its derivatives.
+class PipelineManager
+{
+public:
+
+	PipelineManager();
+
+	// compileThreads = 0 compiles everything on the calling thread
+	void create(VkDevice logicalDevice, PipelineCache *pipelineCache, const ShaderPack *shaderPack, uint32_t compileThreads);
+	void destroy();					// Waits for pending compiles
+
+	// Returns the pipeline for key, compiling it on this thread first if needed. Throws if it can't be built.
+	VkPipeline getPipeline(const PipelineKey &key);
+
+	// Never waits on a compile: returns the pipeline if it is ready, otherwise queues it (once) and returns
+	// getPipeline(fallback). The fallback should be built up front, or the first call compiles it here.
+	VkPipeline requestPipeline(const PipelineKey &key, const PipelineKey &fallback);
+
+	// Waits for queued compiles to finish
+	void waitIdle();
+
+	// Destroys every pipeline built against renderPass, before the render pass itself is destroyed.
+	// The pipelines must not be in use by the GPU.
+	void destroyPipelines(VkRenderPass renderPass);
+
+	PipelineManagerStats getStats() const;
+
+	~PipelineManager();
+
+private:
+	enum class PipelineState {
+		Pending,
+		Ready,
+		Failed			// Not retried; requestPipeline keeps answering with the fallback
+	};
+
+	struct Entry {
+		std::atomic<VkPipeline> pipeline{ VK_NULL_HANDLE };
+		std::atomic<PipelineState> state{ PipelineState::Pending };
+		std::atomic<bool> claimed{ false };		// Set by whichever thread compiles it, so it is only compiled once
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	PipelineCache *cache = nullptr;
+	const ShaderPack *shaders = nullptr;
+	ThreadPool compilePool;
+
+	// Entries are never moved, so a pointer to one stays valid while the lock is released to compile
+	mutable std::shared_mutex entriesMutex;
+	std::unordered_map<PipelineKey, std::unique_ptr<Entry>, PipelineKeyHash> entries;
+
+	// First pipeline built for each set of shaders, input and render pass; later ones derive from it
+	std::mutex basePipelinesMutex;
+	std::unordered_map<uint64_t, VkPipeline> basePipelines;
+
+	// Signalled whenever an entry stops being pending
+	std::mutex compiledMutex;
+	std::condition_variable entryCompiled;
+
+	std::atomic<uint64_t> requestCount{ 0 };
+	std::atomic<uint64_t> fallbackCount{ 0 };
+	std::atomic<uint32_t> syncCompileCount{ 0 };
+	std::atomic<uint32_t> asyncCompileCount{ 0 };
+	std::atomic<uint32_t> derivativeCount{ 0 };
+	std::atomic<uint32_t> failedCompileCount{ 0 };
+	std::atomic<uint32_t> shaderModuleCount{ 0 };
+	std::atomic<uint64_t> shaderModuleNanoseconds{ 0 };
+
+	// - Support Functions
+	Entry *findEntry(const PipelineKey &key) const;
+	Entry *findOrAddEntry(const PipelineKey &key);
+	VkPipeline waitForPipeline(const PipelineKey &key, Entry &entry);
+	void compile(const PipelineKey &key, Entry &entry);
+	VkPipeline buildPipeline(const PipelineKey &key, VkPipeline basePipeline);
+	VkShaderModule createShaderModule(const std::string &name);
+	static uint64_t familyHash(const PipelineKey &key);
+};
@@ -0,0 +1,343 @@
+#include "PngEncoder.h"
+
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+
+// -- DEFLATE TABLES --
+// Match lengths 3-258 and distances 1-32768 are sent as a symbol plus extra bits, RFC 1951 section 3.2.5
+static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+	4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static const uint32_t WINDOW_SIZE = 32768;
+static const uint32_t MIN_MATCH = 3;
+static const uint32_t MAX_MATCH = 258;
+static const uint32_t HASH_BITS = 15;
+static const uint32_t MAX_CHAIN = 64;			// Candidates looked at per position, beyond this matches barely get longer
+static const uint32_t NICE_MATCH = 128;			// Long enough to stop looking for a longer one
+
+static const uint32_t BYTES_PER_PIXEL = 4;
+
+std::vector<uint8_t> PngEncoder::encode(uint32_t width, uint32_t height, const uint8_t* rgba)
+{
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	// -- HEADER --
+	std::vector<uint8_t> header(13);
+	for (int i = 0; i < 4; i++)
+	{
+		header[i] = static_cast<uint8_t>(width >> (24 - 8 * i));
+		header[4 + i] = static_cast<uint8_t>(height >> (24 - 8 * i));
+	}
+	header[8] = 8;		// Bit depth
+	header[9] = 6;		// Colour type: RGBA
+	header[10] = 0;		// Compression: deflate
+	header[11] = 0;		// Filter method: adaptive
+	header[12] = 0;		// Not interlaced
+	writeChunk(png, "IHDR", header);
+
+	// -- PIXELS --
+	std::vector<uint8_t> compressed;
+	deflate(filterRows(width, height, rgba), compressed);
+	writeChunk(png, "IDAT", compressed);
+
+	writeChunk(png, "IEND", {});
+	return png;
+}
+
+void PngEncoder::BitWriter::write(uint32_t bits, uint32_t count)
+{
+	bitBuffer |= bits << bitCount;
+	bitCount += count;
+	while (bitCount >= 8)
+	{
+		bytes.push_back(static_cast<uint8_t>(bitBuffer));
+		bitBuffer >>= 8;
+		bitCount -= 8;
+	}
+}
+
+void PngEncoder::BitWriter::writeHuffman(uint32_t code, uint32_t length)
+{
+	uint32_t reversed = 0;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	write(reversed, length);
+}
+
+void PngEncoder::BitWriter::flush()
+{
+	if (bitCount > 0)
+	{
+		bytes.push_back(static_cast<uint8_t>(bitBuffer));
+	}
+	bitBuffer = 0;
+	bitCount = 0;
+}
+
+std::vector<uint8_t> PngEncoder::filterRows(uint32_t width, uint32_t height, const uint8_t* rgba)
+{
+	// Every row starts with its filter type. Filters predict each byte from the pixel to the left (a), above (b) and
+	// above left (c); what gets compressed is the difference.
+	size_t rowBytes = static_cast<size_t>(width) * BYTES_PER_PIXEL;
+	std::vector<uint8_t> filtered((rowBytes + 1) * height);
+	std::vector<uint8_t> zeroRow(rowBytes, 0);
+	std::array<std::vector<uint8_t>, 5> candidates;
+	for (auto& candidate : candidates)
+	{
+		candidate.resize(rowBytes);
+	}
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		const uint8_t* row = rgba + rowBytes * y;
+		const uint8_t* above = y > 0 ? row - rowBytes : zeroRow.data();
+
+		uint64_t bestCost = UINT64_MAX;
+		uint32_t bestFilter = 0;
+		for (uint32_t filter = 0; filter < candidates.size(); filter++)
+		{
+			uint8_t* out = candidates[filter].data();
+			uint64_t cost = 0;
+			for (size_t i = 0; i < rowBytes; i++)
+			{
+				int a = i >= BYTES_PER_PIXEL ? row[i - BYTES_PER_PIXEL] : 0;
+				int b = above[i];
+				int c = i >= BYTES_PER_PIXEL ? above[i - BYTES_PER_PIXEL] : 0;
+
+				int prediction = 0;
+				switch (filter)
+				{
+				case 1: prediction = a; break;							// Sub
+				case 2: prediction = b; break;							// Up
+				case 3: prediction = (a + b) / 2; break;				// Average
+				case 4:													// Paeth
+				{
+					int p = a + b - c;
+					int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+					prediction = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+					break;
+				}
+				default: break;											// None
+				}
+
+				out[i] = static_cast<uint8_t>(row[i] - prediction);
+				cost += std::abs(static_cast<int8_t>(out[i]));
+			}
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestFilter = filter;
+			}
+		}
+
+		uint8_t* target = filtered.data() + (rowBytes + 1) * y;
+		target[0] = static_cast<uint8_t>(bestFilter);
+		std::copy(candidates[bestFilter].begin(), candidates[bestFilter].end(), target + 1);
+	}
+
+	return filtered;
+}
+
+void PngEncoder::deflate(const std::vector<uint8_t>& data, std::vector<uint8_t>& output)
+{
+	// -- ZLIB HEADER --
+	// 32 KiB window, deflate, fastest compression level (only informative); the pair is a multiple of 31 as required
+	output.push_back(0x78);
+	output.push_back(0x01);
+
+	BitWriter writer(output);
+	writer.write(1, 1);		// Last block
+	writer.write(1, 2);		// Fixed Huffman codes
+
+	// -- LZ77 --
+	// Positions hashed by their first three bytes; each hash chains back through earlier positions with the same hash
+	std::vector<int32_t> head(1u << HASH_BITS, -1);
+	std::vector<int32_t> previous(WINDOW_SIZE, -1);
+	uint32_t size = static_cast<uint32_t>(data.size());
+
+	auto hashAt = [&](uint32_t position) {
+		uint32_t bytes = (data[position] << 16) | (data[position + 1] << 8) | data[position + 2];
+		return (bytes * 2654435761u) >> (32 - HASH_BITS);
+	};
+	auto insert = [&](uint32_t position) {
+		if (position + MIN_MATCH <= size)
+		{
+			uint32_t hash = hashAt(position);
+			previous[position % WINDOW_SIZE] = head[hash];
+			head[hash] = static_cast<int32_t>(position);
+		}
+	};
+
+	uint32_t position = 0;
+	while (position < size)
+	{
+		uint32_t bestLength = 0;
+		uint32_t bestDistance = 0;
+		if (position + MIN_MATCH <= size)
+		{
+			uint32_t maxLength = std::min(MAX_MATCH, size - position);
+			int32_t candidate = head[hashAt(position)];
+			for (uint32_t chain = 0; chain < MAX_CHAIN && candidate >= 0 && position - candidate <= WINDOW_SIZE; chain++)
+			{
+				uint32_t length = 0;
+				while (length < maxLength && data[candidate + length] == data[position + length])
+				{
+					length++;
+				}
+				if (length > bestLength)
+				{
+					bestLength = length;
+					bestDistance = position - candidate;
+					if (length >= NICE_MATCH)
+					{
+						break;
+					}
+				}
+
+				// Older entries are overwritten as the window moves on, a chain that doesn't go back in time has ended
+				int32_t next = previous[candidate % WINDOW_SIZE];
+				if (next >= candidate)
+				{
+					break;
+				}
+				candidate = next;
+			}
+		}
+
+		if (bestLength >= MIN_MATCH)
+		{
+			writeMatch(writer, bestLength, bestDistance);
+			for (uint32_t i = 0; i < bestLength; i++)
+			{
+				insert(position + i);
+			}
+			position += bestLength;
+		}
+		else
+		{
+			writeLiteral(writer, data[position]);
+			insert(position);
+			position++;
+		}
+	}
+
+	writeLiteral(writer, 256);		// End of block
+	writer.flush();
+
+	// -- ZLIB TRAILER --
+	uint32_t checksum = adler32(data);
+	for (int i = 0; i < 4; i++)
+	{
+		output.push_back(static_cast<uint8_t>(checksum >> (24 - 8 * i)));
+	}
+}
+
+void PngEncoder::writeLiteral(BitWriter& writer, uint32_t symbol)
+{
+	// The fixed literal/length code, RFC 1951 section 3.2.6
+	if (symbol < 144)
+	{
+		writer.writeHuffman(0x30 + symbol, 8);
+	}
+	else if (symbol < 256)
+	{
+		writer.writeHuffman(0x190 + symbol - 144, 9);
+	}
+	else if (symbol < 280)
+	{
+		writer.writeHuffman(symbol - 256, 7);
+	}
+	else
+	{
+		writer.writeHuffman(0xC0 + symbol - 280, 8);
+	}
+}
+
+void PngEncoder::writeMatch(BitWriter& writer, uint32_t length, uint32_t distance)
+{
+	uint32_t lengthCode = 28;
+	while (LENGTH_BASE[lengthCode] > length)
+	{
+		lengthCode--;
+	}
+	writeLiteral(writer, 257 + lengthCode);
+	writer.write(length - LENGTH_BASE[lengthCode], LENGTH_EXTRA[lengthCode]);
+
+	// Distance codes are all 5 bits in the fixed code
+	uint32_t distanceCode = 29;
+	while (DISTANCE_BASE[distanceCode] > distance)
+	{
+		distanceCode--;
+	}
+	writer.writeHuffman(distanceCode, 5);
+	writer.write(distance - DISTANCE_BASE[distanceCode], DISTANCE_EXTRA[distanceCode]);
+}
+
+void PngEncoder::writeChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data)
+{
+	uint32_t length = static_cast<uint32_t>(data.size());
+	for (int i = 0; i < 4; i++)
+	{
+		png.push_back(static_cast<uint8_t>(length >> (24 - 8 * i)));
+	}
+
+	// The CRC covers the type and the data, not the length
+	size_t typeStart = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data.begin(), data.end());
+	uint32_t crc = crc32(png.data() + typeStart, png.size() - typeStart);
+	for (int i = 0; i < 4; i++)
+	{
+		png.push_back(static_cast<uint8_t>(crc >> (24 - 8 * i)));
+	}
+}
+
+uint32_t PngEncoder::crc32(const uint8_t* data, size_t size, uint32_t crc)
+{
+	static const std::array<uint32_t, 256> table = []() {
+		std::array<uint32_t, 256> entries;
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+			{
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			entries[n] = c;
+		}
+		return entries;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+uint32_t PngEncoder::adler32(const std::vector<uint8_t>& data)
+{
+	// Sums are reduced every 5552 bytes, the most that can't overflow 32 bits
+	uint32_t a = 1, b = 0;
+	size_t position = 0;
+	while (position < data.size())
+	{
+		size_t end = std::min(data.size(), position + 5552);
+		for (; position < end; position++)
+		{
+			a += data[position];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
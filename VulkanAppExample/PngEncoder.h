@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Encodes 8 bit RGBA images as PNG, without an image library or zlib. Rows are filtered with whichever PNG filter
+// makes them smallest (by the usual sum of absolute differences), then compressed with greedy LZ77 over a 32 KiB
+// window and deflate's fixed Huffman codes. Files come out larger than zlib's default level, which also builds
+// dynamic Huffman tables and matches lazily, but any PNG reader takes them and encoding stays cheap.
+//
+// Stateless and thread safe: frames can be encoded on as many threads as there are frames.
+class PngEncoder
+{
+public:
+	// rgba is width * height * 4 bytes, rows top to bottom, without padding
+	static std::vector<uint8_t> encode(uint32_t width, uint32_t height, const uint8_t *rgba);
+
+private:
+	// Writes bits least significant first, as deflate wants them
+	struct BitWriter {
+		std::vector<uint8_t> &bytes;
+		uint32_t bitBuffer = 0;
+		uint32_t bitCount = 0;
+
+		explicit BitWriter(std::vector<uint8_t> &output) : bytes(output) {}
+		void write(uint32_t bits, uint32_t count);
+		void writeHuffman(uint32_t code, uint32_t length);		// Huffman codes go most significant bit first
+		void flush();
+	};
+
+	static std::vector<uint8_t> filterRows(uint32_t width, uint32_t height, const uint8_t *rgba);
+	static void deflate(const std::vector<uint8_t> &data, std::vector<uint8_t> &output);
+	static void writeLiteral(BitWriter &writer, uint32_t symbol);
+	static void writeMatch(BitWriter &writer, uint32_t length, uint32_t distance);
+	static void writeChunk(std::vector<uint8_t> &png, const char *type, const std::vector<uint8_t> &data);
+	static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+	static uint32_t adler32(const std::vector<uint8_t> &data);
+};
@@ -0,0 +1,1139 @@
+#include "RenderGraph.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "CpuProfiler.h"
+
+// Accesses that make memory unavailable until a dependency makes them available again
+static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+// Blending and load ops read colour attachments, depth tests read depth ones
+static const VkAccessFlags COLOUR_ACCESS = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+static const VkAccessFlags DEPTH_ACCESS = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+static const VkPipelineStageFlags DEPTH_STAGES = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+// Whether an access before the graph (or an imported resource's final state) orders anything at all
+static bool isTrivialAccess(VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	return access == 0 && (stages == 0 || stages == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT || stages == VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+RenderGraph::RenderGraph()
+{
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples, const RenderGraphAccess& initial,
+	const RenderGraphAccess& final)
+{
+	ResourceInfo resource;
+	resource.name = name;
+	resource.imported = true;
+	resource.format = format;
+	resource.samples = samples;
+	resource.initial = initial;
+	resource.final = final;
+	return addResource(resource);
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, const RenderGraphAccess& initial, const RenderGraphAccess& final)
+{
+	ResourceInfo resource;
+	resource.name = name;
+	resource.isImage = false;
+	resource.imported = true;
+	resource.initial = initial;
+	resource.final = final;
+	return addResource(resource);
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples)
+{
+	ResourceInfo resource;
+	resource.name = name;
+	resource.format = format;
+	resource.samples = samples;
+	return addResource(resource);
+}
+
+uint32_t RenderGraph::addGraphicsPass(const std::string& name, VkSubpassContents contents, RenderGraphRecordFunction record)
+{
+	PassInfo pass;
+	pass.name = name;
+	pass.contents = contents;
+	pass.record = record;
+	passes.push_back(pass);
+	return static_cast<uint32_t>(passes.size() - 1);
+}
+
+uint32_t RenderGraph::addComputePass(const std::string& name, RenderGraphRecordFunction record)
+{
+	PassInfo pass;
+	pass.name = name;
+	pass.compute = true;
+	pass.record = record;
+	passes.push_back(pass);
+	return static_cast<uint32_t>(passes.size() - 1);
+}
+
+void RenderGraph::addColourOutput(uint32_t pass, Resource image, const VkClearColorValue* clear)
+{
+	ResourceUse use = { image, UseType::Colour, true, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, COLOUR_ACCESS };
+	if (clear != nullptr)
+	{
+		use.clear = true;
+		use.clearValue.color = *clear;
+	}
+	addUse(pass, use);
+}
+
+void RenderGraph::addDepthOutput(uint32_t pass, Resource image, const VkClearDepthStencilValue* clear)
+{
+	ResourceUse use = { image, UseType::Depth, true, DEPTH_STAGES, DEPTH_ACCESS };
+	if (clear != nullptr)
+	{
+		use.clear = true;
+		use.clearValue.depthStencil = *clear;
+	}
+	addUse(pass, use);
+}
+
+void RenderGraph::addInputAttachment(uint32_t pass, Resource image)
+{
+	addUse(pass, { image, UseType::Input, false, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT });
+}
+
+void RenderGraph::addResolveOutput(uint32_t pass, Resource image, Resource source)
+{
+	ResourceUse use = { image, UseType::Resolve, true, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT };
+	use.source = source;
+	addUse(pass, use);
+}
+
+void RenderGraph::addTextureInput(uint32_t pass, Resource image, VkPipelineStageFlags stages)
+{
+	addUse(pass, { image, UseType::Texture, false, stages, VK_ACCESS_SHADER_READ_BIT });
+}
+
+void RenderGraph::addBufferInput(uint32_t pass, Resource buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	addUse(pass, { buffer, UseType::Buffer, false, stages, access });
+}
+
+void RenderGraph::addBufferOutput(uint32_t pass, Resource buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	addUse(pass, { buffer, UseType::Buffer, true, stages, access });
+}
+
+void RenderGraph::markOutput(Resource resource)
+{
+	resources[resource].output = true;
+}
+
+void RenderGraph::compile(VkDevice logicalDevice, MemoryAllocator* memoryAllocator)
+{
+	PROFILE_FUNCTION();
+
+	device = logicalDevice;
+	allocator = memoryAllocator;
+
+	cullPasses();
+	buildSteps();
+
+	// -- STATE BEFORE THE GRAPH --
+	// Transient images share memory with each other and every execution reuses them, so what used an image's memory
+	// last may be any transient's last use, in this execution or the one before: first uses wait for all of them
+	AccessRecord transientLastUses;
+	for (Resource r = 0; r < resources.size(); r++)
+	{
+		if (resources[r].imported || resources[r].firstStep == INVALID_INDEX)
+		{
+			continue;
+		}
+		for (const PassInfo& pass : passes)
+		{
+			if (pass.culled || pass.step != resources[r].lastStep)
+			{
+				continue;
+			}
+			for (const ResourceUse& use : pass.uses)
+			{
+				if (use.resource == r)
+				{
+					transientLastUses.stages |= use.stages;
+					transientLastUses.access |= use.access & WRITE_ACCESS;
+				}
+			}
+		}
+	}
+
+	std::vector<AccessState> states(resources.size());
+	for (Resource r = 0; r < resources.size(); r++)
+	{
+		AccessState& state = states[r];
+		state.written = true;
+		if (resources[r].imported)
+		{
+			state.write.stages = resources[r].initial.stages;
+			state.write.access = resources[r].initial.access & WRITE_ACCESS;
+			state.layout = resources[r].initial.layout;
+		}
+		else
+		{
+			state.write = transientLastUses;
+		}
+	}
+
+	// -- STEPS --
+	for (uint32_t s = 0; s < steps.size(); s++)
+	{
+		if (steps[s].compute)
+		{
+			buildComputeBarrier(s, states);
+		}
+		else
+		{
+			buildRenderPass(s, states);
+		}
+	}
+
+	// -- STATE AFTER THE GRAPH --
+	// Render passes hand imported resources over with an outgoing dependency, this covers those a compute pass used last
+	for (Resource r = 0; r < resources.size(); r++)
+	{
+		const ResourceInfo& resource = resources[r];
+		if (!resource.imported || resource.firstStep == INVALID_INDEX || !steps[resource.lastStep].compute ||
+			isTrivialAccess(resource.final.stages, resource.final.access))
+		{
+			continue;
+		}
+		const AccessState& state = states[r];
+		if (state.written)
+		{
+			finalBarrier.srcStages |= state.write.stages;
+			finalBarrier.srcAccess |= state.write.access;
+		}
+		for (const AccessRecord& read : state.reads)
+		{
+			finalBarrier.srcStages |= read.stages;
+		}
+		finalBarrier.dstStages |= resource.final.stages;
+		finalBarrier.dstAccess |= resource.final.access;
+	}
+
+	// -- STATISTICS --
+	stats = RenderGraphStats();
+	stats.passCount = static_cast<uint32_t>(passes.size());
+	for (const PassInfo& pass : passes)
+	{
+		stats.culledPassCount += pass.culled ? 1 : 0;
+		stats.subpassCount += !pass.culled && !pass.compute ? 1 : 0;
+	}
+	for (const Step& step : steps)
+	{
+		stats.renderPassCount += step.compute ? 0 : 1;
+		stats.barrierCount += step.dependencyCount + (step.barrier.isNeeded() ? 1 : 0);
+	}
+	stats.barrierCount += finalBarrier.isNeeded() ? 1 : 0;
+}
+
+void RenderGraph::allocate(VkExtent2D newExtent)
+{
+	PROFILE_FUNCTION();
+
+	releaseTargets();
+	extent = newExtent;
+
+	// -- TRANSIENT IMAGES --
+	struct Placement {
+		Resource resource;
+		VkMemoryRequirements requirements;
+	};
+	std::vector<Placement> placements;
+	for (Resource r = 0; r < resources.size(); r++)
+	{
+		ResourceInfo& resource = resources[r];
+		if (resource.imported || !resource.isImage || resource.firstStep == INVALID_INDEX)
+		{
+			continue;
+		}
+
+		VkImageCreateInfo imageCreateInfo = {};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = resource.format;
+		imageCreateInfo.extent = { extent.width, extent.height, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = resource.samples;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.usage = resource.usage;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if (vkCreateImage(device, &imageCreateInfo, nullptr, &resource.image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to create the render graph image " + resource.name + "!");
+		}
+
+		Placement placement;
+		placement.resource = r;
+		vkGetImageMemoryRequirements(device, resource.image, &placement.requirements);
+		placements.push_back(placement);
+	}
+
+	// -- LAZY IMAGES --
+	// Attachments that never leave tile memory only get backing if the driver needs it (e.g. a tile spills), so they
+	// gain nothing from aliasing and stay out of the shared allocation. Without lazily allocated memory they alias as usual.
+	const VkPhysicalDeviceMemoryProperties& memoryProperties = allocator->getMemoryProperties();
+	std::vector<Resource> lazyImages;
+	for (auto placement = placements.begin(); placement != placements.end();)
+	{
+		ResourceInfo& resource = resources[placement->resource];
+		uint32_t memoryType = allocator->findMemoryType(placement->requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+		if (!(resource.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ||
+			!(memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+		{
+			++placement;
+			continue;
+		}
+
+		Allocation allocation = allocator->allocate(placement->requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+			0, AllocationLifetime::Persistent, false);
+		vkBindImageMemory(device, resource.image, allocation.memory, allocation.offset);
+		transientAllocations.push_back(allocation);
+		stats.lazyImageCount++;
+		stats.lazyBytes += placement->requirements.size;
+		lazyImages.push_back(placement->resource);
+		placement = placements.erase(placement);
+	}
+
+	// -- ALIASING --
+	// Largest first, each at the lowest offset where it doesn't overlap an image placed before whose lifetime it
+	// overlaps. Only images whose memory types have something in common can share memory.
+	std::sort(placements.begin(), placements.end(), [](const Placement& a, const Placement& b) { return a.requirements.size > b.requirements.size; });
+
+	VkMemoryRequirements sharedRequirements = {};
+	sharedRequirements.alignment = 1;
+	sharedRequirements.memoryTypeBits = UINT32_MAX;
+	for (size_t i = 0; i < placements.size(); i++)
+	{
+		const VkMemoryRequirements& requirements = placements[i].requirements;
+		ResourceInfo& resource = resources[placements[i].resource];
+
+		std::vector<size_t> conflicts;
+		std::vector<VkDeviceSize> candidates = { 0 };
+		for (size_t j = 0; j < i; j++)
+		{
+			const ResourceInfo& placed = resources[placements[j].resource];
+			if (placed.firstStep <= resource.lastStep && resource.firstStep <= placed.lastStep)
+			{
+				conflicts.push_back(j);
+				VkDeviceSize end = placed.memoryOffset + placements[j].requirements.size;
+				candidates.push_back((end + requirements.alignment - 1) / requirements.alignment * requirements.alignment);
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		for (VkDeviceSize candidate : candidates)
+		{
+			bool fits = std::none_of(conflicts.begin(), conflicts.end(), [&](size_t j) {
+				VkDeviceSize start = resources[placements[j].resource].memoryOffset;
+				return candidate < start + placements[j].requirements.size && start < candidate + requirements.size;
+			});
+			if (fits)
+			{
+				resource.memoryOffset = candidate;
+				break;
+			}
+		}
+
+		sharedRequirements.size = std::max(sharedRequirements.size, resource.memoryOffset + requirements.size);
+		sharedRequirements.alignment = std::max(sharedRequirements.alignment, requirements.alignment);
+		sharedRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+		stats.unaliasedTransientBytes += requirements.size;
+	}
+
+	if (!placements.empty() && sharedRequirements.memoryTypeBits != 0)
+	{
+		Allocation allocation = allocator->allocate(sharedRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, false);
+		for (const Placement& placement : placements)
+		{
+			ResourceInfo& resource = resources[placement.resource];
+			vkBindImageMemory(device, resource.image, allocation.memory, allocation.offset + resource.memoryOffset);
+		}
+		transientAllocations.push_back(allocation);
+		stats.transientBytes = sharedRequirements.size;
+	}
+	else
+	{
+		for (const Placement& placement : placements)
+		{
+			ResourceInfo& resource = resources[placement.resource];
+			Allocation allocation = allocator->allocate(placement.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, AllocationLifetime::Persistent, false);
+			vkBindImageMemory(device, resource.image, allocation.memory, allocation.offset);
+			transientAllocations.push_back(allocation);
+			stats.transientBytes += placement.requirements.size;
+		}
+	}
+
+	// -- VIEWS --
+	std::vector<Resource> images = lazyImages;
+	for (const Placement& placement : placements)
+	{
+		images.push_back(placement.resource);
+	}
+	for (Resource image : images)
+	{
+		ResourceInfo& resource = resources[image];
+
+		VkImageViewCreateInfo viewCreateInfo = {};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = resource.image;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = resource.format;
+		viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+		viewCreateInfo.subresourceRange.aspectMask = isDepthFormat(resource.format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+		viewCreateInfo.subresourceRange.baseMipLevel = 0;
+		viewCreateInfo.subresourceRange.levelCount = 1;
+		viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(device, &viewCreateInfo, nullptr, &resource.imageView) != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to create a view of the render graph image " + resource.name + "!");
+		}
+	}
+	stats.transientImageCount = static_cast<uint32_t>(placements.size());
+}
+
+void RenderGraph::destroy()
+{
+	releaseTargets();
+	for (Step& step : steps)
+	{
+		vkDestroyRenderPass(device, step.renderPass, nullptr);
+	}
+	steps.clear();
+	passes.clear();
+	resources.clear();
+	finalBarrier = Barrier();
+	stats = RenderGraphStats();
+}
+
+void RenderGraph::bindImage(Resource image, VkImageView imageView)
+{
+	resources[image].imageView = imageView;
+}
+
+void RenderGraph::setPassEnabled(uint32_t pass, bool enabled)
+{
+	passes[pass].enabled = enabled;
+}
+
+VkFramebuffer RenderGraph::getFramebuffer(uint32_t pass)
+{
+	if (passes[pass].step == INVALID_INDEX || steps[passes[pass].step].compute)
+	{
+		return VK_NULL_HANDLE;
+	}
+	return getStepFramebuffer(steps[passes[pass].step]);
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, GpuProfiler* profiler)
+{
+	PROFILE_FUNCTION();
+
+	for (Step& step : steps)
+	{
+		RenderGraphPassContext context;
+		context.commandBuffer = commandBuffer;
+		context.extent = extent;
+
+		// -- COMPUTE --
+		if (step.compute)
+		{
+			if (step.barrier.isNeeded())
+			{
+				VkMemoryBarrier memoryBarrier = {};
+				memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				memoryBarrier.srcAccessMask = step.barrier.srcAccess;
+				memoryBarrier.dstAccessMask = step.barrier.dstAccess;
+				vkCmdPipelineBarrier(commandBuffer, step.barrier.srcStages, step.barrier.dstStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+			}
+
+			PassInfo& pass = passes[step.passes[0]];
+			if (pass.enabled)
+			{
+				uint32_t scope = profiler ? profiler->beginScope(commandBuffer, step.name) : 0;
+				pass.record(context);
+				if (profiler)
+				{
+					profiler->endScope(commandBuffer, scope);
+				}
+			}
+			continue;
+		}
+
+		// -- RENDER PASS --
+		context.renderPass = step.renderPass;
+		context.framebuffer = getStepFramebuffer(step);
+
+		VkRenderPassBeginInfo renderPassBeginInfo = {};
+		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassBeginInfo.renderPass = step.renderPass;
+		renderPassBeginInfo.renderArea.offset = { 0, 0 };
+		renderPassBeginInfo.renderArea.extent = extent;
+		renderPassBeginInfo.framebuffer = context.framebuffer;
+		renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(step.clearValues.size());
+		renderPassBeginInfo.pClearValues = step.clearValues.data();
+
+		uint32_t scope = profiler ? profiler->beginScope(commandBuffer, step.name) : 0;
+
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, passes[step.passes[0]].contents);
+			for (uint32_t subpass = 0; subpass < step.passes.size(); subpass++)
+			{
+				PassInfo& pass = passes[step.passes[subpass]];
+				if (subpass > 0)
+				{
+					vkCmdNextSubpass(commandBuffer, pass.contents);
+				}
+				context.subpass = subpass;
+				if (pass.enabled)
+				{
+					pass.record(context);
+				}
+			}
+			vkCmdEndRenderPass(commandBuffer);
+
+		if (profiler)
+		{
+			profiler->endScope(commandBuffer, scope);
+		}
+	}
+
+	if (finalBarrier.isNeeded())
+	{
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = finalBarrier.srcAccess;
+		memoryBarrier.dstAccessMask = finalBarrier.dstAccess;
+		vkCmdPipelineBarrier(commandBuffer, finalBarrier.srcStages, finalBarrier.dstStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+}
+
+RenderGraph::~RenderGraph()
+{
+}
+
+RenderGraph::Resource RenderGraph::addResource(const ResourceInfo& resource)
+{
+	resources.push_back(resource);
+	return static_cast<Resource>(resources.size() - 1);
+}
+
+void RenderGraph::addUse(uint32_t pass, const ResourceUse& use)
+{
+	if (passes[pass].compute && use.type != UseType::Buffer)
+	{
+		throw std::runtime_error("ERROR: Render graph compute pass " + passes[pass].name + " can only use buffers!");
+	}
+	if (resources[use.resource].isImage == (use.type == UseType::Buffer))
+	{
+		throw std::runtime_error("ERROR: Render graph resource " + resources[use.resource].name + " used as the wrong kind of resource!");
+	}
+	if (use.type == UseType::Resolve && std::none_of(passes[pass].uses.begin(), passes[pass].uses.end(),
+		[&](const ResourceUse& colour) { return colour.type == UseType::Colour && colour.resource == use.source; }))
+	{
+		throw std::runtime_error("ERROR: Render graph pass " + passes[pass].name + " resolves " + resources[use.source].name + " without rendering to it!");
+	}
+	passes[pass].uses.push_back(use);
+}
+
+void RenderGraph::cullPasses()
+{
+	// Backwards from the outputs: a pass is needed if it writes something still to be read. A clear or a resolve
+	// overwrites the whole image, so writes to it before are dead; anything else a needed pass reads or loads becomes needed.
+	std::vector<bool> live(resources.size(), false);
+	for (Resource r = 0; r < resources.size(); r++)
+	{
+		live[r] = resources[r].output;
+	}
+
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		PassInfo& pass = passes[p];
+		pass.culled = std::none_of(pass.uses.begin(), pass.uses.end(), [&](const ResourceUse& use) { return use.write && live[use.resource]; });
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (const ResourceUse& use : pass.uses)
+		{
+			if (use.clear || use.type == UseType::Resolve)
+			{
+				live[use.resource] = false;
+			}
+		}
+		for (const ResourceUse& use : pass.uses)
+		{
+			if (!use.clear && use.type != UseType::Resolve)
+			{
+				live[use.resource] = true;
+			}
+		}
+	}
+}
+
+bool RenderGraph::canMerge(const Step& step, const PassInfo& pass) const
+{
+	// Inside a render pass only framebuffer local reads are possible: an input attachment, not a texture or a buffer
+	// another subpass wrote
+	for (const ResourceUse& use : pass.uses)
+	{
+		for (uint32_t earlier : step.passes)
+		{
+			for (const ResourceUse& earlierUse : passes[earlier].uses)
+			{
+				if (earlierUse.resource != use.resource)
+				{
+					continue;
+				}
+				if ((use.type == UseType::Texture && earlierUse.write) || (earlierUse.type == UseType::Texture && use.write) ||
+					(use.type == UseType::Buffer && (use.write || earlierUse.write)))
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+void RenderGraph::buildSteps()
+{
+	for (uint32_t p = 0; p < passes.size(); p++)
+	{
+		PassInfo& pass = passes[p];
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		if (pass.compute || steps.empty() || steps.back().compute || !canMerge(steps.back(), pass))
+		{
+			Step step;
+			step.compute = pass.compute;
+			step.name = pass.name;
+			steps.push_back(step);
+		}
+		else
+		{
+			steps.back().name += " + " + pass.name;
+		}
+
+		Step& step = steps.back();
+		pass.step = static_cast<uint32_t>(steps.size() - 1);
+		pass.subpass = static_cast<uint32_t>(step.passes.size());
+		step.passes.push_back(p);
+
+		for (const ResourceUse& use : pass.uses)
+		{
+			ResourceInfo& resource = resources[use.resource];
+			resource.firstStep = std::min(resource.firstStep, pass.step);
+			resource.lastStep = std::max(resource.lastStep, pass.step);
+			switch (use.type)
+			{
+			case UseType::Colour:	resource.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+			case UseType::Depth:	resource.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT; break;
+			case UseType::Input:	resource.usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT; break;
+			case UseType::Resolve:	resource.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+			case UseType::Texture:	resource.usage |= VK_IMAGE_USAGE_SAMPLED_BIT; resource.attachmentOnly = false; break;
+			case UseType::Buffer:	break;
+			}
+		}
+	}
+
+	// Used in one render pass only, and never sampled: nothing before it loads it and nothing after it stores it
+	for (ResourceInfo& resource : resources)
+	{
+		if (!resource.imported && resource.isImage && resource.firstStep != INVALID_INDEX && resource.firstStep == resource.lastStep &&
+			resource.attachmentOnly)
+		{
+			resource.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		}
+	}
+}
+
+void RenderGraph::buildRenderPass(uint32_t stepIndex, std::vector<AccessState>& states)
+{
+	Step& step = steps[stepIndex];
+	uint32_t subpassCount = static_cast<uint32_t>(step.passes.size());
+
+	// -- ATTACHMENTS --
+	// Load ops and initial layouts from the state before this render pass, final layouts from the next use after it
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<uint32_t> firstSubpass, lastSubpass;
+	for (uint32_t subpass = 0; subpass < subpassCount; subpass++)
+	{
+		for (const ResourceUse& use : passes[step.passes[subpass]].uses)
+		{
+			if (use.type != UseType::Colour && use.type != UseType::Depth && use.type != UseType::Input && use.type != UseType::Resolve)
+			{
+				continue;
+			}
+
+			auto found = std::find(step.attachments.begin(), step.attachments.end(), use.resource);
+			if (found != step.attachments.end())
+			{
+				lastSubpass[found - step.attachments.begin()] = subpass;
+				continue;
+			}
+
+			const ResourceInfo& resource = resources[use.resource];
+			const AccessState& state = states[use.resource];
+			bool contentsValid = state.write.step != INVALID_INDEX || (resource.imported && state.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+
+			VkAttachmentDescription attachment = {};
+			attachment.format = resource.format;
+			attachment.samples = resource.samples;
+			bool overwritten = use.type == UseType::Resolve;
+			attachment.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR :
+				(contentsValid && !overwritten ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+			attachment.initialLayout = attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+
+			const ResourceUse* nextUse = findNextUse(use.resource, stepIndex);
+			attachment.storeOp = nextUse != nullptr || resource.imported ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+			// Stencil goes along with depth in the formats that have it
+			bool stencil = resource.format == VK_FORMAT_D24_UNORM_S8_UINT || resource.format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+			attachment.stencilLoadOp = stencil ? attachment.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachment.stencilStoreOp = stencil ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+			step.attachments.push_back(use.resource);
+			step.clearValues.push_back(use.clearValue);
+			attachments.push_back(attachment);
+			firstSubpass.push_back(subpass);
+			lastSubpass.push_back(subpass);
+		}
+	}
+
+	// -- SUBPASSES & DEPENDENCIES --
+	// A dependency wherever a use reads what an earlier one wrote, writes (or changes the layout of) what earlier ones
+	// accessed; earlier in this render pass it is a subpass to subpass dependency, before it one from outside
+	std::map<std::pair<uint32_t, uint32_t>, VkSubpassDependency> dependencies;
+	auto addDependency = [&](uint32_t srcSubpass, uint32_t dstSubpass, const AccessRecord& src, const ResourceUse& dst) {
+		VkSubpassDependency& dependency = dependencies[{ srcSubpass, dstSubpass }];
+		dependency.srcSubpass = srcSubpass;
+		dependency.dstSubpass = dstSubpass;
+		dependency.srcStageMask |= src.stages;
+		dependency.srcAccessMask |= src.access;
+		dependency.dstStageMask |= dst.stages;
+		dependency.dstAccessMask |= dst.access;
+		if (srcSubpass != VK_SUBPASS_EXTERNAL && dstSubpass != VK_SUBPASS_EXTERNAL)
+		{
+			dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;		// Attachments and input attachments only
+		}
+	};
+
+	std::vector<std::vector<VkAttachmentReference>> colourReferences(subpassCount), inputReferences(subpassCount), resolveReferences(subpassCount);
+	std::vector<VkAttachmentReference> depthReferences(subpassCount, { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+	std::vector<std::vector<uint32_t>> preserveAttachments(subpassCount);
+
+	for (uint32_t subpass = 0; subpass < subpassCount; subpass++)
+	{
+		for (const ResourceUse& use : passes[step.passes[subpass]].uses)
+		{
+			const ResourceInfo& resource = resources[use.resource];
+			AccessState& state = states[use.resource];
+			uint32_t attachment = static_cast<uint32_t>(std::find(step.attachments.begin(), step.attachments.end(), use.resource) - step.attachments.begin());
+			bool isAttachment = attachment < step.attachments.size();
+
+			VkImageLayout layout = getUseLayout(use);
+			VkImageLayout previousLayout = isAttachment && firstSubpass[attachment] == subpass ? attachments[attachment].initialLayout : state.layout;
+			if (use.type == UseType::Texture && previousLayout != layout)
+			{
+				throw std::runtime_error("ERROR: Render graph image " + resource.name + " is sampled before anything made it readable!");
+			}
+			bool transitions = resource.isImage && previousLayout != layout;
+
+			std::vector<AccessRecord> sources;
+			if (state.written)
+			{
+				sources.push_back(state.write);
+			}
+			if (use.write || transitions)
+			{
+				sources.insert(sources.end(), state.reads.begin(), state.reads.end());
+			}
+			for (const AccessRecord& source : sources)
+			{
+				if (source.step == INVALID_INDEX && isTrivialAccess(source.stages, source.access) && !transitions)
+				{
+					continue;
+				}
+				bool inside = source.step == stepIndex;
+				if (inside && source.subpass == subpass)
+				{
+					continue;
+				}
+				addDependency(inside ? source.subpass : VK_SUBPASS_EXTERNAL, subpass, source, use);
+			}
+
+			AccessRecord record;
+			record.step = stepIndex;
+			record.subpass = subpass;
+			record.stages = use.stages;
+			record.access = use.access & WRITE_ACCESS;
+			if (use.write)
+			{
+				state.written = true;
+				state.write = record;
+				state.reads.clear();
+			}
+			else
+			{
+				state.reads.push_back(record);
+			}
+			if (resource.isImage)
+			{
+				state.layout = layout;
+			}
+
+			switch (use.type)
+			{
+			case UseType::Colour:	colourReferences[subpass].push_back({ attachment, layout }); break;
+			case UseType::Depth:	depthReferences[subpass] = { attachment, layout }; break;
+			case UseType::Input:	inputReferences[subpass].push_back({ attachment, layout }); break;
+			default:				break;
+			}
+		}
+
+		// Resolve attachments pair up with the colour attachments they resolve, by index
+		for (const ResourceUse& use : passes[step.passes[subpass]].uses)
+		{
+			if (use.type != UseType::Resolve)
+			{
+				continue;
+			}
+			resolveReferences[subpass].resize(colourReferences[subpass].size(), { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+			uint32_t source = static_cast<uint32_t>(std::find(step.attachments.begin(), step.attachments.end(), use.source) - step.attachments.begin());
+			uint32_t target = static_cast<uint32_t>(std::find(step.attachments.begin(), step.attachments.end(), use.resource) - step.attachments.begin());
+			for (uint32_t colour = 0; colour < colourReferences[subpass].size(); colour++)
+			{
+				if (colourReferences[subpass][colour].attachment == source)
+				{
+					resolveReferences[subpass][colour] = { target, getUseLayout(use) };
+				}
+			}
+		}
+	}
+
+	// -- HAND-OVER --
+	// What comes next transitions attachments it uses as attachments itself; anything else (sampling, presenting) needs
+	// them in its layout when this render pass ends, and an outgoing dependency to order the transition
+	std::vector<Resource> used;
+	for (uint32_t p : step.passes)
+	{
+		for (const ResourceUse& use : passes[p].uses)
+		{
+			if (std::find(used.begin(), used.end(), use.resource) == used.end())
+			{
+				used.push_back(use.resource);
+			}
+		}
+	}
+	for (Resource r : used)
+	{
+		const ResourceInfo& resource = resources[r];
+		AccessState& state = states[r];
+		uint32_t attachment = static_cast<uint32_t>(std::find(step.attachments.begin(), step.attachments.end(), r) - step.attachments.begin());
+		bool isAttachment = attachment < step.attachments.size();
+
+		const ResourceUse* nextUse = findNextUse(r, stepIndex);
+		ResourceUse handOver = { r, UseType::Buffer, false, resource.final.stages, resource.final.access };
+		bool needsHandOver = false;
+		if (nextUse != nullptr)
+		{
+			// Attachment uses transition at the start of their own render pass, and buffers have no layout
+			needsHandOver = nextUse->type == UseType::Texture;
+			handOver.stages = nextUse->stages;
+			handOver.access = nextUse->access;
+		}
+		else
+		{
+			needsHandOver = resource.imported && !isTrivialAccess(resource.final.stages, resource.final.access);
+		}
+
+		if (isAttachment)
+		{
+			VkImageLayout finalLayout = state.layout;
+			if (nextUse != nullptr && nextUse->type == UseType::Texture)
+			{
+				finalLayout = getUseLayout(*nextUse);
+			}
+			else if (nextUse == nullptr && resource.imported && resource.final.layout != VK_IMAGE_LAYOUT_UNDEFINED)
+			{
+				finalLayout = resource.final.layout;
+			}
+			attachments[attachment].finalLayout = finalLayout;
+			state.layout = finalLayout;
+		}
+
+		if (!needsHandOver)
+		{
+			continue;
+		}
+		std::vector<AccessRecord> sources = state.reads;
+		if (state.written)
+		{
+			sources.push_back(state.write);
+		}
+		for (const AccessRecord& source : sources)
+		{
+			if (source.step == stepIndex)
+			{
+				addDependency(source.subpass, VK_SUBPASS_EXTERNAL, source, handOver);
+			}
+		}
+
+		// Made available and visible to what comes next, which only has to wait for it if it writes
+		state.written = false;
+		state.reads.clear();
+		AccessRecord handedOver;
+		handedOver.step = stepIndex;
+		handedOver.subpass = lastSubpass.empty() || !isAttachment ? subpassCount - 1 : lastSubpass[attachment];
+		handedOver.stages = handOver.stages;
+		state.reads.push_back(handedOver);
+	}
+
+	// An attachment used before and after a subpass that doesn't use it must be preserved through it
+	for (uint32_t attachment = 0; attachment < step.attachments.size(); attachment++)
+	{
+		for (uint32_t subpass = firstSubpass[attachment] + 1; subpass < lastSubpass[attachment]; subpass++)
+		{
+			bool usedHere = depthReferences[subpass].attachment == attachment;
+			for (const VkAttachmentReference& reference : colourReferences[subpass])
+			{
+				usedHere = usedHere || reference.attachment == attachment;
+			}
+			for (const VkAttachmentReference& reference : inputReferences[subpass])
+			{
+				usedHere = usedHere || reference.attachment == attachment;
+			}
+			for (const VkAttachmentReference& reference : resolveReferences[subpass])
+			{
+				usedHere = usedHere || reference.attachment == attachment;
+			}
+			if (!usedHere)
+			{
+				preserveAttachments[subpass].push_back(attachment);
+			}
+		}
+	}
+
+	std::vector<VkSubpassDescription> subpasses(subpassCount);
+	for (uint32_t subpass = 0; subpass < subpassCount; subpass++)
+	{
+		VkSubpassDescription& description = subpasses[subpass];
+		description = {};
+		description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		description.colorAttachmentCount = static_cast<uint32_t>(colourReferences[subpass].size());
+		description.pColorAttachments = colourReferences[subpass].data();
+		description.pResolveAttachments = resolveReferences[subpass].empty() ? nullptr : resolveReferences[subpass].data();
+		description.inputAttachmentCount = static_cast<uint32_t>(inputReferences[subpass].size());
+		description.pInputAttachments = inputReferences[subpass].data();
+		description.pDepthStencilAttachment = depthReferences[subpass].attachment != VK_ATTACHMENT_UNUSED ? &depthReferences[subpass] : nullptr;
+		description.preserveAttachmentCount = static_cast<uint32_t>(preserveAttachments[subpass].size());
+		description.pPreserveAttachments = preserveAttachments[subpass].data();
+	}
+
+	std::vector<VkSubpassDependency> dependencyList;
+	for (const auto& dependency : dependencies)
+	{
+		dependencyList.push_back(dependency.second);
+	}
+	step.dependencyCount = static_cast<uint32_t>(dependencyList.size());
+
+	// Create info for render pass
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassCreateInfo.pAttachments = attachments.data();
+	renderPassCreateInfo.subpassCount = subpassCount;
+	renderPassCreateInfo.pSubpasses = subpasses.data();
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(dependencyList.size());
+	renderPassCreateInfo.pDependencies = dependencyList.data();
+
+	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &step.renderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create the render pass for " + step.name + "!");
+	}
+}
+
+void RenderGraph::buildComputeBarrier(uint32_t stepIndex, std::vector<AccessState>& states)
+{
+	Step& step = steps[stepIndex];
+
+	// Everything the pass needs to wait for goes into a single global memory barrier
+	for (const ResourceUse& use : passes[step.passes[0]].uses)
+	{
+		AccessState& state = states[use.resource];
+
+		std::vector<AccessRecord> sources;
+		if (state.written)
+		{
+			sources.push_back(state.write);
+		}
+		if (use.write)
+		{
+			sources.insert(sources.end(), state.reads.begin(), state.reads.end());
+		}
+		for (const AccessRecord& source : sources)
+		{
+			if (source.step == INVALID_INDEX && isTrivialAccess(source.stages, source.access))
+			{
+				continue;
+			}
+			step.barrier.srcStages |= source.stages;
+			step.barrier.srcAccess |= source.access;
+			step.barrier.dstStages |= use.stages;
+			step.barrier.dstAccess |= use.access;
+		}
+
+		AccessRecord record;
+		record.step = stepIndex;
+		record.stages = use.stages;
+		record.access = use.access & WRITE_ACCESS;
+		if (use.write)
+		{
+			state.written = true;
+			state.write = record;
+			state.reads.clear();
+		}
+		else
+		{
+			state.reads.push_back(record);
+		}
+	}
+}
+
+const RenderGraph::ResourceUse* RenderGraph::findNextUse(Resource resource, uint32_t afterStep) const
+{
+	for (uint32_t s = afterStep + 1; s < steps.size(); s++)
+	{
+		for (uint32_t p : steps[s].passes)
+		{
+			for (const ResourceUse& use : passes[p].uses)
+			{
+				if (use.resource == resource)
+				{
+					return &use;
+				}
+			}
+		}
+	}
+	return nullptr;
+}
+
+void RenderGraph::releaseTargets()
+{
+	for (Step& step : steps)
+	{
+		for (auto& framebuffer : step.framebuffers)
+		{
+			vkDestroyFramebuffer(device, framebuffer.second, nullptr);
+		}
+		step.framebuffers.clear();
+	}
+
+	for (ResourceInfo& resource : resources)
+	{
+		if (resource.imported)
+		{
+			resource.imageView = VK_NULL_HANDLE;		// Belongs to whoever imported it, and may not survive the resize
+			continue;
+		}
+		if (resource.imageView != VK_NULL_HANDLE)
+		{
+			vkDestroyImageView(device, resource.imageView, nullptr);
+			resource.imageView = VK_NULL_HANDLE;
+		}
+		if (resource.image != VK_NULL_HANDLE)
+		{
+			vkDestroyImage(device, resource.image, nullptr);
+			resource.image = VK_NULL_HANDLE;
+		}
+	}
+
+	for (Allocation& allocation : transientAllocations)
+	{
+		allocator->free(allocation);
+	}
+	transientAllocations.clear();
+	stats.transientImageCount = 0;
+	stats.transientBytes = 0;
+	stats.unaliasedTransientBytes = 0;
+	stats.lazyImageCount = 0;
+	stats.lazyBytes = 0;
+}
+
+VkFramebuffer RenderGraph::getStepFramebuffer(Step& step)
+{
+	std::vector<VkImageView> views;
+	for (Resource r : step.attachments)
+	{
+		if (resources[r].imageView == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("ERROR: Render graph image " + resources[r].name + " has nothing bound to it!");
+		}
+		views.push_back(resources[r].imageView);
+	}
+
+	auto found = step.framebuffers.find(views);
+	if (found != step.framebuffers.end())
+	{
+		return found->second;
+	}
+
+	VkFramebufferCreateInfo framebufferCreateInfo = {};
+	framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferCreateInfo.renderPass = step.renderPass;										// Render Pass layout the Framebuffer will be used with
+	framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(views.size());
+	framebufferCreateInfo.pAttachments = views.data();										// List of attachments (1:1 with Render Pass)
+	framebufferCreateInfo.width = extent.width;												// Framebuffer width
+	framebufferCreateInfo.height = extent.height;											// Framebuffer height
+	framebufferCreateInfo.layers = 1;														// Framebuffer layers
+
+	VkFramebuffer framebuffer;
+	if (vkCreateFramebuffer(device, &framebufferCreateInfo, nullptr, &framebuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a Framebuffer!");
+	}
+	step.framebuffers[views] = framebuffer;
+	return framebuffer;
+}
+
+bool RenderGraph::isDepthFormat(VkFormat format)
+{
+	return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+VkImageLayout RenderGraph::getUseLayout(const ResourceUse& use)
+{
+	switch (use.type)
+	{
+	case UseType::Colour:	return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	case UseType::Depth:	return VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	case UseType::Input:	return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	case UseType::Resolve:	return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	case UseType::Texture:	return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	default:				return VK_IMAGE_LAYOUT_UNDEFINED;
+	}
+}
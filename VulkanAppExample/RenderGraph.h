@@ -0,0 +1,221 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "MemoryAllocator.h"
+#include "GpuProfiler.h"
+
+// Where an imported resource is before the graph runs, and where it has to be after
+struct RenderGraphAccess {
+	VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	VkAccessFlags access = 0;
+	VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;		// Images only
+};
+
+// What a pass records into
+struct RenderGraphPassContext {
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkRenderPass renderPass = VK_NULL_HANDLE;				// Null for compute passes
+	uint32_t subpass = 0;
+	VkFramebuffer framebuffer = VK_NULL_HANDLE;
+	VkExtent2D extent = {};
+};
+
+typedef std::function<void(const RenderGraphPassContext &context)> RenderGraphRecordFunction;
+
+struct RenderGraphStats {
+	uint32_t passCount = 0;
+	uint32_t culledPassCount = 0;				// Nothing marked as output depends on them
+	uint32_t renderPassCount = 0;
+	uint32_t subpassCount = 0;					// Graphics passes, merged into the render passes
+	uint32_t barrierCount = 0;					// Subpass dependencies and pipeline barriers, per execution
+	uint32_t transientImageCount = 0;
+	VkDeviceSize transientBytes = 0;			// Memory backing the transient images, after aliasing
+	VkDeviceSize unaliasedTransientBytes = 0;	// What they would take with an allocation each
+	uint32_t lazyImageCount = 0;				// Transient images in lazily allocated memory, not counted above
+	VkDeviceSize lazyBytes = 0;					// Their size; tilers may never commit any of it
+};
+
+// Builds the frame from passes that declare what they read and write, instead of hand written render passes
+// and barriers. compile() works out, once:
+// - Which passes are needed: walking back from the resources marked as outputs, the rest are culled
+// - Render passes: consecutive graphics passes become subpasses of one render pass unless one samples what an
+//   earlier one rendered (reading it as an input attachment is fine)
+// - Synchronisation: a subpass dependency or pipeline barrier only where a pass reads or overwrites what an earlier
+//   one accessed, with the exact stages and access of both sides, and the layout transitions that go with it
+// - Load and store ops: contents are only loaded or stored when something before or after uses them
+// allocate() then creates the transient images for an extent, aliasing the memory of those whose lifetimes
+// (in render passes) don't overlap. Transient images that only live inside one render pass as attachments (a
+// multisampled target, depth) are never loaded or stored; they are made TRANSIENT_ATTACHMENT and go into lazily
+// allocated memory where the device has it, so a tiler keeps them in tile memory and never backs them at all.
+//
+// Compute passes work on buffers only; images are rendered to and sampled by graphics passes.
+class RenderGraph
+{
+public:
+	typedef uint32_t Resource;
+	static const uint32_t INVALID_INDEX = UINT32_MAX;
+
+	RenderGraph();
+
+	// -- DECLARATION --
+	Resource importImage(const std::string &name, VkFormat format, VkSampleCountFlagBits samples, const RenderGraphAccess &initial,
+		const RenderGraphAccess &final);
+	Resource importBuffer(const std::string &name, const RenderGraphAccess &initial, const RenderGraphAccess &final);
+	// Owned by the graph, as large as the extent given to allocate. Contents don't survive from one execution to the next.
+	Resource createImage(const std::string &name, VkFormat format, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+
+	uint32_t addGraphicsPass(const std::string &name, VkSubpassContents contents, RenderGraphRecordFunction record);
+	uint32_t addComputePass(const std::string &name, RenderGraphRecordFunction record);
+
+	// Without a clear value the attachment's contents are loaded
+	void addColourOutput(uint32_t pass, Resource image, const VkClearColorValue *clear = nullptr);
+	void addDepthOutput(uint32_t pass, Resource image, const VkClearDepthStencilValue *clear = nullptr);
+	void addInputAttachment(uint32_t pass, Resource image);
+	// Resolves source, a multisampled colour output of the same pass, into image at the end of the subpass
+	void addResolveOutput(uint32_t pass, Resource image, Resource source);
+	void addTextureInput(uint32_t pass, Resource image, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	void addBufferInput(uint32_t pass, Resource buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+	void addBufferOutput(uint32_t pass, Resource buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+
+	// What the graph produces. Passes it doesn't depend on are culled.
+	void markOutput(Resource resource);
+
+	// -- BUILD --
+	void compile(VkDevice logicalDevice, MemoryAllocator *memoryAllocator);
+	// (Re)creates the transient images; framebuffers made before are released. Nothing may use them on the GPU.
+	void allocate(VkExtent2D extent);
+	void destroy();
+
+	// -- EXECUTION --
+	void bindImage(Resource image, VkImageView imageView);		// Imported images, before getFramebuffer and execute
+	void setPassEnabled(uint32_t pass, bool enabled);			// Disabled passes keep their barriers but record nothing
+	VkRenderPass getRenderPass(uint32_t pass) const { return passes[pass].step == INVALID_INDEX ? VK_NULL_HANDLE : steps[passes[pass].step].renderPass; }
+	uint32_t getSubpass(uint32_t pass) const { return passes[pass].subpass; }
+	bool isCulled(uint32_t pass) const { return passes[pass].culled; }
+	VkFramebuffer getFramebuffer(uint32_t pass);				// For the images bound now; made the first time they are seen
+
+	// Records every pass that isn't culled, each render pass or compute pass in its own profiler scope
+	void execute(VkCommandBuffer commandBuffer, GpuProfiler *profiler = nullptr);
+
+	RenderGraphStats getStats() const { return stats; }
+
+	~RenderGraph();
+
+private:
+	enum class UseType {
+		Colour,
+		Depth,
+		Input,
+		Resolve,
+		Texture,
+		Buffer
+	};
+
+	struct ResourceUse {
+		Resource resource;
+		UseType type;
+		bool write;
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		bool clear = false;
+		VkClearValue clearValue = {};
+		Resource source = INVALID_INDEX;			// Resolve only
+	};
+
+	struct PassInfo {
+		std::string name;
+		bool compute = false;
+		VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
+		RenderGraphRecordFunction record;
+		std::vector<ResourceUse> uses;
+		bool culled = false;
+		bool enabled = true;
+		uint32_t step = INVALID_INDEX;				// Render pass or compute step it runs in
+		uint32_t subpass = 0;
+	};
+
+	struct ResourceInfo {
+		std::string name;
+		bool isImage = true;
+		bool imported = false;
+		bool output = false;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+		RenderGraphAccess initial;
+		RenderGraphAccess final;
+		VkImageUsageFlags usage = 0;				// Transient images, from their uses
+		bool attachmentOnly = true;					// Never sampled, so it can live in tile memory
+		uint32_t firstStep = INVALID_INDEX;			// Lifetime, in steps
+		uint32_t lastStep = 0;
+
+		VkImageView imageView = VK_NULL_HANDLE;		// Bound (imported) or owned (transient)
+		VkImage image = VK_NULL_HANDLE;				// Transient only
+		VkDeviceSize memoryOffset = 0;
+	};
+
+	struct Barrier {
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		VkAccessFlags srcAccess = 0;
+		VkAccessFlags dstAccess = 0;
+		bool isNeeded() const { return srcStages != 0; }
+	};
+
+	// Last accesses of a resource, while compile walks the steps
+	struct AccessRecord {
+		uint32_t step = INVALID_INDEX;				// INVALID_INDEX: before the graph
+		uint32_t subpass = 0;
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;					// Writes only, reads need no availability
+	};
+
+	struct AccessState {
+		bool written = false;
+		AccessRecord write;
+		std::vector<AccessRecord> reads;			// Since the last write
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	// A render pass (one or more graphics passes) or a compute pass
+	struct Step {
+		std::string name;
+		bool compute = false;
+		std::vector<uint32_t> passes;				// In subpass order
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		std::vector<Resource> attachments;			// Framebuffer order
+		std::vector<VkClearValue> clearValues;
+		std::map<std::vector<VkImageView>, VkFramebuffer> framebuffers;
+		Barrier barrier;							// Compute steps: recorded before the pass
+		uint32_t dependencyCount = 0;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator *allocator = nullptr;
+	std::vector<PassInfo> passes;
+	std::vector<ResourceInfo> resources;
+	std::vector<Step> steps;
+	Barrier finalBarrier;							// After the last step, for imported resources a compute pass used last
+	VkExtent2D extent = {};
+	std::vector<Allocation> transientAllocations;	// One with aliasing, one per image without, one per lazy image
+	RenderGraphStats stats;
+
+	// - Support Functions
+	Resource addResource(const ResourceInfo &resource);
+	void addUse(uint32_t pass, const ResourceUse &use);
+	void cullPasses();
+	void buildSteps();
+	bool canMerge(const Step &step, const PassInfo &pass) const;
+	void buildRenderPass(uint32_t stepIndex, std::vector<AccessState> &states);
+	void buildComputeBarrier(uint32_t stepIndex, std::vector<AccessState> &states);
+	const ResourceUse *findNextUse(Resource resource, uint32_t afterStep) const;
+	void releaseTargets();
+	VkFramebuffer getStepFramebuffer(Step &step);
+	static bool isDepthFormat(VkFormat format);
+	static VkImageLayout getUseLayout(const ResourceUse &use);
+};
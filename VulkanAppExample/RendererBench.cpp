@@ -0,0 +1,269 @@
+// Renderer benchmark: runs the renderer headless through a set of synthetic scenes, each twice (first with an empty
+// pipeline cache, then with the one the first run wrote), and writes what it measured as JSON so runs on different
+// commits can be compared. Needs no window or display, so it runs on a software driver such as lavapipe:
+//
+//   VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json renderer_bench --output bench.json
+//
+// Every run gets a renderer of its own, so each one pays for instance and device creation again.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <chrono>
+#include "VulkanRenderer.h"
+#include "CommandLine.h"
+
+struct BenchScene {
+	const char *name;
+	uint32_t objects;			// RendererSettings::benchmarkObjects
+	bool gpuDriven;
+	bool depthTest;
+	uint32_t msaaSamples;
+	uint32_t textureCount;
+};
+
+// Small enough that a software rasteriser gets through all of them in a couple of minutes
+static const BenchScene BENCH_SCENES[] = {
+	{ "empty", 0, false, false, 1, 0 },
+	{ "objects_1k", 1000, false, false, 1, 0 },
+	{ "objects_10k", 10000, false, false, 1, 0 },
+	{ "gpu_driven_10k", 10000, true, false, 1, 0 },
+	{ "depth_msaa4_1k", 1000, false, true, 4, 0 },
+	{ "textured_1k", 1000, false, false, 1, 8 },
+};
+
+struct BenchOptions {
+	std::string outputPath = "renderer_bench.json";
+	std::string sceneFilter;				// Only run the scene with this name
+	std::string deviceSelector;
+	uint64_t warmupFrames = 30;				// Not measured: the first frames also build pipeline variants and stream textures in
+	uint64_t measuredFrames = 300;
+	VkExtent2D extent = { 800, 600 };
+	bool parallelInit = true;
+};
+
+static const char *jsonBool(bool value)
+{
+	return value ? "true" : "false";
+}
+
+// Runs one scene from Init to cleanup and appends its JSON object to json. Returns false if the renderer failed.
+static bool runScene(const BenchScene &scene, const BenchOptions &options, bool warmCache, std::ostringstream &json, std::string &deviceJson)
+{
+	RendererSettings settings;
+	settings.headless = true;
+	settings.headlessExtent = options.extent;
+	settings.pipelineCachePath = std::string("renderer_bench_") + scene.name + ".cache";
+	settings.deviceSelector = options.deviceSelector;
+	settings.parallelInit = options.parallelInit;
+	settings.benchmarkObjects = scene.objects;
+	settings.gpuDriven = scene.gpuDriven;
+	settings.depthTest = scene.depthTest;
+	settings.msaaSamples = scene.msaaSamples;
+	settings.textureCount = scene.textureCount;
+	settings.textureSize = 256;
+	settings.presentPolicy = PresentPolicy::Throughput;
+
+	if (!warmCache)
+	{
+		std::remove(settings.pipelineCachePath.c_str());
+	}
+
+	json << "    {\"scene\": " << jsonString(scene.name) << ", \"objects\": " << scene.objects << ", \"gpuDriven\": " << jsonBool(scene.gpuDriven)
+		<< ", \"depthTest\": " << jsonBool(scene.depthTest) << ", \"msaaSamples\": " << scene.msaaSamples << ", \"textures\": " << scene.textureCount
+		<< ", \"pipelineCache\": " << jsonString(warmCache ? "warm" : "cold");
+
+	// A renderer that failed half way through Init can't be cleaned up safely, so it is left as it is
+	VulkanRenderer renderer;
+	if (renderer.Init(nullptr, settings) == EXIT_FAILURE)
+	{
+		json << ", \"status\": \"init failed\"}";
+		return false;
+	}
+
+	// -- FRAMES --
+	std::string error;
+	double frameSeconds = 0.0;
+	uint64_t frameCount = 0;
+	try {
+		while (renderer.getFrameStats().totalFrames < options.warmupFrames)
+		{
+			renderer.draw();
+		}
+
+		// Frames are only submitted here, but with at most framesInFlight of them queued the GPU can't be more than
+		// that far behind once the run is over
+		auto start = std::chrono::steady_clock::now();
+		uint64_t startFrame = renderer.getFrameStats().totalFrames;
+		while (renderer.getFrameStats().totalFrames < startFrame + options.measuredFrames)
+		{
+			renderer.draw();
+		}
+		frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		frameCount = renderer.getFrameStats().totalFrames - startFrame;
+	}
+	catch (const std::runtime_error &e)
+	{
+		error = e.what();
+	}
+
+	// -- RESULTS --
+	json << ", \"status\": " << jsonString(error.empty() ? "ok" : error);
+
+	const FrameStats &frameStats = renderer.getFrameStats();
+	json << ",\n      \"initMs\": " << frameStats.initMs << ", \"timeToFirstFrameMs\": " << frameStats.timeToFirstFrameMs << ", \"initSteps\": {";
+	const std::vector<TaskTiming> &initTimings = renderer.getInitTimings();
+	for (size_t i = 0; i < initTimings.size(); i++)
+	{
+		json << (i > 0 ? ", " : "") << jsonString(initTimings[i].name) << ": " << initTimings[i].durationMs;
+	}
+	json << "}";
+
+	const PipelineCacheStats &cacheStats = renderer.getPipelineCacheStats();
+	PipelineManagerStats pipelineStats = renderer.getPipelineManagerStats();
+	json << ",\n      \"pipelines\": {\"cacheLoadedFromDisk\": " << jsonBool(cacheStats.loadedFromDisk) << ", \"cacheHits\": " << cacheStats.hits
+		<< ", \"cacheMisses\": " << cacheStats.misses << ", \"createMs\": " << cacheStats.totalCreateTimeMs << ", \"built\": " << pipelineStats.pipelineCount
+		<< ", \"failed\": " << pipelineStats.failedCompiles << ", \"shaderModules\": " << pipelineStats.shaderModules
+		<< ", \"shaderModuleMs\": " << pipelineStats.shaderModuleMs << "}";
+
+	json << ",\n      \"frames\": {\"count\": " << frameCount << ", \"seconds\": " << frameSeconds << ", \"framesPerSecond\": "
+		<< (frameSeconds > 0.0 ? frameCount / frameSeconds : 0.0) << ", \"avgRecordMs\": " << frameStats.avgRecordMs
+		<< ", \"avgCpuWaitMs\": " << frameStats.avgCpuWaitMs << ", \"avgLatencyMs\": " << frameStats.avgLatencyMs << "}";
+
+	json << ",\n      \"gpuScopes\": {";
+	std::vector<GpuScopeStats> scopes = renderer.getGpuScopeStats();
+	for (size_t i = 0; i < scopes.size(); i++)
+	{
+		json << (i > 0 ? ", " : "") << jsonString(scopes[i].name) << ": {\"avgMs\": " << scopes[i].avgMs << ", \"p99Ms\": " << scopes[i].p99Ms << "}";
+	}
+	json << "}";
+
+	RenderGraphStats graphStats = renderer.getRenderGraphStats();
+	json << ",\n      \"renderGraph\": {\"passes\": " << graphStats.passCount << ", \"culledPasses\": " << graphStats.culledPassCount
+		<< ", \"renderPasses\": " << graphStats.renderPassCount << ", \"subpasses\": " << graphStats.subpassCount << ", \"barriers\": " << graphStats.barrierCount
+		<< ", \"transientImages\": " << graphStats.transientImageCount << ", \"transientBytes\": " << graphStats.transientBytes
+		<< ", \"unaliasedTransientBytes\": " << graphStats.unaliasedTransientBytes << ", \"lazyBytes\": " << graphStats.lazyBytes
+		<< ", \"sampleCount\": " << renderer.getSampleCount() << "}";
+
+	uint64_t deviceMemoryUsed = 0;
+	for (const HeapStats &heap : renderer.getMemoryStats())
+	{
+		deviceMemoryUsed += heap.used;
+	}
+	json << ", \"memoryUsedBytes\": " << deviceMemoryUsed << "}";
+
+	if (deviceJson.empty())
+	{
+		const VkPhysicalDeviceProperties &properties = renderer.getDeviceProperties();
+		std::ostringstream device;
+		device << "{\"name\": " << jsonString(properties.deviceName) << ", \"type\": " << jsonString(deviceTypeName(properties.deviceType))
+			<< ", \"vendorId\": " << properties.vendorID << ", \"deviceId\": " << properties.deviceID << ", \"driverVersion\": " << properties.driverVersion
+			<< ", \"apiVersion\": " << jsonString(std::to_string(VK_VERSION_MAJOR(properties.apiVersion)) + "." + std::to_string(VK_VERSION_MINOR(properties.apiVersion))
+			+ "." + std::to_string(VK_VERSION_PATCH(properties.apiVersion))) << "}";
+		deviceJson = device.str();
+	}
+
+	renderer.cleanup();
+	return error.empty();
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+
+	// --output FILE     : where the JSON goes (default renderer_bench.json)
+	// --scene NAME      : only run this scene
+	// --frames N        : frames measured per run
+	// --warmup N        : frames drawn before measuring
+	// --width N         : offscreen target size
+	// --height N
+	// --device SELECTOR : pin the GPU by index, UUID or name (overrides VULKAN_APP_DEVICE)
+	// --serial-init     : run the initialisation steps one after the other, so their timings don't overlap
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--output" && i + 1 < argc)
+		{
+			options.outputPath = argv[++i];
+		}
+		else if (arg == "--scene" && i + 1 < argc)
+		{
+			options.sceneFilter = argv[++i];
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			options.measuredFrames = parseUnsignedFlag(arg, argv[++i]);
+		}
+		else if (arg == "--warmup" && i + 1 < argc)
+		{
+			options.warmupFrames = parseUnsignedFlag(arg, argv[++i]);
+		}
+		else if (arg == "--width" && i + 1 < argc)
+		{
+			options.extent.width = parseUint32Flag(arg, argv[++i]);
+		}
+		else if (arg == "--height" && i + 1 < argc)
+		{
+			options.extent.height = parseUint32Flag(arg, argv[++i]);
+		}
+		else if (arg == "--device" && i + 1 < argc)
+		{
+			options.deviceSelector = argv[++i];
+		}
+		else if (arg == "--serial-init")
+		{
+			options.parallelInit = false;
+		}
+		else
+		{
+			exitWithUnknownArgument(arg);
+		}
+	}
+
+	std::ostringstream runs;
+	std::string deviceJson;
+	uint32_t runCount = 0;
+	uint32_t failedRuns = 0;
+	for (const BenchScene &scene : BENCH_SCENES)
+	{
+		if (!options.sceneFilter.empty() && options.sceneFilter != scene.name)
+		{
+			continue;
+		}
+
+		for (bool warmCache : { false, true })
+		{
+			std::cout << "Bench: " << scene.name << " (" << (warmCache ? "warm" : "cold") << " pipeline cache)" << std::endl;
+			runs << (runCount > 0 ? ",\n" : "");
+			if (!runScene(scene, options, warmCache, runs, deviceJson))
+			{
+				failedRuns++;
+			}
+			runCount++;
+		}
+	}
+
+	if (runCount == 0)
+	{
+		std::cout << "ERROR: no bench scene named \"" << options.sceneFilter << "\"" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ofstream output(options.outputPath, std::ios::trunc);
+	output << "{\n  \"device\": " << (deviceJson.empty() ? "null" : deviceJson) << ",\n"
+		<< "  \"settings\": {\"width\": " << options.extent.width << ", \"height\": " << options.extent.height << ", \"warmupFrames\": " << options.warmupFrames
+		<< ", \"measuredFrames\": " << options.measuredFrames << ", \"parallelInit\": " << jsonBool(options.parallelInit)
+		<< ", \"cpuProfiling\": " << jsonBool(CPU_PROFILING_ENABLED) << "},\n"
+		<< "  \"runs\": [\n" << runs.str() << "\n  ]\n}\n";
+	output.close();
+	if (!output)
+	{
+		std::cout << "Failed to write " << options.outputPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Bench: " << runCount - failedRuns << " of " << runCount << " runs succeeded, results in " << options.outputPath << std::endl;
+	return failedRuns == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
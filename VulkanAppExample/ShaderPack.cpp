@@ -0,0 +1,208 @@
+#include "ShaderPack.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "CpuProfiler.h"
+
+// First word of every SPIR-V module
+static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+ShaderPack::ShaderPack()
+{
+}
+
+void ShaderPack::open(const std::string& filePath)
+{
+	PROFILE_FUNCTION();
+
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("ERROR: Failed to open shader pack " + filePath);
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("ERROR: Failed to map shader pack " + filePath);
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+	mappedData = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int file = ::open(filePath.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		throw std::runtime_error("ERROR: Failed to open shader pack " + filePath);
+	}
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0)
+	{
+		::close(file);
+		throw std::runtime_error("ERROR: Failed to read the size of shader pack " + filePath);
+	}
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+
+	void* mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);		// The mapping keeps its own reference to the file
+	mappedData = mapping == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(mapping);
+#endif
+
+	if (mappedData == nullptr)
+	{
+		close();
+		throw std::runtime_error("ERROR: Failed to map shader pack " + filePath);
+	}
+
+	validate(filePath);
+}
+
+void ShaderPack::close()
+{
+	if (mappedData != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mappedData);
+#else
+		munmap(const_cast<unsigned char*>(mappedData), mappedSize);
+#endif
+	}
+
+#ifdef _WIN32
+	if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+	if (fileHandle != nullptr) CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#endif
+
+	mappedData = nullptr;
+	mappedSize = 0;
+	entries = nullptr;
+	entryCount = 0;
+}
+
+ShaderCode ShaderPack::find(const std::string& name) const
+{
+	// Index is sorted by name, so binary search it in place
+	const ShaderPackEntry* end = entries + entryCount;
+	const ShaderPackEntry* entry = std::lower_bound(entries, end, name, [](const ShaderPackEntry& e, const std::string& n) {
+		return strncmp(e.name, n.c_str(), SHADER_PACK_NAME_LENGTH) < 0;
+	});
+
+	ShaderCode shaderCode;
+	if (entry != end && strncmp(entry->name, name.c_str(), SHADER_PACK_NAME_LENGTH) == 0)
+	{
+		shaderCode.code = reinterpret_cast<const uint32_t*>(mappedData + entry->offset);
+		shaderCode.size = entry->size;
+	}
+	return shaderCode;
+}
+
+ShaderCode ShaderPack::get(const std::string& name) const
+{
+	ShaderCode shaderCode = find(name);
+	if (shaderCode.code == nullptr)
+	{
+		throw std::runtime_error("ERROR: Shader " + name + " is not in the shader pack");
+	}
+	return shaderCode;
+}
+
+std::string ShaderPack::locate(const std::string& fileName)
+{
+	std::vector<std::string> candidates;
+
+	// Directory of the running executable, so the pack is found whatever the working directory is
+#ifdef _WIN32
+	char exePath[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, exePath, MAX_PATH);
+	std::string exe(exePath, length);
+#else
+	char exePath[4096];
+	ssize_t length = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+	std::string exe(exePath, length > 0 ? static_cast<size_t>(length) : 0);
+#endif
+	size_t slash = exe.find_last_of("/\\");
+	if (slash != std::string::npos)
+	{
+		candidates.push_back(exe.substr(0, slash + 1) + fileName);
+	}
+
+	// Layout used when running from the project directory
+	candidates.push_back("../Shaders/" + fileName);
+	candidates.push_back(fileName);
+
+	for (const auto& candidate : candidates)
+	{
+		if (std::ifstream(candidate, std::ios::binary).is_open())
+		{
+			return candidate;
+		}
+	}
+
+	throw std::runtime_error("ERROR: Can't find shader pack " + fileName);
+}
+
+ShaderPack::~ShaderPack()
+{
+	close();
+}
+
+void ShaderPack::validate(const std::string& filePath)
+{
+	ShaderPackHeader header;
+	if (mappedSize < sizeof(header))
+	{
+		close();
+		throw std::runtime_error("ERROR: Shader pack " + filePath + " is truncated");
+	}
+	memcpy(&header, mappedData, sizeof(header));
+
+	if (header.magic != SHADER_PACK_MAGIC || header.version != SHADER_PACK_VERSION ||
+		mappedSize < sizeof(header) + static_cast<size_t>(header.entryCount) * sizeof(ShaderPackEntry))
+	{
+		close();
+		throw std::runtime_error("ERROR: " + filePath + " is not a valid shader pack");
+	}
+
+	entries = reinterpret_cast<const ShaderPackEntry*>(mappedData + sizeof(header));
+	entryCount = header.entryCount;
+
+	// Check every blob once up front so later lookups can hand out pointers without any checks
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		const ShaderPackEntry& entry = entries[i];
+		bool valid = entry.offset % sizeof(uint32_t) == 0 && entry.size % sizeof(uint32_t) == 0 && entry.size >= sizeof(uint32_t) &&
+			static_cast<size_t>(entry.offset) + entry.size <= mappedSize &&
+			*reinterpret_cast<const uint32_t*>(mappedData + entry.offset) == SPIRV_MAGIC;
+		if (!valid)
+		{
+			close();
+			throw std::runtime_error("ERROR: Shader pack " + filePath + " has a corrupt entry");
+		}
+	}
+}
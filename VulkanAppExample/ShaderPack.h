@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Shader pack file layout (all little endian), written at build time by Shaders/pack_shaders.py:
+//	ShaderPackHeader
+//	ShaderPackEntry[entryCount]		index, sorted by name
+//	SPIR-V blobs					each starting on a SHADER_PACK_ALIGNMENT boundary
+// Keep this in sync with the packing script.
+const uint32_t SHADER_PACK_MAGIC = 0x4B415053;		// 'SPAK'
+const uint32_t SHADER_PACK_VERSION = 1;
+const uint32_t SHADER_PACK_ALIGNMENT = 16;
+const uint32_t SHADER_PACK_NAME_LENGTH = 56;
+
+struct ShaderPackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+};
+
+struct ShaderPackEntry {
+	char name[SHADER_PACK_NAME_LENGTH];		// Null terminated source file name, e.g. "shader.vert"
+	uint32_t offset;						// Offset of the SPIR-V from the start of the file
+	uint32_t size;							// Size of the SPIR-V in bytes (multiple of 4)
+};
+
+// A SPIR-V blob inside the mapped pack. Points straight into the mapping, no copy is made.
+struct ShaderCode {
+	const uint32_t *code = nullptr;
+	size_t size = 0;						// In bytes, as vkCreateShaderModule expects
+};
+
+// Read-only, memory mapped view of a shader pack. The pack is mapped once and every shader
+// is handed out as a pointer into the mapping, so loading a shader costs no syscall or allocation.
+class ShaderPack
+{
+public:
+
+	ShaderPack();
+
+	void open(const std::string &filePath);
+	void close();
+
+	bool isOpen() const { return mappedData != nullptr; }
+	ShaderCode find(const std::string &name) const;
+	ShaderCode get(const std::string &name) const;		// Same as find, but throws if missing
+
+	// Looks next to the executable first, then in the working directory's ../Shaders
+	static std::string locate(const std::string &fileName);
+
+	~ShaderPack();
+
+private:
+	const unsigned char *mappedData = nullptr;
+	size_t mappedSize = 0;
+	const ShaderPackEntry *entries = nullptr;
+	uint32_t entryCount = 0;
+
+#ifdef _WIN32
+	void *fileHandle = nullptr;
+	void *mappingHandle = nullptr;
+#endif
+
+	void validate(const std::string &filePath);
+};
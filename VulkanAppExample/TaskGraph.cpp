@@ -0,0 +1,163 @@
+#include "TaskGraph.h"
+
+#include <stdexcept>
+
+#include "CpuProfiler.h"
+
+TaskGraph::TaskGraph()
+{
+}
+
+TaskGraph::TaskId TaskGraph::addTask(const char* name, std::function<void()> task, std::initializer_list<TaskId> dependencies)
+{
+	return addTask(name, std::move(task), std::vector<TaskId>(dependencies));
+}
+
+TaskGraph::TaskId TaskGraph::addTask(const char* name, std::function<void()> task, const std::vector<TaskId>& dependencies)
+{
+	TaskId taskId = static_cast<TaskId>(tasks.size());
+
+	// Only earlier tasks can be depended on, so the graph can't have cycles
+	for (TaskId dependency : dependencies)
+	{
+		if (dependency >= taskId)
+		{
+			throw std::runtime_error(std::string("ERROR: Task ") + name + " depends on a task that hasn't been added yet!");
+		}
+		tasks[dependency].dependents.push_back(taskId);
+	}
+
+	Task newTask;
+	newTask.name = name;
+	newTask.function = std::move(task);
+	newTask.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	tasks.push_back(std::move(newTask));
+
+	return taskId;
+}
+
+void TaskGraph::run(ThreadPool& threadPool)
+{
+	timings.clear();
+	runStart = std::chrono::steady_clock::now();
+
+	std::vector<TaskId> readyTasks;
+	{
+		std::lock_guard<std::mutex> lock(graphMutex);
+		unfinishedTasks = static_cast<uint32_t>(tasks.size());
+		taskException = nullptr;
+		for (TaskId taskId = 0; taskId < tasks.size(); taskId++)
+		{
+			tasks[taskId].pendingDependencies = tasks[taskId].dependencyCount;
+			if (tasks[taskId].dependencyCount == 0)
+			{
+				readyTasks.push_back(taskId);
+			}
+		}
+	}
+
+	for (TaskId taskId : readyTasks)
+	{
+		threadPool.enqueue([this, &threadPool, taskId](uint32_t worker) { execute(threadPool, taskId, worker); });
+	}
+
+	std::unique_lock<std::mutex> lock(graphMutex);
+	graphDone.wait(lock, [this]() { return unfinishedTasks == 0; });
+
+	if (taskException)
+	{
+		std::rethrow_exception(taskException);
+	}
+}
+
+void TaskGraph::runSerial()
+{
+	timings.clear();
+	runStart = std::chrono::steady_clock::now();
+
+	// Dependencies always come before their dependents, so insertion order is a valid order
+	for (TaskId taskId = 0; taskId < tasks.size(); taskId++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		{
+			PROFILE_ZONE(tasks[taskId].name);
+			tasks[taskId].function();
+		}
+		recordTiming(taskId, start, 0);
+	}
+}
+
+TaskGraph::~TaskGraph()
+{
+}
+
+void TaskGraph::execute(ThreadPool& threadPool, TaskId taskId, uint32_t worker)
+{
+	Task& task = tasks[taskId];
+
+	// Once something has failed, the rest of the graph is only walked, not run
+	bool skip;
+	{
+		std::lock_guard<std::mutex> lock(graphMutex);
+		skip = taskException != nullptr;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if (!skip)
+	{
+		try
+		{
+			PROFILE_ZONE(task.name);
+			task.function();
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(graphMutex);
+			if (!taskException)
+			{
+				taskException = std::current_exception();
+			}
+		}
+	}
+
+	std::vector<TaskId> readyTasks;
+	{
+		std::lock_guard<std::mutex> lock(graphMutex);
+		if (!skip)
+		{
+			recordTiming(taskId, start, worker);
+		}
+
+		for (TaskId dependent : task.dependents)
+		{
+			if (--tasks[dependent].pendingDependencies == 0)
+			{
+				readyTasks.push_back(dependent);
+			}
+		}
+
+		// The waiter may return as soon as this hits zero, nothing of the graph can be touched afterwards
+		if (--unfinishedTasks == 0)
+		{
+			graphDone.notify_all();
+		}
+	}
+
+	// Enqueued outside the lock: a pool without workers runs the job right here
+	for (TaskId dependent : readyTasks)
+	{
+		threadPool.enqueue([this, &threadPool, dependent](uint32_t nextWorker) { execute(threadPool, dependent, nextWorker); });
+	}
+}
+
+void TaskGraph::recordTiming(TaskId taskId, std::chrono::steady_clock::time_point start, uint32_t worker)
+{
+	auto end = std::chrono::steady_clock::now();
+
+	TaskTiming timing;
+	timing.name = tasks[taskId].name;
+	timing.startMs = std::chrono::duration<double, std::milli>(start - runStart).count();
+	timing.durationMs = std::chrono::duration<double, std::milli>(end - start).count();
+	timing.worker = worker;
+	timings.push_back(timing);
+}
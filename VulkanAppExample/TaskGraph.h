@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+
+#include "ThreadPool.h"
+
+// When one task of a graph ran, relative to the start of the run
+struct TaskTiming {
+	const char *name;
+	double startMs;
+	double durationMs;
+	uint32_t worker;				// Thread pool worker that ran it
+};
+
+// A set of tasks with dependencies between them. run() starts every task as soon as the tasks it depends on
+// have finished, so independent work overlaps on the thread pool.
+class TaskGraph
+{
+public:
+	using TaskId = uint32_t;
+
+	TaskGraph();
+
+	// Dependencies must have been added before. name is also the task's CPU profiler zone, so it must be a
+	// string literal (or otherwise outlive the profiler).
+	TaskId addTask(const char *name, std::function<void()> task, std::initializer_list<TaskId> dependencies = {});
+	TaskId addTask(const char *name, std::function<void()> task, const std::vector<TaskId> &dependencies);
+
+	// Runs every task and returns once they have all finished. If a task throws, nothing that depends on it
+	// is started, tasks already running are waited for, and the first exception is rethrown.
+	void run(ThreadPool &threadPool);
+
+	// Runs every task on the calling thread, in the order they were added
+	void runSerial();
+
+	const std::vector<TaskTiming> &getTimings() const { return timings; }
+
+	~TaskGraph();
+
+private:
+	struct Task {
+		const char *name;
+		std::function<void()> function;
+		std::vector<TaskId> dependents;		// Tasks waiting on this one
+		uint32_t dependencyCount = 0;
+		uint32_t pendingDependencies = 0;		// Counts down while running
+	};
+
+	std::vector<Task> tasks;
+	std::vector<TaskTiming> timings;
+	std::chrono::steady_clock::time_point runStart;
+
+	// State of a parallel run
+	std::mutex graphMutex;
+	std::condition_variable graphDone;
+	uint32_t unfinishedTasks = 0;			// Started or still to start
+	std::exception_ptr taskException;
+
+	void execute(ThreadPool &threadPool, TaskId taskId, uint32_t worker);
+	void recordTiming(TaskId taskId, std::chrono::steady_clock::time_point start, uint32_t worker);
+};
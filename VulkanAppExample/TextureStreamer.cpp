@@ -0,0 +1,510 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "CpuProfiler.h"
+
+// Updates without a request before a texture's demand is considered gone and its fine levels become evictable
+static const uint64_t DEMAND_TIMEOUT_FRAMES = 60;
+
+// Updates between two reads of the driver's memory budget, the query isn't free
+static const uint64_t BUDGET_QUERY_INTERVAL = 30;
+
+// Part of the driver's remaining budget the textures may grow into, the rest is left to everything else
+static const double DRIVER_BUDGET_SHARE = 0.8;
+
+TextureStreamer::TextureStreamer()
+{
+}
+
+void TextureStreamer::create(VkDevice logicalDevice, MemoryAllocator* memoryAllocator, UploadManager* uploadManager, BindlessTable* bindlessTable,
+	uint32_t framesInFlight, VkDeviceSize budget, VkDeviceSize uploadBytesPerFrame, uint32_t loadThreads)
+{
+	PROFILE_FUNCTION();
+
+	device = logicalDevice;
+	allocator = memoryAllocator;
+	uploads = uploadManager;
+	bindless = bindlessTable;
+	this->framesInFlight = std::max(framesInFlight, 1u);
+	this->budget = budget;
+	effectiveBudget = budget;
+	this->uploadBytesPerFrame = uploadBytesPerFrame;
+
+	// Enough loads queued to keep every loader thread busy while the previous results upload
+	loadThreads = std::max(loadThreads, 1u);
+	maxPendingLoads = loadThreads * 2;
+	loaderPool.start(loadThreads);
+
+	// One sampler for every texture: trilinear, and no LOD clamp since each image view only holds resident levels
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerCreateInfo.mipLodBias = 0.0f;
+	samplerCreateInfo.anisotropyEnable = VK_FALSE;
+	samplerCreateInfo.maxAnisotropy = 1.0f;
+	samplerCreateInfo.compareEnable = VK_FALSE;
+	samplerCreateInfo.minLod = 0.0f;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+
+	VkResult result = vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create the texture Sampler!");
+	}
+}
+
+void TextureStreamer::destroy()
+{
+	loaderPool.stop();
+	completedLoads.clear();
+
+	for (auto& retired : retiredImages)
+	{
+		destroyImage(retired.image);
+	}
+	retiredImages.clear();
+	for (auto& texture : textures)
+	{
+		destroyImage(texture.current);
+		destroyImage(texture.next);
+	}
+	textures.clear();
+
+	vkDestroySampler(device, sampler, nullptr);
+	sampler = VK_NULL_HANDLE;
+}
+
+uint32_t TextureStreamer::addTexture(const std::string& name, uint32_t width, uint32_t height, TextureLoader loader)
+{
+	PROFILE_FUNCTION();
+
+	Texture texture;
+	texture.name = name;
+	texture.width = std::max(width, 1u);
+	texture.height = std::max(height, 1u);
+	texture.loader = loader;
+
+	// Full chain down to 1x1, and the finest level that is no bigger than the tail size
+	uint32_t largest = std::max(texture.width, texture.height);
+	texture.mipCount = 1;
+	while ((largest >> texture.mipCount) > 0)
+	{
+		texture.mipCount++;
+	}
+	while ((largest >> texture.tailMip) > TAIL_SIZE)
+	{
+		texture.tailMip++;
+	}
+
+	std::vector<TextureMip> mips = texture.loader(texture.tailMip);
+	uint64_t ticket;
+	bytesUploaded += uploadChain(texture, texture.tailMip, mips, &texture.current, &ticket);
+
+	// The frame that flushes this upload waits for it, so the tail can be sampled from the first frame
+	texture.current.bindlessIndex = bindless->addImage(texture.current.imageView, sampler);
+	if (texture.current.bindlessIndex == BindlessTable::INVALID_INDEX)
+	{
+		destroyImage(texture.current);
+		throw std::runtime_error("ERROR: No bindless slot left for texture " + name);
+	}
+	texture.targetMip = texture.tailMip;
+	texture.requestedMip = texture.tailMip;
+	texture.wantedMip = texture.tailMip;
+
+	textures.push_back(std::move(texture));
+	return static_cast<uint32_t>(textures.size() - 1);
+}
+
+void TextureStreamer::requestResolution(uint32_t texture, float texelsAcross)
+{
+	Texture& entry = textures[texture];
+
+	// Level whose width matches what is on screen, never finer than mip 0 or coarser than the tail
+	float texelsPerPixel = static_cast<float>(std::max(entry.width, entry.height)) / std::max(texelsAcross, 1.0f);
+	uint32_t mip = texelsPerPixel <= 1.0f ? 0 : static_cast<uint32_t>(std::floor(std::log2(texelsPerPixel)));
+	mip = std::min(mip, entry.tailMip);
+
+	entry.requestedMip = entry.requested ? std::min(entry.requestedMip, mip) : mip;
+	entry.requested = true;
+	entry.lastRequestFrame = frameCounter;
+}
+
+void TextureStreamer::update()
+{
+	PROFILE_FUNCTION();
+
+	frameCounter++;
+
+	// -- RETIRE --
+	// The last frame that could sample a retired image was recorded before it was retired, and every frame slot
+	// has been waited on since
+	while (!retiredImages.empty() && retiredImages.front().retireFrame + framesInFlight <= frameCounter)
+	{
+		destroyImage(retiredImages.front().image);
+		retiredImages.pop_front();
+	}
+
+	// -- SWAP IN FINISHED UPLOADS --
+	for (auto& texture : textures)
+	{
+		if (texture.next.image == VK_NULL_HANDLE || !uploads->isComplete(texture.nextTicket))
+		{
+			continue;
+		}
+
+		// A new slot rather than rewriting the old one, which frames in flight may still read
+		texture.next.bindlessIndex = bindless->addImage(texture.next.imageView, sampler);
+		if (texture.next.bindlessIndex == BindlessTable::INVALID_INDEX)
+		{
+			continue;		// Table full, try again next frame
+		}
+
+		if (texture.next.firstMip < texture.current.firstMip)
+		{
+			levelsStreamedIn += texture.current.firstMip - texture.next.firstMip;
+		}
+		else
+		{
+			levelsEvicted += texture.next.firstMip - texture.current.firstMip;
+		}
+		retireImage(texture.current);
+		texture.current = texture.next;
+		texture.next = TextureImage();
+		texture.busy = false;
+	}
+
+	// -- UPLOAD FINISHED LOADS --
+	// Only so many bytes a frame, so a burst of loads spreads over several frames instead of stalling one
+	VkDeviceSize uploadedThisFrame = 0;
+	while (uploadedThisFrame < uploadBytesPerFrame)
+	{
+		LoadResult load;
+		{
+			std::lock_guard<std::mutex> lock(loadMutex);
+			if (completedLoads.empty())
+			{
+				break;
+			}
+			load = std::move(completedLoads.front());
+			completedLoads.pop_front();
+		}
+
+		Texture& texture = textures[load.texture];
+		if (load.mips.empty())
+		{
+			texture.failed = true;
+			texture.busy = false;
+			texture.targetMip = texture.current.firstMip;
+			continue;
+		}
+		uploadedThisFrame += uploadChain(texture, load.firstMip, load.mips, &texture.next, &texture.nextTicket);
+	}
+	bytesUploaded += uploadedThisFrame;
+
+	// -- DEMAND --
+	for (auto& texture : textures)
+	{
+		if (texture.requested)
+		{
+			texture.wantedMip = texture.requestedMip;
+			texture.requested = false;
+		}
+		else if (frameCounter - texture.lastRequestFrame > DEMAND_TIMEOUT_FRAMES)
+		{
+			texture.wantedMip = texture.tailMip;
+		}
+	}
+
+	// -- BUDGET --
+	updateBudget();
+
+	// What memory will look like once every load in flight has landed
+	VkDeviceSize projectedBytes = 0;
+	uint32_t pendingLoads = 0;
+	for (const auto& texture : textures)
+	{
+		projectedBytes += chainBytes(texture, texture.targetMip);
+		pendingLoads += texture.busy ? 1 : 0;
+	}
+
+	// -- EVICT --
+	// One level at a time, from textures that have more than they need first, then the ones asked for longest ago
+	while (projectedBytes > effectiveBudget)
+	{
+		Texture* victim = nullptr;
+		for (auto& texture : textures)
+		{
+			if (texture.busy || texture.failed || texture.targetMip >= texture.tailMip)
+			{
+				continue;
+			}
+			bool overResident = texture.targetMip < texture.wantedMip;
+			bool victimOverResident = victim != nullptr && victim->targetMip < victim->wantedMip;
+			if (victim == nullptr || (overResident && !victimOverResident) ||
+				(overResident == victimOverResident && texture.lastRequestFrame < victim->lastRequestFrame))
+			{
+				victim = &texture;
+			}
+		}
+		if (victim == nullptr)
+		{
+			break;			// Everything is down to its tail or busy
+		}
+
+		projectedBytes -= chainBytes(*victim, victim->targetMip) - chainBytes(*victim, victim->targetMip + 1);
+		startLoad(static_cast<uint32_t>(victim - textures.data()), victim->targetMip + 1);
+		pendingLoads++;
+	}
+
+	// -- STREAM IN --
+	// Largest shortfall first, then the most recently asked for
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < textures.size(); i++)
+	{
+		const Texture& texture = textures[i];
+		if (!texture.busy && !texture.failed && texture.targetMip > texture.wantedMip)
+		{
+			candidates.push_back(i);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) {
+		uint32_t shortfallA = textures[a].targetMip - textures[a].wantedMip;
+		uint32_t shortfallB = textures[b].targetMip - textures[b].wantedMip;
+		if (shortfallA != shortfallB)
+		{
+			return shortfallA > shortfallB;
+		}
+		return textures[a].lastRequestFrame > textures[b].lastRequestFrame;
+	});
+
+	for (uint32_t index : candidates)
+	{
+		if (pendingLoads >= maxPendingLoads)
+		{
+			break;
+		}
+
+		Texture& texture = textures[index];
+		VkDeviceSize growth = chainBytes(texture, texture.targetMip - 1) - chainBytes(texture, texture.targetMip);
+		if (projectedBytes + growth > effectiveBudget)
+		{
+			continue;		// A smaller texture further down may still fit
+		}
+
+		projectedBytes += growth;
+		startLoad(index, texture.targetMip - 1);
+		pendingLoads++;
+	}
+}
+
+TextureStreamerStats TextureStreamer::getStats() const
+{
+	TextureStreamerStats stats;
+	stats.textureCount = static_cast<uint32_t>(textures.size());
+	stats.budgetBytes = effectiveBudget;
+	stats.levelsStreamedIn = levelsStreamedIn;
+	stats.levelsEvicted = levelsEvicted;
+	stats.bytesUploaded = bytesUploaded;
+
+	for (const auto& texture : textures)
+	{
+		stats.residentBytes += texture.current.allocation.size;
+		stats.satisfiedCount += texture.current.firstMip <= texture.wantedMip ? 1 : 0;
+		stats.pendingLoads += texture.busy ? 1 : 0;
+	}
+	return stats;
+}
+
+TextureMip TextureStreamer::downsample(const TextureMip& mip)
+{
+	TextureMip result;
+	result.width = std::max(mip.width / 2, 1u);
+	result.height = std::max(mip.height / 2, 1u);
+	result.texels.resize(static_cast<size_t>(result.width) * result.height * 4);
+
+	// Odd sizes drop the last row or column, clamped so 1 texel wide levels still read inside the source
+	for (uint32_t y = 0; y < result.height; y++)
+	{
+		for (uint32_t x = 0; x < result.width; x++)
+		{
+			uint32_t x0 = std::min(x * 2, mip.width - 1);
+			uint32_t x1 = std::min(x * 2 + 1, mip.width - 1);
+			uint32_t y0 = std::min(y * 2, mip.height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, mip.height - 1);
+			for (uint32_t channel = 0; channel < 4; channel++)
+			{
+				uint32_t sum = mip.texels[(static_cast<size_t>(y0) * mip.width + x0) * 4 + channel] +
+					mip.texels[(static_cast<size_t>(y0) * mip.width + x1) * 4 + channel] +
+					mip.texels[(static_cast<size_t>(y1) * mip.width + x0) * 4 + channel] +
+					mip.texels[(static_cast<size_t>(y1) * mip.width + x1) * 4 + channel];
+				result.texels[(static_cast<size_t>(y) * result.width + x) * 4 + channel] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+	return result;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+}
+
+void TextureStreamer::updateBudget()
+{
+	// The configured budget, lowered when the driver says the heap has less room than that left. The driver's usage
+	// already includes the textures, so they may keep what they have plus a share of the remaining room.
+	if (!allocator->hasMemoryBudget() || heapIndex == UINT32_MAX || frameCounter % BUDGET_QUERY_INTERVAL != 1)
+	{
+		return;
+	}
+
+	HeapStats heap = allocator->getHeapStats()[heapIndex];
+	VkDeviceSize residentBytes = 0;
+	for (const auto& texture : textures)
+	{
+		residentBytes += texture.current.allocation.size + texture.next.allocation.size;
+	}
+	VkDeviceSize headroom = heap.budget > heap.usage ? heap.budget - heap.usage : 0;
+	VkDeviceSize driverBudget = residentBytes + static_cast<VkDeviceSize>(headroom * DRIVER_BUDGET_SHARE);
+	effectiveBudget = std::min(budget, driverBudget);
+}
+
+void TextureStreamer::startLoad(uint32_t textureIndex, uint32_t firstMip)
+{
+	Texture& texture = textures[textureIndex];
+	texture.busy = true;
+	texture.targetMip = firstMip;
+
+	// The loader is copied, textures may be reallocated by addTexture while the job runs
+	TextureLoader loader = texture.loader;
+	uint32_t levelCount = texture.mipCount - firstMip;
+	loaderPool.enqueue([this, textureIndex, firstMip, levelCount, loader](uint32_t) {
+		LoadResult load;
+		load.texture = textureIndex;
+		load.firstMip = firstMip;
+		try
+		{
+			load.mips = loader(firstMip);
+		}
+		catch (const std::exception&)
+		{
+			load.mips.clear();
+		}
+
+		// A chain too short for the image fails the same way, and its pixels are freed here rather than queued
+		if (load.mips.size() < levelCount)
+		{
+			load.mips.clear();
+		}
+
+		std::lock_guard<std::mutex> lock(loadMutex);
+		completedLoads.push_back(std::move(load));
+	});
+}
+
+VkDeviceSize TextureStreamer::uploadChain(Texture& texture, uint32_t firstMip, const std::vector<TextureMip>& mips, TextureImage* image, uint64_t* ticket)
+{
+	uint32_t levelCount = texture.mipCount - firstMip;
+	if (mips.size() < levelCount)
+	{
+		throw std::runtime_error("ERROR: Texture " + texture.name + " loader returned too few mip levels!");
+	}
+
+	// -- IMAGE --
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	imageCreateInfo.extent = { mips[0].width, mips[0].height, 1 };
+	imageCreateInfo.mipLevels = levelCount;							// firstMip is the image's level 0
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;		// The upload manager hands it over to graphics
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	image->firstMip = firstMip;
+	image->image = allocator->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &image->allocation);
+	heapIndex = allocator->getMemoryProperties().memoryTypes[image->allocation.memoryTypeIndex].heapIndex;
+
+	// Every resident level, so sampling never reaches a level that isn't there
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = image->image;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewCreateInfo.format = imageCreateInfo.format;
+	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewCreateInfo.subresourceRange.baseMipLevel = 0;
+	viewCreateInfo.subresourceRange.levelCount = levelCount;
+	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	viewCreateInfo.subresourceRange.layerCount = 1;
+
+	VkResult result = vkCreateImageView(device, &viewCreateInfo, nullptr, &image->imageView);
+	if (result != VK_SUCCESS)
+	{
+		allocator->destroyImage(image->image, image->allocation);
+		image->image = VK_NULL_HANDLE;
+		throw std::runtime_error("ERROR: Failed to create a texture Image View!");
+	}
+
+	// -- UPLOAD --
+	// Levels come from one batch, so the last ticket covers them all
+	VkDeviceSize bytes = 0;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const TextureMip& mip = mips[level];
+		*ticket = uploads->uploadImage(image->image, { mip.width, mip.height, 1 }, level, mip.texels.data(), mip.texels.size(),
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		bytes += mip.texels.size();
+	}
+	return bytes;
+}
+
+void TextureStreamer::retireImage(TextureImage& image)
+{
+	if (image.image != VK_NULL_HANDLE)
+	{
+		retiredImages.push_back({ image, frameCounter });
+	}
+	image = TextureImage();
+}
+
+void TextureStreamer::destroyImage(TextureImage& image)
+{
+	if (image.bindlessIndex != BindlessTable::INVALID_INDEX)
+	{
+		bindless->removeImage(image.bindlessIndex);
+	}
+	if (image.image != VK_NULL_HANDLE)
+	{
+		vkDestroyImageView(device, image.imageView, nullptr);
+		allocator->destroyImage(image.image, image.allocation);
+	}
+	image = TextureImage();
+}
+
+VkDeviceSize TextureStreamer::chainBytes(const Texture& texture, uint32_t firstMip) const
+{
+	VkDeviceSize bytes = 0;
+	for (uint32_t level = firstMip; level < texture.mipCount; level++)
+	{
+		VkDeviceSize width = std::max(texture.width >> level, 1u);
+		VkDeviceSize height = std::max(texture.height >> level, 1u);
+		bytes += width * height * 4;
+	}
+	return bytes;
+}
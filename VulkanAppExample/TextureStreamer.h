@@ -0,0 +1,154 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+
+#include "MemoryAllocator.h"
+#include "UploadManager.h"
+#include "BindlessTable.h"
+#include "ThreadPool.h"
+
+// Texels of one mip level, tightly packed RGBA8
+struct TextureMip {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> texels;
+};
+
+// Produces a texture's levels from firstMip down to 1x1, coarsest last. Runs on a loader thread, so it must be
+// thread safe. Levels come precomputed (authored, or derived with TextureStreamer::downsample): the uploads run
+// on the transfer queue, which can't blit.
+typedef std::function<std::vector<TextureMip>(uint32_t firstMip)> TextureLoader;
+
+struct TextureStreamerStats {
+	uint32_t textureCount = 0;
+	uint32_t satisfiedCount = 0;		// Textures with every level their demand asks for resident
+	uint32_t pendingLoads = 0;			// Loads and uploads in flight
+	VkDeviceSize residentBytes = 0;		// Device memory of the images in use
+	VkDeviceSize budgetBytes = 0;		// Budget of the last update, after the driver's cap
+	uint64_t levelsStreamedIn = 0;
+	uint64_t levelsEvicted = 0;
+	uint64_t bytesUploaded = 0;
+};
+
+// Streams texture mip levels by screen space demand within a device memory budget. Every texture keeps its coarse
+// tail (TAIL_SIZE texels and below) resident from the start; finer levels are loaded on the streamer's own threads,
+// one level at a time, while the renderer keeps drawing with what is resident. Over budget, the finest levels of the
+// textures that need them least are dropped again.
+//
+// Without sparse residency an image can't gain or lose levels, so every change builds a new image with the new chain
+// and swaps it in once its upload has completed; the old one is destroyed once no frame in flight can use it. The
+// image's bindless slot changes with it, so look it up every frame (getBindlessIndex).
+class TextureStreamer
+{
+public:
+	static const uint32_t TAIL_SIZE = 64;
+
+	TextureStreamer();
+
+	void create(VkDevice logicalDevice, MemoryAllocator *memoryAllocator, UploadManager *uploadManager, BindlessTable *bindlessTable,
+		uint32_t framesInFlight, VkDeviceSize budget, VkDeviceSize uploadBytesPerFrame, uint32_t loadThreads);
+	void destroy();			// Waits for the loader threads. The GPU must be done with every texture.
+
+	// Loads the tail on this thread and returns the texture's id. Not thread safe, call before rendering starts.
+	uint32_t addTexture(const std::string &name, uint32_t width, uint32_t height, TextureLoader loader);
+
+	// The texture is drawn texelsAcross texels wide on screen (for its whole width). Called from the render thread;
+	// the finest level asked for since the last update wins.
+	void requestResolution(uint32_t texture, float texelsAcross);
+
+	// Once per frame, on the render thread, after the frame's fence: retires images no frame uses any more, swaps in
+	// finished uploads and starts new loads and evictions, within the budget and the per frame upload limit
+	void update();
+
+	uint32_t getBindlessIndex(uint32_t texture) const { return textures[texture].current.bindlessIndex; }
+	uint32_t getResidentMip(uint32_t texture) const { return textures[texture].current.firstMip; }
+	uint32_t getTextureCount() const { return static_cast<uint32_t>(textures.size()); }
+	TextureStreamerStats getStats() const;
+
+	// 2x2 box filter, for loaders that only have the top level
+	static TextureMip downsample(const TextureMip &mip);
+
+	~TextureStreamer();
+
+private:
+	// One image holding levels [firstMip, mipCount) of a texture
+	struct TextureImage {
+		VkImage image = VK_NULL_HANDLE;
+		Allocation allocation;
+		VkImageView imageView = VK_NULL_HANDLE;
+		uint32_t bindlessIndex = BindlessTable::INVALID_INDEX;
+		uint32_t firstMip = 0;
+	};
+
+	struct Texture {
+		std::string name;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t mipCount = 1;
+		uint32_t tailMip = 0;							// Finest level of the tail, always resident
+		TextureLoader loader;
+
+		TextureImage current;							// What shaders sample
+		TextureImage next;								// Uploading, replaces current once nextTicket completes
+		uint64_t nextTicket = 0;
+		uint32_t targetMip = 0;							// current.firstMip, or the firstMip of the load in flight
+		bool busy = false;								// Loading or uploading
+		bool failed = false;							// The loader threw or returned too few levels, the texture stays as it is
+
+		uint32_t requestedMip = 0;						// Finest level asked for since the last update
+		bool requested = false;
+		uint32_t wantedMip = 0;							// Demand the last update acted on
+		uint64_t lastRequestFrame = 0;
+	};
+
+	struct LoadResult {
+		uint32_t texture;
+		uint32_t firstMip;
+		std::vector<TextureMip> mips;					// Empty if the loader failed or returned too few levels
+	};
+
+	struct RetiredImage {
+		TextureImage image;
+		uint64_t retireFrame;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator *allocator = nullptr;
+	UploadManager *uploads = nullptr;
+	BindlessTable *bindless = nullptr;
+	VkSampler sampler = VK_NULL_HANDLE;
+	uint32_t framesInFlight = 1;
+	VkDeviceSize budget = 0;
+	VkDeviceSize effectiveBudget = 0;
+	VkDeviceSize uploadBytesPerFrame = 0;
+	uint32_t maxPendingLoads = 1;
+	uint32_t heapIndex = UINT32_MAX;					// Of the memory the images live in, once the first one exists
+
+	std::vector<Texture> textures;
+	std::deque<RetiredImage> retiredImages;
+	uint64_t frameCounter = 0;
+
+	// Filled by the loader threads, drained by update
+	ThreadPool loaderPool;
+	std::mutex loadMutex;
+	std::deque<LoadResult> completedLoads;
+
+	// - Statistics
+	uint64_t levelsStreamedIn = 0;
+	uint64_t levelsEvicted = 0;
+	uint64_t bytesUploaded = 0;
+
+	// - Support Functions
+	void updateBudget();
+	void startLoad(uint32_t textureIndex, uint32_t firstMip);
+	VkDeviceSize uploadChain(Texture &texture, uint32_t firstMip, const std::vector<TextureMip> &mips, TextureImage *image, uint64_t *ticket);
+	void retireImage(TextureImage &image);
+	void destroyImage(TextureImage &image);
+	VkDeviceSize chainBytes(const Texture &texture, uint32_t firstMip) const;
+};
@@ -0,0 +1,169 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <string>
+
+#include "CpuProfiler.h"
+
+ThreadPool::ThreadPool()
+{
+}
+
+void ThreadPool::start(uint32_t threadCount)
+{
+	stop();
+
+	if (threadCount == 0)
+	{
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	stopping = false;
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+void ThreadPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+void ThreadPool::enqueue(std::function<void(uint32_t)> job)
+{
+	// Without workers (not started) there is nobody to hand the job to, so run it here
+	if (workers.empty())
+	{
+		job(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		jobs.push_back(std::move(job));
+	}
+	jobAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	allJobsDone.wait(lock, [this]() { return jobs.empty() && runningJobs == 0; });
+
+	if (jobException)
+	{
+		std::exception_ptr exception = jobException;
+		jobException = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::parallelFor(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task)
+{
+	if (taskCount == 0)
+	{
+		return;
+	}
+
+	// Completion is tracked per call rather than with waitIdle, so unrelated queued jobs don't hold this up
+	struct ParallelForState {
+		uint32_t remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::exception_ptr exception;
+	} state;
+	state.remaining = taskCount;
+
+	for (uint32_t taskIndex = 0; taskIndex < taskCount; taskIndex++)
+	{
+		enqueue([&state, &task, taskIndex](uint32_t workerIndex) {
+			try
+			{
+				task(taskIndex, workerIndex);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (!state.exception)
+				{
+					state.exception = std::current_exception();
+				}
+			}
+
+			// Decrement under the lock: the waiter may destroy state as soon as it sees zero
+			std::lock_guard<std::mutex> lock(state.mutex);
+			if (--state.remaining == 0)
+			{
+				state.done.notify_all();
+			}
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(state.mutex);
+	state.done.wait(lock, [&state]() { return state.remaining == 0; });
+
+	if (state.exception)
+	{
+		std::rethrow_exception(state.exception);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+void ThreadPool::workerLoop(uint32_t workerIndex)
+{
+	PROFILE_THREAD_NAME("Worker " + std::to_string(workerIndex));
+
+	while (true)
+	{
+		std::function<void(uint32_t)> job;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+			{
+				return;		// Stopping and nothing left to do
+			}
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			runningJobs++;
+		}
+
+		try
+		{
+			job(workerIndex);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if (!jobException)
+			{
+				jobException = std::current_exception();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			runningJobs--;
+			if (jobs.empty() && runningJobs == 0)
+			{
+				allJobsDone.notify_all();
+			}
+		}
+	}
+}
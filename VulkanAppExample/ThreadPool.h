@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+// Fixed set of worker threads fed from a single job queue. Every job is told the index of the worker running it,
+// which is stable for the life of the pool, so jobs can use per-thread resources (e.g. Vulkan command pools,
+// which must never be used from two threads at once) without locking.
+class ThreadPool
+{
+public:
+
+	ThreadPool();
+
+	void start(uint32_t threadCount);		// 0 = one per hardware thread
+	void stop();							// Finishes queued jobs first
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+	// Queue a job and return immediately
+	void enqueue(std::function<void(uint32_t workerIndex)> job);
+
+	// Wait for every queued job. Rethrows the first exception a job threw since the last wait.
+	void waitIdle();
+
+	// Run task(taskIndex, workerIndex) for every taskIndex in [0, taskCount) and return once all have finished.
+	// Rethrows the first exception a task threw.
+	void parallelFor(uint32_t taskCount, const std::function<void(uint32_t taskIndex, uint32_t workerIndex)> &task);
+
+	~ThreadPool();
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void(uint32_t)>> jobs;
+	std::mutex queueMutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable allJobsDone;
+	uint32_t runningJobs = 0;
+	bool stopping = false;
+	std::exception_ptr jobException;
+
+	void workerLoop(uint32_t workerIndex);
+};
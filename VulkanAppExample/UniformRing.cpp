@@ -0,0 +1,85 @@
+#include "UniformRing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "CpuProfiler.h"
+
+UniformRing::UniformRing()
+{
+}
+
+void UniformRing::create(MemoryAllocator* memoryAllocator, VkDeviceSize minUniformBufferOffsetAlignment, uint32_t framesInFlight, VkDeviceSize bytesPerFrame)
+{
+	PROFILE_FUNCTION();
+
+	allocator = memoryAllocator;
+	alignment = std::max<VkDeviceSize>(minUniformBufferOffsetAlignment, 1);
+	capacity = (bytesPerFrame + alignment - 1) / alignment * alignment;
+	stats = UniformRingStats();
+	stats.capacityPerFrame = capacity;
+
+	// Coherent, so writes need no flush. Device local as well where the driver offers it (resizable BAR, integrated GPUs).
+	frames.resize(framesInFlight);
+	for (auto& frame : frames)
+	{
+		frame.buffer = allocator->createBuffer(capacity, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			AllocationLifetime::Persistent, &frame.allocation);
+		if (frame.allocation.mapped == nullptr)
+		{
+			throw std::runtime_error("ERROR: Uniform ring memory isn't mapped!");
+		}
+	}
+
+	currentFrame = 0;
+	frameStarted = false;
+	head.store(0);
+	allocationCount.store(0);
+}
+
+void UniformRing::destroy()
+{
+	for (auto& frame : frames)
+	{
+		allocator->destroyBuffer(frame.buffer, frame.allocation);
+	}
+	frames.clear();
+}
+
+void UniformRing::beginFrame(uint32_t frameIndex)
+{
+	// The frame recorded before this one is complete, so its usage is final
+	if (frameStarted)
+	{
+		stats.bytesLastFrame = std::min(head.load(std::memory_order_relaxed), capacity);
+		stats.allocationsLastFrame = allocationCount.load(std::memory_order_relaxed);
+		stats.peakBytesPerFrame = std::max(stats.peakBytesPerFrame, stats.bytesLastFrame);
+	}
+
+	currentFrame = frameIndex;
+	frameStarted = true;
+	head.store(0, std::memory_order_relaxed);
+	allocationCount.store(0, std::memory_order_relaxed);
+}
+
+UniformAllocation UniformRing::allocate(VkDeviceSize size)
+{
+	// Sizes are rounded up, so every offset stays a multiple of the alignment without a compare-and-swap loop
+	VkDeviceSize alignedSize = (size + alignment - 1) / alignment * alignment;
+	VkDeviceSize offset = head.fetch_add(alignedSize, std::memory_order_relaxed);
+	if (offset + alignedSize > capacity)
+	{
+		throw std::runtime_error("ERROR: Uniform ring is full, raise RendererSettings::uniformRingSize!");
+	}
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	UniformAllocation allocation;
+	allocation.mapped = static_cast<char*>(frames[currentFrame].allocation.mapped) + offset;
+	allocation.offset = static_cast<uint32_t>(offset);
+	return allocation;
+}
+
+UniformRing::~UniformRing()
+{
+}
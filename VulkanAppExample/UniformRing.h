@@ -0,0 +1,72 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <atomic>
+#include <cstring>
+
+#include "MemoryAllocator.h"
+
+// Space handed out by a UniformRing, valid until the frame slot comes round again
+struct UniformAllocation {
+	void *mapped = nullptr;				// Write the uniform data here
+	uint32_t offset = 0;				// Dynamic offset to bind the frame's buffer with
+};
+
+struct UniformRingStats {
+	VkDeviceSize bytesLastFrame = 0;		// Including alignment padding
+	VkDeviceSize peakBytesPerFrame = 0;
+	VkDeviceSize capacityPerFrame = 0;
+	uint32_t allocationsLastFrame = 0;
+};
+
+// Persistently mapped, host coherent uniform buffer per frame in flight, handed out with a bump pointer.
+// Every allocation is aligned to minUniformBufferOffsetAlignment, so it can be bound through a
+// UNIFORM_BUFFER_DYNAMIC descriptor with its offset: a single descriptor set per frame covers every draw.
+// allocate() is one atomic add, so recording threads can share the ring without locking.
+class UniformRing
+{
+public:
+
+	UniformRing();
+
+	void create(MemoryAllocator *memoryAllocator, VkDeviceSize minUniformBufferOffsetAlignment, uint32_t framesInFlight, VkDeviceSize bytesPerFrame);
+	void destroy();
+
+	// Call once the GPU has finished the frame that last used this slot. Not thread safe with allocate().
+	void beginFrame(uint32_t frameIndex);
+
+	// Throws if the frame's space has run out
+	UniformAllocation allocate(VkDeviceSize size);
+
+	template <typename T>
+	UniformAllocation push(const T &data)
+	{
+		UniformAllocation allocation = allocate(sizeof(T));
+		std::memcpy(allocation.mapped, &data, sizeof(T));
+		return allocation;
+	}
+
+	VkBuffer getBuffer() const { return frames[currentFrame].buffer; }		// Of the current frame
+	UniformRingStats getStats() const { return stats; }
+
+	~UniformRing();
+
+private:
+	struct FrameBuffer {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation allocation;
+	};
+
+	MemoryAllocator *allocator = nullptr;
+	std::vector<FrameBuffer> frames;
+	VkDeviceSize alignment = 1;
+	VkDeviceSize capacity = 0;
+	uint32_t currentFrame = 0;
+	bool frameStarted = false;
+
+	std::atomic<VkDeviceSize> head{ 0 };				// Next free byte of the current frame's buffer
+	std::atomic<uint32_t> allocationCount{ 0 };
+	UniformRingStats stats;
+};
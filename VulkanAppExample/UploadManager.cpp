@@ -0,0 +1,484 @@
+#include "UploadManager.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "CpuProfiler.h"
+
+// Offset alignment of staged data: covers the texel block size of every uncompressed format and keeps memcpy fast
+static const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+// Stages that may read uploaded data, the graphics queue waits for the transfer at these
+static const VkPipelineStageFlags UPLOAD_CONSUMER_STAGES = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+	VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+static const VkAccessFlags UPLOAD_CONSUMER_ACCESS = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+	VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+UploadManager::UploadManager()
+{
+}
+
+void UploadManager::create(VkDevice logicalDevice, MemoryAllocator* memoryAllocator, VkQueue transferQueue, uint32_t transferFamily,
+	uint32_t graphicsFamily, uint32_t framesInFlight, VkDeviceSize stagingSize)
+{
+	PROFILE_FUNCTION();
+
+	this->device = logicalDevice;
+	this->allocator = memoryAllocator;
+	this->transferQueue = transferQueue;
+	this->transferFamily = transferFamily;
+	this->graphicsFamily = graphicsFamily;
+
+	// -- COMMAND POOLS --
+	// Command buffers are re-recorded every time their batch is reused
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = transferFamily;
+
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create a transfer Command Pool!");
+	}
+
+	poolInfo.queueFamilyIndex = graphicsFamily;
+	result = vkCreateCommandPool(device, &poolInfo, nullptr, &acquireCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to create an ownership acquire Command Pool!");
+	}
+
+	// -- BATCHES --
+	batches.resize(std::max(framesInFlight, 1u));
+
+	VkCommandBufferAllocateInfo cbAllocInfo = {};
+	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cbAllocInfo.commandBufferCount = 1;
+
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	for (auto& batch : batches)
+	{
+		cbAllocInfo.commandPool = transferCommandPool;
+		VkResult transferResult = vkAllocateCommandBuffers(device, &cbAllocInfo, &batch.transferCommandBuffer);
+		cbAllocInfo.commandPool = acquireCommandPool;
+		VkResult acquireResult = vkAllocateCommandBuffers(device, &cbAllocInfo, &batch.acquireCommandBuffer);
+		if (transferResult != VK_SUCCESS || acquireResult != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to allocate upload Command Buffers!");
+		}
+
+		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &batch.fence) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &batch.semaphore) != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to create upload Semaphore and/or Fence!");
+		}
+	}
+
+	// -- STAGING RING --
+	// Host coherent, so writes through the mapping need no flush before the copy is submitted
+	stagingBuffer = allocator->createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, AllocationLifetime::Persistent, &stagingAllocation);
+
+	stagingHead = 0;
+	stagingTail = 0;
+	stagingUsed = 0;
+	recordingBatch = 0;
+	recording = false;
+}
+
+void UploadManager::destroy()
+{
+	if (device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(uploadMutex);
+
+	// Anything recorded but never flushed is dropped
+	if (recording)
+	{
+		vkEndCommandBuffer(batches[recordingBatch].transferCommandBuffer);
+		recording = false;
+	}
+
+	retireBatches(std::numeric_limits<uint64_t>::max(), true);
+	for (auto& batch : batches)
+	{
+		for (auto& overflow : batch.overflowBuffers)
+		{
+			allocator->destroyBuffer(overflow.first, overflow.second);
+		}
+		vkDestroySemaphore(device, batch.semaphore, nullptr);
+		vkDestroyFence(device, batch.fence, nullptr);
+	}
+	batches.clear();
+
+	allocator->destroyBuffer(stagingBuffer, stagingAllocation);
+	vkDestroyCommandPool(device, acquireCommandPool, nullptr);
+	vkDestroyCommandPool(device, transferCommandPool, nullptr);
+
+	device = VK_NULL_HANDLE;
+}
+
+uint64_t UploadManager::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, bool concurrent)
+{
+	std::lock_guard<std::mutex> lock(uploadMutex);
+
+	beginBatch();
+	Batch& batch = batches[recordingBatch];
+
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset = stage(data, size, STAGING_ALIGNMENT, &srcBuffer);
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(batch.transferCommandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+	// Hand the buffer over to the graphics family: released here, acquired by the frame that waits for this batch.
+	// On a shared family, or for a concurrent buffer, the batch semaphore already makes the copy visible.
+	if (isDedicatedQueue() && !concurrent)
+	{
+		VkBufferMemoryBarrier release = {};
+		release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		release.dstAccessMask = 0;								// Ignored for a release, the acquire defines it
+		release.srcQueueFamilyIndex = transferFamily;
+		release.dstQueueFamilyIndex = graphicsFamily;
+		release.buffer = dstBuffer;
+		release.offset = dstOffset;
+		release.size = size;
+
+		vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 1, &release, 0, nullptr);
+
+		VkBufferMemoryBarrier acquire = release;
+		acquire.srcAccessMask = 0;
+		acquire.dstAccessMask = UPLOAD_CONSUMER_ACCESS;
+		batch.bufferAcquires.push_back(acquire);
+	}
+
+	return batch.ticket;
+}
+
+uint64_t UploadManager::uploadImage(VkImage dstImage, VkExtent3D extent, uint32_t mipLevel, const void* data, VkDeviceSize size,
+	VkImageLayout finalLayout, VkImageAspectFlags aspectMask)
+{
+	std::lock_guard<std::mutex> lock(uploadMutex);
+
+	beginBatch();
+	Batch& batch = batches[recordingBatch];
+
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset = stage(data, size, STAGING_ALIGNMENT, &srcBuffer);
+
+	// Transition the mip level so it can be copied to
+	VkImageMemoryBarrier toTransfer = {};
+	toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	toTransfer.srcAccessMask = 0;
+	toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;					// Previous contents are overwritten anyway
+	toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = dstImage;
+	toTransfer.subresourceRange.aspectMask = aspectMask;
+	toTransfer.subresourceRange.baseMipLevel = mipLevel;
+	toTransfer.subresourceRange.levelCount = 1;
+	toTransfer.subresourceRange.baseArrayLayer = 0;
+	toTransfer.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &toTransfer);
+
+	VkBufferImageCopy copyRegion = {};
+	copyRegion.bufferOffset = srcOffset;
+	copyRegion.bufferRowLength = 0;										// Tightly packed
+	copyRegion.bufferImageHeight = 0;
+	copyRegion.imageSubresource.aspectMask = aspectMask;
+	copyRegion.imageSubresource.mipLevel = mipLevel;
+	copyRegion.imageSubresource.baseArrayLayer = 0;
+	copyRegion.imageSubresource.layerCount = 1;
+	copyRegion.imageOffset = { 0, 0, 0 };
+	copyRegion.imageExtent = extent;
+	vkCmdCopyBufferToImage(batch.transferCommandBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+	// Move to the final layout, releasing ownership on the way when the graphics family is a different one
+	VkImageMemoryBarrier release = toTransfer;
+	release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	release.dstAccessMask = 0;
+	release.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	release.newLayout = finalLayout;
+	if (isDedicatedQueue())
+	{
+		release.srcQueueFamilyIndex = transferFamily;
+		release.dstQueueFamilyIndex = graphicsFamily;
+	}
+
+	vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &release);
+
+	// The acquire has to repeat the layout transition exactly as it was released
+	if (isDedicatedQueue())
+	{
+		VkImageMemoryBarrier acquire = release;
+		acquire.srcAccessMask = 0;
+		acquire.dstAccessMask = UPLOAD_CONSUMER_ACCESS;
+		batch.imageAcquires.push_back(acquire);
+	}
+
+	return batch.ticket;
+}
+
+UploadSubmitInfo UploadManager::flush(uint32_t frameIndex)
+{
+	PROFILE_FUNCTION();
+
+	std::lock_guard<std::mutex> lock(uploadMutex);
+
+	UploadSubmitInfo submitInfo;
+
+	// Pick up batches the transfer queue finished in the meantime, so tickets and ring space free up without waiting
+	retireBatches(std::numeric_limits<uint64_t>::max(), false);
+
+	if (!recording)
+	{
+		recordingBatch = (frameIndex + 1) % static_cast<uint32_t>(batches.size());
+		return submitInfo;
+	}
+
+	Batch& batch = batches[recordingBatch];
+
+	VkResult result = vkEndCommandBuffer(batch.transferCommandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to stop recording an upload Command Buffer!");
+	}
+
+	VkSubmitInfo transferSubmitInfo = {};
+	transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	transferSubmitInfo.commandBufferCount = 1;
+	transferSubmitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+	transferSubmitInfo.signalSemaphoreCount = 1;
+	transferSubmitInfo.pSignalSemaphores = &batch.semaphore;
+
+	result = vkQueueSubmit(transferQueue, 1, &transferSubmitInfo, batch.fence);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to submit uploads to the transfer Queue!");
+	}
+
+	batch.submitted = true;
+	recording = false;
+	nextTicket++;
+
+	submitInfo.waitSemaphore = batch.semaphore;
+	submitInfo.waitStage = UPLOAD_CONSUMER_STAGES;
+
+	// Acquire everything that was released by the transfer queue, before the frame's commands run
+	if (!batch.bufferAcquires.empty() || !batch.imageAcquires.empty())
+	{
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		vkBeginCommandBuffer(batch.acquireCommandBuffer, &beginInfo);
+		vkCmdPipelineBarrier(batch.acquireCommandBuffer, UPLOAD_CONSUMER_STAGES, UPLOAD_CONSUMER_STAGES, 0,
+			0, nullptr,
+			static_cast<uint32_t>(batch.bufferAcquires.size()), batch.bufferAcquires.data(),
+			static_cast<uint32_t>(batch.imageAcquires.size()), batch.imageAcquires.data());
+		result = vkEndCommandBuffer(batch.acquireCommandBuffer);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to record an ownership acquire Command Buffer!");
+		}
+
+		submitInfo.acquireCommandBuffer = batch.acquireCommandBuffer;
+		batch.bufferAcquires.clear();
+		batch.imageAcquires.clear();
+	}
+
+	recordingBatch = (frameIndex + 1) % static_cast<uint32_t>(batches.size());
+
+	return submitInfo;
+}
+
+bool UploadManager::isComplete(uint64_t ticket)
+{
+	std::lock_guard<std::mutex> lock(uploadMutex);
+
+	retireBatches(ticket, false);
+	return ticket <= completedTicket;
+}
+
+UploadManager::~UploadManager()
+{
+}
+
+void UploadManager::retireBatches(uint64_t upToTicket, bool wait)
+{
+	// Oldest first: the ring can only be released in the order it was filled
+	std::vector<Batch*> submittedBatches;
+	for (auto& batch : batches)
+	{
+		if (batch.submitted && batch.ticket <= upToTicket)
+		{
+			submittedBatches.push_back(&batch);
+		}
+	}
+	std::sort(submittedBatches.begin(), submittedBatches.end(), [](const Batch* a, const Batch* b) { return a->ticket < b->ticket; });
+
+	for (Batch* batch : submittedBatches)
+	{
+		if (!retireBatch(*batch, wait))
+		{
+			break;
+		}
+	}
+}
+
+void UploadManager::beginBatch()
+{
+	if (recording)
+	{
+		return;
+	}
+
+	// The slot is reused every framesInFlight flushes, by then its transfer has normally long finished
+	Batch& batch = batches[recordingBatch];
+	if (batch.submitted)
+	{
+		retireBatches(batch.ticket, true);
+	}
+
+	vkResetCommandBuffer(batch.transferCommandBuffer, 0);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VkResult result = vkBeginCommandBuffer(batch.transferCommandBuffer, &beginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to start recording an upload Command Buffer!");
+	}
+
+	batch.ticket = nextTicket;
+	batch.stagingBytes = 0;
+	batch.stagingEnd = stagingHead;
+	recording = true;
+}
+
+bool UploadManager::retireBatch(Batch& batch, bool wait)
+{
+	if (!batch.submitted)
+	{
+		return true;
+	}
+
+	if (wait)
+	{
+		vkWaitForFences(device, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+	else if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS)
+	{
+		return false;
+	}
+	vkResetFences(device, 1, &batch.fence);
+
+	// Release the batch's part of the ring
+	if (batch.stagingBytes > 0)
+	{
+		stagingUsed -= batch.stagingBytes;
+		stagingTail = batch.stagingEnd;
+		if (stagingUsed == 0)
+		{
+			stagingHead = 0;
+			stagingTail = 0;
+		}
+	}
+
+	for (auto& overflow : batch.overflowBuffers)
+	{
+		allocator->destroyBuffer(overflow.first, overflow.second);
+	}
+	batch.overflowBuffers.clear();
+
+	completedTicket = std::max(completedTicket, batch.ticket);
+	batch.submitted = false;
+
+	return true;
+}
+
+VkDeviceSize UploadManager::stage(const void* data, VkDeviceSize size, VkDeviceSize alignment, VkBuffer* srcBuffer)
+{
+	Batch& batch = batches[recordingBatch];
+	VkDeviceSize stagingSize = stagingAllocation.size;
+
+	// Same scheme as the allocator's transient ring: free space is [head, size) + [0, tail) or [head, tail)
+	VkDeviceSize offset = 0;
+	VkDeviceSize consumed = 0;
+	VkDeviceSize alignedHead = (stagingHead + alignment - 1) / alignment * alignment;
+	bool fits = false;
+
+	if (stagingUsed < stagingSize)
+	{
+		if (stagingHead >= stagingTail)
+		{
+			if (alignedHead + size <= stagingSize)
+			{
+				offset = alignedHead;
+				consumed = alignedHead + size - stagingHead;
+				fits = true;
+			}
+			else if (size <= stagingTail)
+			{
+				offset = 0;
+				consumed = (stagingSize - stagingHead) + size;
+				fits = true;
+			}
+		}
+		else if (alignedHead + size <= stagingTail)
+		{
+			offset = alignedHead;
+			consumed = alignedHead + size - stagingHead;
+			fits = true;
+		}
+	}
+
+	if (fits)
+	{
+		memcpy(static_cast<char*>(stagingAllocation.mapped) + offset, data, static_cast<size_t>(size));
+
+		stagingHead = offset + size;
+		stagingUsed += consumed;
+		batch.stagingBytes += consumed;
+		batch.stagingEnd = stagingHead;
+
+		*srcBuffer = stagingBuffer;
+		return offset;
+	}
+
+	// Ring is full (or the upload is bigger than it), rather than stall give this upload its own staging buffer,
+	// which is released together with the batch
+	Allocation overflowAllocation;
+	VkBuffer overflowBuffer = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, AllocationLifetime::Persistent, &overflowAllocation);
+	memcpy(overflowAllocation.mapped, data, static_cast<size_t>(size));
+	batch.overflowBuffers.push_back({ overflowBuffer, overflowAllocation });
+
+	*srcBuffer = overflowBuffer;
+	return 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <mutex>
+
+#include "MemoryAllocator.h"
+
+// What the graphics submission of a frame has to add so it sees that frame's uploads
+struct UploadSubmitInfo {
+	VkSemaphore waitSemaphore = VK_NULL_HANDLE;			// Signalled by the transfer submission, VK_NULL_HANDLE if nothing was uploaded
+	VkPipelineStageFlags waitStage = 0;					// Stage to wait for the semaphore at
+	VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;	// Queue family ownership acquire, submit before the frame's own commands
+};
+
+// Streams data to device local buffers and images through a persistently mapped staging ring.
+// Copies are recorded as they are requested and sent to the transfer queue in one submission per frame
+// (flush), so uploads run alongside rendering instead of stalling the graphics queue. When the transfer
+// queue is from a different family than graphics, ownership of the destination is released on the transfer
+// queue and acquired again by a small command buffer the frame submits before its own.
+class UploadManager
+{
+public:
+
+	UploadManager();
+
+	void create(VkDevice logicalDevice, MemoryAllocator *memoryAllocator, VkQueue transferQueue, uint32_t transferFamily,
+		uint32_t graphicsFamily, uint32_t framesInFlight, VkDeviceSize stagingSize = 32 * 1024 * 1024);
+	void destroy();
+
+	// Queue a copy into dstBuffer. The returned ticket can be passed to isComplete.
+	// The destination must not be used by the GPU until the frame this upload was flushed with.
+	// A concurrent buffer (shared with the transfer family, see MemoryAllocator::createBuffer) has no owner to hand over to.
+	uint64_t uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size, bool concurrent = false);
+
+	// Queue a copy of tightly packed texels into one mip level of dstImage (layout UNDEFINED beforehand),
+	// leaving it in finalLayout
+	uint64_t uploadImage(VkImage dstImage, VkExtent3D extent, uint32_t mipLevel, const void *data, VkDeviceSize size,
+		VkImageLayout finalLayout, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT);
+
+	// Submit everything queued since the last flush. Call once per frame, after the fence of frameIndex has been waited on.
+	UploadSubmitInfo flush(uint32_t frameIndex);
+
+	bool isComplete(uint64_t ticket);
+	bool isDedicatedQueue() const { return transferFamily != graphicsFamily; }
+
+	~UploadManager();
+
+private:
+	// Everything recorded between two flushes
+	struct Batch {
+		VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;					// Transfer submission done
+		VkSemaphore semaphore = VK_NULL_HANDLE;			// Transfer submission done, for the graphics queue
+		uint64_t ticket = 0;							// Ticket of the uploads recorded in this batch, 0 when unused
+		bool submitted = false;
+		VkDeviceSize stagingEnd = 0;					// Ring head once this batch was recorded
+		VkDeviceSize stagingBytes = 0;					// Ring bytes (with padding) this batch holds
+		std::vector<VkBufferMemoryBarrier> bufferAcquires;
+		std::vector<VkImageMemoryBarrier> imageAcquires;
+		std::vector<std::pair<VkBuffer, Allocation>> overflowBuffers;	// Staging for uploads that didn't fit in the ring
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator *allocator = nullptr;
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	uint32_t transferFamily = 0;
+	uint32_t graphicsFamily = 0;
+
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+	VkCommandPool acquireCommandPool = VK_NULL_HANDLE;	// Graphics family
+	std::vector<Batch> batches;							// One per frame in flight
+	uint32_t recordingBatch = 0;
+	bool recording = false;
+
+	// - Staging ring
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	Allocation stagingAllocation;
+	VkDeviceSize stagingHead = 0;
+	VkDeviceSize stagingTail = 0;
+	VkDeviceSize stagingUsed = 0;
+
+	uint64_t nextTicket = 1;
+	uint64_t completedTicket = 0;
+	std::mutex uploadMutex;
+
+	// - Support Functions
+	void beginBatch();
+	void retireBatches(uint64_t upToTicket, bool wait);
+	bool retireBatch(Batch &batch, bool wait);			// False if not finished yet (only when not waiting)
+	VkDeviceSize stage(const void *data, VkDeviceSize size, VkDeviceSize alignment, VkBuffer *srcBuffer);
+};
@@ -1,20 +1,236 @@
 #pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+
+#include "MemoryAllocator.h"
 
 const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// Number of frames the CPU is allowed to record ahead of the GPU by default
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+// Smallest slice of the draw list worth handing to a recording thread
+const uint32_t MIN_OBJECTS_PER_SLICE = 64;
+
+// Set numbers in the pipeline layout: per frame uniforms (dynamic offsets into the uniform ring), then the bindless table,
+// then the GPU culling instances when rendering GPU driven
+const uint32_t FRAME_DESCRIPTOR_SET = 0;
+const uint32_t BINDLESS_DESCRIPTOR_SET = 1;
+const uint32_t INSTANCE_DESCRIPTOR_SET = 2;
+
+// Push constants every device supports. Per draw data up to this size is pushed, anything bigger goes in the uniform ring.
+const uint32_t MAX_PUSH_CONSTANT_SIZE = 128;
+const VkShaderStageFlags DRAW_CONSTANT_STAGES = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+// Bytes of uniform data each frame in flight can allocate
+const VkDeviceSize DEFAULT_UNIFORM_RING_SIZE = 4 * 1024 * 1024;
+
+// Slots in the bindless table, before clamping to the device's limits
+const uint32_t BINDLESS_MAX_IMAGES = 16384;
+const uint32_t BINDLESS_MAX_BUFFERS = 4096;
+
+// Streamed textures (see TextureStreamer): device memory they may take, and bytes uploaded per frame at most
+const VkDeviceSize DEFAULT_TEXTURE_BUDGET = 64 * 1024 * 1024;
+const VkDeviceSize DEFAULT_TEXTURE_UPLOAD_PER_FRAME = 8 * 1024 * 1024;
+
+// Frames between two passes over the draw list working out how large each texture is on screen
+const uint32_t TEXTURE_DEMAND_INTERVAL = 8;
+
+// Materials after the default and opaque ones sample a streamed texture each
+const uint32_t FIRST_TEXTURED_MATERIAL = 2;
+
+// Frame rate PresentPolicy::PowerSaving caps to when no cap is set
+const double DEFAULT_POWER_SAVING_FRAME_RATE = 30.0;
+
+// Environment variable that pins the GPU, see RendererSettings::deviceSelector
+const char DEVICE_SELECTOR_VARIABLE[] = "VULKAN_APP_DEVICE";
+
+// Vertex data representation
+struct Vertex {
+	glm::vec3 pos;		// Vertex position (x, y, z)
+	glm::vec3 col;		// Vertex colour (r, g, b)
+};
+
+// -- SHADER INTERFACE --
+// Must match the blocks in the shaders (std140 for uniforms)
+
+// set = FRAME_DESCRIPTOR_SET, binding = 0: written once per frame
+struct FrameUniforms {
+	glm::mat4 viewProjection;		// The scene is authored in clip space, so this is the identity for now
+};
+
+// set = FRAME_DESCRIPTOR_SET, binding = 1: one per material, rebound with a new dynamic offset when the material changes
+struct MaterialUniforms {
+	glm::vec4 tint = glm::vec4(1.0f);		// Multiplies the vertex colour
+	uint32_t textureIndex = UINT32_MAX;		// Bindless image slot, read by shader_textured.frag only
+	uint32_t padding[3] = {};
+};
+
+// Push constants, every draw
+struct DrawConstants {
+	glm::mat4 model;				// Model to world transform
+};
+static_assert(sizeof(DrawConstants) <= MAX_PUSH_CONSTANT_SIZE, "Draw constants must fit the push constants every device supports");
+
+// set = INSTANCE_DESCRIPTOR_SET, binding = 0 (std430): one per object when rendering GPU driven, see GpuCulling
+struct InstanceData {
+	glm::mat4 model;				// Model to world transform
+	glm::vec4 boundingSphere;		// Centre (xyz) and radius (w) of the mesh, in model space
+	uint32_t indexCount;			// Of the mesh
+	uint32_t batchIndex;			// Draw count slot the instance is appended to
+	uint32_t firstCommand;			// First command of its batch
+	uint32_t padding;
+};
+
+// Push constants of the cull pass
+struct CullConstants {
+	glm::vec4 frustumPlanes[6];		// Normalised, xyz facing into the frustum
+	uint32_t instanceCount;
+	uint32_t compact;				// 1: append visible instances to their batch and count them, 0: write every command
+};
+static_assert(sizeof(CullConstants) <= MAX_PUSH_CONSTANT_SIZE, "Cull constants must fit the push constants every device supports");
+
+// How vertex attributes are laid out in the vertex buffer
+enum class VertexLayout {
+	Interleaved,		// One stream, whole Vertex structs back to back
+	SplitPosition		// Positions in their own stream, everything else in a second one (cheaper depth-only passes)
+};
+
+// What the swap chain's present mode and image count favour
+enum class PresentPolicy {
+	LowLatency,			// IMMEDIATE (else FIFO_RELAXED), as few images as allowed: frames are shown as soon as they are done, tearing allowed
+	Throughput,			// MAILBOX (else FIFO, never tearing), two images more than the minimum: rendering doesn't wait for vertical blank where MAILBOX exists
+	PowerSaving			// FIFO, one image more than the minimum and a frame rate cap, so no frame is rendered that won't be shown
+};
+
+// How captured frames are written (see FrameCapture)
+enum class CaptureFormat {
+	Raw,				// One file of tightly packed RGBA8 frames, one after the other
+	Png					// One PNG per frame
+};
+
+// Options chosen by the application before the renderer is initialised
+struct RendererSettings {
+	uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;		// Frames that can be in flight at the same time (2-3 is sensible)
+
+	// Headless mode renders into device-local images instead of a swap chain, so no window,
+	// surface or presentation-capable queue is needed (e.g. CI with lavapipe/SwiftShader)
+	bool headless = false;
+	VkExtent2D headlessExtent = { 800, 600 };				// Size of the offscreen targets
+	VkFormat headlessFormat = VK_FORMAT_R8G8B8A8_UNORM;		// Format of the offscreen targets
+
+	// Where the pipeline cache is kept between runs. Empty keeps the cache in memory only
+	std::string pipelineCachePath = "pipeline_cache.bin";
+
+	// Shader pack built from the Shaders folder. Empty searches next to the executable, then ../Shaders
+	std::string shaderPackPath;
+
+	VertexLayout vertexLayout = VertexLayout::Interleaved;
+
+	// Threads recording secondary command buffers each frame. 0 = one per hardware thread
+	uint32_t recordingThreads = 0;
+
+	// Extra copies of the meshes scattered over the screen, to give recording something to chew on
+	uint32_t benchmarkObjects = 0;
+
+	// Time render passes with GPU timestamps (see VulkanRenderer::getGpuScopeStats)
+	bool gpuProfiling = true;
+
+	// Pins the physical device by index, UUID or part of its name instead of picking the best scoring one.
+	// Empty falls back to the VULKAN_APP_DEVICE environment variable.
+	std::string deviceSelector;
+
+	// Run the independent steps of Init on the thread pool. Off runs them one after the other, for comparison.
+	bool parallelInit = true;
+
+	// Background threads compiling pipeline variants, which draw with the default pipeline until they are ready.
+	// 0 compiles them on the recording thread that first needs them instead.
+	uint32_t pipelineCompileThreads = 1;
+
+	// Create a bindless descriptor table (see BindlessTable) when the device supports descriptor indexing
+	bool bindless = true;
+
+	// Uniform data each frame in flight can allocate (see UniformRing)
+	VkDeviceSize uniformRingSize = DEFAULT_UNIFORM_RING_SIZE;
+
+	// Cull on the GPU and draw with indirect commands (see GpuCulling) instead of recording a draw per object.
+	// Ignored on devices without drawIndirectFirstInstance.
+	bool gpuDriven = false;
+
+	// Submit compute work (GPU culling) to a compute-only queue where the device has one, so it overlaps rendering.
+	// Off, or without such a queue, it is recorded into the graphics command buffer instead.
+	bool asyncCompute = true;
+
+	// Procedural textures streamed in by screen size (see TextureStreamer), textureSize texels square at mip 0.
+	// Needs the bindless table, which is how the shaders find them. 0 (the default) draws the scene untextured.
+	uint32_t textureCount = 0;
+	uint32_t textureSize = 1024;
+	VkDeviceSize textureBudget = DEFAULT_TEXTURE_BUDGET;		// Capped further by VK_EXT_memory_budget where available
+	uint32_t textureLoadThreads = 1;
+
+	// Presentation, see VulkanRenderer::setPresentPolicy. Low latency also wants framesInFlight 1.
+	PresentPolicy presentPolicy = PresentPolicy::Throughput;
+	double frameRateCap = 0.0;				// Frames per second the CPU paces itself to, 0 for none (PowerSaving: DEFAULT_POWER_SAVING_FRAME_RATE)
+	double latencyBudgetMs = 0.0;			// Frames slower than this from submit to presentable are counted (FrameStats), 0 for no budget
+
+	// Depth buffer and multisampling of the scene pass. Both live in transient attachments (lazily allocated memory
+	// where the device has it) and never leave the render pass; samples are lowered to what the device supports.
+	bool depthTest = false;
+	uint32_t msaaSamples = 1;
+
+	// Read rendered frames back and write them to capturePath (a file for raw frames, the name every PNG starts with).
+	// Empty captures nothing. Frames the readback ring has no room for are dropped, rendering never waits for it.
+	std::string capturePath;
+	CaptureFormat captureFormat = CaptureFormat::Png;
+	uint32_t captureInterval = 1;			// Every Nth frame
+	uint32_t captureSlots = 0;				// Readback buffers, 0 = framesInFlight + 1
+	uint32_t captureThreads = 0;			// PNG encoding threads, 0 = one per hardware thread
+};
+
+// Frame timing measured by the renderer, refreshed roughly once per second
+struct FrameStats {
+	double framesPerSecond = 0.0;		// Frames submitted per second over the last interval
+	double avgCpuWaitMs = 0.0;			// Average time per frame the CPU was blocked waiting for the GPU
+	double maxCpuWaitMs = 0.0;			// Longest single wait during the last interval
+	double avgRecordMs = 0.0;			// Average time per frame spent recording command buffers (all threads, wall clock)
+	double avgPacingMs = 0.0;			// Average time per frame the frame limiter slept
+	double avgLatencyMs = 0.0;			// Average time from submitting a frame until the GPU finished it and it could be presented
+	double maxLatencyMs = 0.0;			// Slowest frame of the last interval, by the same measure
+	double lastLatencyMs = 0.0;			// Of the last frame measured
+	uint64_t latencyBudgetMisses = 0;	// Frames since Init over RendererSettings::latencyBudgetMs
+	uint64_t totalFrames = 0;			// Frames drawn since Init
+	uint64_t intervalCount = 0;			// Incremented every time the values above are refreshed
+	uint32_t swapChainRecreations = 0;	// Times the swap chain was rebuilt (resize, out of date, suboptimal)
+	double lastSwapChainRecreateMs = 0.0;	// CPU time the last rebuild took, including the wait for in-flight frames
+	double initMs = 0.0;				// Time Init took
+	double timeToFirstFrameMs = 0.0;	// From the start of Init until the first frame was submitted
+};
+
 // Indices (location) of queue families if the exist at all
 struct QueueFamilyIndices {
 	int graphicsFamily = -1;			// Location of Graphics Queue Family
 	int presentationFamily = -1;		// Location of Presentation Queue Family
+	int transferFamily = -1;			// Location of a transfer-only Queue Family, or graphicsFamily if the device has none
+	int computeFamily = -1;				// Location of a compute Queue Family without graphics (async compute), or graphicsFamily
 
-	// Check if queue families are valid.
-	bool isValid()
+	// Check if queue families are valid. Presentation is only needed when rendering to a surface.
+	bool isValid(bool needsPresentation = true) const
 	{
-		return graphicsFamily >= 0 && presentationFamily >= 0;
+		return graphicsFamily >= 0 && (presentationFamily >= 0 || !needsPresentation);
 	}
 
 
@@ -29,28 +245,65 @@ struct SwapChainDetails {
 struct SwapchainImage {
 	VkImage imagen;
 	VkImageView imageView;
+	Allocation allocation;						// Only set for offscreen (headless) targets, which own their memory
 };
 
-static std::vector<char> readFile(const std::string& fileName)
+// 64-bit FNV-1a hash. Pass a previous result as seed to hash several pieces of data together.
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ULL)
 {
-	// Open the file to the end to get the size.
-	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
-
-	if (!file.is_open())
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++)
 	{
-		throw std::runtime_error("ERROR: Failed open a file");
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
 	}
+	return hash;
+}
 
-	size_t length = (size_t)file.tellg();
-
-	std::vector<char> fileBuffer(length);
-
-	file.seekg(0); // Reset the pointer to the beginning of the file
-	file.read(fileBuffer.data(), length); // Read the file into the buffer.
-
-	// Close the stream.
-	file.close();
-
-	return fileBuffer;
+// Quoted JSON string, with quotes, backslashes and control characters escaped
+inline std::string jsonString(const std::string& value)
+{
+	std::string result = "\"";
+	for (char c : value)
+	{
+		switch (c)
+		{
+		case '"': result += "\\\""; break;
+		case '\\': result += "\\\\"; break;
+		case '\n': result += "\\n"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20)
+			{
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+				result += escaped;
+			}
+			else
+			{
+				result += c;
+			}
+		}
+	}
+	return result + "\"";
+}
 
-}
\ No newline at end of file
+// Value of an environment variable, empty if it isn't set
+static std::string getEnvironmentVariable(const char* name)
+{
+#ifdef _MSC_VER
+	// getenv is flagged as unsafe by the SDL checks
+	char* value = nullptr;
+	size_t length = 0;
+	std::string result;
+	if (_dupenv_s(&value, &length, name) == 0 && value != nullptr)
+	{
+		result = value;
+	}
+	free(value);
+	return result;
+#else
+	const char* value = std::getenv(name);
+	return value != nullptr ? value : "";
+#endif
+}
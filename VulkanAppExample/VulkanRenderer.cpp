@@ -4,19 +4,94 @@ VulkanRenderer::VulkanRenderer()
 {
 }
 
-int VulkanRenderer::Init(GLFWwindow* pWindow)
+int VulkanRenderer::Init(GLFWwindow* pWindow, const RendererSettings &rendererSettings)
 {
+	PROFILE_FUNCTION();
+
 	m_pWindow = pWindow;
+	settings = rendererSettings;
+
+	if (settings.framesInFlight == 0)
+	{
+		settings.framesInFlight = 1;
+	}
+
+	initStart = std::chrono::steady_clock::now();
+
+	// No swap chain yet, so this only sets the frame limiter up
+	setPresentPolicy(settings.presentPolicy, settings.frameRateCap);
 
 	try {
-		createInstance();
-		createDebugCallback();
-		createSurface();
-		getPhysicalDevice();
-		createLogicalDevice();
-		createSwapChain();
-		createRenderPass();
-		createGraphicsPipeline();
+		// Workers record command buffers every frame, but first they build the renderer
+		threadPool.start(settings.recordingThreads);
+
+		// -- INITIALISATION GRAPH --
+		// Each step only waits for what it really uses, so shader and cache file I/O, swap chain creation and
+		// pipeline compilation overlap. Anything two steps both write goes through a step they both depend on.
+		TaskGraph initGraph;
+		TaskGraph::TaskId shaders = initGraph.addTask("loadShaderPack", [this]() { loadShaderPack(); });
+		TaskGraph::TaskId instanceReady = initGraph.addTask("createInstance", [this]() { createInstance(); });
+		// Instance level objects are created one after the other, and the callback first so it sees device selection
+		TaskGraph::TaskId debugReady = initGraph.addTask("createDebugCallback", [this]() { createDebugCallback(); }, { instanceReady });
+		TaskGraph::TaskId surfaceReady = debugReady;
+		if (!settings.headless)
+		{
+			surfaceReady = initGraph.addTask("createSurface", [this]() { createSurface(); }, { debugReady });
+		}
+		TaskGraph::TaskId physicalDevice = initGraph.addTask("getPhysicalDevice", [this]() {
+			getPhysicalDevice();
+			chooseRenderTargetFormat();
+			captureEnabled = !settings.capturePath.empty() && checkCaptureSupport();
+		}, { surfaceReady });
+		TaskGraph::TaskId device = initGraph.addTask("createLogicalDevice", [this]() { createLogicalDevice(); }, { physicalDevice });
+
+		TaskGraph::TaskId allocator = initGraph.addTask("createMemoryAllocator", [this]() {
+			memoryAllocator.create(mainDevice.physicalDevice, mainDevice.logicalDevice, settings.framesInFlight);
+			if (memoryBudgetEnabled)
+			{
+				memoryAllocator.enableMemoryBudget(properties2Functions.getMemoryProperties2);
+			}
+		}, { device });
+		TaskGraph::TaskId uploads = initGraph.addTask("createUploadManager", [this]() { createUploadManager(); }, { allocator });
+		TaskGraph::TaskId meshes = initGraph.addTask("createMeshes", [this]() { createMeshes(); }, { uploads });
+		initGraph.addTask("createUniformRing", [this]() { createUniformRing(); }, { allocator });
+		initGraph.addTask("createGpuProfiler", [this]() { createGpuProfiler(); }, { device });
+
+		TaskGraph::TaskId targets = initGraph.addTask(settings.headless ? "createOffscreenTargets" : "createSwapChain", [this]() {
+			settings.headless ? createOffscreenTargets() : createSwapChain();
+		}, { allocator });
+		TaskGraph::TaskId pass = initGraph.addTask("createRenderGraph", [this]() { createRenderGraph(); }, { allocator });
+		TaskGraph::TaskId cache = initGraph.addTask("createPipelineCache", [this]() { createPipelineCache(); }, { device });
+		TaskGraph::TaskId descriptors = initGraph.addTask("createDescriptors", [this]() { createDescriptors(); }, { device });
+		TaskGraph::TaskId layout = initGraph.addTask("createPipelineLayout", [this]() { createPipelineLayout(); }, { descriptors });
+		initGraph.addTask("createInstanceBuffer", [this]() { createInstanceBuffer(); }, { meshes, descriptors });
+		initGraph.addTask("createTextures", [this]() { createTextures(); }, { uploads, descriptors });
+		initGraph.addTask("createFrameCapture", [this]() { createFrameCapture(); }, { allocator });
+		initGraph.addTask("createCullPipeline", [this]() { createCullPipeline(); }, { cache, shaders, descriptors });
+		TaskGraph::TaskId pipelines = initGraph.addTask("createPipelineManager", [this]() { createPipelineManager(); }, { cache, shaders, layout });
+		initGraph.addTask("createGraphicsPipeline", [this]() { createGraphicsPipeline(); }, { pass, pipelines });
+		initGraph.addTask("allocateRenderTargets", [this]() { renderGraph.allocate(swapChainExtent); }, { targets, pass });
+
+		TaskGraph::TaskId pools = initGraph.addTask("createCommandPool", [this]() { createCommandPool(); }, { device });
+		initGraph.addTask("createCommandBuffers", [this]() { createCommandBuffers(); }, { pools });
+		initGraph.addTask("createSynchronisation", [this]() { createSynchronisation(); }, { device });
+
+		if (settings.parallelInit)
+		{
+			initGraph.run(threadPool);
+		}
+		else
+		{
+			initGraph.runSerial();
+		}
+
+		frameStats.initMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initStart).count();
+		initTimings = initGraph.getTimings();
+		std::cout << "Init: " << frameStats.initMs << " ms (" << (settings.parallelInit ? "parallel on " + std::to_string(threadPool.getThreadCount()) + " threads" : std::string("serial")) << ")" << std::endl;
+		for (const TaskTiming& timing : initTimings)
+		{
+			std::cout << "  " << timing.name << ": " << timing.startMs << " + " << timing.durationMs << " ms (worker " << timing.worker << ")" << std::endl;
+		}
 	}
 	catch (const std::runtime_error& e)
 	{
@@ -24,21 +99,276 @@ int VulkanRenderer::Init(GLFWwindow* pWindow)
 		return EXIT_FAILURE;
 	}
 
+	statsIntervalStart = std::chrono::steady_clock::now();
+
 	return 0;
 }
 
+void VulkanRenderer::draw()
+{
+	PROFILE_ZONE("Frame");
+
+	// -- PACE --
+	// Sleeping before the frame starts rather than after it is presented keeps the wait out of the frame's latency.
+	// The sleep waits on the frames in flight, so the ones finishing during it are timed when they finish.
+	double pacingMs = frameLimiter.wait([this](std::chrono::steady_clock::time_point until) { waitForFrameFences(until); });
+
+	// -- WAIT FOR FRAME SLOT --
+	// Only block if the GPU is still processing the frame that last used this slot, so up to
+	// settings.framesInFlight frames can be queued before the CPU has to wait.
+	auto waitStart = std::chrono::steady_clock::now();
+	{
+		PROFILE_ZONE("Wait for frame");
+		updateFrameLatency();
+		vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		updateFrameLatency();
+	}
+
+	// The GPU is done with this slot, so its transient memory and descriptor sets can be handed out again
+	memoryAllocator.beginFrame(currentFrame);
+	descriptorAllocator.beginFrame(currentFrame);
+	uniformRing.beginFrame(currentFrame);
+
+	// -- TEXTURE STREAMING --
+	// Before recording, so this frame already samples whatever finished streaming in
+	if (texturesEnabled)
+	{
+		updateTextureDemand();
+		textureStreamer.update();
+	}
+
+	// -- GET NEXT IMAGE --
+	// Get index of next image to be drawn to, and signal semaphore when ready to be drawn to.
+	// Offscreen targets have no presentation engine, so just cycle through them.
+	uint32_t imageIndex;
+	if (settings.headless)
+	{
+		imageIndex = nextOffscreenImage;
+		nextOffscreenImage = (nextOffscreenImage + 1) % static_cast<uint32_t>(swapChainImages.size());
+	}
+	else
+	{
+		PROFILE_ZONE("Acquire");
+		VkResult acquireResult = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+		// Surface no longer matches the swap chain (usually a resize), nothing can be drawn until it is rebuilt.
+		// SUBOPTIMAL still gave us an image, so draw this frame and rebuild after presenting it.
+		if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			recreateSwapChain();
+			return;
+		}
+		else if (acquireResult != VK_SUCCESS && acquireResult != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("ERROR: Failed to acquire a swap chain image!");
+		}
+	}
+
+	auto recordStart = std::chrono::steady_clock::now();
+	double cpuWaitMs = std::chrono::duration<double, std::milli>(recordStart - waitStart).count();
+	gpuProfiler.addCpuEvent("Wait for frame", waitStart, recordStart);
+
+	// -- RECORD COMMANDS --
+	// The frame slot's command buffers are free again now its fence has signalled
+	recordCommands(imageIndex);
+	auto recordEnd = std::chrono::steady_clock::now();
+	double recordMs = std::chrono::duration<double, std::milli>(recordEnd - recordStart).count();
+	gpuProfiler.addCpuEvent("Record", recordStart, recordEnd);
+
+	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
+
+	// -- SEND UPLOADS --
+	// Everything uploaded since the last frame goes to the transfer queue now; this frame waits for it
+	UploadSubmitInfo uploads = uploadManager.flush(currentFrame);
+
+	// -- SUBMIT CULL TO COMPUTE QUEUE --
+	// Nothing on the compute queue waits: the cull only reads instances whose upload has completed, and the
+	// commands it writes belong to this frame slot, which the graphics queue finished with before the fence
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	if (frameCommands[currentFrame].computeRecorded)
+	{
+		VkSubmitInfo computeSubmitInfo = {};
+		computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		computeSubmitInfo.commandBufferCount = 1;
+		computeSubmitInfo.pCommandBuffers = &frameCommands[currentFrame].computeBuffer;
+		computeSubmitInfo.signalSemaphoreCount = 1;
+		computeSubmitInfo.pSignalSemaphores = &computeFinished[currentFrame];			// Draws wait on it, see below
+
+		VkResult computeResult;
+		{
+			PROFILE_ZONE("Submit compute");
+			computeResult = vkQueueSubmit(computeQueue, 1, &computeSubmitInfo, VK_NULL_HANDLE);
+		}
+		if (computeResult != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to submit the compute Command Buffer!");
+		}
+
+		// Only the indirect reads need the cull; everything before them (uploads, clears) can run alongside it
+		waitSemaphores.push_back(computeFinished[currentFrame]);
+		waitStages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+	}
+
+	// -- SUBMIT COMMAND BUFFER TO RENDER --
+	// Queue submission information
+	std::vector<VkCommandBuffer> submitCommandBuffers;
+
+	// Nothing to wait for or hand over to when there is no presentation engine
+	if (!settings.headless)
+	{
+		waitSemaphores.push_back(imageAvailable[currentFrame]);
+		waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+	}
+	if (uploads.waitSemaphore != VK_NULL_HANDLE)
+	{
+		waitSemaphores.push_back(uploads.waitSemaphore);
+		waitStages.push_back(uploads.waitStage);
+	}
+	if (uploads.acquireCommandBuffer != VK_NULL_HANDLE)
+	{
+		submitCommandBuffers.push_back(uploads.acquireCommandBuffer);
+	}
+	submitCommandBuffers.push_back(frameCommands[currentFrame].primaryBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());		// Number of semaphores to wait on
+	submitInfo.pWaitSemaphores = waitSemaphores.data();									// List of semaphores to wait on
+	submitInfo.pWaitDstStageMask = waitStages.data();									// Stages to check semaphores at
+	submitInfo.commandBufferCount = static_cast<uint32_t>(submitCommandBuffers.size());	// Number of command buffers to submit
+	submitInfo.pCommandBuffers = submitCommandBuffers.data();							// Command buffers to submit, in order
+	submitInfo.signalSemaphoreCount = settings.headless ? 0 : 1;						// Number of semaphores to signal
+	submitInfo.pSignalSemaphores = &renderFinished[currentFrame];						// Semaphores to signal when command buffer finishes
+
+	// Submit command buffer to queue, fence is signalled when the GPU is done with this frame
+	VkResult result;
+	{
+		PROFILE_ZONE("Submit");
+		result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences[currentFrame]);
+	}
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to submit Command Buffer to Queue!");
+	}
+	if (captureEnabled)
+	{
+		frameCapture.submit(graphicsQueue);
+	}
+	frameSubmitTimes[currentFrame] = std::chrono::steady_clock::now();
+	latencyPending[currentFrame] = true;
+
+	if (settings.headless)
+	{
+		currentFrame = (currentFrame + 1) % settings.framesInFlight;
+		updateFrameStats(cpuWaitMs, recordMs, pacingMs);
+		return;
+	}
+
+	// -- PRESENT RENDERED IMAGE TO SCREEN --
+	VkPresentInfoKHR presentInfo = {};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.waitSemaphoreCount = 1;								// Number of semaphores to wait on
+	presentInfo.pWaitSemaphores = &renderFinished[currentFrame];	// Semaphores to wait on
+	presentInfo.swapchainCount = 1;									// Number of swapchains to present to
+	presentInfo.pSwapchains = &swapchain;							// Swapchains to present images to
+	presentInfo.pImageIndices = &imageIndex;						// Index of images in swapchains to present
+
+	{
+		PROFILE_ZONE("Present");
+		result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	}
+
+	// Get next frame (use % to keep value below settings.framesInFlight)
+	currentFrame = (currentFrame + 1) % settings.framesInFlight;
+
+	updateFrameStats(cpuWaitMs, recordMs, pacingMs);
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+	{
+		recreateSwapChain();
+	}
+	else if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to present Image!");
+	}
+}
+
 void VulkanRenderer::cleanup()
 {
-	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+	PROFILE_FUNCTION();
+
+	// Wait until no actions being run on device before destroying
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+	gpuProfiler.destroy();
+	for (size_t i = 0; i < settings.framesInFlight; i++)
+	{
+		vkDestroySemaphore(mainDevice.logicalDevice, renderFinished[i], nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
+		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
+	}
+	for (auto semaphore : computeFinished)
+	{
+		vkDestroySemaphore(mainDevice.logicalDevice, semaphore, nullptr);
+	}
+	threadPool.stop();
+	for (auto& frame : frameCommands)
+	{
+		// Destroying a pool frees every command buffer allocated from it
+		vkDestroyCommandPool(mainDevice.logicalDevice, frame.primaryPool, nullptr);
+		vkDestroyCommandPool(mainDevice.logicalDevice, frame.computePool, nullptr);
+		for (auto& thread : frame.threads)
+		{
+			vkDestroyCommandPool(mainDevice.logicalDevice, thread.pool, nullptr);
+		}
+	}
+	pipelineManager.destroy();
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
-	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+	if (gpuDrivenEnabled)
+	{
+		gpuCulling.destroy();
+	}
+	if (texturesEnabled)
+	{
+		textureStreamer.destroy();
+	}
+	if (captureEnabled)
+	{
+		frameCapture.destroy();
+	}
+	if (bindlessEnabled)
+	{
+		bindlessTable.destroy();
+	}
+	descriptorAllocator.destroy();
+	descriptorLayoutCache.destroy();
+	uniformRing.destroy();
+	renderGraph.destroy();
 	for (auto image : swapChainImages)
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
+
+		// Offscreen targets are owned by us rather than the swap chain
+		if (image.allocation.memory != VK_NULL_HANDLE)
+		{
+			memoryAllocator.destroyImage(image.imagen, image.allocation);
+		}
 	}
 
-	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (!settings.headless)
+	{
+		vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
+	pipelineCache.destroy();
+	shaderPack.close();
+	for (auto& mesh : meshList)
+	{
+		mesh.destroyBuffers();
+	}
+	uploadManager.destroy();
+	memoryAllocator.destroy();
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 	if(validationEnabled)
 		DestroyDebugReportCallbackEXT(instance, callback, nullptr);
@@ -51,6 +381,8 @@ VulkanRenderer::~VulkanRenderer()
 
 void VulkanRenderer::createInstance()
 {
+	PROFILE_FUNCTION();
+
 	if (validationEnabled && !checkValidationLayerSupport())
 	{
 		throw std::runtime_error("Required validation layers not supported");
@@ -74,16 +406,19 @@ void VulkanRenderer::createInstance()
 	// Create list to hold instance extensions
 	std::vector<const char*> instanceExtensions = std::vector<const char*>();
 
-	// Set up extensions to use
-	uint32_t glfwExtensionsCount = 0; // GLFW may require multiple extensions.
-	const char** glfwExtensions; // Extensions passed as array of cstring, so need pointer...
+	// Set up extensions to use. Headless rendering needs no window system integration at all.
+	if (!settings.headless)
+	{
+		uint32_t glfwExtensionsCount = 0; // GLFW may require multiple extensions.
+		const char** glfwExtensions; // Extensions passed as array of cstring, so need pointer...
 
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
 
-	// Add GLDFW extensions to list of extensions
-	for (size_t i = 0; i < glfwExtensionsCount; i++)
-	{
-		instanceExtensions.push_back(glfwExtensions[i]);
+		// Add GLDFW extensions to list of extensions
+		for (size_t i = 0; i < glfwExtensionsCount; i++)
+		{
+			instanceExtensions.push_back(glfwExtensions[i]);
+		}
 	}
 
 	// if validation enabled, add extension to report validation debug info
@@ -92,6 +427,22 @@ void VulkanRenderer::createInstance()
 		instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 	}
 
+	// Optional: extended device queries (device UUID, descriptor indexing), used when the loader has it
+	std::vector<const char*> properties2Extension = { VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME };
+	bool properties2Available = checkInstanceExtensionsSupport(&properties2Extension);
+	if (properties2Available)
+	{
+		instanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	}
+
+	// Optional: device UUIDs, whose properties structure comes with the external memory capabilities extension
+	std::vector<const char*> deviceIDExtension = { VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME };
+	bool deviceIDAvailable = properties2Available && checkInstanceExtensionsSupport(&deviceIDExtension);
+	if (deviceIDAvailable)
+	{
+		instanceExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+	}
+
 	// Check instance extensions supported
 	if (!checkInstanceExtensionsSupport(&instanceExtensions))
 	{
@@ -119,10 +470,20 @@ void VulkanRenderer::createInstance()
 	{
 		throw std::runtime_error("ERROR: Failed to create a Vulkan instance");
 	}
+
+	if (properties2Available)
+	{
+		properties2Functions.getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+		properties2Functions.getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+		properties2Functions.getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+		properties2Functions.deviceIDProperties = deviceIDAvailable;
+	}
 }
 
 void VulkanRenderer::createDebugCallback()
 {
+	PROFILE_FUNCTION();
+
 	if (validationEnabled)
 	{
 		VkDebugReportCallbackCreateInfoEXT callbackCreateInfo = {};
@@ -140,13 +501,46 @@ void VulkanRenderer::createDebugCallback()
 
 void VulkanRenderer::createLogicalDevice()
 {
-	// Get the queue family indices for the chosen physical device.
-	QueueFamilyIndices indices = getQueueFamilies(mainDevice.physicalDevice);
+	PROFILE_FUNCTION();
+
+	// Queue family indices chosen for the physical device when it was selected
+	const QueueFamilyIndices& indices = deviceCapabilities.queueFamilyIndices;
+
+	// GPU driven rendering finds each draw's instance through firstInstance, the rest has fallbacks
+	if (settings.gpuDriven)
+	{
+		gpuDrivenEnabled = deviceCapabilities.features.drawIndirectFirstInstance == VK_TRUE;
+		if (!gpuDrivenEnabled)
+		{
+			std::cout << "GPU driven rendering needs drawIndirectFirstInstance, drawing from the CPU instead" << std::endl;
+		}
+	}
+
+	// The cull is the only compute work, so a queue of its own is only worth having with GPU driven rendering.
+	// Without a compute family apart from graphics the cull stays on the graphics queue.
+	asyncComputeEnabled = gpuDrivenEnabled && settings.asyncCompute && indices.computeFamily != indices.graphicsFamily;
+
+	// When compute shares a family with the uploads, it gets the family's second queue if there is one
+	uint32_t computeQueueIndex = 0;
+	if (asyncComputeEnabled && indices.computeFamily == indices.transferFamily &&
+		deviceCapabilities.queueFamilies[indices.computeFamily].queueCount > 1)
+	{
+		computeQueueIndex = 1;
+	}
 
 	// Vector for queue creation information and set for family indices
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.presentationFamily };
+	std::set<int> queueFamilyIndices = { indices.graphicsFamily, indices.transferFamily };
+	if (indices.presentationFamily >= 0)
+	{
+		queueFamilyIndices.insert(indices.presentationFamily);
+	}
+	if (asyncComputeEnabled)
+	{
+		queueFamilyIndices.insert(indices.computeFamily);
+	}
 
+	float priorities[] = { 1.0f, 1.0f };
 	for (int queueFamilyIndex: queueFamilyIndices)
 	{
 
@@ -154,22 +548,68 @@ void VulkanRenderer::createLogicalDevice()
 		VkDeviceQueueCreateInfo queueCreateInfo = {};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-		queueCreateInfo.queueCount = 1;
-		float priority = 1.0;
-		queueCreateInfo.pQueuePriorities = &priority;
+		queueCreateInfo.queueCount = queueFamilyIndex == indices.computeFamily && asyncComputeEnabled ? computeQueueIndex + 1 : 1;
+		queueCreateInfo.pQueuePriorities = priorities;
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	// Optional extensions: only enabled where the driver has them
+	if (deviceCapabilities.hasExtension(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME))
+	{
+		enabledDeviceExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+		pipelineCreationFeedbackEnabled = true;
+	}
+	bool drawIndirectCountEnabled = gpuDrivenEnabled && deviceCapabilities.hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (drawIndirectCountEnabled)
+	{
+		enabledDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	// Descriptor indexing features the bindless table relies on, chained into the device create info
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+	descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	if (settings.bindless && deviceCapabilities.supportsBindless())
+	{
+		enabledDeviceExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);		// Required by descriptor indexing
+		enabledDeviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		bindlessEnabled = true;
+	}
+
+	// Textures are only reachable from the shaders through the bindless table
+	texturesEnabled = bindlessEnabled && settings.textureCount > 0;
+	if (settings.textureCount > 0 && !bindlessEnabled)
+	{
+		std::cout << "Texture streaming needs the bindless table, drawing without textures" << std::endl;
+	}
+
+	// Heap budgets from the driver, so streaming backs off before the heap is oversubscribed
+	if (properties2Functions.getMemoryProperties2 != nullptr && deviceCapabilities.hasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+	{
+		enabledDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		memoryBudgetEnabled = true;
+	}
+
 	// Information to create logical device 
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceCreateInfo.pNext = bindlessEnabled ? &descriptorIndexingFeatures : nullptr;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledDeviceExtensions.size());
+	deviceCreateInfo.ppEnabledExtensionNames = enabledDeviceExtensions.data();
 	
 	// Physical device features that logical device will be using.
+	// Indirect drawing ones are enabled whenever they exist, they cost nothing when unused.
 	VkPhysicalDeviceFeatures deviceFeatures = {};
+	deviceFeatures.multiDrawIndirect = deviceCapabilities.features.multiDrawIndirect;
+	deviceFeatures.drawIndirectFirstInstance = deviceCapabilities.features.drawIndirectFirstInstance;
+	deviceFeatures.shaderSampledImageArrayDynamicIndexing = bindlessEnabled ? deviceCapabilities.features.shaderSampledImageArrayDynamicIndexing : VK_FALSE;
 
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
@@ -181,12 +621,36 @@ void VulkanRenderer::createLogicalDevice()
 	}
 
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
-	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
-	
+	if (indices.presentationFamily >= 0)
+	{
+		vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+	}
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.transferFamily, 0, &transferQueue);
+	computeQueue = graphicsQueue;
+	if (asyncComputeEnabled)
+	{
+		vkGetDeviceQueue(mainDevice.logicalDevice, indices.computeFamily, computeQueueIndex, &computeQueue);
+	}
+	if (gpuDrivenEnabled)
+	{
+		std::cout << "Cull: " << (asyncComputeEnabled ? "async compute queue family " : "graphics queue family ")
+			<< (asyncComputeEnabled ? indices.computeFamily : indices.graphicsFamily)
+			<< (asyncComputeEnabled && computeQueueIndex == 0 && indices.computeFamily == indices.transferFamily ? " (shares the transfer queue)" : "") << std::endl;
+	}
+
+	// Without multiDrawIndirect the limit is 1, every indirect draw is a call of its own
+	indirectDrawSupport.multiDrawIndirect = deviceFeatures.multiDrawIndirect == VK_TRUE;
+	indirectDrawSupport.maxDrawIndirectCount = deviceCapabilities.properties.limits.maxDrawIndirectCount;
+	if (drawIndirectCountEnabled)
+	{
+		indirectDrawSupport.drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkCmdDrawIndexedIndirectCountKHR");
+	}
 }
 
 void VulkanRenderer::createSurface()
 {
+	PROFILE_FUNCTION();
+
 	VkResult result = glfwCreateWindowSurface(instance, m_pWindow, nullptr, &surface);
 
 	if(result != VK_SUCCESS)
@@ -197,19 +661,32 @@ void VulkanRenderer::createSurface()
 
 void VulkanRenderer::createSwapChain()
 {
+	PROFILE_FUNCTION();
+
 	// Get swap chain details so we can pick best settings
-	SwapChainDetails swapChainDetails = getSwapChainDetails(mainDevice.physicalDevice);
+	SwapChainDetails swapChainDetails = getSwapChainDetails();
 
 	// Find optimal surface values for our swap chain
 	// 1. Choose best surface format
 	VkSurfaceFormatKHR surfaceFormat = chooseBestSurfaceFormat(swapChainDetails.formats);
 	// 2. Choose best presentation mode
-	VkPresentModeKHR presentMode = chooseBestPresentationMode(swapChainDetails.presentationModes);
+	presentMode = chooseBestPresentationMode(swapChainDetails.presentationModes);
 	// 3. Choose swap chain image resolution
 	VkExtent2D extent = chooseBestExtent(swapChainDetails.surfaceCapabilities);
 
-	// How many images are in the swap chain? Get 1 more than the minimum to allow triple buffering
-	uint32_t imageCount = swapChainDetails.surfaceCapabilities.minImageCount + 1;
+	// How many images are in the swap chain? Low latency takes the minimum, so no frame queues behind another;
+	// throughput takes 2 more so MAILBOX always has a free image to render into while one is shown and one waits;
+	// power saving takes 1 more, enough for FIFO at the capped frame rate
+	uint32_t extraImages = 1;
+	if (settings.presentPolicy == PresentPolicy::LowLatency)
+	{
+		extraImages = 0;
+	}
+	else if (settings.presentPolicy == PresentPolicy::Throughput)
+	{
+		extraImages = 2;
+	}
+	uint32_t imageCount = swapChainDetails.surfaceCapabilities.minImageCount + extraImages;
 	if (swapChainDetails.surfaceCapabilities.maxImageCount> 0 && swapChainDetails.surfaceCapabilities.maxImageCount < imageCount)
 	{
 		imageCount = swapChainDetails.surfaceCapabilities.maxImageCount;
@@ -219,19 +696,19 @@ void VulkanRenderer::createSwapChain()
 	VkSwapchainCreateInfoKHR swapChainCreateInfo = {};
 	swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	swapChainCreateInfo.surface = surface;
-	swapChainCreateInfo.imageFormat = surfaceFormat.format;
+	swapChainCreateInfo.imageFormat = swapChainImageFormat;						// Same as surfaceFormat.format, see chooseRenderTargetFormat
 	swapChainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
 	swapChainCreateInfo.presentMode = presentMode;
 	swapChainCreateInfo.imageExtent = extent;
 	swapChainCreateInfo.minImageCount = imageCount;
 	swapChainCreateInfo.imageArrayLayers = 1;
-	swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (captureEnabled ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
 	swapChainCreateInfo.preTransform = swapChainDetails.surfaceCapabilities.currentTransform;
 	swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	swapChainCreateInfo.clipped = VK_TRUE;
 
-	// Get queue famili indices
-	QueueFamilyIndices indices = getQueueFamilies(mainDevice.physicalDevice);
+	// Queue family indices chosen for the physical device when it was selected
+	const QueueFamilyIndices& indices = deviceCapabilities.queueFamilyIndices;
 
 	// If grapohics and presentation families are different then swap chain must let images be shared between families
 	if (indices.graphicsFamily != indices.presentationFamily)
@@ -252,8 +729,9 @@ void VulkanRenderer::createSwapChain()
 		swapChainCreateInfo.pQueueFamilyIndices = nullptr;
 	}
 
-	// if old swap chain been destroyed and this on replaces it , ...
-	swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+	// If this swap chain replaces an existing one, hand the old one over so the driver can reuse its resources
+	// and keep presenting already queued images while the new one is being set up
+	swapChainCreateInfo.oldSwapchain = swapchain;
 
 	// Create a swap chain
 	VkResult res = vkCreateSwapchainKHR(mainDevice.logicalDevice, &swapChainCreateInfo, nullptr, &swapchain);
@@ -262,11 +740,11 @@ void VulkanRenderer::createSwapChain()
 		throw std::runtime_error("ERROR: Failed to create a swap chain!");
 	}
 
-	swapChainImageFormat = surfaceFormat.format;
 	swapChainExtent = extent;
 
 	uint32_t swapChainImageCount;
 	vkGetSwapchainImagesKHR(mainDevice.logicalDevice, swapchain, &swapChainImageCount, nullptr);
+	std::cout << "Swap chain: " << swapChainImageCount << " images, " << presentModeName(presentMode) << std::endl;
 	std::vector<VkImage> images(swapChainImageCount);
 	vkGetSwapchainImagesKHR(mainDevice.logicalDevice, swapchain, &swapChainImageCount, images.data());
 
@@ -282,468 +760,1352 @@ void VulkanRenderer::createSwapChain()
 
 }
 
-void VulkanRenderer::createRenderPass()
-{
-	// Colour attachments of render pass
-	VkAttachmentDescription colourAttachment = {};
-	colourAttachment.format = swapChainImageFormat;
-	colourAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colourAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // like glClear();
-	colourAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colourAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colourAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-	// Framebuffer data will be stored as an image, but images can bi given different data layouts
-	// to give optimal use of certain operations
-	colourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colourAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	// Attachment references uses an atachment index that referes to index in the attachment list passed to renderpasscreateinfo
-	VkAttachmentReference colourAttachmentReference = {};
-	colourAttachmentReference.attachment = 0;
-	colourAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.pColorAttachments = &colourAttachmentReference;
-	subpass.colorAttachmentCount = 1;
-
-	// Just if you unnderstand parallel programming
-	// Need to determine when layout trasitions occur using subpass dependencies.
-	std::array <VkSubpassDependency, 2> subpassDepoendencies;
-
-	// Conversion from VK_IMAGE_LAYOUT_UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-	// Transition must happen after
-	subpassDepoendencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-	subpassDepoendencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	subpassDepoendencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-
-	// Transition must happen before
-	subpassDepoendencies[0].dstSubpass = 0;
-	subpassDepoendencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDepoendencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	subpassDepoendencies[0].dependencyFlags = 0;
-
-	// Conversion from VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-	// Transition must happen after
-	subpassDepoendencies[1].srcSubpass = 0;
-	subpassDepoendencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDepoendencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	// Transition must happen before
-	subpassDepoendencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-	subpassDepoendencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	subpassDepoendencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	subpassDepoendencies[1].dependencyFlags = 0;
-
-	// Create info for render pass
-	VkRenderPassCreateInfo renderPassCreateInfo = {};
-	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassCreateInfo.attachmentCount = 1;
-	renderPassCreateInfo.pAttachments = &colourAttachment;
-	renderPassCreateInfo.subpassCount = 1;
-	renderPassCreateInfo.pSubpasses = &subpass;
-	renderPassCreateInfo.dependencyCount = static_cast<uint32_t> (subpassDepoendencies.size());
-	renderPassCreateInfo.pDependencies = subpassDepoendencies.data();
-
-	VkResult res = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &renderPass);
-	if (res != VK_SUCCESS)
-	{
-		throw std::runtime_error("ERROR: Failed to create a Render Pass");
-	}
+void VulkanRenderer::createOffscreenTargets()
+{
+	PROFILE_FUNCTION();
 
+	swapChainExtent = settings.headlessExtent;
 
+	// One target per frame in flight is enough: a target is only reused once its frame's fence has signalled
+	for (uint32_t i = 0; i < settings.framesInFlight; i++)
+	{
+		SwapchainImage offscreenImage = {};
+		offscreenImage.imagen = createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &offscreenImage.allocation);
+		offscreenImage.imageView = createImageView(offscreenImage.imagen, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
 
+		swapChainImages.push_back(offscreenImage);
+	}
 }
 
-void VulkanRenderer::createGraphicsPipeline()
+void VulkanRenderer::createUploadManager()
 {
-	auto vertexShaderCode = readFile("../Shaders/vert.spv");
-	auto fragmentShaderCode = readFile("../Shaders/frag.spv");
+	PROFILE_FUNCTION();
 
-	// Build shader moduloes to link to graphics pipeline.
-	VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
-	VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
+	const QueueFamilyIndices& indices = deviceCapabilities.queueFamilyIndices;
 
-	// -- SHADER STAGE CREATION INFORMATION --
-	// Vertex stage creation information
-	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
-	vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertexShaderCreateInfo.module = vertexShaderModule;
-	vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertexShaderCreateInfo.pName = "main"; // entry point of the shader.
-	
-	// Fragment stage creation information
-	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo = {};
-	fragmentShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragmentShaderCreateInfo.module = fragmentShaderModule;
-	fragmentShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragmentShaderCreateInfo.pName = "main"; // entry point of the shader.
-
-	// Create pipeline
-	VkPipelineShaderStageCreateInfo shaderStages[] =
-	{
-		vertexShaderCreateInfo, 
-		fragmentShaderCreateInfo
-	};
-
-	// -- VERTEX INPUT -- 
-	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
-	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
-	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputCreateInfo.pVertexAttributeDescriptions = nullptr;
-
-	// -- INPUT ASSEMBLY --
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-	// -- VIEWPORT & SCISSOR
-	// Create a viewport info struct
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapChainExtent.width;
-	viewport.height = (float)swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	uploadManager.create(mainDevice.logicalDevice, &memoryAllocator, transferQueue, static_cast<uint32_t>(indices.transferFamily),
+		static_cast<uint32_t>(indices.graphicsFamily), settings.framesInFlight);
 
-	// Create a scissor info struct
-	VkRect2D scissor = {};
-	scissor.offset = {0,0};
-	scissor.extent = swapChainExtent;
+	std::cout << "Uploads: " << (uploadManager.isDedicatedQueue() ? "dedicated transfer queue family " : "graphics queue family ")
+		<< indices.transferFamily << std::endl;
+}
 
-	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
-	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportStateCreateInfo.viewportCount = 1;
-	viewportStateCreateInfo.pViewports = &viewport;
-	viewportStateCreateInfo.scissorCount = 1;
-	viewportStateCreateInfo.pScissors = &scissor;
-	
-	// -- DYNAMIC STATES --
-	// Dynamic states to enable
-	/*std::vector<VkDynamicState> dynamicStateEnables;
-	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
-	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
-
-	// Dynamic state creation info
-	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
-	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
-	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();*/
-
-	// -- RASTERIZER --
-	// Convert triangles into fragments
-	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
-	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizerCreateInfo.depthClampEnable = VK_FALSE;
-	rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-	rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizerCreateInfo.lineWidth = 1.0f;
-	rasterizerCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizerCreateInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
-
-	// -- MULTISAMPLING --
-	VkPipelineMultisampleStateCreateInfo multiSamplingCreateInfo = {};
-	multiSamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multiSamplingCreateInfo.sampleShadingEnable = VK_FALSE;
-	multiSamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	
-	// -- BLENDING -- 
-	// Blending decides how to blend a new colour being written to a fragment, with the old value.
-
-	// Blend attachment state
-	VkPipelineColorBlendAttachmentState colourState = {};
-	colourState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colourState.blendEnable = VK_TRUE;
-
-	// Blending uses the following equation (srcColourBlendFactor * newColour) colourBlendOp (dstColourBlendFactor * oldColour)
-	colourState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-	colourState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-	colourState.colorBlendOp = VK_BLEND_OP_ADD;
-
-	colourState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-	colourState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	colourState.alphaBlendOp = VK_BLEND_OP_ADD;
-
-	VkPipelineColorBlendStateCreateInfo colourBlendingCreateInfo = {};
-	colourBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colourBlendingCreateInfo.logicOpEnable = VK_FALSE;
-	//colourBlendingCreateInfo.logicOp = VK_LOGIC_OP_COPY; 
-	colourBlendingCreateInfo.attachmentCount = 1;
-	colourBlendingCreateInfo.pAttachments = &colourState;
-
-	// -- PIPELINE LAYOUT (TODO)
-	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutCreateInfo.setLayoutCount = 0;
-	pipelineLayoutCreateInfo.pSetLayouts = nullptr;
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+void VulkanRenderer::createGpuProfiler()
+{
+	PROFILE_FUNCTION();
 
-	// Create pipeline layout
-	VkResult res = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
-	if (res != VK_SUCCESS)
+	if (!settings.gpuProfiling)
 	{
-		throw std::runtime_error("ERROR: Creating pipeline layout");
+		return;
 	}
 
-	// -- DEPTH STENCIL TESTING --
-	// TODO: Set up depth stencil testing.
-
-	// -- Graphics pipeline creation --
-	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
-	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineCreateInfo.stageCount = 2;
-	pipelineCreateInfo.pStages = shaderStages;
-	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
-	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
-	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-	pipelineCreateInfo.pDynamicState = nullptr;
-	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
-	pipelineCreateInfo.pMultisampleState = &multiSamplingCreateInfo;
-	pipelineCreateInfo.pColorBlendState = &colourBlendingCreateInfo;
-	pipelineCreateInfo.pDepthStencilState = nullptr;
-	pipelineCreateInfo.layout = pipelineLayout;
-	pipelineCreateInfo.renderPass = renderPass;
-	pipelineCreateInfo.subpass = 0;
-
-	// Pipeline derivatives...
-	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineCreateInfo.basePipelineIndex = -1;
-
-	// Create graphics pipeline
-	res = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline);
-	if (res != VK_SUCCESS)
+	// Each track's scopes are written into its queue's command buffers, so that family's timestamp support is what counts
+	const QueueFamilyIndices& indices = deviceCapabilities.queueFamilyIndices;
+	std::vector<uint32_t> timestampValidBits(GPU_TRACK_COUNT, 0);
+	timestampValidBits[static_cast<uint32_t>(GpuTrack::Graphics)] = deviceCapabilities.queueFamilies[indices.graphicsFamily].timestampValidBits;
+	if (asyncComputeEnabled)
 	{
-		throw std::runtime_error("ERROR: Creating pipeline layout");
+		timestampValidBits[static_cast<uint32_t>(GpuTrack::Compute)] = deviceCapabilities.queueFamilies[indices.computeFamily].timestampValidBits;
 	}
+	gpuProfiler.create(mainDevice.logicalDevice, deviceCapabilities.properties.limits.timestampPeriod,
+		timestampValidBits, settings.framesInFlight);
 
-	// Destroy shader module no longer needed after pipeline created
-	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+	if (!gpuProfiler.isEnabled())
+	{
+		std::cout << "GPU profiling: timestamps not supported on the graphics queue family, disabled" << std::endl;
+	}
 }
 
-void VulkanRenderer::getPhysicalDevice()
+void VulkanRenderer::createMeshes()
 {
-	// Enumerate physical devices the VkInstance can access
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+	PROFILE_FUNCTION();
 
-	// Check if there are devices available to support Vulkan
-	if (deviceCount == 0)
+	// Two quads, each built from the vertices of a 4x4 grid so the cache optimisation has something to do
+	const uint32_t gridSize = 4;
+	glm::vec3 colours[] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+	glm::vec3 origins[] = { { -0.9f, -0.4f, 0.0f }, { 0.1f, -0.4f, 0.0f } };
+
+	for (uint32_t m = 0; m < 2; m++)
 	{
-		throw std::runtime_error("ERROR:  Can't find GPU's that support Vulkan Instance!");
+		MeshData meshData;
+		for (uint32_t y = 0; y <= gridSize; y++)
+		{
+			for (uint32_t x = 0; x <= gridSize; x++)
+			{
+				float u = static_cast<float>(x) / gridSize;
+				float v = static_cast<float>(y) / gridSize;
+				Vertex vertex;
+				vertex.pos = origins[m] + glm::vec3(u * 0.8f, v * 0.8f, 0.0f);
+				vertex.col = colours[m] * (0.5f + 0.5f * u);
+				meshData.vertices.push_back(vertex);
+			}
+		}
+
+		// Deliberately emitted column by column, the order least friendly to the vertex cache
+		for (uint32_t x = 0; x < gridSize; x++)
+		{
+			for (uint32_t y = 0; y < gridSize; y++)
+			{
+				uint32_t topLeft = y * (gridSize + 1) + x;
+				uint32_t bottomLeft = topLeft + gridSize + 1;
+				meshData.indices.insert(meshData.indices.end(), { topLeft, bottomLeft, topLeft + 1, topLeft + 1, bottomLeft, bottomLeft + 1 });
+			}
+		}
+
+		// "Import" step
+		float acmrBefore = calculateACMR(meshData.indices, meshData.vertices.size());
+		optimizeMesh(meshData);
+		float acmrAfter = calculateACMR(meshData.indices, meshData.vertices.size());
+		std::cout << "Mesh " << m << ": ACMR " << acmrBefore << " -> " << acmrAfter << std::endl;
+
+		meshList.push_back(Mesh(&memoryAllocator, &uploadManager, meshData, settings.vertexLayout));
+		renderObjects.push_back({ m, glm::mat4(1.0f), texturesEnabled ? FIRST_TEXTURED_MATERIAL + m % settings.textureCount : 0 });
 	}
 
-	// Get list of physical devices
-	std::vector<VkPhysicalDevice> devices(deviceCount);
-	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+	// Benchmark copies: a grid of small quads alternating between the two meshes, covering the screen
+	uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(settings.benchmarkObjects))));
+	for (uint32_t i = 0; i < settings.benchmarkObjects; i++)
+	{
+		float cellSize = 2.0f / columns;
+		glm::vec3 cellCentre(-1.0f + cellSize * (i % columns + 0.5f), -1.0f + cellSize * (i / columns + 0.5f), 0.0f);
+
+		// The meshes are 0.8 wide around x = -0.5 / 0.5, y = 0
+		glm::vec3 meshCentre((i % 2) == 0 ? -0.5f : 0.5f, 0.0f, 0.0f);
+		float scale = cellSize / 0.8f * 0.9f;
 
-	for (const auto& device : devices)
+		glm::mat4 model = glm::translate(glm::mat4(1.0f), cellCentre);
+		model = glm::scale(model, glm::vec3(scale, scale, 1.0f));
+		model = glm::translate(model, meshCentre * -1.0f);
+		renderObjects.push_back({ i % 2, model, texturesEnabled ? FIRST_TEXTURED_MATERIAL + i % settings.textureCount : 1 });
+	}
+}
+
+void VulkanRenderer::createFrameCapture()
+{
+	PROFILE_FUNCTION();
+
+	if (!captureEnabled)
 	{
-		if (checkDeviceSuitable(device))
-		{
-			mainDevice.physicalDevice = device;
-			break;
-		}
+		return;
 	}
+
+	// One more slot than frames in flight, so a frame can be copied while the collector still reads the last one
+	uint32_t slotCount = settings.captureSlots > 0 ? settings.captureSlots : settings.framesInFlight + 1;
+	frameCapture.create(mainDevice.logicalDevice, &memoryAllocator, settings.captureFormat, settings.capturePath, slotCount,
+		settings.captureInterval, settings.captureThreads);
 }
 
-bool VulkanRenderer::checkInstanceExtensionsSupport(std::vector<const char*>* checkExtensions)
+void VulkanRenderer::createTextures()
 {
-	// Need to get the number of extensions to create array of correct size to hold extensions.
-	uint32_t extensionsCount = 0;
-	vkEnumerateInstanceExtensionProperties(nullptr, &extensionsCount, nullptr);
+	PROFILE_FUNCTION();
 
-	// Creeate a list of VkExtensionProperties using count.
-	std::vector<VkExtensionProperties> extensions( extensionsCount );
-	vkEnumerateInstanceExtensionProperties(nullptr, &extensionsCount, extensions.data());
+	if (!texturesEnabled)
+	{
+		return;
+	}
 
-	// Check if given extensions are in list of available extensions
-	for (const auto& checkExtension : *checkExtensions)
+	textureStreamer.create(mainDevice.logicalDevice, &memoryAllocator, &uploadManager, &bindlessTable, settings.framesInFlight,
+		settings.textureBudget, DEFAULT_TEXTURE_UPLOAD_PER_FRAME, settings.textureLoadThreads);
+
+	// Procedural checkerboards standing in for files on disk: every load generates the requested top level and
+	// filters the rest of the chain down from it, which is about what decoding plus mip generation would cost
+	const uint32_t size = settings.textureSize;
+	for (uint32_t t = 0; t < settings.textureCount; t++)
 	{
-		bool hasExtension = false;
-		for (const auto& extension : extensions)
-		{
-			if (!strcmp(checkExtension, extension.extensionName))
+		glm::vec3 colour(0.4f + 0.6f * ((t + 1) % 2), 0.4f + 0.6f * ((t / 2 + 1) % 2), 0.4f + 0.6f * ((t / 4) % 2));
+		uint32_t squares = 8 << (t % 3);
+
+		textureStreamer.addTexture("Checker " + std::to_string(t), size, size, [size, colour, squares](uint32_t firstMip) {
+			std::vector<TextureMip> mips(1);
+			TextureMip &top = mips[0];
+			top.width = std::max(size >> firstMip, 1u);
+			top.height = top.width;
+			top.texels.resize(static_cast<size_t>(top.width) * top.height * 4);
+
+			uint32_t squareSize = std::max(top.width / squares, 1u);
+			for (uint32_t y = 0; y < top.height; y++)
 			{
-				hasExtension = true;
-				break;
+				for (uint32_t x = 0; x < top.width; x++)
+				{
+					float shade = ((x / squareSize + y / squareSize) % 2) == 0 ? 1.0f : 0.25f;
+					uint8_t *texel = &top.texels[(static_cast<size_t>(y) * top.width + x) * 4];
+					texel[0] = static_cast<uint8_t>(colour.x * shade * 255.0f);
+					texel[1] = static_cast<uint8_t>(colour.y * shade * 255.0f);
+					texel[2] = static_cast<uint8_t>(colour.z * shade * 255.0f);
+					texel[3] = 255;
+				}
 			}
-		}
 
-		if(!hasExtension)
-			return false;
+			while (mips.back().width > 1 || mips.back().height > 1)
+			{
+				mips.push_back(TextureStreamer::downsample(mips.back()));
+			}
+			return mips;
+		});
 	}
 
-	return true;
+	TextureStreamerStats stats = textureStreamer.getStats();
+	std::cout << "Textures: " << stats.textureCount << " x " << size << "x" << size << ", budget " << stats.budgetBytes / (1024 * 1024)
+		<< " MiB, driver memory budget " << (memoryBudgetEnabled ? "on" : "off") << std::endl;
 }
 
-bool VulkanRenderer::checkValidationLayerSupport()
+void VulkanRenderer::createInstanceBuffer()
 {
-	// Get number of validation layers to create vector of apropiate size
-	uint32_t validationLayerCount = 0;
-	vkEnumerateInstanceLayerProperties(&validationLayerCount, nullptr);
+	PROFILE_FUNCTION();
 
-	// Check if no validation layers found and we want at least 1
-	if (validationLayerCount == 0 && validationLayers.size() > 0)
+	if (!gpuDrivenEnabled)
 	{
-		return false;
+		return;
 	}
 
-	// Creeate a list of VkExtensionProperties using count.
-	std::vector<VkLayerProperties> availableLayers(validationLayerCount);
-	vkEnumerateInstanceLayerProperties(&validationLayerCount, availableLayers.data());
+	gpuCulling.setScene(renderObjects, meshList, &uploadManager);
 
-	// Check if given extensions are in list of available extensions
-	for (const auto& validationLayer : validationLayers)
+	const char* modeNames[] = { "draw count", "multi draw indirect", "one indirect draw per object" };
+	std::cout << "GPU culling: " << gpuCulling.getInstanceCount() << " instances in " << gpuCulling.getBatches().size() << " batches, "
+		<< modeNames[static_cast<int>(gpuCulling.getMode())] << std::endl;
+}
+
+void VulkanRenderer::createPipelineCache()
+{
+	PROFILE_FUNCTION();
+
+	pipelineCache.create(mainDevice.physicalDevice, mainDevice.logicalDevice, settings.pipelineCachePath, pipelineCreationFeedbackEnabled);
+}
+
+void VulkanRenderer::loadShaderPack()
+{
+	PROFILE_FUNCTION();
+
+	shaderPack.open(settings.shaderPackPath.empty() ? ShaderPack::locate("shaders.pack") : settings.shaderPackPath);
+}
+
+void VulkanRenderer::createRenderGraph()
+{
+	PROFILE_FUNCTION();
+
+	// -- RESOURCES --
+	// The render target arrives in whatever state the last frame left it, its contents are cleared anyway; it leaves
+	// ready to present (or to copy out, headless). Waiting for the acquire semaphore happens at the colour output stage.
+	// When capturing, the capture copies it out first and hands it on to presentation itself.
+	RenderGraphAccess targetInitial;
+	targetInitial.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	RenderGraphAccess targetFinal;
+	targetFinal.stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	targetFinal.layout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	if (captureEnabled)
 	{
-		bool hasLayer = false;
-		for (const auto& availableLayer : availableLayers)
+		targetFinal.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		targetFinal.access = VK_ACCESS_TRANSFER_READ_BIT;
+		targetFinal.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	}
+	backbufferResource = renderGraph.importImage("Backbuffer", swapChainImageFormat, VK_SAMPLE_COUNT_1_BIT, targetInitial, targetFinal);
+
+	// -- CULL --
+	// Each frame in flight culls into its own buffers, so only this frame's draws read what the cull writes
+	RenderGraph::Resource indirectCommands = RenderGraph::INVALID_INDEX;
+	if (gpuDrivenEnabled)
+	{
+		indirectCommands = renderGraph.importBuffer("Indirect commands", RenderGraphAccess(), RenderGraphAccess());
+		cullPass = renderGraph.addComputePass("Cull", [this](const RenderGraphPassContext& context) {
+			gpuCulling.recordCull(context.commandBuffer, currentFrame, descriptorAllocator, viewProjection, false);
+		});
+		renderGraph.addBufferOutput(cullPass, indirectCommands, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	// -- SCENE --
+	// Its contents all come from the secondary buffers (or inline, GPU driven)
+	scenePass = renderGraph.addGraphicsPass("Main pass", gpuDrivenEnabled ? VK_SUBPASS_CONTENTS_INLINE : VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS,
+		[this](const RenderGraphPassContext& context) {
+			if (gpuDrivenEnabled)
+			{
+				recordIndirectObjects(context.commandBuffer);
+			}
+			else
+			{
+				// Slices run in draw list order
+				const FrameCommands& frame = frameCommands[currentFrame];
+				vkCmdExecuteCommands(context.commandBuffer, static_cast<uint32_t>(frame.sliceBuffers.size()), frame.sliceBuffers.data());
+			}
+		});
+	// Multisampled, it renders into a transient target that is resolved into the backbuffer at the end of the subpass.
+	// Neither that nor the depth buffer is ever loaded or stored.
+	VkClearColorValue clearColour = { { 0.6f, 0.65f, 0.4f, 1.0f } };
+	if (sampleCount != VK_SAMPLE_COUNT_1_BIT)
+	{
+		RenderGraph::Resource multisampled = renderGraph.createImage("Colour (multisampled)", swapChainImageFormat, sampleCount);
+		renderGraph.addColourOutput(scenePass, multisampled, &clearColour);
+		renderGraph.addResolveOutput(scenePass, backbufferResource, multisampled);
+	}
+	else
+	{
+		renderGraph.addColourOutput(scenePass, backbufferResource, &clearColour);
+	}
+	if (depthFormat != VK_FORMAT_UNDEFINED)
+	{
+		VkClearDepthStencilValue clearDepth = { 1.0f, 0 };
+		renderGraph.addDepthOutput(scenePass, renderGraph.createImage("Depth", depthFormat, sampleCount), &clearDepth);
+	}
+	if (gpuDrivenEnabled)
+	{
+		renderGraph.addBufferInput(scenePass, indirectCommands, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	}
+
+	renderGraph.markOutput(backbufferResource);
+	renderGraph.compile(mainDevice.logicalDevice, &memoryAllocator);
+	renderPass = renderGraph.getRenderPass(scenePass);
+}
+
+void VulkanRenderer::createDescriptors()
+{
+	PROFILE_FUNCTION();
+
+	descriptorLayoutCache.create(mainDevice.logicalDevice);
+	descriptorAllocator.create(mainDevice.logicalDevice, settings.framesInFlight);
+
+	// -- FRAME SET --
+	// Both bindings point into the frame's uniform ring, what they read is picked by the dynamic offsets
+	VkDescriptorSetLayoutBinding frameBinding = {};
+	frameBinding.binding = 0;
+	frameBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	frameBinding.descriptorCount = 1;
+	frameBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	frameBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding materialBinding = {};
+	materialBinding.binding = 1;
+	materialBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	materialBinding.descriptorCount = 1;
+	materialBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	materialBinding.pImmutableSamplers = nullptr;
+
+	frameSetLayout = descriptorLayoutCache.getLayout({ frameBinding, materialBinding });
+
+	if (bindlessEnabled)
+	{
+		bindlessTable.create(mainDevice.logicalDevice, deviceCapabilities, descriptorLayoutCache, BINDLESS_MAX_IMAGES, BINDLESS_MAX_BUFFERS);
+		std::cout << "Bindless table: " << bindlessTable.getImageCapacity() << " images, " << bindlessTable.getBufferCapacity() << " buffers" << std::endl;
+	}
+
+	// -- INSTANCE SET --
+	if (gpuDrivenEnabled)
+	{
+		// Written by the compute queue and read by graphics every frame when culling asynchronously
+		const QueueFamilyIndices& indices = deviceCapabilities.queueFamilyIndices;
+		std::vector<uint32_t> sharingFamilies;
+		if (asyncComputeEnabled)
 		{
-			if (!strcmp(validationLayer, availableLayer.layerName))
+			sharingFamilies = { static_cast<uint32_t>(indices.graphicsFamily), static_cast<uint32_t>(indices.computeFamily),
+				static_cast<uint32_t>(indices.transferFamily) };
+		}
+		gpuCulling.create(mainDevice.logicalDevice, &memoryAllocator, descriptorLayoutCache, indirectDrawSupport, settings.framesInFlight, sharingFamilies);
+	}
+}
+
+void VulkanRenderer::createUniformRing()
+{
+	PROFILE_FUNCTION();
+
+	uniformRing.create(&memoryAllocator, deviceCapabilities.properties.limits.minUniformBufferOffsetAlignment, settings.framesInFlight, settings.uniformRingSize);
+}
+
+void VulkanRenderer::createPipelineLayout()
+{
+	PROFILE_FUNCTION();
+
+	// -- PIPELINE LAYOUT --
+	// Per draw constants, pushed straight into the command buffer for each draw
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = DRAW_CONSTANT_STAGES;			// Shader stage push constant will go to
+	pushConstantRange.offset = 0;									// Offset into given data to pass to push constant
+	pushConstantRange.size = sizeof(DrawConstants);					// Size of data being passed
+
+	// Descriptor sets: frame uniforms at FRAME_DESCRIPTOR_SET, then the bindless table when there is one, then the
+	// instances when GPU driven. Set numbers can't have gaps, so a missing bindless table leaves an empty layout there.
+	std::vector<VkDescriptorSetLayout> setLayouts = { frameSetLayout };
+	if (bindlessEnabled)
+	{
+		setLayouts.push_back(bindlessTable.getLayout());
+	}
+	if (gpuDrivenEnabled)
+	{
+		if (!bindlessEnabled)
+		{
+			setLayouts.push_back(descriptorLayoutCache.getLayout({}));
+		}
+		setLayouts.push_back(gpuCulling.getSetLayout());
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	// Create pipeline layout. Every material shares it, so it survives render pass recreation.
+	VkResult res = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (res != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Creating pipeline layout");
+	}
+}
+
+void VulkanRenderer::createPipelineManager()
+{
+	PROFILE_FUNCTION();
+
+	pipelineManager.create(mainDevice.logicalDevice, &pipelineCache, &shaderPack, settings.pipelineCompileThreads);
+
+	// -- MATERIALS --
+	// Default: alpha blended, back faces culled. This one is built during Init and is every other material's fallback.
+	Material defaultMaterial;
+	defaultMaterial.pipeline.vertexShader = gpuDrivenEnabled ? "shader_indirect.vert" : "shader.vert";
+	defaultMaterial.pipeline.vertexLayout = settings.vertexLayout;
+	defaultMaterial.pipeline.layout = pipelineLayout;
+	defaultMaterial.pipeline.depthTest = true;
+	defaultMaterial.pipeline.depthWrite = false;								// Blended, so it doesn't hide what is drawn behind it later
+	defaultMaterial.pipeline.depthCompare = VK_COMPARE_OP_LESS_OR_EQUAL;		// The scene is flat, equal depths keep draw order
+	materials.push_back(defaultMaterial);
+
+	// Opaque, double sided and dimmed, used by the benchmark copies. Only differs in fixed function state, so it is
+	// built in the background as a derivative of the default.
+	Material opaqueMaterial = defaultMaterial;
+	opaqueMaterial.pipeline.blendMode = BlendMode::Opaque;
+	opaqueMaterial.pipeline.depthWrite = true;
+	opaqueMaterial.pipeline.cullMode = VK_CULL_MODE_NONE;
+	opaqueMaterial.parameters.tint = glm::vec4(0.6f, 0.6f, 0.6f, 1.0f);
+	materials.push_back(opaqueMaterial);
+
+	// Textured: opaque, one per streamed texture. They share one pipeline, only the texture index differs.
+	if (texturesEnabled)
+	{
+		Material texturedMaterial = opaqueMaterial;
+		texturedMaterial.pipeline.fragmentShader = "shader_textured.frag";
+		texturedMaterial.parameters.tint = glm::vec4(1.0f);
+		for (uint32_t texture = 0; texture < settings.textureCount; texture++)
+		{
+			texturedMaterial.texture = texture;
+			materials.push_back(texturedMaterial);
+		}
+	}
+}
+
+void VulkanRenderer::createGraphicsPipeline()
+{
+	PROFILE_FUNCTION();
+
+	// Built on this thread: nothing can be drawn without it
+	graphicsPipeline = pipelineManager.getPipeline(getMaterialKey(0));
+}
+
+void VulkanRenderer::createCullPipeline()
+{
+	PROFILE_FUNCTION();
+
+	if (gpuDrivenEnabled)
+	{
+		gpuCulling.createPipeline(&pipelineCache, &shaderPack);
+	}
+}
+
+void VulkanRenderer::createCommandPool()
+{
+	PROFILE_FUNCTION();
+
+	// Queue family indices chosen for the physical device when it was selected
+	const QueueFamilyIndices& queueFamilyIndices = deviceCapabilities.queueFamilyIndices;
+
+	// Pools are reset as a whole once their frame has finished, rather than freeing or resetting buffers one by one
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;			// Buffers are re-recorded every frame
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;	// Queue Family type that buffers from this command pool will use
+
+	// One pool for the primary buffer and one per recording thread, for each frame in flight.
+	// A pool may only be used by one thread at a time, so this way recording needs no locks.
+	frameCommands.resize(settings.framesInFlight);
+	for (auto& frame : frameCommands)
+	{
+		frame.threads.resize(threadPool.getThreadCount());
+
+		// Create a Graphics Queue Family Command Pool
+		VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &frame.primaryPool);
+		for (auto& thread : frame.threads)
+		{
+			if (result == VK_SUCCESS)
 			{
-				hasLayer = true;
-				break;
+				result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &thread.pool);
 			}
 		}
+		if (result == VK_SUCCESS && asyncComputeEnabled)
+		{
+			VkCommandPoolCreateInfo computePoolInfo = poolInfo;
+			computePoolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily;
+			result = vkCreateCommandPool(mainDevice.logicalDevice, &computePoolInfo, nullptr, &frame.computePool);
+		}
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to create a Command Pool!");
+		}
+	}
+}
 
-		if (!hasLayer)
-			return false;
+void VulkanRenderer::createCommandBuffers()
+{
+	PROFILE_FUNCTION();
+
+	// One primary command buffer per frame in flight, re-recorded every frame.
+	// Secondary buffers are allocated by the recording threads as they need them.
+	for (auto& frame : frameCommands)
+	{
+		VkCommandBufferAllocateInfo cbAllocInfo = {};
+		cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cbAllocInfo.commandPool = frame.primaryPool;
+		cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;	// PRIMARY: Buffer you submit directly to queue
+		cbAllocInfo.commandBufferCount = 1;
+
+		// Allocate command buffers and place handles in array of buffers
+		VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &frame.primaryBuffer);
+		if (result == VK_SUCCESS && frame.computePool != VK_NULL_HANDLE)
+		{
+			cbAllocInfo.commandPool = frame.computePool;
+			result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &frame.computeBuffer);
+		}
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to allocate Command Buffers!");
+		}
 	}
-	return true;
 }
 
-bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
+void VulkanRenderer::createSynchronisation()
 {
-	/*
-	// Information about the device itself (Id, name, type, vendor, ...)
-	VkPhysicalDeviceProperties deviceProperties;
-	vkGetPhysicalDeviceProperties(device, &deviceProperties);
-	
-	// Information about what the device can do (geo shader, tess shader, wide lines, ...)
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-	*/
+	PROFILE_FUNCTION();
+
+	imageAvailable.resize(settings.framesInFlight);
+	renderFinished.resize(settings.framesInFlight);
+	drawFences.resize(settings.framesInFlight);
+	frameSubmitTimes.resize(settings.framesInFlight);
+	latencyPending.assign(settings.framesInFlight, false);
 
-	QueueFamilyIndices indices = getQueueFamilies(device);
+	// Semaphore creation information
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	bool extensionsSupported = checkDeviceExtensionSupport(device);
+	// Fence creation information. Start signalled so the first wait on each frame slot returns immediately
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	bool swapChainValid = false;
-	if (extensionsSupported)
+	for (size_t i = 0; i < settings.framesInFlight; i++)
 	{
-		SwapChainDetails swapChainDetails = getSwapChainDetails(device);
-		swapChainValid = !swapChainDetails.presentationModes.empty() && !swapChainDetails.formats.empty();
+		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinished[i]) != VK_SUCCESS ||
+			vkCreateFence(mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &drawFences[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("ERROR: Failed to create a Semaphore and/or Fence!");
+		}
 	}
 
-	return indices.isValid() && extensionsSupported && swapChainValid;
+	if (asyncComputeEnabled)
+	{
+		computeFinished.resize(settings.framesInFlight);
+		for (auto& semaphore : computeFinished)
+		{
+			if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &semaphore) != VK_SUCCESS)
+			{
+				throw std::runtime_error("ERROR: Failed to create a Semaphore!");
+			}
+		}
+	}
 }
 
-bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
+void VulkanRenderer::recordCommands(uint32_t imageIndex)
 {
-	uint32_t extensionCount = 0;
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	PROFILE_FUNCTION();
+
+	FrameCommands& frame = frameCommands[currentFrame];
+
+	// Everything recorded the last time this frame slot was used is finished with, start the pools from scratch
+	vkResetCommandPool(mainDevice.logicalDevice, frame.primaryPool, 0);
+	for (auto& thread : frame.threads)
+	{
+		vkResetCommandPool(mainDevice.logicalDevice, thread.pool, 0);
+		thread.usedCount = 0;
+	}
 
-	if (extensionCount == 0) return false;
+	// Information about how to begin each command buffer
+	VkCommandBufferBeginInfo bufferBeginInfo = {};
+	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-	std::vector<VkExtensionProperties> extensions(extensionCount);
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+	// Start recording commands to command buffer! The primary is begun first so the profiler's query reset lands
+	// ahead of any scope the secondary buffers write
+	VkResult result = vkBeginCommandBuffer(frame.primaryBuffer, &bufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to start recording a Command Buffer!");
+	}
+
+	gpuProfiler.beginFrame(frame.primaryBuffer, currentFrame);
 
-	for (const auto& deviceExtension : deviceExtensions)
+	// -- MATERIALS --
+	// Looked up once here rather than per slice, so every slice of a frame draws a material with the same pipeline.
+	// Materials still compiling draw with the default pipeline this frame.
+	materialPipelines.resize(materials.size());
+	materialPipelines[0] = graphicsPipeline;
+	for (uint32_t material = 1; material < materials.size(); material++)
 	{
-		bool hasExtension = false;
-		for (const auto& extension : extensions)
+		materialPipelines[material] = pipelineManager.requestPipeline(getMaterialKey(material), getMaterialKey(0));
+	}
+
+	recordUniforms();
+
+	// -- CULL --
+	// On the compute queue once the instances have arrived; until then, or without one, as the render graph's cull
+	// pass in this command buffer
+	frame.computeRecorded = asyncComputeEnabled && uploadManager.isComplete(gpuCulling.getUploadTicket());
+	if (frame.computeRecorded)
+	{
+		recordComputeCommands();
+	}
+	if (gpuDrivenEnabled)
+	{
+		renderGraph.setPassEnabled(cullPass, !frame.computeRecorded);
+	}
+	renderGraph.bindImage(backbufferResource, swapChainImages[imageIndex].imageView);
+
+	// -- SECONDARY COMMAND BUFFERS --
+	// Split the draw list into slices, each recorded into its own secondary buffer by whichever worker picks it up.
+	// A couple of slices per thread evens out the load; tiny scenes stay in a single slice.
+	// GPU driven frames have a few indirect draws at most, those are recorded straight into the primary.
+	uint32_t objectCount = static_cast<uint32_t>(renderObjects.size());
+	uint32_t sliceCount = std::min(threadPool.getThreadCount() * 2, (objectCount + MIN_OBJECTS_PER_SLICE - 1) / MIN_OBJECTS_PER_SLICE);
+	sliceCount = gpuDrivenEnabled ? 0 : std::max(sliceCount, 1u);
+	frame.sliceBuffers.resize(sliceCount);
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;										// Render pass the secondary buffers execute in
+	inheritanceInfo.subpass = renderGraph.getSubpass(scenePass);
+	inheritanceInfo.framebuffer = renderGraph.getFramebuffer(scenePass);			// Optional, but lets the driver specialise
+
+	threadPool.parallelFor(sliceCount, [&](uint32_t slice, uint32_t worker) {
+		ThreadCommands& thread = frame.threads[worker];
+
+		// Reuse the buffers the pool reset; only allocate when this thread records more slices than ever before
+		if (thread.usedCount == thread.secondaryBuffers.size())
 		{
-			if (!strcmp(deviceExtension, extension.extensionName))
+			VkCommandBufferAllocateInfo cbAllocInfo = {};
+			cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cbAllocInfo.commandPool = thread.pool;
+			cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;		// SECONDARY: Buffer can't be submitted directly, only executed by a primary
+			cbAllocInfo.commandBufferCount = 1;
+
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &commandBuffer) != VK_SUCCESS)
 			{
-				hasExtension = true;
-				break;
+				throw std::runtime_error("ERROR: Failed to allocate a secondary Command Buffer!");
 			}
+			thread.secondaryBuffers.push_back(commandBuffer);
 		}
+		VkCommandBuffer commandBuffer = thread.secondaryBuffers[thread.usedCount++];
+		frame.sliceBuffers[slice] = commandBuffer;
+
+		uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(objectCount) * slice / sliceCount);
+		uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(objectCount) * (slice + 1) / sliceCount);
+		recordObjects(commandBuffer, inheritanceInfo, first, last);
+	});
 
-		if(!hasExtension) return false;
+	// -- PRIMARY COMMAND BUFFER --
+	// The cull, the render pass and the barriers between them, each pass in its own profiler scope
+	renderGraph.execute(frame.primaryBuffer, &gpuProfiler);
+
+	// -- CAPTURE --
+	// Into a readback buffer if one is free, then on to presentation
+	if (captureEnabled)
+	{
+		frameCapture.recordCapture(frame.primaryBuffer, swapChainImages[imageIndex].imagen, swapChainImageFormat, swapChainExtent,
+			settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 	}
 
-	return true;
+	// Stop recording to command buffer
+	result = vkEndCommandBuffer(frame.primaryBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to stop recording a Command Buffer!");
+	}
 }
 
-QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
+void VulkanRenderer::recordComputeCommands()
 {
-	QueueFamilyIndices indices;
+	PROFILE_FUNCTION();
 
-	// Get all Queue Family Property info for the given device
-	uint32_t queueFamilyCount;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	FrameCommands& frame = frameCommands[currentFrame];
+	vkResetCommandPool(mainDevice.logicalDevice, frame.computePool, 0);
 
-	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilyList.data());
+	VkCommandBufferBeginInfo bufferBeginInfo = {};
+	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-	// Check if given extensions are in list of available extensions
-	int i = 0;
-	for (const auto& queueFamily : queueFamilyList)
+	VkResult result = vkBeginCommandBuffer(frame.computeBuffer, &bufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to start recording a Command Buffer!");
+	}
+
+	gpuProfiler.beginTrack(frame.computeBuffer, GpuTrack::Compute);
+
+	uint32_t cullScope = gpuProfiler.beginScope(frame.computeBuffer, "Cull", GpuTrack::Compute);
+	gpuCulling.recordCull(frame.computeBuffer, currentFrame, descriptorAllocator, viewProjection, false);
+	gpuProfiler.endScope(frame.computeBuffer, cullScope);
+
+	result = vkEndCommandBuffer(frame.computeBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to stop recording a Command Buffer!");
+	}
+}
+
+void VulkanRenderer::recordUniforms()
+{
+	PROFILE_FUNCTION();
+
+	// -- UNIFORM DATA --
+	FrameUniforms frameUniforms;
+	frameUniforms.viewProjection = viewProjection;
+	frameUniformOffset = uniformRing.push(frameUniforms).offset;
+
+	materialUniformOffsets.resize(materials.size());
+	for (uint32_t material = 0; material < materials.size(); material++)
+	{
+		// Streaming moves a texture to another bindless slot whenever its resident levels change
+		if (materials[material].texture != UINT32_MAX)
+		{
+			materials[material].parameters.textureIndex = textureStreamer.getBindlessIndex(materials[material].texture);
+		}
+		materialUniformOffsets[material] = uniformRing.push(materials[material].parameters).offset;
+	}
+
+	// -- FRAME SET --
+	// Allocated fresh every frame from the transient pools; its buffer is this frame's ring
+	frameDescriptorSet = descriptorAllocator.allocate(frameSetLayout);
+
+	VkDescriptorBufferInfo frameBufferInfo = {};
+	frameBufferInfo.buffer = uniformRing.getBuffer();
+	frameBufferInfo.offset = 0;								// The dynamic offset is added to this
+	frameBufferInfo.range = sizeof(FrameUniforms);
+
+	VkDescriptorBufferInfo materialBufferInfo = {};
+	materialBufferInfo.buffer = uniformRing.getBuffer();
+	materialBufferInfo.offset = 0;
+	materialBufferInfo.range = sizeof(MaterialUniforms);
+
+	VkWriteDescriptorSet writes[2] = {};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = frameDescriptorSet;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	writes[0].pBufferInfo = &frameBufferInfo;
+
+	writes[1] = writes[0];
+	writes[1].dstBinding = 1;
+	writes[1].pBufferInfo = &materialBufferInfo;
+
+	vkUpdateDescriptorSets(mainDevice.logicalDevice, 2, writes, 0, nullptr);
+}
+
+void VulkanRenderer::recordObjects(VkCommandBuffer commandBuffer, const VkCommandBufferInheritanceInfo& inheritanceInfo, uint32_t first, uint32_t last)
+{
+	PROFILE_FUNCTION();
+
+	VkCommandBufferBeginInfo bufferBeginInfo = {};
+	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;	// Executed entirely inside a render pass
+	bufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &bufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to start recording a secondary Command Buffer!");
+	}
+
+		// State is not inherited from the primary, every secondary sets up its own
+		recordDynamicState(commandBuffer);
+
+		// Every material shares the pipeline layout, so sets stay bound across pipeline changes
+		if (bindlessEnabled)
+		{
+			VkDescriptorSet bindlessSet = bindlessTable.getSet();
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, BINDLESS_DESCRIPTOR_SET, 1, &bindlessSet, 0, nullptr);
+		}
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		uint32_t boundMaterial = UINT32_MAX;
+		uint32_t boundMesh = UINT32_MAX;
+		for (uint32_t i = first; i < last; i++)
+		{
+			const RenderObject& object = renderObjects[i];
+			const Mesh& mesh = meshList[object.meshIndex];
+
+			// Compare pipelines rather than materials: a material still compiling shares the default's
+			VkPipeline pipeline = materialPipelines[object.materialIndex];
+			if (pipeline != boundPipeline)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				boundPipeline = pipeline;
+			}
+
+			// Same set every time, only the material's dynamic offset moves
+			if (object.materialIndex != boundMaterial)
+			{
+				uint32_t dynamicOffsets[] = { frameUniformOffset, materialUniformOffsets[object.materialIndex] };
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, FRAME_DESCRIPTOR_SET, 1, &frameDescriptorSet, 2, dynamicOffsets);
+				boundMaterial = object.materialIndex;
+			}
+
+			// Only rebind buffers when the mesh changes, consecutive objects often share one
+			if (object.meshIndex != boundMesh)
+			{
+				mesh.bind(commandBuffer);
+				boundMesh = object.meshIndex;
+			}
+
+			// "Push" constants to given shader stage directly (no buffer)
+			DrawConstants drawConstants;
+			drawConstants.model = object.model;
+			vkCmdPushConstants(commandBuffer, pipelineLayout, DRAW_CONSTANT_STAGES, 0, sizeof(DrawConstants), &drawConstants);
+
+			// Execute pipeline
+			vkCmdDrawIndexed(commandBuffer, mesh.getIndexCount(), 1, 0, 0, 0);
+		}
+
+	result = vkEndCommandBuffer(commandBuffer);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("ERROR: Failed to stop recording a secondary Command Buffer!");
+	}
+}
+
+void VulkanRenderer::recordIndirectObjects(VkCommandBuffer commandBuffer)
+{
+	PROFILE_FUNCTION();
+
+	recordDynamicState(commandBuffer);
+
+	// Nothing was culled when the scene is empty
+	VkDescriptorSet instanceSet = gpuCulling.getInstanceSet();
+	if (instanceSet == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	if (bindlessEnabled)
+	{
+		VkDescriptorSet bindlessSet = bindlessTable.getSet();
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, BINDLESS_DESCRIPTOR_SET, 1, &bindlessSet, 0, nullptr);
+	}
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, INSTANCE_DESCRIPTOR_SET, 1, &instanceSet, 0, nullptr);
+
+	// Batches are sorted by material, then mesh, so each of these changes as rarely as it can
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	uint32_t boundMaterial = UINT32_MAX;
+	uint32_t boundMesh = UINT32_MAX;
+	const std::vector<IndirectBatch>& batches = gpuCulling.getBatches();
+	for (uint32_t i = 0; i < batches.size(); i++)
+	{
+		const IndirectBatch& batch = batches[i];
+
+		VkPipeline pipeline = materialPipelines[batch.materialIndex];
+		if (pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			boundPipeline = pipeline;
+		}
+
+		if (batch.materialIndex != boundMaterial)
+		{
+			uint32_t dynamicOffsets[] = { frameUniformOffset, materialUniformOffsets[batch.materialIndex] };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, FRAME_DESCRIPTOR_SET, 1, &frameDescriptorSet, 2, dynamicOffsets);
+			boundMaterial = batch.materialIndex;
+		}
+
+		if (batch.meshIndex != boundMesh)
+		{
+			meshList[batch.meshIndex].bind(commandBuffer);
+			boundMesh = batch.meshIndex;
+		}
+
+		gpuCulling.recordDraws(commandBuffer, i);
+	}
+}
+
+void VulkanRenderer::recordDynamicState(VkCommandBuffer commandBuffer)
+{
+	// Viewport and scissor are dynamic state, cover the whole current extent. They stay set across pipeline binds.
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)swapChainExtent.width;
+	viewport.height = (float)swapChainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = swapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void VulkanRenderer::recreateSwapChain()
+{
+	PROFILE_FUNCTION();
+
+	// A minimised window has a zero sized framebuffer, and a swap chain can't be created for it. Wait until it is restored.
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(m_pWindow, &width, &height);
+	while ((width == 0 || height == 0) && !glfwWindowShouldClose(m_pWindow))
 	{
-		// First check if queue family has at least 1 queue in that Family ...
-		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		glfwWaitEvents();
+		glfwGetFramebufferSize(m_pWindow, &width, &height);
+	}
+	if (width == 0 || height == 0)
+	{
+		return;
+	}
+
+	auto recreateStart = std::chrono::steady_clock::now();
+	framebufferResized = false;
+
+	// In-flight frames still reference the old images and framebuffers
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+	VkSwapchainKHR oldSwapchain = swapchain;
+	std::vector<SwapchainImage> oldSwapChainImages = std::move(swapChainImages);
+	VkFormat oldFormat = swapChainImageFormat;
+	swapChainImages.clear();
+
+	// New swap chain is created from the old one (see oldSwapchain in createSwapChain), then the old one can go
+	chooseRenderTargetFormat();
+	createSwapChain();
+
+	// Viewport and scissor are dynamic, so the pipeline survives a resize. Only a change of surface format
+	// (e.g. window moved to an HDR monitor) invalidates the render passes and everything built against them.
+	if (swapChainImageFormat != oldFormat)
+	{
+		pipelineManager.destroyPipelines(renderPass);
+		renderGraph.destroy();
+		createRenderGraph();
+		createGraphicsPipeline();
+	}
+
+	// Command buffers are recorded every frame against the current targets, nothing else to redo. Framebuffers are
+	// made again as the new images are bound.
+	renderGraph.allocate(swapChainExtent);
+
+	for (auto image : oldSwapChainImages)
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
+	}
+	vkDestroySwapchainKHR(mainDevice.logicalDevice, oldSwapchain, nullptr);
+
+	frameStats.swapChainRecreations++;
+	frameStats.lastSwapChainRecreateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recreateStart).count();
+	std::cout << "Swap chain recreated (" << swapChainExtent.width << "x" << swapChainExtent.height << ") in "
+		<< frameStats.lastSwapChainRecreateMs << " ms" << std::endl;
+}
+
+void VulkanRenderer::updateTextureDemand()
+{
+	PROFILE_FUNCTION();
+
+	// Nothing moves quickly enough to need this every frame, and the streamer holds on to demand between passes
+	if (frameStats.totalFrames % TEXTURE_DEMAND_INTERVAL != 0)
+	{
+		return;
+	}
+
+	float screenSize = static_cast<float>(std::max(swapChainExtent.width, swapChainExtent.height));
+	for (const RenderObject& object : renderObjects)
+	{
+		const Material& material = materials[object.materialIndex];
+		if (material.texture == UINT32_MAX)
 		{
-			indices.graphicsFamily = i; // if queue family is valid, thet, get the index.
+			continue;
 		}
 
-		// Check if queue family support presentation
-		VkBool32 presentationSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,&presentationSupport );
+		// Every mesh maps the texture once across its bounding sphere, so the texture is as wide on screen as the
+		// sphere: its diameter in clip space (scaled by the largest axis of the transform) over w at its centre
+		glm::mat4 transform = viewProjection * object.model;
+		glm::vec4 sphere = meshList[object.meshIndex].getBoundingSphere();
+		float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+		float w = std::max((transform * glm::vec4(glm::vec3(sphere), 1.0f)).w, 1e-4f);
+
+		// Clip space spans 2 units across the screen, the diameter 2 radii
+		float texelsAcross = sphere.w * scale / w * screenSize;
+		textureStreamer.requestResolution(material.texture, texelsAcross);
+	}
+}
+
+void VulkanRenderer::setPresentPolicy(PresentPolicy policy, double frameRateCap)
+{
+	bool rebuildSwapChain = swapchain != VK_NULL_HANDLE && policy != settings.presentPolicy;
+	settings.presentPolicy = policy;
+	settings.frameRateCap = frameRateCap;
+
+	// Only power saving caps by default: FIFO already paces the GPU, the cap keeps the CPU from queueing ahead
+	if (frameRateCap <= 0.0 && policy == PresentPolicy::PowerSaving)
+	{
+		frameRateCap = DEFAULT_POWER_SAVING_FRAME_RATE;
+	}
+	frameLimiter.setFrameRate(frameRateCap);
+
+	// Rebuilt on the next draw, the same way as after a resize
+	if (rebuildSwapChain)
+	{
+		framebufferResized = true;
+	}
+}
 
-		// Check if queue is presentation type can be both grapphics and presentation
-		if (queueFamily.queueCount > 0 && presentationSupport)
+void VulkanRenderer::updateFrameStats(double cpuWaitMs, double recordMs, double pacingMs)
+{
+	frameStats.totalFrames++;
+	if (frameStats.totalFrames == 1)
+	{
+		frameStats.timeToFirstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initStart).count();
+	}
+	statsIntervalFrames++;
+	statsIntervalWaitMs += cpuWaitMs;
+	statsIntervalRecordMs += recordMs;
+	statsIntervalMaxWaitMs = std::max(statsIntervalMaxWaitMs, cpuWaitMs);
+	statsIntervalPacingMs += pacingMs;
+
+	// Publish averages once at least a second has passed, so the numbers are stable enough to compare
+	auto now = std::chrono::steady_clock::now();
+	double elapsedSeconds = std::chrono::duration<double>(now - statsIntervalStart).count();
+	if (elapsedSeconds >= 1.0)
+	{
+		frameStats.framesPerSecond = statsIntervalFrames / elapsedSeconds;
+		frameStats.avgCpuWaitMs = statsIntervalWaitMs / statsIntervalFrames;
+		frameStats.maxCpuWaitMs = statsIntervalMaxWaitMs;
+		frameStats.avgRecordMs = statsIntervalRecordMs / statsIntervalFrames;
+		frameStats.avgPacingMs = statsIntervalPacingMs / statsIntervalFrames;
+		frameStats.avgLatencyMs = statsIntervalLatencyFrames > 0 ? statsIntervalLatencyMs / statsIntervalLatencyFrames : 0.0;
+		frameStats.maxLatencyMs = statsIntervalMaxLatencyMs;
+		frameStats.intervalCount++;
+
+		statsIntervalStart = now;
+		statsIntervalFrames = 0;
+		statsIntervalWaitMs = 0.0;
+		statsIntervalRecordMs = 0.0;
+		statsIntervalMaxWaitMs = 0.0;
+		statsIntervalPacingMs = 0.0;
+		statsIntervalLatencyMs = 0.0;
+		statsIntervalMaxLatencyMs = 0.0;
+		statsIntervalLatencyFrames = 0;
+	}
+}
+
+void VulkanRenderer::updateFrameLatency()
+{
+	// A frame's image can be presented once its submission completes (renderFinished signals with the fence), so
+	// that is where its latency ends. Nothing reports the moment a fence signals: a fence already signalled when
+	// polled here completed some time since the last poll, and one the CPU just blocked on is exact.
+	auto now = std::chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < settings.framesInFlight; frame++)
+	{
+		if (!latencyPending[frame] || vkGetFenceStatus(mainDevice.logicalDevice, drawFences[frame]) != VK_SUCCESS)
+		{
+			continue;
+		}
+		latencyPending[frame] = false;
+
+		double latencyMs = std::chrono::duration<double, std::milli>(now - frameSubmitTimes[frame]).count();
+		frameStats.lastLatencyMs = latencyMs;
+		if (settings.latencyBudgetMs > 0.0 && latencyMs > settings.latencyBudgetMs)
+		{
+			frameStats.latencyBudgetMisses++;
+		}
+		statsIntervalLatencyMs += latencyMs;
+		statsIntervalMaxLatencyMs = std::max(statsIntervalMaxLatencyMs, latencyMs);
+		statsIntervalLatencyFrames++;
+	}
+}
+
+void VulkanRenderer::waitForFrameFences(std::chrono::steady_clock::time_point until)
+{
+	updateFrameLatency();
+	while (true)
+	{
+		std::vector<VkFence> pendingFences;
+		for (uint32_t frame = 0; frame < settings.framesInFlight; frame++)
 		{
-			indices.presentationFamily = i;
+			if (latencyPending[frame])
+			{
+				pendingFences.push_back(drawFences[frame]);
+			}
 		}
 
-		// Check if queue family indices are in a valid state, stop searching if so
-		if (indices.isValid())
+		auto now = std::chrono::steady_clock::now();
+		if (now >= until)
 		{
-			break;
+			return;
 		}
+		if (pendingFences.empty())
+		{
+			std::this_thread::sleep_until(until);
+			return;
+		}
+
+		// Wakes up for whichever frame finishes first, or when the time is up
+		uint64_t timeout = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(until - now).count());
+		vkWaitForFences(mainDevice.logicalDevice, static_cast<uint32_t>(pendingFences.size()), pendingFences.data(), VK_FALSE, timeout);
+		updateFrameLatency();
+	}
+}
+
+void VulkanRenderer::getPhysicalDevice()
+{
+	PROFILE_FUNCTION();
+
+	// Enumerate physical devices the VkInstance can access
+	uint32_t deviceCount = 0;
+	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+	// Check if there are devices available to support Vulkan
+	if (deviceCount == 0)
+	{
+		throw std::runtime_error("ERROR:  Can't find GPU's that support Vulkan Instance!");
+	}
 
-		i++;
+	// Get list of physical devices
+	std::vector<VkPhysicalDevice> devices(deviceCount);
+	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+	// Swap chain support is only required when presenting
+	if (!settings.headless)
+	{
+		enabledDeviceExtensions = deviceExtensions;
 	}
 
+	// An explicit pin wins over the scores
+	std::string deviceSelector = settings.deviceSelector.empty() ? getEnvironmentVariable(DEVICE_SELECTOR_VARIABLE) : settings.deviceSelector;
+
+	// Everything later decisions need is read once per device here, then every suitable device is scored
+	mainDevice.physicalDevice = VK_NULL_HANDLE;
+	uint32_t bestScore = 0;
+	bool pinned = false;
+	for (uint32_t i = 0; i < deviceCount; i++)
+	{
+		DeviceCapabilities capabilities = queryDeviceCapabilities(devices[i], settings.headless ? VK_NULL_HANDLE : surface, properties2Functions);
+		bool selected = matchesDeviceSelector(capabilities, i, deviceSelector);
+
+		std::cout << "GPU " << i << ": " << capabilities.properties.deviceName << " (" << deviceTypeName(capabilities.properties.deviceType) << ")";
+		if (!checkDeviceSuitable(capabilities))
+		{
+			std::cout << " not suitable" << std::endl;
+			if (selected)
+			{
+				throw std::runtime_error("ERROR: The pinned GPU " + deviceSelector + " can't run the renderer!");
+			}
+			continue;
+		}
+
+		DeviceScore score = scoreDevice(capabilities);
+		std::cout << " score " << score.total() << " = type " << score.type << " + memory " << score.memory
+			<< " + queues " << score.queues << " + features " << score.features << (selected ? " [pinned]" : "") << std::endl;
+
+		// First pinned match wins outright, otherwise the highest score (the first of equals)
+		if (pinned || (!selected && mainDevice.physicalDevice != VK_NULL_HANDLE && score.total() <= bestScore))
+		{
+			continue;
+		}
+		mainDevice.physicalDevice = devices[i];
+		deviceCapabilities = std::move(capabilities);
+		bestScore = score.total();
+		pinned = selected;
+	}
 
-	return indices;
+	if (!deviceSelector.empty() && !pinned)
+	{
+		throw std::runtime_error("ERROR: No GPU matches " + deviceSelector + "!");
+	}
+	if (mainDevice.physicalDevice == VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("ERROR: Can't find a suitable GPU!");
+	}
+
+	std::cout << "Using GPU: " << deviceCapabilities.properties.deviceName << std::endl;
+}
+
+PipelineKey VulkanRenderer::getMaterialKey(uint32_t materialIndex) const
+{
+	// Materials are stored without a render pass so they outlive it, and take its sample count from it. Their depth
+	// state only applies when the pass has a depth buffer.
+	PipelineKey key = materials[materialIndex].pipeline;
+	key.renderPass = renderPass;
+	key.samples = sampleCount;
+	if (depthFormat == VK_FORMAT_UNDEFINED)
+	{
+		key.depthTest = false;
+		key.depthWrite = false;
+	}
+	return key;
+}
+
+bool VulkanRenderer::checkInstanceExtensionsSupport(std::vector<const char*>* checkExtensions)
+{
+	// Need to get the number of extensions to create array of correct size to hold extensions.
+	uint32_t extensionsCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionsCount, nullptr);
+
+	// Creeate a list of VkExtensionProperties using count.
+	std::vector<VkExtensionProperties> extensions( extensionsCount );
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionsCount, extensions.data());
+
+	// Check if given extensions are in list of available extensions
+	for (const auto& checkExtension : *checkExtensions)
+	{
+		bool hasExtension = false;
+		for (const auto& extension : extensions)
+		{
+			if (!strcmp(checkExtension, extension.extensionName))
+			{
+				hasExtension = true;
+				break;
+			}
+		}
+
+		if(!hasExtension)
+			return false;
+	}
+
+	return true;
+}
+
+bool VulkanRenderer::checkValidationLayerSupport()
+{
+	// Get number of validation layers to create vector of apropiate size
+	uint32_t validationLayerCount = 0;
+	vkEnumerateInstanceLayerProperties(&validationLayerCount, nullptr);
+
+	// Check if no validation layers found and we want at least 1
+	if (validationLayerCount == 0 && validationLayers.size() > 0)
+	{
+		return false;
+	}
+
+	// Creeate a list of VkExtensionProperties using count.
+	std::vector<VkLayerProperties> availableLayers(validationLayerCount);
+	vkEnumerateInstanceLayerProperties(&validationLayerCount, availableLayers.data());
+
+	// Check if given extensions are in list of available extensions
+	for (const auto& validationLayer : validationLayers)
+	{
+		bool hasLayer = false;
+		for (const auto& availableLayer : availableLayers)
+		{
+			if (!strcmp(validationLayer, availableLayer.layerName))
+			{
+				hasLayer = true;
+				break;
+			}
+		}
+
+		if (!hasLayer)
+			return false;
+	}
+	return true;
+}
+
+bool VulkanRenderer::checkCaptureSupport()
+{
+	// Frames are copied out as 8 bit RGBA, and a swap chain's images can only be copied from where the surface allows it
+	if (!FrameCapture::isFormatSupported(swapChainImageFormat))
+	{
+		std::cout << "Capture disabled: render target format " << swapChainImageFormat << " isn't 8 bit RGBA or BGRA" << std::endl;
+		return false;
+	}
+	if (!settings.headless && !(getSwapChainDetails().surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+	{
+		std::cout << "Capture disabled: the surface's images can't be copied from" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool VulkanRenderer::checkDeviceSuitable(const DeviceCapabilities& capabilities)
+{
+	// Presentation support was only queried if there is a surface, and formats only if the swap chain extension exists
+	bool extensionsSupported = capabilities.hasExtensions(enabledDeviceExtensions);
+	bool swapChainValid = settings.headless || (!capabilities.presentationModes.empty() && !capabilities.surfaceFormats.empty());
+
+	return capabilities.queueFamilyIndices.isValid(!settings.headless) && extensionsSupported && swapChainValid;
 }
 
-SwapChainDetails VulkanRenderer::getSwapChainDetails(VkPhysicalDevice device)
+SwapChainDetails VulkanRenderer::getSwapChainDetails()
 {
 	SwapChainDetails swapChainDetails;
 
 	// -- CAPABILITIES --
-	// Get the surface capabilities for the given ...
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &swapChainDetails.surfaceCapabilities);
+	// Current extent follows the window, so this is the one part queried every time
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(mainDevice.physicalDevice, surface, &swapChainDetails.surfaceCapabilities);
+
+	// -- FORMATS AND PRESENTATION MODES --
+	swapChainDetails.formats = deviceCapabilities.surfaceFormats;
+	swapChainDetails.presentationModes = deviceCapabilities.presentationModes;
+
+	return swapChainDetails;
+}
+
+void VulkanRenderer::chooseRenderTargetFormat()
+{
+	// Known as soon as the device is picked, so the render pass doesn't have to wait for the swap chain
+	swapChainImageFormat = settings.headless ? settings.headlessFormat : chooseBestSurfaceFormat(deviceCapabilities.surfaceFormats).format;
+	depthFormat = settings.depthTest ? chooseDepthFormat() : VK_FORMAT_UNDEFINED;
+	sampleCount = chooseSampleCount();
+}
 
-	// -- FORMATS --
-	uint32_t formatCount = 0;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
-	if (formatCount > 0)
+VkFormat VulkanRenderer::chooseDepthFormat()
+{
+	// No stencil is needed, so the depth only formats come first. D32 is the one format every desktop supports,
+	// D16 is there for the devices that only do D24S8 or D16.
+	const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D16_UNORM };
+	for (VkFormat format : candidates)
 	{
-		swapChainDetails.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, swapChainDetails.formats.data());
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, format, &formatProperties);
+		if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		{
+			return format;
+		}
 	}
 
-	// -- PRESENTATION MODES --
-	uint32_t presentationCount = 0;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentationCount, nullptr);
-	if (presentationCount > 0)
+	throw std::runtime_error("ERROR: Failed to find a depth format!");
+}
+
+VkSampleCountFlagBits VulkanRenderer::chooseSampleCount()
+{
+	// Highest power of two up to the requested count that both the colour and (if there is one) depth attachment support
+	const VkPhysicalDeviceLimits& limits = deviceCapabilities.properties.limits;
+	VkSampleCountFlags supported = limits.framebufferColorSampleCounts;
+	if (depthFormat != VK_FORMAT_UNDEFINED)
 	{
-		swapChainDetails.presentationModes.resize(presentationCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentationCount, swapChainDetails.presentationModes.data());
+		supported &= limits.framebufferDepthSampleCounts;
 	}
 
-	return swapChainDetails;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	for (uint32_t count = 2; count <= settings.msaaSamples && count <= VK_SAMPLE_COUNT_64_BIT; count *= 2)
+	{
+		if (supported & count)
+		{
+			samples = static_cast<VkSampleCountFlagBits>(count);
+		}
+	}
+	return samples;
 }
 
 // Best format is subjective, but ours will be :
@@ -769,11 +2131,25 @@ VkSurfaceFormatKHR VulkanRenderer::chooseBestSurfaceFormat(const std::vector<VkS
 
 VkPresentModeKHR VulkanRenderer::chooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes)
 {
-	for (const auto& presentationMode : presentationModes)
+	// The policy's modes in order of preference. FIFO is always supported, so it is everyone's last resort.
+	std::vector<VkPresentModeKHR> preferredModes;
+	switch (settings.presentPolicy)
+	{
+	case PresentPolicy::LowLatency:
+		preferredModes = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+		break;
+	case PresentPolicy::Throughput:
+		preferredModes = { VK_PRESENT_MODE_MAILBOX_KHR };
+		break;
+	case PresentPolicy::PowerSaving:
+		break;
+	}
+
+	for (VkPresentModeKHR preferredMode : preferredModes)
 	{
-		if (presentationMode == VK_PRESENT_MODE_MAILBOX_KHR)
+		if (std::find(presentationModes.begin(), presentationModes.end(), preferredMode) != presentationModes.end())
 		{
-			return presentationMode;
+			return preferredMode;
 		}
 	}
 	return VK_PRESENT_MODE_FIFO_KHR;
@@ -837,19 +2213,26 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	return imageView;
 }
 
-VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
+VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags,
+	VkMemoryPropertyFlags propFlags, Allocation* imageAllocation)
 {
-	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
-	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	shaderModuleCreateInfo.codeSize = code.size();
-	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
-	
-
-	VkShaderModule shaderModule;
-	VkResult res = vkCreateShaderModule(mainDevice.logicalDevice, &shaderModuleCreateInfo, nullptr, &shaderModule);
-	if (res != VK_SUCCESS)
-	{
-		throw std::runtime_error("ERROR: Failed to create a shader module!");
-	}
-	return shaderModule;
+	// CREATE IMAGE
+	// Image creation info
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;						// Type of image (1D, 2D or 3D)
+	imageCreateInfo.extent.width = width;								// Width of image extent
+	imageCreateInfo.extent.height = height;								// Height of image extent
+	imageCreateInfo.extent.depth = 1;									// Depth of image (just 1, no 3D aspect)
+	imageCreateInfo.mipLevels = 1;										// Number of mipmap levels
+	imageCreateInfo.arrayLayers = 1;									// Number of levels in image array
+	imageCreateInfo.format = format;									// Format type of image
+	imageCreateInfo.tiling = tiling;									// How image data should be "tiled" (arranged for optimal reading)
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;			// Layout of image data on creation
+	imageCreateInfo.usage = useFlags;									// Bit flags defining what image will be used for
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;					// Number of samples for multi-sampling
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;			// Whether image can be shared between queues
+
+	// Create image and bind it to memory sub-allocated from the device's pools
+	return memoryAllocator.createImage(imageCreateInfo, propFlags, 0, imageAllocation);
 }
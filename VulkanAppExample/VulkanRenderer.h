@@ -8,25 +8,92 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <limits>
+#include <cstring>
+#include <chrono>
+#include <cmath>
 
 #include "Utilities.h"
+#include "DeviceCapabilities.h"
+#include "PipelineCache.h"
+#include "PipelineManager.h"
+#include "DescriptorAllocator.h"
+#include "BindlessTable.h"
+#include "UniformRing.h"
+#include "GpuCulling.h"
+#include "TextureStreamer.h"
+#include "FrameLimiter.h"
+#include "RenderGraph.h"
+#include "FrameCapture.h"
+#include "ShaderPack.h"
+#include "UploadManager.h"
+#include "Mesh.h"
+#include "ThreadPool.h"
+#include "TaskGraph.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
 
 #include "VulkanValidation.h"
 
+// What a draw looks like: the pipeline state, and the uniforms its shaders read
+struct Material {
+	PipelineKey pipeline;				// Render pass is filled in when looked up
+	MaterialUniforms parameters;
+	uint32_t texture = UINT32_MAX;		// TextureStreamer id; its bindless slot is written to parameters every frame
+};
+
 class VulkanRenderer
 {
 public:
 
 	VulkanRenderer();
 
-	int Init(GLFWwindow *pWindow);
+	int Init(GLFWwindow *pWindow, const RendererSettings &rendererSettings = RendererSettings());
+	void draw();
 	void cleanup();
 
+	// Call from the window's framebuffer size callback; the swap chain is rebuilt on the next draw
+	void notifyFramebufferResized() { framebufferResized = true; }
+
+	// Switches presentation policy and frame rate cap (0: the policy's default) from the next draw on. The swap chain
+	// is rebuilt for the policy's present mode and image count.
+	void setPresentPolicy(PresentPolicy policy, double frameRateCap = 0.0);
+	PresentPolicy getPresentPolicy() const { return settings.presentPolicy; }
+	VkPresentModeKHR getPresentMode() const { return presentMode; }
+	double getFrameRateCap() const { return frameLimiter.getFrameRate(); }
+
+	const FrameStats& getFrameStats() const { return frameStats; }
+	const std::vector<TaskTiming>& getInitTimings() const { return initTimings; }		// Each step of the last Init
+	const VkPhysicalDeviceProperties& getDeviceProperties() const { return deviceCapabilities.properties; }
+	const PipelineCacheStats& getPipelineCacheStats() const { return pipelineCache.getStats(); }
+	PipelineManagerStats getPipelineManagerStats() const { return pipelineManager.getStats(); }
+	DescriptorAllocatorStats getDescriptorStats() { return descriptorAllocator.getStats(); }
+	UniformRingStats getUniformRingStats() const { return uniformRing.getStats(); }
+	bool isBindlessEnabled() const { return bindlessEnabled; }
+	bool isGpuDrivenEnabled() const { return gpuDrivenEnabled; }
+	bool isAsyncComputeEnabled() const { return asyncComputeEnabled; }
+	bool isMemoryBudgetEnabled() const { return memoryBudgetEnabled; }
+	TextureStreamerStats getTextureStats() const { return textureStreamer.getStats(); }
+	RenderGraphStats getRenderGraphStats() const { return renderGraph.getStats(); }
+	VkSampleCountFlagBits getSampleCount() const { return sampleCount; }
+	VkFormat getDepthFormat() const { return depthFormat; }		// VK_FORMAT_UNDEFINED without depth testing
+	bool isCaptureEnabled() const { return captureEnabled; }
+	FrameCaptureStats getCaptureStats() { return frameCapture.getStats(); }		// Final once cleanup has drained the writes
+	std::vector<HeapStats> getMemoryStats() { return memoryAllocator.getHeapStats(); }
+	uint32_t getRecordingThreadCount() const { return threadPool.getThreadCount(); }
+	std::vector<GpuScopeStats> getGpuScopeStats() { return gpuProfiler.getScopeStats(); }
+	GpuOverlapStats getGpuOverlapStats() { return gpuProfiler.getOverlapStats(); }
+	bool writeGpuTrace(const std::string &filePath) { return gpuProfiler.writeChromeTrace(filePath); }
+
 	~VulkanRenderer();
 
 
 private:
 	GLFWwindow* m_pWindow;
+	RendererSettings settings;
+
+	uint32_t currentFrame = 0;
+	bool framebufferResized = false;
 
 	// Vulkan Components
 	// - Main
@@ -37,22 +104,118 @@ private:
 		VkPhysicalDevice physicalDevice;
 		VkDevice logicalDevice;
 	}mainDevice;
+	DeviceCapabilities deviceCapabilities;				// Snapshot of mainDevice.physicalDevice
+	Properties2Functions properties2Functions;			// Null without VK_KHR_get_physical_device_properties2
 
 	VkQueue graphicsQueue;
 	VkQueue presentationQueue;
-	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
+	VkQueue transferQueue;								// Same as graphicsQueue when the device has no separate transfer family
+	VkQueue computeQueue;								// Same as graphicsQueue unless asyncComputeEnabled
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;		// Of the current swap chain
+	FrameLimiter frameLimiter;
 
+	// Render targets: swap chain images, or offscreen images when running headless
 	std::vector<SwapchainImage> swapChainImages;
 
+	// Frame structure: passes, their render passes, barriers and transient targets
+	RenderGraph renderGraph;
+	RenderGraph::Resource backbufferResource = RenderGraph::INVALID_INDEX;	// The swap chain image being rendered, bound every frame
+	uint32_t cullPass = RenderGraph::INVALID_INDEX;						// Only when gpuDrivenEnabled
+	uint32_t scenePass = RenderGraph::INVALID_INDEX;
+	VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;				// Of the scene pass's colour and depth
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;								// No depth buffer when undefined
+
+	// Scene Objects
+	std::vector<Mesh> meshList;
+	std::vector<RenderObject> renderObjects;		// Draw list, recorded in this order
+	GpuCulling gpuCulling;							// Instances, culling and indirect draws, only when gpuDrivenEnabled
+	glm::mat4 viewProjection = glm::mat4(1.0f);		// The scene is authored in clip space, so this is the identity for now
+	TextureStreamer textureStreamer;				// Only when texturesEnabled
+	FrameCapture frameCapture;						// Only when captureEnabled
+
 	// - Pipeline
-	VkPipeline graphicsPipeline;
+	VkPipeline graphicsPipeline;					// Materials[0], always built, the fallback while other materials compile
 	VkPipelineLayout pipelineLayout;
-	VkRenderPass renderPass;
+	VkRenderPass renderPass;						// The scene pass's, owned by renderGraph
+	PipelineCache pipelineCache;
+	PipelineManager pipelineManager;
+	std::vector<Material> materials;
+	std::vector<VkPipeline> materialPipelines;		// Resolved once per frame, before recording starts
+
+	// - Descriptors
+	DescriptorLayoutCache descriptorLayoutCache;
+	DescriptorAllocator descriptorAllocator;		// Transient sets, reset every frame
+	BindlessTable bindlessTable;					// Persistent resources, only when bindlessEnabled
+	VkDescriptorSetLayout frameSetLayout = VK_NULL_HANDLE;		// Owned by the layout cache
+
+	// - Uniforms
+	UniformRing uniformRing;
+	VkDescriptorSet frameDescriptorSet = VK_NULL_HANDLE;		// This frame's, points at this frame's ring buffer
+	uint32_t frameUniformOffset = 0;
+	std::vector<uint32_t> materialUniformOffsets;				// Per material, this frame
+	ShaderPack shaderPack;
+
+	// - Command recording
+	// Command pools may only be used by one thread at a time, so every recording thread gets its own, for each frame in flight
+	struct ThreadCommands {
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> secondaryBuffers;	// Kept across frames, the pool reset makes them reusable
+		uint32_t usedCount = 0;							// Secondary buffers recorded so far this frame
+	};
+	struct FrameCommands {
+		VkCommandPool primaryPool = VK_NULL_HANDLE;
+		VkCommandBuffer primaryBuffer = VK_NULL_HANDLE;
+		std::vector<ThreadCommands> threads;			// Indexed by thread pool worker
+		VkCommandPool computePool = VK_NULL_HANDLE;		// Compute family, only when asyncComputeEnabled
+		VkCommandBuffer computeBuffer = VK_NULL_HANDLE;
+		bool computeRecorded = false;					// The cull went to the compute queue this frame
+		std::vector<VkCommandBuffer> sliceBuffers;		// Secondary buffers the scene pass executes this frame
+	};
+	std::vector<FrameCommands> frameCommands;		// One per frame in flight
+	ThreadPool threadPool;
+
+	// - Pools
+	MemoryAllocator memoryAllocator;
+	UploadManager uploadManager;
 
 	// - Utility
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
+	std::vector<const char*> enabledDeviceExtensions;
+	uint32_t nextOffscreenImage = 0;
+	bool pipelineCreationFeedbackEnabled = false;
+	bool bindlessEnabled = false;
+	bool gpuDrivenEnabled = false;
+	bool asyncComputeEnabled = false;				// Culls on the compute family's queue, needs gpuDrivenEnabled
+	bool texturesEnabled = false;					// Streamed textures, sampled through the bindless table
+	bool memoryBudgetEnabled = false;				// VK_EXT_memory_budget
+	bool captureEnabled = false;					// Frames are read back, the render targets can be copied from
+	IndirectDrawSupport indirectDrawSupport;
+
+	// - Synchronisation
+	std::vector<VkSemaphore> imageAvailable;		// One per frame in flight
+	std::vector<VkSemaphore> renderFinished;		// One per frame in flight
+	std::vector<VkSemaphore> computeFinished;		// One per frame in flight, only when asyncComputeEnabled
+	std::vector<VkFence> drawFences;				// One per frame in flight
+
+	// - Statistics
+	FrameStats frameStats;
+	std::chrono::steady_clock::time_point statsIntervalStart;
+	std::chrono::steady_clock::time_point initStart;
+	std::vector<TaskTiming> initTimings;
+	uint32_t statsIntervalFrames = 0;
+	double statsIntervalWaitMs = 0.0;
+	double statsIntervalRecordMs = 0.0;
+	double statsIntervalMaxWaitMs = 0.0;
+	double statsIntervalPacingMs = 0.0;
+	double statsIntervalLatencyMs = 0.0;
+	double statsIntervalMaxLatencyMs = 0.0;
+	uint32_t statsIntervalLatencyFrames = 0;
+	std::vector<std::chrono::steady_clock::time_point> frameSubmitTimes;	// One per frame in flight
+	std::vector<bool> latencyPending;										// The frame slot's submission hasn't been seen to complete yet
+	GpuProfiler gpuProfiler;
 
 	// Vulkan functions
 	// - Create Functions
@@ -61,30 +224,70 @@ private:
 	void createLogicalDevice();
 	void createSurface();
 	void createSwapChain();
-	void createRenderPass();
+	void createOffscreenTargets();
+	void createUploadManager();
+	void createGpuProfiler();
+	void createMeshes();
+	void createInstanceBuffer();
+	void createTextures();
+	void createFrameCapture();
+	void createPipelineCache();
+	void createDescriptors();
+	void createUniformRing();
+	void loadShaderPack();
+	void createRenderGraph();
+	void createPipelineLayout();
+	void createPipelineManager();
 	void createGraphicsPipeline();
+	void createCullPipeline();
+	void createCommandPool();
+	void createCommandBuffers();
+	void createSynchronisation();
+
+	// - Update Functions
+	void updateTextureDemand();
+
+	// - Recreate Functions
+	void recreateSwapChain();
+
+	// - Record Functions
+	void recordCommands(uint32_t imageIndex);
+	void recordUniforms();
+	void recordComputeCommands();
+	void recordObjects(VkCommandBuffer commandBuffer, const VkCommandBufferInheritanceInfo &inheritanceInfo, uint32_t first, uint32_t last);
+	void recordIndirectObjects(VkCommandBuffer commandBuffer);
+	void recordDynamicState(VkCommandBuffer commandBuffer);
 
 	// - Get Functions
 	void getPhysicalDevice();
+	PipelineKey getMaterialKey(uint32_t materialIndex) const;
 
 	// - Support Functions
 	// -- Checker functions
 	bool checkInstanceExtensionsSupport(std::vector<const char *> *checkExtensions);
 	bool checkValidationLayerSupport();
-	bool checkDeviceSuitable(VkPhysicalDevice device);
-	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+	bool checkCaptureSupport();
+	bool checkDeviceSuitable(const DeviceCapabilities &capabilities);
 
 	// -- Getter Functions
-	QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
-	SwapChainDetails getSwapChainDetails(VkPhysicalDevice device);
+	SwapChainDetails getSwapChainDetails();
 
 	// -- Choose function
+	void chooseRenderTargetFormat();
 	VkSurfaceFormatKHR chooseBestSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats);
+	VkFormat chooseDepthFormat();
+	VkSampleCountFlagBits chooseSampleCount();
 	VkPresentModeKHR chooseBestPresentationMode(const std::vector<VkPresentModeKHR>& presentationModes);
 	VkExtent2D chooseBestExtent(const VkSurfaceCapabilitiesKHR &surfaceCapabilities);
 
 	// -- Create functions
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageCreateFlags aspectFlags);
-	VkShaderModule createShaderModule(const std::vector<char> &code);
+	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags,
+		VkMemoryPropertyFlags propFlags, Allocation *imageAllocation);
+
+	// -- Statistics functions
+	void updateFrameStats(double cpuWaitMs, double recordMs, double pacingMs);
+	void updateFrameLatency();
+	void waitForFrameFences(std::chrono::steady_clock::time_point until);		// Times frames finishing until then
 };
 
@@ -2,8 +2,13 @@
 
 #include <vector>
 
-// Switch ON/OFF validation layers.
+// Switch ON/OFF validation layers. Off in release builds, which is what gets benchmarked and may run where
+// no layers are installed.
+#ifdef NDEBUG
+const bool validationEnabled = false;
+#else
 const bool validationEnabled = true;
+#endif
 
 // List of validation layers to use.
 // VK_LUNARG_standard_validation = All standard validation layers.
@@ -1,11 +1,19 @@
 // VulkanAppExample.cpp : Este archivo contiene la función "main". La ejecución del programa comienza y termina ahí.
 //
 #include <iostream>
+#include <string>
 #include "VulkanRenderer.h"
+#include "CommandLine.h"
 
-GLFWwindow* pWindow;
+GLFWwindow* pWindow = nullptr;
 VulkanRenderer vulkanRenderer;
 
+// Swap chain is rebuilt lazily by the renderer on its next draw
+void OnFramebufferResize(GLFWwindow* window, int width, int height)
+{
+    vulkanRenderer.notifyFramebufferResized();
+}
+
 // Create a window class to store all of this stuff
 void InitWindow(std::string wName = "Test Window", const int width = 800, const int height = 600)
 {
@@ -13,31 +21,353 @@ void InitWindow(std::string wName = "Test Window", const int width = 800, const
     glfwInit();
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // Switch off OpenGL
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
     pWindow = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
+    glfwSetFramebufferSizeCallback(pWindow, OnFramebufferResize);
 
 }
 
 
-int main()
+int main(int argc, char **argv)
 {
-    InitWindow();
+    RendererSettings settings;
+    uint64_t headlessFrameCount = 1000;
+    std::string tracePath;
+    std::string cpuTracePath;
+
+    // --frames-in-flight N : how many frames the CPU may queue ahead of the GPU
+    // --headless           : render offscreen without creating a window
+    // --frames N           : number of frames to render in headless mode
+    // --split-streams      : keep vertex positions in their own stream instead of interleaving
+    // --recording-threads N: threads recording command buffers (default: one per hardware thread)
+    // --objects N          : add N extra objects to the scene, to benchmark recording
+    // --trace FILE         : write a Chrome trace (chrome://tracing) of CPU and GPU timings on exit
+    // --no-gpu-profiling   : don't write GPU timestamps
+    // --cpu-trace FILE     : stream CPU zones to a Chrome trace (builds with CPU_PROFILING_ENABLED only)
+    // --device SELECTOR    : pin the GPU by index, UUID or name (overrides VULKAN_APP_DEVICE)
+    // --serial-init        : run the initialisation steps one after the other instead of in parallel
+    // --no-bindless        : don't create the bindless descriptor table even if the device supports it
+    // --gpu-driven         : cull on the GPU and draw with indirect commands
+    // --no-async-compute   : cull on the graphics queue even if the device has a separate compute queue
+    // --textures N         : stream N textures onto the scene's objects (default 0: none, needs the bindless table)
+    // --texture-size N     : width and height of the streamed textures' top level
+    // --texture-budget MB  : device memory the streamed textures may use (capped by the driver's budget)
+    // --present-policy P   : low-latency, throughput (default) or power-saving
+    // --fps-cap N          : pace the CPU to N frames per second (0: the policy's default)
+    // --latency-budget MS  : count frames taking longer than MS from submit until they can be presented
+    // --depth              : depth test the scene against a depth buffer
+    // --msaa N             : render with N samples per pixel (lowered to what the device supports)
+    // --capture PATH       : read frames back and write them to PATH (raw: one file, png: PATH_NNNNNN.png)
+    // --capture-format F   : png (default) or raw
+    // --capture-interval N : capture every Nth frame
+    // --capture-threads N  : threads compressing PNGs (default: one per hardware thread)
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--frames-in-flight" && i + 1 < argc)
+        {
+            settings.framesInFlight = parseUint32Flag(arg, argv[++i]);
+        }
+        else if (arg == "--headless")
+        {
+            settings.headless = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            headlessFrameCount = parseUnsignedFlag(arg, argv[++i]);
+        }
+        else if (arg == "--split-streams")
+        {
+            settings.vertexLayout = VertexLayout::SplitPosition;
+        }
+        else if (arg == "--recording-threads" && i + 1 < argc)
+        {
+            settings.recordingThreads = parseUint32Flag(arg, argv[++i]);
+        }
+        else if (arg == "--objects" && i + 1 < argc)
+        {
+            settings.benchmarkObjects = parseUint32Flag(arg, argv[++i]);
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (arg == "--no-gpu-profiling")
+        {
+            settings.gpuProfiling = false;
+        }
+        else if (arg == "--cpu-trace" && i + 1 < argc)
+        {
+            cpuTracePath = argv[++i];
+        }
+        else if (arg == "--device" && i + 1 < argc)
+        {
+            settings.deviceSelector = argv[++i];
+        }
+        else if (arg == "--serial-init")
+        {
+            settings.parallelInit = false;
+        }
+        else if (arg == "--no-bindless")
+        {
+            settings.bindless = false;
+        }
+        else if (arg == "--gpu-driven")
+        {
+            settings.gpuDriven = true;
+        }
+        else if (arg == "--no-async-compute")
+        {
+            settings.asyncCompute = false;
+        }
+        else if (arg == "--textures" && i + 1 < argc)
+        {
+            settings.textureCount = parseUint32Flag(arg, argv[++i]);
+        }
+        else if (arg == "--texture-size" && i + 1 < argc)
+        {
+            settings.textureSize = parseUint32Flag(arg, argv[++i]);
+        }
+        else if (arg == "--texture-budget" && i + 1 < argc)
+        {
+            settings.textureBudget = parseUnsignedFlag(arg, argv[++i], UINT64_MAX / (1024 * 1024)) * 1024 * 1024;
+        }
+        else if (arg == "--present-policy" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+            if (policy == "low-latency")
+            {
+                settings.presentPolicy = PresentPolicy::LowLatency;
+            }
+            else if (policy == "power-saving")
+            {
+                settings.presentPolicy = PresentPolicy::PowerSaving;
+            }
+            else if (policy == "throughput")
+            {
+                settings.presentPolicy = PresentPolicy::Throughput;
+            }
+            else
+            {
+                exitWithBadValue(arg, policy.c_str(), "low-latency, throughput or power-saving");
+            }
+        }
+        else if (arg == "--fps-cap" && i + 1 < argc)
+        {
+            settings.frameRateCap = parseNumberFlag(arg, argv[++i]);
+        }
+        else if (arg == "--latency-budget" && i + 1 < argc)
+        {
+            settings.latencyBudgetMs = parseNumberFlag(arg, argv[++i]);
+        }
+        else if (arg == "--depth")
+        {
+            settings.depthTest = true;
+        }
+        else if (arg == "--msaa" && i + 1 < argc)
+        {
+            settings.msaaSamples = parseUint32Flag(arg, argv[++i]);
+        }
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            settings.capturePath = argv[++i];
+        }
+        else if (arg == "--capture-format" && i + 1 < argc)
+        {
+            std::string format = argv[++i];
+            if (format != "raw" && format != "png")
+            {
+                exitWithBadValue(arg, format.c_str());
+            }
+            settings.captureFormat = format == "raw" ? CaptureFormat::Raw : CaptureFormat::Png;
+        }
+        else if (arg == "--capture-interval" && i + 1 < argc)
+        {
+            const char *interval = argv[++i];
+            settings.captureInterval = parseUint32Flag(arg, interval);
+            if (settings.captureInterval == 0)
+            {
+                exitWithBadValue(arg, interval, "a frame count of 1 or more");
+            }
+        }
+        else if (arg == "--capture-threads" && i + 1 < argc)
+        {
+            settings.captureThreads = parseUint32Flag(arg, argv[++i]);
+        }
+        else
+        {
+            exitWithUnknownArgument(arg);
+        }
+    }
+
+    // Started before anything else so Init shows up in the trace
+    if (!cpuTracePath.empty())
+    {
+        if (!CPU_PROFILING_ENABLED)
+        {
+            std::cout << "CPU zones are compiled out of this build, define ENABLE_CPU_PROFILING to trace them" << std::endl;
+        }
+        else if (!CpuProfiler::start(cpuTracePath))
+        {
+            std::cout << "Failed to create CPU trace " << cpuTracePath << std::endl;
+        }
+        PROFILE_THREAD_NAME("Main");
+    }
+
+    if (!settings.headless)
+    {
+        InitWindow();
+    }
     
     // Create Vulkan Renderer instance;
-    if (vulkanRenderer.Init(pWindow) == EXIT_FAILURE)
+    if (vulkanRenderer.Init(pWindow, settings) == EXIT_FAILURE)
         return EXIT_FAILURE;
 
+    uint64_t lastReportedInterval = 0;
+    auto runStart = std::chrono::steady_clock::now();
+
     // Loop 
-    while (!glfwWindowShouldClose(pWindow))
+    while (settings.headless ? vulkanRenderer.getFrameStats().totalFrames < headlessFrameCount : !glfwWindowShouldClose(pWindow))
+    {
+        if (!settings.headless)
+        {
+            glfwPollEvents();
+        }
+
+        try {
+            vulkanRenderer.draw();
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cout << "ERROR: " << e.what() << std::endl;
+            break;
+        }
+
+        // Report the sustained frame rate whenever the renderer publishes a new interval
+        const FrameStats& stats = vulkanRenderer.getFrameStats();
+        if (stats.totalFrames == 1)
+        {
+            std::cout << "Time to first frame: " << stats.timeToFirstFrameMs << " ms (Init " << stats.initMs << " ms)" << std::endl;
+        }
+        if (stats.intervalCount != lastReportedInterval)
+        {
+            lastReportedInterval = stats.intervalCount;
+            std::cout << "Frames in flight: " << settings.framesInFlight
+                      << " | FPS: " << stats.framesPerSecond
+                      << " | CPU wait avg: " << stats.avgCpuWaitMs << " ms"
+                      << " | CPU wait max: " << stats.maxCpuWaitMs << " ms"
+                      << " | Record (" << vulkanRenderer.getRecordingThreadCount() << " threads): " << stats.avgRecordMs << " ms"
+                      << " | Latency avg: " << stats.avgLatencyMs << " ms, max: " << stats.maxLatencyMs << " ms";
+            if (vulkanRenderer.getFrameRateCap() > 0.0)
+            {
+                std::cout << " | Paced to " << vulkanRenderer.getFrameRateCap() << " FPS, slept " << stats.avgPacingMs << " ms";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    // Report while everything is still allocated; cleanup() releases it all
+    std::vector<HeapStats> heapStats = vulkanRenderer.getMemoryStats();
+    for (size_t i = 0; i < heapStats.size(); i++)
+    {
+        if (heapStats[i].memoryObjectCount == 0)
+        {
+            continue;
+        }
+        std::cout << "Heap " << i << ": " << heapStats[i].used / 1024 << " KiB used / " << heapStats[i].reserved / 1024 << " KiB reserved"
+            << ", " << heapStats[i].allocationCount << " allocations in " << heapStats[i].memoryObjectCount << " blocks"
+            << ", fragmentation " << heapStats[i].fragmentation * 100.0f << "%";
+        if (vulkanRenderer.isMemoryBudgetEnabled())
+        {
+            std::cout << ", process usage " << heapStats[i].usage / 1024 << " KiB of " << heapStats[i].budget / 1024 << " KiB budget";
+        }
+        std::cout << std::endl;
+    }
+
+    for (const GpuScopeStats& scope : vulkanRenderer.getGpuScopeStats())
+    {
+        std::cout << "GPU " << scope.name << ": min " << scope.minMs << " ms | avg " << scope.avgMs << " ms | p99 " << scope.p99Ms
+            << " ms (" << scope.sampleCount << " frames)" << std::endl;
+    }
+    GpuOverlapStats overlapStats = vulkanRenderer.getGpuOverlapStats();
+    if (overlapStats.sampleCount > 0)
+    {
+        std::cout << "Async compute: " << overlapStats.computeMs << " ms per frame, " << overlapStats.overlappedMs << " ms ("
+            << overlapStats.overlappedMs / std::max(overlapStats.computeMs, 1e-9) * 100.0 << "%) overlapped with graphics ("
+            << overlapStats.sampleCount << " frames)" << std::endl;
+    }
+    if (settings.latencyBudgetMs > 0.0)
+    {
+        const FrameStats& stats = vulkanRenderer.getFrameStats();
+        std::cout << "Latency budget: " << stats.latencyBudgetMisses << " of " << stats.totalFrames << " frames over " << settings.latencyBudgetMs << " ms" << std::endl;
+    }
+    PipelineManagerStats pipelineStats = vulkanRenderer.getPipelineManagerStats();
+    std::cout << "Pipelines: " << pipelineStats.pipelineCount << " built (" << pipelineStats.syncCompiles << " blocking, " << pipelineStats.asyncCompiles
+        << " background, " << pipelineStats.derivatives << " derivatives, " << pipelineStats.failedCompiles << " failed), "
+        << pipelineStats.fallbacksUsed << " of " << pipelineStats.requests << " requests used the fallback" << std::endl;
+
+    DescriptorAllocatorStats descriptorStats = vulkanRenderer.getDescriptorStats();
+    std::cout << "Descriptors: " << descriptorStats.setsLastFrame << " sets last frame from " << descriptorStats.poolsLastFrame << " pools (peak "
+        << descriptorStats.peakSetsPerFrame << ", " << descriptorStats.poolCount << " pools in total), bindless "
+        << (vulkanRenderer.isBindlessEnabled() ? "on" : "off") << ", GPU driven " << (vulkanRenderer.isGpuDrivenEnabled() ? "on" : "off") << std::endl;
+
+    TextureStreamerStats textureStats = vulkanRenderer.getTextureStats();
+    if (textureStats.textureCount > 0)
+    {
+        std::cout << "Textures: " << textureStats.residentBytes / 1024 << " KiB resident of " << textureStats.budgetBytes / 1024 << " KiB budget, "
+            << textureStats.satisfiedCount << " of " << textureStats.textureCount << " at the resolution they are drawn at, "
+            << textureStats.levelsStreamedIn << " levels streamed in, " << textureStats.levelsEvicted << " evicted, "
+            << textureStats.bytesUploaded / 1024 << " KiB uploaded" << std::endl;
+    }
+
+    RenderGraphStats graphStats = vulkanRenderer.getRenderGraphStats();
+    std::cout << "Render graph: " << graphStats.passCount << " passes (" << graphStats.culledPassCount << " culled) in " << graphStats.renderPassCount
+        << " render passes with " << graphStats.subpassCount << " subpasses, " << graphStats.barrierCount << " barriers per frame, "
+        << graphStats.transientImageCount << " transient images in " << graphStats.transientBytes / 1024 << " KiB ("
+        << graphStats.unaliasedTransientBytes / 1024 << " KiB without aliasing), " << graphStats.lazyImageCount << " lazily allocated ("
+        << graphStats.lazyBytes / 1024 << " KiB), " << vulkanRenderer.getSampleCount() << "x MSAA, depth "
+        << (vulkanRenderer.getDepthFormat() != VK_FORMAT_UNDEFINED ? "on" : "off") << std::endl;
+
+    UniformRingStats uniformStats = vulkanRenderer.getUniformRingStats();
+    std::cout << "Uniform ring: " << uniformStats.bytesLastFrame << " bytes in " << uniformStats.allocationsLastFrame << " allocations last frame (peak "
+        << uniformStats.peakBytesPerFrame << " of " << uniformStats.capacityPerFrame << " bytes per frame)" << std::endl;
+
+    if (!tracePath.empty())
     {
-        glfwPollEvents();
+        std::cout << (vulkanRenderer.writeGpuTrace(tracePath) ? "Trace written to " : "Failed to write trace to ") << tracePath << std::endl;
     }
 
     vulkanRenderer.cleanup();
 
-    glfwDestroyWindow(pWindow);
-    glfwTerminate();
+    // After cleanup(), which waits for the frames still being written
+    if (vulkanRenderer.isCaptureEnabled())
+    {
+        FrameCaptureStats captureStats = vulkanRenderer.getCaptureStats();
+        std::cout << "Capture: " << captureStats.framesWritten << " of " << captureStats.framesCaptured << " frames written ("
+            << captureStats.framesDropped << " dropped, " << captureStats.failedWrites << " failed, " << captureStats.pendingFrames << " pending), "
+            << captureStats.readMegabytesPerSecond << " MB/s read back, " << captureStats.framesPerSecond << " frames/s written, "
+            << captureStats.avgEncodeMs << " ms per frame to encode, " << captureStats.bytesWritten / 1024 << " KiB on disk" << std::endl;
+    }
+
+    if (CpuProfiler::isRunning())
+    {
+        CpuProfiler::stop();
+        std::cout << "CPU trace written to " << cpuTracePath << " (" << CpuProfiler::getDroppedZoneCount() << " zones dropped)" << std::endl;
+    }
+
+    if (settings.headless)
+    {
+        // Include the final GPU drain done by cleanup() so short runs are not flattered
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+        uint64_t frames = vulkanRenderer.getFrameStats().totalFrames;
+        std::cout << "Headless: " << frames << " frames in " << seconds << " s (" << frames / seconds << " FPS)" << std::endl;
+    }
+    else
+    {
+        glfwDestroyWindow(pWindow);
+        glfwTerminate();
+    }
 
     return EXIT_SUCCESS;
 }